@@ -29,6 +29,7 @@
 #undef INET_CSK_CLEAR_TIMERS
 
 struct inet_bind_bucket;
+struct inet_reuseport_group;
 struct tcp_congestion_ops;
 
 /*
@@ -67,6 +68,8 @@ struct inet_connection_sock_af_ops {
  *
  * @icsk_accept_queue:	   FIFO of established children 
  * @icsk_bind_hash:	   Bind node
+ * @icsk_listen_portaddr_node: hash linkage in inet_hashinfo.lhash2
+ * @icsk_reuseport_group: SO_REUSEPORT listeners sharing this one's SYNs
  * @icsk_timeout:	   Timeout
  * @icsk_retransmit_timer: Resend (no ack)
  * @icsk_rto:		   Retransmit timeout
@@ -93,6 +96,10 @@ struct inet_connection_sock {
 
     // icsk_bind_hash 该socket bind的端口
 	struct inet_bind_bucket	  *icsk_bind_hash;      
+	/* listeners only: linkage in the (port, address) listener hash */
+	struct hlist_nulls_node	  icsk_listen_portaddr_node;
+	/* listeners only: SO_REUSEPORT group, NULL if not in one */
+	struct inet_reuseport_group __rcu *icsk_reuseport_group;
 	unsigned long		  icsk_timeout;
  	struct timer_list	  icsk_retransmit_timer;
  	struct timer_list	  icsk_delack_timer;
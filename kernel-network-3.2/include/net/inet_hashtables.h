@@ -19,6 +19,7 @@
 #include <linux/ip.h>
 #include <linux/ipv6.h>
 #include <linux/list.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
 #include <linux/socket.h>
 #include <linux/spinlock.h>
@@ -38,7 +39,7 @@
 
 /* This is for all connections with a full identity, no wildcards.
  * One chain is dedicated to TIME_WAIT sockets.
- * I'll experiment with dynamic table growth later.
+ * The table grows online, see inet_ehash_grow().
  */
 struct inet_ehash_bucket {
 	struct hlist_nulls_head chain;
@@ -53,7 +54,10 @@ struct inet_ehash_bucket {
  *	2) If all sockets have sk->sk_reuse set, and none of them are in
  *	   TCP_LISTEN state, the port may be shared.
  *	   Failing that, goto test 3.
- *	3) If all sockets are bound to a specific inet_sk(sk)->rcv_saddr local
+ *	3) If all sockets have sk->sk_reuseport set and belong to the same
+ *	   user, the port may be shared, in TCP_LISTEN state too.
+ *	   Failing that, goto test 4.
+ *	4) If all sockets are bound to a specific inet_sk(sk)->rcv_saddr local
  *	   address, and none of them are the same, the port may be
  *	   shared.
  *	   Failing this, the port cannot be shared.
@@ -69,6 +73,9 @@ struct inet_ehash_bucket {
  * sk->sk_reuse set, we don't even have to walk the owners list at all,
  * we return that it is ok to bind this socket to the requested local port.
  *
+ * fastreuseport does the same for test #3, with the owners' uid in
+ * fastuid.
+ *
  * Sounds like a lot of work, but it is worth it.  In a more naive
  * implementation (ie. current FreeBSD etc.) the entire list of ports
  * must be walked for each data port opened by an ftp server.  Needless
@@ -84,6 +91,8 @@ struct inet_bind_bucket {
 	unsigned short		port;
 
 	signed short		fastreuse; // 允许一个端口绑定到多个socket上
+	signed short		fastreuseport;
+	uid_t			fastuid;
 	int			num_owners;        // 有多少socket bind到该端口上
 	struct hlist_node	node;      // 在哈希表中的链表节点
 	struct hlist_head	owners;    // 绑定到该端口上的socket列表 表头
@@ -111,12 +120,25 @@ struct inet_bind_hashbucket {
 #define LISTENING_NULLS_BASE (1U << 29)
 struct inet_listen_hashbucket {
 	spinlock_t		lock;
+	unsigned int		count;
 	struct hlist_nulls_head	head;
 };
 
 /* This is for listening sockets, thus all sockets which possess wildcards. */
 #define INET_LHTABLE_SIZE	32	/* Yes, really, this is all you need. */
 
+/*
+ * Listeners are also hashed by (port, bound address) in lhash2, wildcard
+ * listeners under INADDR_ANY, so a SYN to a port with many address-bound
+ * listeners finds its socket without scoring all of them. Chains longer
+ * than this in listening_hash are looked up through lhash2.
+ */
+#define INET_LHASH2_SIZE	4096
+#define INET_LHASH2_MIN_CHAIN	10
+
+/* ehash is doubled once it holds more sockets than this per bucket */
+#define INET_EHASH_MAX_LOAD	1
+
 struct inet_hashinfo {
 	/* This is for sockets with full identity only.  Sockets here will
 	 * always be without wildcards and will have the following invariant:
@@ -130,6 +152,17 @@ struct inet_hashinfo {
 	unsigned int			ehash_mask;
 	unsigned int			ehash_locks_mask;
 
+	/* While ehash is being grown, the table it is moved to and how
+	 * many of its buckets are there already. ehash_seq changes when a
+	 * resize starts and when it ends.
+	 */
+	seqcount_t			ehash_seq;
+	struct inet_ehash_bucket	*ehash_next;
+	unsigned int			ehash_next_mask;
+	unsigned int			ehash_moved;
+	/* ehash is not grown past this many buckets, at all if it is 0 */
+	unsigned int			ehash_max_size;
+
 	/* Ok, let's try this, I give up, we do need a local binding
 	 * TCP hash as well as the others for fast bind/connect.
 	 */
@@ -140,6 +173,10 @@ struct inet_hashinfo {
 
 	struct kmem_cache		*bind_bucket_cachep;
 
+	/* Listeners by (port, rcv_saddr), NULL if the protocol has none */
+	struct inet_listen_hashbucket	*lhash2;
+	unsigned int			lhash2_mask;
+
 	/* All the above members are written once at bootup and
 	 * never written again _or_ are predominantly read-access.
 	 *
@@ -157,11 +194,88 @@ struct inet_hashinfo {
 	atomic_t			bsockets; // tcp 中所有已bind的socket的总数???
 };
 
+/*
+ * The bucket of hash and, in *slot, the nulls value ending its chains.
+ * Buckets already moved by a resize are in ehash_next. Returns the
+ * ehash_seq the table was read under; a lookup that misses has to
+ * recheck it, as sockets are off their chains for a moment when moved.
+ * Nothing moves out of the bucket while the lock of hash is held.
+ */
+static inline unsigned int inet_ehash_slot(struct inet_hashinfo *hashinfo,
+					   unsigned int hash,
+					   struct inet_ehash_bucket **head,
+					   unsigned int *slot)
+{
+	struct inet_ehash_bucket *next;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&hashinfo->ehash_seq);
+		*slot = hash & hashinfo->ehash_mask;
+		next = hashinfo->ehash_next;
+		if (unlikely(next) && *slot < ACCESS_ONCE(hashinfo->ehash_moved)) {
+			*slot = hash & hashinfo->ehash_next_mask;
+			*head = &next[*slot];
+		} else
+			*head = &hashinfo->ehash[*slot];
+	} while (read_seqcount_retry(&hashinfo->ehash_seq, seq));
+	return seq;
+}
+
+/* Caller must hold the lock of hash */
 static inline struct inet_ehash_bucket *inet_ehash_bucket(
 	struct inet_hashinfo *hashinfo,
 	unsigned int hash)
 {
-	return &hashinfo->ehash[hash & hashinfo->ehash_mask];
+	struct inet_ehash_bucket *head;
+	unsigned int slot;
+
+	inet_ehash_slot(hashinfo, hash, &head, &slot);
+	return head;
+}
+
+/*
+ * Highest bucket of a walk over all of ehash, which numbers the buckets
+ * as the larger table does while a resize is under way. Sockets only move
+ * to a bucket of the same or a higher number, so a walk in bucket order
+ * misses none that stay hashed, though it may meet a moved one twice.
+ */
+static inline unsigned int inet_ehash_walk_mask(struct inet_hashinfo *hashinfo)
+{
+	unsigned int seq, mask;
+
+	do {
+		seq = read_seqcount_begin(&hashinfo->ehash_seq);
+		mask = hashinfo->ehash_next ? hashinfo->ehash_next_mask :
+					      hashinfo->ehash_mask;
+	} while (read_seqcount_retry(&hashinfo->ehash_seq, seq));
+	return mask;
+}
+
+/*
+ * Bucket i of such a walk, or NULL while its sockets are still in bucket
+ * i & ehash_mask of the old table, which the walk covers there. *seq is
+ * as from inet_ehash_slot(). Caller holds rcu_read_lock(), and the lock
+ * of i to walk the chains.
+ */
+static inline struct inet_ehash_bucket *inet_ehash_walk_bucket(
+	struct inet_hashinfo *hashinfo,
+	unsigned int i, unsigned int *seq)
+{
+	struct inet_ehash_bucket *head;
+	unsigned int slot;
+
+	*seq = inet_ehash_slot(hashinfo, i, &head, &slot);
+	return slot == i ? head : NULL;
+}
+
+static inline int inet_ehash_overloaded(struct inet_hashinfo *hashinfo,
+					unsigned long nr_socks)
+{
+	unsigned int size = hashinfo->ehash_mask + 1;
+
+	return size < ACCESS_ONCE(hashinfo->ehash_max_size) &&
+	       nr_socks > (unsigned long)size * INET_EHASH_MAX_LOAD;
 }
 
 static inline spinlock_t *inet_ehash_lockp(
@@ -187,6 +301,9 @@ static inline int inet_ehash_locks_alloc(struct inet_hashinfo *hashinfo)
 		size = 2048;
 	if (nr_pcpus >= 32)
 		size = 4096;
+	/* a chain must have a single lock for inet_ehash_grow() to move it */
+	if (size > hashinfo->ehash_mask + 1)
+		size = hashinfo->ehash_mask + 1;
 	if (sizeof(spinlock_t) != 0) {
 #ifdef CONFIG_NUMA
 		if (size * sizeof(spinlock_t) > PAGE_SIZE)
@@ -247,28 +364,69 @@ static inline int inet_sk_listen_hashfn(const struct sock *sk)
 	return inet_lhashfn(sock_net(sk), inet_sk(sk)->inet_num);
 }
 
+static inline unsigned int inet_lhash2fn(struct net *net, const __be32 addr,
+					 const unsigned short num)
+{
+	return jhash_1word((__force u32)addr, net_hash_mix(net)) ^ num;
+}
+
+static inline struct inet_listen_hashbucket *
+inet_lhash2_bucket(struct inet_hashinfo *hashinfo, unsigned int hash)
+{
+	return &hashinfo->lhash2[hash & hashinfo->lhash2_mask];
+}
+
+#define inet_lhash2_for_each_icsk_rcu(__icsk, node, list) \
+	hlist_nulls_for_each_entry_rcu(__icsk, node, list, \
+				       icsk_listen_portaddr_node)
+
+/*
+ * SO_REUSEPORT listeners of one user bound to the same port, address and
+ * device form a group. A SYN for them is handed to the member picked by
+ * the hash of its 4-tuple, so every member gets its own share of the
+ * connections in its own accept queue. All the members are hashed as
+ * usual and point to the group, which is changed under the listening_hash
+ * lock of their port and freed after an RCU grace period.
+ */
+struct inet_reuseport_group {
+	struct rcu_head		rcu;
+	unsigned int		max_socks;
+	unsigned int		num_socks;
+	struct sock		*socks[0];
+};
+
+#define INET_REUSEPORT_MIN_SOCKS	8
+
 /* Caller must disable local BH processing. */
 extern int __inet_inherit_port(struct sock *sk, struct sock *child);
 
 extern void inet_put_port(struct sock *sk);
 
 void inet_hashinfo_init(struct inet_hashinfo *h);
+extern int inet_hashinfo2_init(struct inet_hashinfo *h, unsigned int size);
+extern void inet_lhash2_clear_sk(struct sock *sk, int size);
+extern int inet_ehash_grow(struct inet_hashinfo *hashinfo);
 
 extern int __inet_hash_nolisten(struct sock *sk, struct inet_timewait_sock *tw);
 extern void inet_hash(struct sock *sk);
 extern void inet_unhash(struct sock *sk);
 
+/* saddr and sport only pick the member of a SO_REUSEPORT group */
 extern struct sock *__inet_lookup_listener(struct net *net,
 					   struct inet_hashinfo *hashinfo,
+					   const __be32 saddr,
+					   const __be16 sport,
 					   const __be32 daddr,
 					   const unsigned short hnum,
 					   const int dif);
 
 static inline struct sock *inet_lookup_listener(struct net *net,
 		struct inet_hashinfo *hashinfo,
+		__be32 saddr, __be16 sport,
 		__be32 daddr, __be16 dport, int dif)
 {
-	return __inet_lookup_listener(net, hashinfo, daddr, ntohs(dport), dif);
+	return __inet_lookup_listener(net, hashinfo, saddr, sport,
+				      daddr, ntohs(dport), dif);
 }
 
 /* Socket demux engine toys. */
@@ -359,7 +517,8 @@ static inline struct sock *__inet_lookup(struct net *net,
 	struct sock *sk = __inet_lookup_established(net, hashinfo,
 				saddr, sport, daddr, hnum, dif);
 
-	return sk ? : __inet_lookup_listener(net, hashinfo, daddr, hnum, dif);
+	return sk ? : __inet_lookup_listener(net, hashinfo, saddr, sport,
+					     daddr, hnum, dif);
 }
 
 static inline struct sock *inet_lookup(struct net *net,
@@ -58,6 +58,8 @@ int inet_csk_bind_conflict(const struct sock *sk,
 	struct sock *sk2;
 	struct hlist_node *node;
 	int reuse = sk->sk_reuse;
+	int reuseport = sk->sk_reuseport;
+	uid_t uid = sock_i_uid((struct sock *)sk);
 
 	/*
 	 * Unlike other sk lookup places we do not check
@@ -72,8 +74,15 @@ int inet_csk_bind_conflict(const struct sock *sk,
 		    (!sk->sk_bound_dev_if ||  // 新的socket没有绑到设备
 		     !sk2->sk_bound_dev_if || // 或者已存在的socket没有绑到设备
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if)) { // 或者新的socket和已存在的socket绑到同一个设备
-			if (!reuse || !sk2->sk_reuse ||  // sk不可复用 或者 sk2不可复用
-			    sk2->sk_state == TCP_LISTEN) {
+			if ((!reuse || !sk2->sk_reuse ||  // sk不可复用 或者 sk2不可复用
+			     sk2->sk_state == TCP_LISTEN) &&
+			    /*
+			     * A TIME_WAIT owner's tw_reuseport is never
+			     * set, so sk2->sk_reuseport is not to be read.
+			     */
+			    (!reuseport || sk2->sk_state == TCP_TIME_WAIT ||
+			     !sk2->sk_reuseport ||
+			     uid != sock_i_uid(sk2))) {
 				const __be32 sk2_rcv_saddr = sk_rcv_saddr(sk2);
 				if (!sk2_rcv_saddr || !sk_rcv_saddr(sk) || // sk没有绑定地址 或者 sk2没有绑定地址 或者 二者的地址相同
 				    sk2_rcv_saddr == sk_rcv_saddr(sk))
@@ -98,6 +107,7 @@ int inet_csk_get_port(struct sock *sk, unsigned short snum)
 	int ret, attempts = 5;
 	struct net *net = sock_net(sk);
 	int smallest_size = -1, smallest_rover;
+	uid_t uid = sock_i_uid(sk);
 
 	local_bh_disable();
     
@@ -137,9 +147,12 @@ again:
                 // 哈希表中，在通过网络命名空间中，rover所表示的端口号已经被bind过了
 				if (net_eq(ib_net(tb), net) && tb->port == rover) {
 
-					if (tb->fastreuse > 0 && // 端口资源必须是可复用的
-					    sk->sk_reuse &&      // socket 本身必须设置SO_REUSEADDR
-					    sk->sk_state != TCP_LISTEN && //  socket不能处于TCP_LISTEN状态
+					if (((tb->fastreuse > 0 && // 端口资源必须是可复用的
+					      sk->sk_reuse &&      // socket 本身必须设置SO_REUSEADDR
+					      sk->sk_state != TCP_LISTEN) || //  socket不能处于TCP_LISTEN状态
+					     (tb->fastreuseport > 0 &&
+					      sk->sk_reuseport &&
+					      tb->fastuid == uid)) &&
                         // 端口资源上已绑定着的socket数是最少的
 					    (tb->num_owners < smallest_size || smallest_size == -1)) {
 						smallest_size = tb->num_owners;
@@ -204,8 +217,10 @@ tb_found:
     // 指定的端口资源已经被bind了
 	if (!hlist_empty(&tb->owners)) {
         
-		if (tb->fastreuse > 0 &&                          // 端口资源可复用
-		    sk->sk_reuse && sk->sk_state != TCP_LISTEN && // socket可复用
+		if (((tb->fastreuse > 0 &&                         // 端口资源可复用
+		      sk->sk_reuse && sk->sk_state != TCP_LISTEN) || // socket可复用
+		     (tb->fastreuseport > 0 &&
+		      sk->sk_reuseport && tb->fastuid == uid)) &&
 		    smallest_size == -1) {                        // 由用户层指定端口复用
 			goto success;
 		} else {
@@ -216,7 +231,9 @@ tb_found:
                 // 如果socket允许复用
                 // 不是由用户层指定的复用
                 // 尝试次数小于5
-				if (sk->sk_reuse && sk->sk_state != TCP_LISTEN &&
+				if (((sk->sk_reuse && sk->sk_state != TCP_LISTEN) ||
+				     (tb->fastreuseport > 0 &&
+				      sk->sk_reuseport && tb->fastuid == uid)) &&
 				    smallest_size != -1 && --attempts >= 0) {
 					spin_unlock(&head->lock);
 					goto again; // 重新尝试查找系统可用端口号
@@ -244,13 +261,22 @@ tb_not_found:
 			tb->fastreuse = 1;
 		else
 			tb->fastreuse = 0;
-	} 
+		if (sk->sk_reuseport) {
+			tb->fastreuseport = 1;
+			tb->fastuid = uid;
+		} else
+			tb->fastreuseport = 0;
+	} else {
     // 该端口号资源其上虽然已经有socket绑定了，但它是可复用的;
     // 我们需要往该端口绑的socket没有设置SO_REUSEADDR或者处于TCP_LISTEN状态
     // 则这个端口号资源后续不再可复用
-    else if (tb->fastreuse &&
-		   (!sk->sk_reuse || sk->sk_state == TCP_LISTEN))
-		tb->fastreuse = 0;
+		if (tb->fastreuse &&
+		    (!sk->sk_reuse || sk->sk_state == TCP_LISTEN))
+			tb->fastreuse = 0;
+		if (tb->fastreuseport &&
+		    (!sk->sk_reuseport || tb->fastuid != uid))
+			tb->fastreuseport = 0;
+	}
 
 success:
     // socket 正真的bind端口号动作 千辛万苦啊!!!
@@ -687,6 +713,8 @@ struct sock *inet_csk_clone(struct sock *sk, const struct request_sock *req,
 
 		newsk->sk_state = TCP_SYN_RECV;
 		newicsk->icsk_bind_hash = NULL;
+		newicsk->icsk_reuseport_group = NULL;
+		newicsk->icsk_listen_portaddr_node.pprev = NULL;
 
 		inet_sk(newsk)->inet_dport = inet_rsk(req)->rmt_port;
 		inet_sk(newsk)->inet_num = ntohs(inet_rsk(req)->loc_port);
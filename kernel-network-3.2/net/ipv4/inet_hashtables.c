@@ -13,7 +13,11 @@
  *      2 of the License, or (at your option) any later version.
  */
 
+#include <linux/bitops.h>
+#include <linux/jhash.h>
 #include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
 #include <linux/random.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
@@ -39,6 +43,7 @@ struct inet_bind_bucket *inet_bind_bucket_create(struct kmem_cache *cachep,
 		write_pnet(&tb->ib_net, hold_net(net));
 		tb->port      = snum;
 		tb->fastreuse = 0;
+		tb->fastreuseport = 0;
 		tb->num_owners = 0;
 		INIT_HLIST_HEAD(&tb->owners);
 		hlist_add_head(&tb->node, &head->chain);
@@ -71,6 +76,224 @@ void inet_bind_hash(struct sock *sk, struct inet_bind_bucket *tb,
 	inet_csk(sk)->icsk_bind_hash = tb;
 }
 
+/*
+ * The local ports connect() gave out towards a few busy destinations, so
+ * it can go straight to one that is likely free instead of trying them
+ * in turn. A destination gets a bitmap once finding it a port took more
+ * than INET_PORT_DEST_MIN_PROBES tries. A set bit is only a hint: ports
+ * are still checked as before, and those found taken are marked as they
+ * are tried. IPv6 connects, whose inet_daddr is not their destination,
+ * go without.
+ *
+ * Destinations hash to a set of INET_PORT_DEST_WAYS. A destination that
+ * finds its set full takes the way least recently used, but only once
+ * that has gone unused for INET_PORT_DEST_IDLE uses of the set: with more
+ * busy destinations than ways, those that have a bitmap keep it and the
+ * others go without, rather than each connect replacing a bitmap.
+ */
+struct inet_port_dest {
+	struct inet_hashinfo	*hinfo;
+	struct net		*net;
+	__be32			saddr;
+	__be32			daddr;
+	__be16			dport;
+	u16			cursor;		/* where the next search starts */
+	u32			last_use;	/* set clock when last used */
+	unsigned long		*used;		/* a bit per port, NULL if unused */
+};
+
+#define INET_PORT_DEST_SETS		16
+#define INET_PORT_DEST_WAYS		4
+#define INET_PORT_DEST_IDLE		64
+#define INET_PORT_DEST_MIN_PROBES	16
+#define INET_PORT_DEST_BYTES		(65536 / 8)
+
+struct inet_port_dest_set {
+	spinlock_t		lock;
+	u32			clock;		/* ticks once per connect using the set */
+	struct inet_port_dest	way[INET_PORT_DEST_WAYS];
+};
+
+static struct inet_port_dest_set inet_port_dests[INET_PORT_DEST_SETS] = {
+	[0 ... INET_PORT_DEST_SETS - 1] = {
+		.lock = __SPIN_LOCK_UNLOCKED(inet_port_dests.lock),
+	},
+};
+
+static inline struct inet_port_dest_set *inet_port_dest_set(const struct sock *sk)
+{
+	const struct inet_sock *inet = inet_sk(sk);
+	u32 hash = jhash_3words((__force u32)inet->inet_rcv_saddr,
+				(__force u32)inet->inet_daddr,
+				(__force u32)inet->inet_dport,
+				inet_ehash_secret + net_hash_mix(sock_net(sk)));
+
+	return &inet_port_dests[hash & (INET_PORT_DEST_SETS - 1)];
+}
+
+static inline int inet_port_dest_match(const struct inet_port_dest *pd,
+				       struct inet_hashinfo *hinfo,
+				       const struct sock *sk)
+{
+	const struct inet_sock *inet = inet_sk(sk);
+
+	return pd->used && sk->sk_family == AF_INET && pd->hinfo == hinfo &&
+	       net_eq(pd->net, sock_net(sk)) &&
+	       pd->daddr == inet->inet_daddr &&
+	       pd->saddr == inet->inet_rcv_saddr &&
+	       pd->dport == inet->inet_dport;
+}
+
+/* Caller holds pds->lock */
+static struct inet_port_dest *inet_port_dest_find(struct inet_port_dest_set *pds,
+						  struct inet_hashinfo *hinfo,
+						  const struct sock *sk)
+{
+	int i;
+
+	for (i = 0; i < INET_PORT_DEST_WAYS; i++)
+		if (inet_port_dest_match(&pds->way[i], hinfo, sk))
+			return &pds->way[i];
+	return NULL;
+}
+
+/*
+ * Way for a new destination: a free one, else the least recently used if
+ * it has been idle long enough. Caller holds pds->lock.
+ */
+static struct inet_port_dest *inet_port_dest_victim(struct inet_port_dest_set *pds)
+{
+	struct inet_port_dest *pd, *victim = NULL;
+	int i;
+
+	for (i = 0; i < INET_PORT_DEST_WAYS; i++) {
+		pd = &pds->way[i];
+		if (!pd->used)
+			return pd;
+		if (!victim || (s32)(pd->last_use - victim->last_use) < 0)
+			victim = pd;
+	}
+	if (pds->clock - victim->last_use < INET_PORT_DEST_IDLE)
+		return NULL;
+	return victim;
+}
+
+/*
+ * Next port in [low, high] not known to be taken towards sk's destination,
+ * from the cursor on. -1 if it has no bitmap, or if every port is marked:
+ * the marks are dropped then, for the caller to try all the ports again.
+ */
+static int inet_port_dest_next(struct inet_port_dest_set *pds,
+			       struct inet_hashinfo *hinfo,
+			       const struct sock *sk, int low, int high)
+{
+	struct inet_port_dest *pd;
+	int port = -1, cursor;
+
+	spin_lock(&pds->lock);
+	pd = inet_port_dest_find(pds, hinfo, sk);
+	if (pd) {
+		cursor = pd->cursor;
+		if (cursor < low || cursor > high)
+			cursor = low;
+		port = find_next_zero_bit(pd->used, high + 1, cursor);
+		if (port > high) {
+			port = find_next_zero_bit(pd->used, cursor, low);
+			if (port >= cursor) {
+				memset(pd->used, 0, INET_PORT_DEST_BYTES);
+				port = -1;
+			}
+		}
+	}
+	spin_unlock(&pds->lock);
+	return port;
+}
+
+/* Port is taken towards sk's destination; by sk itself if mine */
+static void inet_port_dest_mark(struct inet_port_dest_set *pds,
+				struct inet_hashinfo *hinfo,
+				const struct sock *sk, int port, int mine)
+{
+	struct inet_port_dest *pd;
+
+	spin_lock(&pds->lock);
+	pd = inet_port_dest_find(pds, hinfo, sk);
+	if (pd) {
+		__set_bit(port, pd->used);
+		if (mine) {
+			pd->cursor = port + 1;
+			pd->last_use = ++pds->clock;
+		}
+	}
+	spin_unlock(&pds->lock);
+}
+
+/* sk needed many tries to get port: give its destination a bitmap */
+static void inet_port_dest_add(struct inet_port_dest_set *pds,
+			       struct inet_hashinfo *hinfo,
+			       const struct sock *sk, int port)
+{
+	const struct inet_sock *inet = inet_sk(sk);
+	struct inet_port_dest *pd;
+	unsigned long *used, *old;
+
+	spin_lock(&pds->lock);
+	/* a destination wanting a way uses the set too */
+	pds->clock++;
+	pd = inet_port_dest_find(pds, hinfo, sk) ? NULL :
+	     inet_port_dest_victim(pds);
+	spin_unlock(&pds->lock);
+	if (!pd)
+		return;
+
+	used = kzalloc(INET_PORT_DEST_BYTES, GFP_ATOMIC);
+	if (!used)
+		return;
+	__set_bit(port, used);
+
+	spin_lock(&pds->lock);
+	/* the set may have changed while it was unlocked */
+	pd = inet_port_dest_find(pds, hinfo, sk) ? NULL :
+	     inet_port_dest_victim(pds);
+	if (pd) {
+		old = pd->used;
+		pd->hinfo = hinfo;
+		pd->net = sock_net(sk);
+		pd->saddr = inet->inet_rcv_saddr;
+		pd->daddr = inet->inet_daddr;
+		pd->dport = inet->inet_dport;
+		pd->cursor = port + 1;
+		pd->last_use = pds->clock;
+		pd->used = used;
+	} else
+		old = used;
+	spin_unlock(&pds->lock);
+	kfree(old);
+}
+
+/* Caller holds the bind hash lock of sk's port */
+static void inet_port_dest_release(struct inet_hashinfo *hinfo,
+				   const struct sock *sk)
+{
+	struct inet_port_dest_set *pds;
+	struct inet_port_dest *pd;
+	int i;
+
+	if (!inet_sk(sk)->inet_daddr)
+		return;
+	pds = inet_port_dest_set(sk);
+	for (i = 0; i < INET_PORT_DEST_WAYS; i++)
+		if (ACCESS_ONCE(pds->way[i].daddr) == inet_sk(sk)->inet_daddr)
+			break;
+	if (i == INET_PORT_DEST_WAYS)
+		return;
+	spin_lock(&pds->lock);
+	pd = inet_port_dest_find(pds, hinfo, sk);
+	if (pd)
+		__clear_bit(inet_sk(sk)->inet_num, pd->used);
+	spin_unlock(&pds->lock);
+}
+
 /*
  * Get rid of any references to a local port held by the given sock.
  */
@@ -85,6 +308,7 @@ static void __inet_put_port(struct sock *sk)
 	atomic_dec(&hashinfo->bsockets);
 
 	spin_lock(&head->lock);
+	inet_port_dest_release(hashinfo, sk);
 	tb = inet_csk(sk)->icsk_bind_hash;
 	__sk_del_bind_node(sk);
 	tb->num_owners--;
@@ -174,8 +398,84 @@ static inline int compute_score(struct sock *sk, struct net *net,
  */
 
 
+/*
+ * The member of sk's SO_REUSEPORT group that gets the connection with this
+ * 4-tuple hash. A member being removed may still be returned; the caller's
+ * rescore after taking the reference copes with it like with any listener
+ * unhashed under a lookup.
+ */
+static struct sock *inet_reuseport_select(struct sock *sk, u32 hash)
+{
+	struct inet_reuseport_group *group;
+	unsigned int num;
+
+	group = rcu_dereference(inet_csk(sk)->icsk_reuseport_group);
+	if (!group)
+		return sk;
+	num = ACCESS_ONCE(group->num_socks);
+	if (!num)
+		return sk;
+	smp_rmb();
+	return group->socks[((u64)hash * num) >> 32];
+}
+
+/*
+ * Best listener of the lhash2 chain of (hnum, addr). Every listener bound
+ * to it is on the chain, with whatever else hashed to the same slot, which
+ * compute_score() turns away or may rank below them.
+ */
+static struct sock *inet_lhash2_lookup(struct net *net,
+				       struct inet_listen_hashbucket *ilb2,
+				       unsigned int slot2, const __be32 addr,
+				       const __be32 saddr, const __be16 sport,
+				       const __be32 daddr,
+				       const unsigned short hnum, const int dif)
+{
+	struct inet_connection_sock *icsk;
+	struct hlist_nulls_node *node;
+	struct sock *sk, *result;
+	int score, hiscore;
+
+begin:
+	result = NULL;
+	hiscore = -1;
+	inet_lhash2_for_each_icsk_rcu(icsk, node, &ilb2->head) {
+		sk = (struct sock *)icsk;
+		score = compute_score(sk, net, hnum, daddr, dif);
+		if (score > hiscore) {
+			result = sk;
+			hiscore = score;
+			/*
+			 * The rest of a group bound to the chain's own
+			 * address scores no higher: don't score it too.
+			 */
+			if (sk->sk_reuseport &&
+			    inet_sk(sk)->inet_rcv_saddr == addr) {
+				result = inet_reuseport_select(sk,
+					inet_ehashfn(net, daddr, hnum,
+						     saddr, sport));
+				goto found;
+			}
+		}
+	}
+	if (get_nulls_value(node) != slot2)
+		goto begin;
+found:
+	if (result) {
+		if (unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
+			result = NULL;
+		else if (unlikely(compute_score(result, net, hnum, daddr,
+				  dif) < hiscore)) {
+			sock_put(result);
+			goto begin;
+		}
+	}
+	return result;
+}
+
 struct sock *__inet_lookup_listener(struct net *net,
 				    struct inet_hashinfo *hashinfo,
+				    const __be32 saddr, const __be16 sport,
 				    const __be32 daddr, const unsigned short hnum,
 				    const int dif)
 {
@@ -186,6 +486,29 @@ struct sock *__inet_lookup_listener(struct net *net,
 	int score, hiscore;
 
 	rcu_read_lock();
+	if (hashinfo->lhash2 && ilb->count > INET_LHASH2_MIN_CHAIN) {
+		unsigned int hash2 = inet_lhash2fn(net, daddr, hnum);
+		unsigned int slot2 = hash2 & hashinfo->lhash2_mask;
+
+		/* a listener bound to daddr beats the wildcards */
+		result = inet_lhash2_lookup(net, &hashinfo->lhash2[slot2],
+					    slot2, daddr, saddr, sport, daddr,
+					    hnum, dif);
+		if (result)
+			goto done;
+
+		hash2 = inet_lhash2fn(net, htonl(INADDR_ANY), hnum);
+		slot2 = hash2 & hashinfo->lhash2_mask;
+		result = inet_lhash2_lookup(net, &hashinfo->lhash2[slot2],
+					    slot2, htonl(INADDR_ANY), saddr,
+					    sport, daddr, hnum, dif);
+		if (result)
+			goto done;
+		/*
+		 * Not every listener is in lhash2: __inet6_hash() leaves
+		 * dual-stack ones out, so a miss has to walk the port.
+		 */
+	}
 begin:
 	result = NULL;
 	hiscore = -1;
@@ -194,6 +517,12 @@ begin:
 		if (score > hiscore) {
 			result = sk;
 			hiscore = score;
+			/*
+			 * Only a group bound to daddr can stop the walk; a
+			 * wildcard one may yet lose to a bound listener.
+			 */
+			if (sk->sk_reuseport && inet_sk(sk)->inet_rcv_saddr)
+				goto found;
 		}
 	}
 	/*
@@ -203,6 +532,10 @@ begin:
 	 */
 	if (get_nulls_value(node) != hash + LISTENING_NULLS_BASE)
 		goto begin;
+found:
+	if (result && result->sk_reuseport)
+		result = inet_reuseport_select(result,
+				inet_ehashfn(net, daddr, hnum, saddr, sport));
 	if (result) {
 		if (unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
 			result = NULL;
@@ -212,11 +545,52 @@ begin:
 			goto begin;
 		}
 	}
+done:
 	rcu_read_unlock();
 	return result;
 }
 EXPORT_SYMBOL_GPL(__inet_lookup_listener);
 
+/*
+ * A miss that raced with a resize of ehash: look again under the bucket
+ * lock, which keeps sockets from moving.
+ */
+static struct sock *__inet_lookup_established_locked(struct net *net,
+				  struct inet_hashinfo *hashinfo,
+				  unsigned int hash,
+				  const __be32 saddr, const __be16 sport,
+				  const __be32 daddr, const u16 hnum,
+				  const int dif)
+{
+	INET_ADDR_COOKIE(acookie, saddr, daddr)
+	const __portpair ports = INET_COMBINED_PORTS(sport, hnum);
+	spinlock_t *lock = inet_ehash_lockp(hashinfo, hash);
+	struct inet_ehash_bucket *head;
+	const struct hlist_nulls_node *node;
+	struct sock *sk;
+
+	spin_lock(lock);
+	head = inet_ehash_bucket(hashinfo, hash);
+	sk_nulls_for_each(sk, node, &head->chain) {
+		if (INET_MATCH(sk, net, hash, acookie,
+					saddr, daddr, ports, dif))
+			goto found;
+	}
+	sk_nulls_for_each(sk, node, &head->twchain) {
+		if (INET_TW_MATCH(sk, net, hash, acookie,
+					saddr, daddr, ports, dif))
+			goto found;
+	}
+	sk = NULL;
+	goto out;
+found:
+	if (unlikely(!atomic_inc_not_zero(&sk->sk_refcnt)))
+		sk = NULL;
+out:
+	spin_unlock(lock);
+	return sk;
+}
+
 struct sock * __inet_lookup_established(struct net *net,
 				  struct inet_hashinfo *hashinfo,
 				  const __be32 saddr, const __be16 sport,
@@ -231,11 +605,12 @@ struct sock * __inet_lookup_established(struct net *net,
 	 * have wildcards anyways.
 	 */
 	unsigned int hash = inet_ehashfn(net, daddr, hnum, saddr, sport);
-	unsigned int slot = hash & hashinfo->ehash_mask;
-	struct inet_ehash_bucket *head = &hashinfo->ehash[slot];
+	unsigned int slot, seq;
+	struct inet_ehash_bucket *head;
 
 	rcu_read_lock();
 begin:
+	seq = inet_ehash_slot(hashinfo, hash, &head, &slot);
 	sk_nulls_for_each_rcu(sk, node, &head->chain) {
 		if (INET_MATCH(sk, net, hash, acookie,
 					saddr, daddr, ports, dif)) {
@@ -282,6 +657,11 @@ begintw:
 	if (get_nulls_value(node) != slot)
 		goto begintw;
 	sk = NULL;
+	if (unlikely(ACCESS_ONCE(hashinfo->ehash_next) ||
+		     read_seqcount_retry(&hashinfo->ehash_seq, seq)))
+		sk = __inet_lookup_established_locked(net, hashinfo, hash,
+						      saddr, sport, daddr,
+						      hnum, dif);
 out:
 	rcu_read_unlock();
 	return sk;
@@ -303,7 +683,7 @@ static int __inet_check_established(struct inet_timewait_death_row *death_row,
 	struct net *net = sock_net(sk);
 	unsigned int hash = inet_ehashfn(net, daddr, lport,
 					 saddr, inet->inet_dport);
-	struct inet_ehash_bucket *head = inet_ehash_bucket(hinfo, hash);
+	struct inet_ehash_bucket *head;
 	spinlock_t *lock = inet_ehash_lockp(hinfo, hash);
 	struct sock *sk2;
 	const struct hlist_nulls_node *node;
@@ -311,6 +691,7 @@ static int __inet_check_established(struct inet_timewait_death_row *death_row,
 	int twrefcnt = 0;
 
 	spin_lock(lock);
+	head = inet_ehash_bucket(hinfo, hash);
 
 	/* Check TIME-WAIT sockets first. */
 	sk_nulls_for_each(sk2, node, &head->twchain) {
@@ -384,11 +765,11 @@ int __inet_hash_nolisten(struct sock *sk, struct inet_timewait_sock *tw)
 	WARN_ON(!sk_unhashed(sk));
 
 	sk->sk_hash = inet_sk_ehashfn(sk);
-	head = inet_ehash_bucket(hashinfo, sk->sk_hash);
-	list = &head->chain;
 	lock = inet_ehash_lockp(hashinfo, sk->sk_hash);
 
 	spin_lock(lock);
+	head = inet_ehash_bucket(hashinfo, sk->sk_hash);
+	list = &head->chain;
 	__sk_nulls_add_node_rcu(sk, list);
 	if (tw) {
 		WARN_ON(sk->sk_hash != tw->tw_hash);
@@ -400,6 +781,145 @@ int __inet_hash_nolisten(struct sock *sk, struct inet_timewait_sock *tw)
 }
 EXPORT_SYMBOL_GPL(__inet_hash_nolisten);
 
+/*
+ * Caller holds ilb->lock, ilb being the listening_hash bucket of sk's port.
+ * ilb->count is the number of its listeners that lhash2 holds as well.
+ */
+static void inet_hash2(struct inet_hashinfo *hashinfo,
+		       struct inet_listen_hashbucket *ilb, struct sock *sk)
+{
+	struct inet_listen_hashbucket *ilb2;
+
+	if (!hashinfo->lhash2)
+		return;
+
+	ilb2 = inet_lhash2_bucket(hashinfo,
+				  inet_lhash2fn(sock_net(sk),
+						inet_sk(sk)->inet_rcv_saddr,
+						inet_sk(sk)->inet_num));
+	spin_lock(&ilb2->lock);
+	hlist_nulls_add_head_rcu(&inet_csk(sk)->icsk_listen_portaddr_node,
+				 &ilb2->head);
+	spin_unlock(&ilb2->lock);
+	ilb->count++;
+}
+
+/*
+ * Listeners hashed by other means than __inet_hash() (__inet6_hash() does
+ * not call inet_hash2()) are not in lhash2 and were not counted.
+ */
+static void inet_unhash2(struct inet_hashinfo *hashinfo,
+			 struct inet_listen_hashbucket *ilb, struct sock *sk)
+{
+	struct inet_listen_hashbucket *ilb2;
+
+	if (!hashinfo->lhash2 ||
+	    hlist_nulls_unhashed(&inet_csk(sk)->icsk_listen_portaddr_node))
+		return;
+
+	ilb2 = inet_lhash2_bucket(hashinfo,
+				  inet_lhash2fn(sock_net(sk),
+						inet_sk(sk)->inet_rcv_saddr,
+						inet_sk(sk)->inet_num));
+	spin_lock(&ilb2->lock);
+	hlist_nulls_del_init_rcu(&inet_csk(sk)->icsk_listen_portaddr_node);
+	spin_unlock(&ilb2->lock);
+	ilb->count--;
+}
+
+static struct inet_reuseport_group *inet_reuseport_alloc(unsigned int max_socks)
+{
+	struct inet_reuseport_group *group;
+
+	group = kzalloc(sizeof(*group) + max_socks * sizeof(struct sock *),
+			GFP_ATOMIC);
+	if (group)
+		group->max_socks = max_socks;
+	return group;
+}
+
+/* May listener sk2 share sk's SYNs? */
+static inline int inet_reuseport_match(struct sock *sk, struct sock *sk2)
+{
+	return sk2 != sk && sk2->sk_reuseport &&
+	       sk2->sk_family == sk->sk_family &&
+	       net_eq(sock_net(sk2), sock_net(sk)) &&
+	       inet_sk(sk2)->inet_num == inet_sk(sk)->inet_num &&
+	       inet_sk(sk2)->inet_rcv_saddr == inet_sk(sk)->inet_rcv_saddr &&
+	       sk2->sk_bound_dev_if == sk->sk_bound_dev_if &&
+	       sock_i_uid(sk2) == sock_i_uid(sk);
+}
+
+/*
+ * Caller holds the listening_hash lock of sk's port, which is the lock of
+ * every group on that port. If memory runs out sk stays out of the group
+ * and only gets the SYNs the score walk hands it.
+ */
+static void inet_reuseport_attach(struct inet_listen_hashbucket *ilb,
+				  struct sock *sk)
+{
+	struct inet_reuseport_group *group = NULL, *more;
+	struct hlist_nulls_node *node;
+	struct sock *sk2;
+	unsigned int i;
+
+	sk_nulls_for_each(sk2, node, &ilb->head) {
+		if (inet_reuseport_match(sk, sk2)) {
+			group = inet_csk(sk2)->icsk_reuseport_group;
+			break;
+		}
+	}
+
+	if (!group) {
+		group = inet_reuseport_alloc(INET_REUSEPORT_MIN_SOCKS);
+		if (!group)
+			return;
+	} else if (group->num_socks == group->max_socks) {
+		more = inet_reuseport_alloc(group->max_socks * 2);
+		if (!more)
+			return;
+		memcpy(more->socks, group->socks,
+		       group->num_socks * sizeof(struct sock *));
+		more->num_socks = group->num_socks;
+		for (i = 0; i < more->num_socks; i++)
+			rcu_assign_pointer(inet_csk(more->socks[i])->icsk_reuseport_group,
+					   more);
+		kfree_rcu(group, rcu);
+		group = more;
+	}
+
+	group->socks[group->num_socks] = sk;
+	smp_wmb();
+	group->num_socks++;
+	rcu_assign_pointer(inet_csk(sk)->icsk_reuseport_group, group);
+}
+
+/* Caller holds the listening_hash lock of sk's port */
+static void inet_reuseport_detach(struct sock *sk)
+{
+	struct inet_reuseport_group *group = inet_csk(sk)->icsk_reuseport_group;
+	unsigned int i;
+
+	if (!group)
+		return;
+
+	/*
+	 * The last member takes sk's slot before the count drops, so a
+	 * reader using either count finds a member or sk.
+	 */
+	for (i = 0; i < group->num_socks; i++) {
+		if (group->socks[i] == sk) {
+			group->socks[i] = group->socks[group->num_socks - 1];
+			smp_wmb();
+			group->num_socks--;
+			break;
+		}
+	}
+	RCU_INIT_POINTER(inet_csk(sk)->icsk_reuseport_group, NULL);
+	if (!group->num_socks)
+		kfree_rcu(group, rcu);
+}
+
 static void __inet_hash(struct sock *sk)
 {
 	struct inet_hashinfo *hashinfo = sk->sk_prot->h.hashinfo;
@@ -415,8 +935,12 @@ static void __inet_hash(struct sock *sk)
 	ilb = &hashinfo->listening_hash[inet_sk_listen_hashfn(sk)];
 
 	spin_lock(&ilb->lock);
+	RCU_INIT_POINTER(inet_csk(sk)->icsk_reuseport_group, NULL);
+	if (sk->sk_reuseport)
+		inet_reuseport_attach(ilb, sk);
     // 把socket加入到listening 哈希表的某个链的链头， 这也是listen函数的第二项重要任务!
 	__sk_nulls_add_node_rcu(sk, &ilb->head);
+	inet_hash2(hashinfo, ilb, sk);
     // ???
 	sock_prot_inuse_add(sock_net(sk), sk->sk_prot, 1);
 	spin_unlock(&ilb->lock);
@@ -435,21 +959,28 @@ EXPORT_SYMBOL_GPL(inet_hash);
 void inet_unhash(struct sock *sk)
 {
 	struct inet_hashinfo *hashinfo = sk->sk_prot->h.hashinfo;
+	struct inet_listen_hashbucket *ilb = NULL;
 	spinlock_t *lock;
 	int done;
 
 	if (sk_unhashed(sk))
 		return;
 
-	if (sk->sk_state == TCP_LISTEN)
-		lock = &hashinfo->listening_hash[inet_sk_listen_hashfn(sk)].lock;
-	else
+	if (sk->sk_state == TCP_LISTEN) {
+		ilb = &hashinfo->listening_hash[inet_sk_listen_hashfn(sk)];
+		lock = &ilb->lock;
+	} else
 		lock = inet_ehash_lockp(hashinfo, sk->sk_hash);
 
 	spin_lock_bh(lock);
 	done =__sk_nulls_del_node_init_rcu(sk);
-	if (done)
+	if (done) {
+		if (ilb) {
+			inet_reuseport_detach(sk);
+			inet_unhash2(hashinfo, ilb, sk);
+		}
 		sock_prot_inuse_add(sock_net(sk), sk->sk_prot, -1);
+	}
 	spin_unlock_bh(lock);
 }
 EXPORT_SYMBOL_GPL(inet_unhash);
@@ -474,15 +1005,27 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 		u32 offset = hint + port_offset;
 		struct hlist_node *node;
 		struct inet_timewait_sock *tw = NULL;
+		struct inet_port_dest_set *pds = inet_port_dest_set(sk);
+		int use_pd = 1;
 
 		inet_get_local_port_range(&low, &high);
 		remaining = (high - low) + 1;
 
 		local_bh_disable();
 		for (i = 1; i <= remaining; i++) {
-			port = low + (i + offset) % remaining;
+			if (use_pd) {
+				port = inet_port_dest_next(pds, hinfo, sk,
+							   low, high);
+				if (port < 0) {
+					/* no bitmap, or none free in it */
+					use_pd = 0;
+					i = 0;
+					continue;
+				}
+			} else
+				port = low + (i + offset) % remaining;
 			if (inet_is_reserved_local_port(port))
-				continue;
+				goto next_port_nolock;
 			head = &hinfo->bhash[inet_bhashfn(net, port,
 					hinfo->bhash_size)];
 			spin_lock(&head->lock);
@@ -511,17 +1054,22 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 				break;
 			}
 			tb->fastreuse = -1;
+			tb->fastreuseport = -1;
 			goto ok;
 
 		next_port:
 			spin_unlock(&head->lock);
+		next_port_nolock:
+			inet_port_dest_mark(pds, hinfo, sk, port, 0);
 		}
 		local_bh_enable();
 
 		return -EADDRNOTAVAIL;
 
 ok:
-		hint += i;
+		if (!use_pd)
+			hint += i;
+		inet_port_dest_mark(pds, hinfo, sk, port, 1);
 
 		/* Head lock still held and bh's disabled */
 		inet_bind_hash(sk, tb, port);
@@ -541,6 +1089,9 @@ ok:
 			}
 		}
 
+		if (!use_pd && i > INET_PORT_DEST_MIN_PROBES &&
+		    sk->sk_family == AF_INET)
+			inet_port_dest_add(pds, hinfo, sk, port);
 		ret = 0;
 		goto out;
 	}
@@ -578,10 +1129,158 @@ void inet_hashinfo_init(struct inet_hashinfo *h)
 	int i;
 
 	atomic_set(&h->bsockets, 0);
+	seqcount_init(&h->ehash_seq);
 	for (i = 0; i < INET_LHTABLE_SIZE; i++) {
 		spin_lock_init(&h->listening_hash[i].lock);
+		h->listening_hash[i].count = 0;
 		INIT_HLIST_NULLS_HEAD(&h->listening_hash[i].head,
 				      i + LISTENING_NULLS_BASE);
 		}
 }
 EXPORT_SYMBOL_GPL(inet_hashinfo_init);
+
+/*
+ * Allocate the (port, address) listener hash, size a power of two. Must
+ * be called before the first listener is hashed; without it listeners
+ * are only found through listening_hash.
+ */
+int inet_hashinfo2_init(struct inet_hashinfo *h, unsigned int size)
+{
+	unsigned int i;
+
+	h->lhash2 = vmalloc(size * sizeof(*h->lhash2));
+	if (!h->lhash2)
+		return -ENOMEM;
+
+	for (i = 0; i < size; i++) {
+		spin_lock_init(&h->lhash2[i].lock);
+		h->lhash2[i].count = 0;
+		INIT_HLIST_NULLS_HEAD(&h->lhash2[i].head, i);
+	}
+	h->lhash2_mask = size - 1;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(inet_hashinfo2_init);
+
+/*
+ * clear_sk of protocols whose listeners go into lhash2 and whose sockets
+ * come from a SLAB_DESTROY_BY_RCU cache. A lookup may still be walking an
+ * lhash2 chain through a freed listener when its memory is handed out
+ * again, so like sk_node.next, the next pointer of its lhash2 linkage
+ * must survive the zeroing in sk_alloc(); a NULL there is not a nulls
+ * marker and would end the walk in a NULL dereference.
+ */
+void inet_lhash2_clear_sk(struct sock *sk, int size)
+{
+	unsigned long nulls1, nulls2;
+
+	nulls1 = offsetof(struct sock, __sk_common.skc_node.next);
+	nulls2 = offsetof(struct inet_connection_sock,
+			  icsk_listen_portaddr_node.next);
+	BUILD_BUG_ON(offsetof(struct sock, __sk_common.skc_node.next) >=
+		     offsetof(struct inet_connection_sock,
+			      icsk_listen_portaddr_node.next));
+
+	if (nulls1 != 0)
+		memset((char *)sk, 0, nulls1);
+	memset((char *)sk + nulls1 + sizeof(void *), 0,
+	       nulls2 - nulls1 - sizeof(void *));
+	memset((char *)sk + nulls2 + sizeof(void *), 0,
+	       size - nulls2 - sizeof(void *));
+}
+EXPORT_SYMBOL_GPL(inet_lhash2_clear_sk);
+
+static DEFINE_MUTEX(inet_ehash_grow_mutex);
+
+/* Caller holds the lock of from */
+static void inet_ehash_move(struct inet_ehash_bucket *from,
+			    struct inet_ehash_bucket *to, unsigned int mask)
+{
+	struct sock_common *skc;
+
+	while (!hlist_nulls_empty(&from->chain)) {
+		skc = hlist_nulls_entry(from->chain.first, struct sock_common,
+					skc_nulls_node);
+		hlist_nulls_del_rcu(&skc->skc_nulls_node);
+		hlist_nulls_add_head_rcu(&skc->skc_nulls_node,
+					 &to[skc->skc_hash & mask].chain);
+	}
+	while (!hlist_nulls_empty(&from->twchain)) {
+		skc = hlist_nulls_entry(from->twchain.first, struct sock_common,
+					skc_nulls_node);
+		hlist_nulls_del_rcu(&skc->skc_nulls_node);
+		hlist_nulls_add_head_rcu(&skc->skc_nulls_node,
+					 &to[skc->skc_hash & mask].twchain);
+	}
+}
+
+/*
+ * Double ehash while it is in use. The buckets are moved to the new table
+ * one at a time under their lock, so inserts and lockless lookups go on
+ * throughout; a lookup that misses while a resize is under way looks
+ * again under the lock. A failure caps the table at its current size, so
+ * that inet_ehash_overloaded() stops asking for more. Process context.
+ */
+int inet_ehash_grow(struct inet_hashinfo *hashinfo)
+{
+	struct inet_ehash_bucket *old, *new;
+	unsigned int i, old_size, size;
+	int err = 0;
+
+	mutex_lock(&inet_ehash_grow_mutex);
+	old_size = hashinfo->ehash_mask + 1;
+	size = old_size * 2;
+	if (!size || size > hashinfo->ehash_max_size ||
+	    hashinfo->ehash_locks_mask > hashinfo->ehash_mask) {
+		err = -EINVAL;
+		goto out;
+	}
+	new = vmalloc(size * sizeof(*new));
+	if (!new) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < size; i++) {
+		INIT_HLIST_NULLS_HEAD(&new[i].chain, i);
+		INIT_HLIST_NULLS_HEAD(&new[i].twchain, i);
+	}
+
+	local_bh_disable();
+	write_seqcount_begin(&hashinfo->ehash_seq);
+	hashinfo->ehash_moved = 0;
+	hashinfo->ehash_next_mask = size - 1;
+	hashinfo->ehash_next = new;
+	write_seqcount_end(&hashinfo->ehash_seq);
+	local_bh_enable();
+
+	for (i = 0; i < old_size; i++) {
+		spinlock_t *lock = inet_ehash_lockp(hashinfo, i);
+
+		spin_lock_bh(lock);
+		inet_ehash_move(&hashinfo->ehash[i], new, size - 1);
+		hashinfo->ehash_moved = i + 1;
+		spin_unlock_bh(lock);
+		cond_resched();
+	}
+
+	old = hashinfo->ehash;
+	local_bh_disable();
+	write_seqcount_begin(&hashinfo->ehash_seq);
+	hashinfo->ehash = new;
+	hashinfo->ehash_mask = size - 1;
+	hashinfo->ehash_next = NULL;
+	write_seqcount_end(&hashinfo->ehash_seq);
+	local_bh_enable();
+
+	/* lookups may still be walking the old buckets */
+	synchronize_rcu();
+	/* the boot time table may come from bootmem */
+	if (is_vmalloc_addr(old))
+		vfree(old);
+out:
+	if (err)
+		hashinfo->ehash_max_size = old_size;
+	mutex_unlock(&inet_ehash_grow_mutex);
+	return err;
+}
+EXPORT_SYMBOL_GPL(inet_ehash_grow);
@@ -61,6 +61,7 @@
 #include <linux/init.h>
 #include <linux/times.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 
 #include <net/net_namespace.h>
 #include <net/icmp.h>
@@ -104,6 +105,28 @@ struct tcp_md5sig_key *tcp_v4_md5_do_lookup(struct sock *sk, __be32 addr)
 struct inet_hashinfo tcp_hashinfo;
 EXPORT_SYMBOL(tcp_hashinfo);
 
+static void tcp_ehash_grow(struct work_struct *work)
+{
+	while (inet_ehash_overloaded(&tcp_hashinfo,
+			percpu_counter_sum_positive(&tcp_sockets_allocated) +
+			tcp_death_row.tw_count) &&
+	       !inet_ehash_grow(&tcp_hashinfo))
+		;
+}
+
+static DECLARE_WORK(tcp_ehash_grow_work, tcp_ehash_grow);
+
+/*
+ * Called when a socket has been added to ehash. Never schedules while
+ * tcp_hashinfo.ehash_max_size is 0, see tcp_v4_init().
+ */
+static inline void tcp_ehash_check_load(void)
+{
+	if (unlikely(inet_ehash_overloaded(&tcp_hashinfo,
+			percpu_counter_read_positive(&tcp_sockets_allocated))))
+		schedule_work(&tcp_ehash_grow_work);
+}
+
 static inline __u32 tcp_v4_init_sequence(const struct sk_buff *skb)
 {
 	return secure_tcp_sequence_number(ip_hdr(skb)->daddr,
@@ -241,6 +264,7 @@ int tcp_v4_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
 	err = inet_hash_connect(&tcp_death_row, sk);
 	if (err)
 		goto failure;
+	tcp_ehash_check_load();
 
 	rt = ip_route_newports(fl4, rt, orig_sport, orig_dport,
 			       inet->inet_sport, inet->inet_dport, sk);
@@ -1532,6 +1556,7 @@ struct sock *tcp_v4_syn_recv_sock(struct sock *sk, struct sk_buff *skb,
 	if (__inet_inherit_port(sk, newsk) < 0)
 		goto put_and_exit;
 	__inet_hash_nolisten(newsk, NULL);
+	tcp_ehash_check_load();
 
 	return newsk;
 
@@ -1817,6 +1842,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -2140,10 +2166,29 @@ static void *listening_get_idx(struct seq_file *seq, loff_t *pos)
 	return rc;
 }
 
+/* Caller holds rcu_read_lock() */
 static inline int empty_bucket(struct tcp_iter_state *st)
 {
-	return hlist_nulls_empty(&tcp_hashinfo.ehash[st->bucket].chain) &&
-		hlist_nulls_empty(&tcp_hashinfo.ehash[st->bucket].twchain);
+	struct inet_ehash_bucket *head;
+	unsigned int seq;
+
+	head = inet_ehash_walk_bucket(&tcp_hashinfo, st->bucket, &seq);
+	if (!head)
+		return 1;
+	if (!hlist_nulls_empty(&head->chain) ||
+	    !hlist_nulls_empty(&head->twchain))
+		return 0;
+	/* a socket being moved by a resize is on no chain for a moment */
+	return !ACCESS_ONCE(tcp_hashinfo.ehash_next) &&
+	       !read_seqcount_retry(&tcp_hashinfo.ehash_seq, seq);
+}
+
+/* Caller holds rcu_read_lock() and the lock of st->bucket */
+static inline struct inet_ehash_bucket *tcp_walk_bucket(struct tcp_iter_state *st)
+{
+	unsigned int seq;
+
+	return inet_ehash_walk_bucket(&tcp_hashinfo, st->bucket, &seq);
 }
 
 /*
@@ -2157,18 +2202,25 @@ static void *established_get_first(struct seq_file *seq)
 	void *rc = NULL;
 
 	st->offset = 0;
-	for (; st->bucket <= tcp_hashinfo.ehash_mask; ++st->bucket) {
+	for (; st->bucket <= inet_ehash_walk_mask(&tcp_hashinfo); ++st->bucket) {
 		struct sock *sk;
 		struct hlist_nulls_node *node;
 		struct inet_timewait_sock *tw;
+		struct inet_ehash_bucket *head;
 		spinlock_t *lock = inet_ehash_lockp(&tcp_hashinfo, st->bucket);
 
+		rcu_read_lock();
 		/* Lockless fast path for the common case of empty buckets */
-		if (empty_bucket(st))
+		if (empty_bucket(st)) {
+			rcu_read_unlock();
 			continue;
+		}
 
 		spin_lock_bh(lock);
-		sk_nulls_for_each(sk, node, &tcp_hashinfo.ehash[st->bucket].chain) {
+		head = tcp_walk_bucket(st);
+		if (!head)
+			goto next;
+		sk_nulls_for_each(sk, node, &head->chain) {
 			if (sk->sk_family != st->family ||
 			    !net_eq(sock_net(sk), net)) {
 				continue;
@@ -2177,8 +2229,7 @@ static void *established_get_first(struct seq_file *seq)
 			goto out;
 		}
 		st->state = TCP_SEQ_STATE_TIME_WAIT;
-		inet_twsk_for_each(tw, node,
-				   &tcp_hashinfo.ehash[st->bucket].twchain) {
+		inet_twsk_for_each(tw, node, &head->twchain) {
 			if (tw->tw_family != st->family ||
 			    !net_eq(twsk_net(tw), net)) {
 				continue;
@@ -2186,7 +2237,9 @@ static void *established_get_first(struct seq_file *seq)
 			rc = tw;
 			goto out;
 		}
+next:
 		spin_unlock_bh(lock);
+		rcu_read_unlock();
 		st->state = TCP_SEQ_STATE_ESTABLISHED;
 	}
 out:
@@ -2216,18 +2269,12 @@ get_tw:
 			goto out;
 		}
 		spin_unlock_bh(inet_ehash_lockp(&tcp_hashinfo, st->bucket));
+		rcu_read_unlock();
 		st->state = TCP_SEQ_STATE_ESTABLISHED;
 
 		/* Look for next non empty bucket */
-		st->offset = 0;
-		while (++st->bucket <= tcp_hashinfo.ehash_mask &&
-				empty_bucket(st))
-			;
-		if (st->bucket > tcp_hashinfo.ehash_mask)
-			return NULL;
-
-		spin_lock_bh(inet_ehash_lockp(&tcp_hashinfo, st->bucket));
-		sk = sk_nulls_head(&tcp_hashinfo.ehash[st->bucket].chain);
+		++st->bucket;
+		return established_get_first(seq);
 	} else
 		sk = sk_nulls_next(sk);
 
@@ -2237,7 +2284,7 @@ get_tw:
 	}
 
 	st->state = TCP_SEQ_STATE_TIME_WAIT;
-	tw = tw_head(&tcp_hashinfo.ehash[st->bucket].twchain);
+	tw = tw_head(&tcp_walk_bucket(st)->twchain);
 	goto get_tw;
 found:
 	cur = sk;
@@ -2299,7 +2346,7 @@ static void *tcp_seek_last_pos(struct seq_file *seq)
 	case TCP_SEQ_STATE_ESTABLISHED:
 	case TCP_SEQ_STATE_TIME_WAIT:
 		st->state = TCP_SEQ_STATE_ESTABLISHED;
-		if (st->bucket > tcp_hashinfo.ehash_mask)
+		if (st->bucket > inet_ehash_walk_mask(&tcp_hashinfo))
 			break;
 		rc = established_get_first(seq);
 		while (offset-- && rc)
@@ -2381,8 +2428,10 @@ static void tcp_seq_stop(struct seq_file *seq, void *v)
 		break;
 	case TCP_SEQ_STATE_TIME_WAIT:
 	case TCP_SEQ_STATE_ESTABLISHED:
-		if (v)
+		if (v) {
 			spin_unlock_bh(inet_ehash_lockp(&tcp_hashinfo, st->bucket));
+			rcu_read_unlock();
+		}
 		break;
 	}
 }
@@ -2660,6 +2709,7 @@ struct proto tcp_prot = {
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
+	.clear_sk		= inet_lhash2_clear_sk,
 	.enter_memory_pressure	= tcp_enter_memory_pressure,
 	.sockets_allocated	= &tcp_sockets_allocated,
 	.orphan_count		= &tcp_orphan_count,
@@ -2707,7 +2757,14 @@ static struct pernet_operations __net_initdata tcp_sk_ops = {
 
 void __init tcp_v4_init(void)
 {
+	/*
+	 * ehash_max_size is left 0, so the established hash keeps its boot
+	 * size: __inet_twsk_hashdance() picks its bucket before it takes the
+	 * bucket lock, and a resize could move the chain in between.
+	 */
 	inet_hashinfo_init(&tcp_hashinfo);
+	if (inet_hashinfo2_init(&tcp_hashinfo, INET_LHASH2_SIZE))
+		panic("Failed to allocate the TCP listener hash.\n");
 	if (register_pernet_subsys(&tcp_sk_ops))
 		panic("Failed to create the TCP control socket.\n");
 }
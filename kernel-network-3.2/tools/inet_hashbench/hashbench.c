@@ -0,0 +1,972 @@
+/*
+ * hashbench - TCP socket lookups of net/ipv4/inet_hashtables.c, in userspace
+ *
+ * The hash tables are built and searched by the kernel's own code, linked
+ * in unmodified (see include/kshim.h). The benchmark fills them with
+ * listeners and established sockets and times, from one or more threads:
+ *
+ *   established  __inet_lookup_established() hits, the path of every
+ *                segment of an open connection
+ *   syn          __inet_lookup() of a tuple that is not established, so an
+ *                ehash miss followed by __inet_lookup_listener(): the path
+ *                of every SYN. Run with -H 0 to score every listener of
+ *                the port instead of using the (port, address) hash.
+ *
+ * Listener i is bound to 10.1.x.y:(8000 + i % ports), a distinct address
+ * per port, and each port also gets a wildcard listener, as a host with
+ * many virtual IPs has. With -r every one of those listeners is a group of
+ * SO_REUSEPORT sockets instead, and the run ends with how evenly the SYNs
+ * were spread over the members. Established sockets are spread over the
+ * listeners.
+ * With -F the syn lookups run once more while another thread keeps closing
+ * listeners and, as the SLAB_DESTROY_BY_RCU tcp slab does, handing their
+ * memory out again at once to a new listener: lookups walking a chain
+ * through one must neither crash nor find anything but a listener of the
+ * port (or none, if they lose the race for the last reference). A small
+ * -H, say 16, makes the lhash2 chains long enough for a lookup to be
+ * caught on a listener while it is reused.
+ * Sockets are obj_size bytes (a tcp_sock by default) and cache line
+ * aligned, as the tcp slab allocates them, and keys are looked up in
+ * random order, so the cache misses are those of a busy server.
+ *
+ * With -g the run is about ehash growth instead: established sockets are
+ * added in steps from 10k up to the given number, ehash starting at -e
+ * buckets and doubled by inet_ehash_grow() whenever it holds more sockets
+ * than buckets (never with -R 0), and established lookups are timed after
+ * every step. While the sockets go in and the table grows, a second thread
+ * keeps looking up the sockets already hashed; every one must be found.
+ * A third walks all of ehash bucket by bucket, as /proc/net/tcp does, and
+ * must come across at least as many sockets as were in when it started.
+ *
+ * With -c the run is a connect() storm: inet_hash_connect() picks local
+ * ports for connections to -d destinations out of a range of the given
+ * size, as tcp_v4_connect() does. The range is filled to 50%, 90%, 99% and
+ * 99.9% towards every destination, and at each level connections to a
+ * random one are closed at random and new ones made, timing every connect;
+ * at last every port is taken, and connects that fail are timed. The
+ * kzalloc()s during each level are counted too: with many destinations,
+ * the port bitmaps connect() keeps for them must not be replaced at every
+ * connect. TIME_WAIT is not modelled: a port is free as soon as its
+ * connection is closed.
+ *
+ * Cache misses are counted with perf_event_open(2) when the kernel and
+ * hardware allow it.
+ */
+#include <getopt.h>
+#include <time.h>
+
+#include <net/inet_hashtables.h>
+#include <net/ip.h>
+
+#include "perfctr.h"
+
+#define LISTEN_PORT_BASE	8000
+#define LISTEN_ADDR_BASE	0x0a010001	/* 10.1.0.1 */
+#define UNBOUND_ADDR		0x0a020001	/* 10.2.0.1 */
+#define REMOTE_ADDR_BASE	0xac100000	/* 172.16.0.0 */
+#define SYN_ADDR_BASE		0xc0a80000	/* 192.168.0.0 */
+#define REMOTE_PORTS		50000
+#define STORM_ADDR		0xcb007101	/* 203.0.113.1 */
+#define STORM_PORT		443
+#define STORM_LOCAL_LOW		32768
+#define STORM_ROUNDS		20000
+
+struct bench_opts {
+	int		nr_estab;
+	int		nr_listen;
+	int		nr_ports;
+	int		wildcard;
+	int		reuseport;
+	unsigned int	ehash_size;
+	unsigned int	lhash2_size;
+	long		nr_lookups;
+	int		nr_threads;
+	unsigned int	obj_size;
+	long		grow_max;
+	int		grow;
+	int		storm_ports;
+	int		storm_dests;
+	int		churn;
+};
+
+static struct bench_opts opts = {
+	.nr_estab	= 100000,
+	.nr_listen	= 1000,
+	.nr_ports	= 16,
+	.wildcard	= 1,
+	.reuseport	= 1,
+	.ehash_size	= 65536,
+	.lhash2_size	= INET_LHASH2_SIZE,
+	.nr_lookups	= 4000000,
+	.nr_threads	= 1,
+	.obj_size	= 1792,
+	.grow		= 1,
+	.storm_dests	= 1,
+};
+
+static struct inet_hashinfo hashinfo;
+static struct proto bench_prot = {
+	.name		= "TCP",
+	.clear_sk	= inet_lhash2_clear_sk,		/* as tcp_prot */
+};
+static struct sock **listeners;
+static int nr_listeners;
+
+/* what a segment carries: its source is the remote end of the socket */
+struct lookup_key {
+	__be32		saddr;
+	__be32		daddr;
+	__be16		sport;
+	__be16		dport;
+	__be32		bound;		/* rcv_saddr of the socket to find */
+};
+
+struct phase {
+	const char		*name;
+	struct lookup_key	*keys;
+	unsigned int		nr_keys;
+	struct sock		*(*lookup)(const struct lookup_key *key);
+	int			(*check)(const struct lookup_key *key,
+					 struct sock *sk);
+	const char		*note;		/* printed at the end of its row */
+};
+
+struct lookup_thread {
+	pthread_t		thread;
+	const struct phase	*phase;
+	unsigned int		first;
+	long			nr_lookups;
+	long			nr_bad;
+	double			secs;
+	uint64_t		misses;
+	int			perf_ok;
+} ____cacheline_aligned;
+
+static unsigned long long rnd_state = 0x9e3779b97f4a7c15ULL;
+
+static u32 rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state >> 32;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int roundup_pow_of_two(unsigned int n)
+{
+	unsigned int p = 1;
+
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+
+	if (!p) {
+		perror("malloc");
+		exit(1);
+	}
+	return p;
+}
+
+/* sk_alloc() has cleared sk */
+static void bench_sk_init(struct sock *sk, int state, __be32 laddr, u16 lport,
+			  __be32 raddr, __be16 rport)
+{
+	struct inet_sock *inet;
+
+	sk->sk_family = PF_INET;
+	sk->sk_state = state;
+	sk->sk_protocol = IPPROTO_TCP;
+	sk->sk_prot = &bench_prot;
+	sock_net_set(sk, &init_net);
+	atomic_set(&sk->sk_refcnt, 1);
+
+	inet = inet_sk(sk);
+	inet->inet_rcv_saddr = laddr;
+	inet->inet_saddr = laddr;
+	inet->inet_num = lport;
+	inet->inet_sport = htons(lport);
+	inet->inet_daddr = raddr;
+	inet->inet_dport = rport;
+}
+
+static struct sock *bench_sk_alloc(int state, __be32 laddr, u16 lport,
+				   __be32 raddr, __be16 rport)
+{
+	struct sock *sk;
+
+	if (posix_memalign((void **)&sk, L1_CACHE_BYTES, opts.obj_size)) {
+		perror("posix_memalign");
+		exit(1);
+	}
+	memset(sk, 0, opts.obj_size);
+	bench_sk_init(sk, state, laddr, lport, raddr, rport);
+	return sk;
+}
+
+static void listen_addr(int i, __be32 *addr, u16 *port)
+{
+	*addr = htonl(LISTEN_ADDR_BASE + i / opts.nr_ports);
+	*port = LISTEN_PORT_BASE + i % opts.nr_ports;
+}
+
+static void hashinfo_setup(void)
+{
+	unsigned int i;
+
+	hashinfo.ehash = xmalloc(opts.ehash_size * sizeof(*hashinfo.ehash));
+	hashinfo.ehash_mask = opts.ehash_size - 1;
+	for (i = 0; i < opts.ehash_size; i++) {
+		INIT_HLIST_NULLS_HEAD(&hashinfo.ehash[i].chain, i);
+		INIT_HLIST_NULLS_HEAD(&hashinfo.ehash[i].twchain, i);
+	}
+	if (inet_ehash_locks_alloc(&hashinfo)) {
+		fprintf(stderr, "cannot allocate ehash locks\n");
+		exit(1);
+	}
+	if (opts.grow && opts.grow_max > opts.ehash_size)
+		hashinfo.ehash_max_size = roundup_pow_of_two(opts.grow_max);
+
+	hashinfo.bhash_size = 65536;
+	hashinfo.bhash = xmalloc(hashinfo.bhash_size * sizeof(*hashinfo.bhash));
+	for (i = 0; i < hashinfo.bhash_size; i++) {
+		spin_lock_init(&hashinfo.bhash[i].lock);
+		INIT_HLIST_HEAD(&hashinfo.bhash[i].chain);
+	}
+	hashinfo.bind_bucket_cachep =
+		kmem_cache_create("tcp_bind_bucket",
+				  sizeof(struct inet_bind_bucket), 0, 0, NULL);
+
+	inet_hashinfo_init(&hashinfo);
+	if (opts.lhash2_size && inet_hashinfo2_init(&hashinfo, opts.lhash2_size)) {
+		fprintf(stderr, "cannot allocate the listener hash\n");
+		exit(1);
+	}
+	bench_prot.h.hashinfo = &hashinfo;
+	bench_prot.obj_size = opts.obj_size;
+}
+
+/* one listener, or a SO_REUSEPORT group of them with -r */
+static void listen_on(__be32 addr, u16 port)
+{
+	struct sock *sk;
+	int i;
+
+	for (i = 0; i < opts.reuseport; i++) {
+		sk = bench_sk_alloc(TCP_LISTEN, addr, port, 0, 0);
+		sk->sk_reuseport = opts.reuseport > 1;
+		inet_hash(sk);
+		listeners[nr_listeners++] = sk;
+	}
+}
+
+/* established socket i, and the key of a segment it receives */
+static void estab_key(long i, struct lookup_key *key)
+{
+	__be32 addr;
+	u16 port;
+
+	listen_addr(opts.nr_listen ? i % opts.nr_listen : 0, &addr, &port);
+	key->saddr = htonl(REMOTE_ADDR_BASE + i / REMOTE_PORTS);
+	key->sport = htons(1024 + i % REMOTE_PORTS);
+	key->daddr = addr;
+	key->dport = htons(port);
+}
+
+static void hash_estab(long i)
+{
+	struct lookup_key key;
+
+	estab_key(i, &key);
+	__inet_hash_nolisten(bench_sk_alloc(TCP_ESTABLISHED, key.daddr,
+					    ntohs(key.dport), key.saddr,
+					    key.sport), NULL);
+}
+
+static void populate(void)
+{
+	__be32 addr;
+	u16 port;
+	int i;
+
+	listeners = xmalloc((opts.nr_listen + opts.nr_ports) * opts.reuseport *
+			    sizeof(*listeners));
+	for (i = 0; i < opts.nr_listen; i++) {
+		listen_addr(i, &addr, &port);
+		listen_on(addr, port);
+	}
+	for (i = 0; opts.wildcard && i < opts.nr_ports; i++)
+		listen_on(0, LISTEN_PORT_BASE + i);
+
+	for (i = 0; !opts.grow_max && !opts.storm_ports && i < opts.nr_estab; i++)
+		hash_estab(i);
+}
+
+static void shuffle(struct lookup_key *keys, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = n - 1; i > 0; i--) {
+		unsigned int j = rnd() % (i + 1);
+		struct lookup_key tmp = keys[i];
+
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+}
+
+static struct lookup_key *estab_keys(unsigned int *nr)
+{
+	struct lookup_key *keys = xmalloc(opts.nr_estab * sizeof(*keys));
+	int i;
+
+	for (i = 0; i < opts.nr_estab; i++)
+		estab_key(i, &keys[i]);
+	shuffle(keys, opts.nr_estab);
+	*nr = opts.nr_estab;
+	return keys;
+}
+
+/*
+ * New connections from addresses no established socket uses. With
+ * wildcard listeners one SYN in eight goes to an address nothing is bound
+ * to, and has to fall back to the wildcard.
+ */
+static struct lookup_key *syn_keys(unsigned int *nr)
+{
+	unsigned int i, n = 1 << 20;
+	struct lookup_key *keys = xmalloc(n * sizeof(*keys));
+	__be32 addr;
+	u16 port;
+
+	for (i = 0; i < n; i++) {
+		if (opts.nr_listen && (!opts.wildcard || i % 8)) {
+			listen_addr(rnd() % opts.nr_listen, &addr, &port);
+			keys[i].bound = addr;
+		} else {
+			addr = htonl(UNBOUND_ADDR);
+			port = LISTEN_PORT_BASE + rnd() % opts.nr_ports;
+			keys[i].bound = 0;
+		}
+		keys[i].saddr = htonl(SYN_ADDR_BASE + (i >> 16));
+		keys[i].sport = htons(1024 + (i & 0xffff) % REMOTE_PORTS);
+		keys[i].daddr = addr;
+		keys[i].dport = htons(port);
+	}
+	*nr = n;
+	return keys;
+}
+
+static struct sock *lookup_estab(const struct lookup_key *key)
+{
+	return __inet_lookup_established(&init_net, &hashinfo,
+					 key->saddr, key->sport,
+					 key->daddr, ntohs(key->dport), 0);
+}
+
+static struct sock *lookup_syn(const struct lookup_key *key)
+{
+	return __inet_lookup(&init_net, &hashinfo, key->saddr, key->sport,
+			     key->daddr, key->dport, 0);
+}
+
+static int check_estab(const struct lookup_key *key, struct sock *sk)
+{
+	return sk && sk->sk_state == TCP_ESTABLISHED &&
+	       inet_sk(sk)->inet_daddr == key->saddr &&
+	       inet_sk(sk)->inet_dport == key->sport;
+}
+
+/* the most specific listener: bound to the address if there is one */
+static int check_syn(const struct lookup_key *key, struct sock *sk)
+{
+	const struct inet_sock *inet = sk ? inet_sk(sk) : NULL;
+
+	return sk && sk->sk_state == TCP_LISTEN &&
+	       inet->inet_num == ntohs(key->dport) &&
+	       inet->inet_rcv_saddr == key->bound;
+}
+
+/* with -F: the listener may be between lives, and then there is none */
+static int check_syn_churn(const struct lookup_key *key, struct sock *sk)
+{
+	const struct inet_sock *inet = sk ? inet_sk(sk) : NULL;
+
+	return !sk || (sk->sk_state == TCP_LISTEN &&
+		       inet->inet_num == ntohs(key->dport) &&
+		       (inet->inet_rcv_saddr == key->bound ||
+			!inet->inet_rcv_saddr));
+}
+
+static void *lookup_thread_fn(void *arg)
+{
+	struct lookup_thread *lt = arg;
+	const struct phase *phase = lt->phase;
+	unsigned int idx = lt->first;
+	int fd = perfctr_open();
+	uint64_t misses = perfctr_read(fd);
+	double start = now();
+	long i;
+
+	for (i = 0; i < lt->nr_lookups; i++) {
+		const struct lookup_key *key = &phase->keys[idx];
+		struct sock *sk = phase->lookup(key);
+
+		if (unlikely(!phase->check(key, sk)))
+			lt->nr_bad++;
+		if (sk)
+			sock_put(sk);
+		if (++idx == phase->nr_keys)
+			idx = 0;
+	}
+
+	lt->secs = now() - start;
+	lt->misses = perfctr_read(fd) - misses;
+	lt->perf_ok = fd >= 0;
+	perfctr_close(fd);
+	return NULL;
+}
+
+static int run_phase(const struct phase *phase)
+{
+	struct lookup_thread *lt;
+	double cpu_secs = 0, wall_secs = 0;
+	uint64_t misses = 0;
+	long bad = 0;
+	int perf_ok = 1;
+	int t;
+
+	if (posix_memalign((void **)&lt, L1_CACHE_BYTES,
+			   opts.nr_threads * sizeof(*lt))) {
+		perror("posix_memalign");
+		exit(1);
+	}
+	memset(lt, 0, opts.nr_threads * sizeof(*lt));
+	for (t = 0; t < opts.nr_threads; t++) {
+		lt[t].phase = phase;
+		lt[t].first = (u64)phase->nr_keys * t / opts.nr_threads;
+		lt[t].nr_lookups = opts.nr_lookups / opts.nr_threads;
+		if (pthread_create(&lt[t].thread, NULL, lookup_thread_fn,
+				   &lt[t])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (t = 0; t < opts.nr_threads; t++) {
+		pthread_join(lt[t].thread, NULL);
+		cpu_secs += lt[t].secs;
+		if (lt[t].secs > wall_secs)
+			wall_secs = lt[t].secs;
+		misses += lt[t].misses;
+		bad += lt[t].nr_bad;
+		perf_ok &= lt[t].perf_ok;
+	}
+
+	long total = lt[0].nr_lookups * opts.nr_threads;
+	printf("%-12s %10ld %10.1f %10.2f ", phase->name, total,
+	       cpu_secs * 1e9 / total, total / wall_secs / 1e6);
+	if (perf_ok)
+		printf("%14.2f", (double)misses / total);
+	else
+		printf("%14s", "n/a");
+	printf("%s%s\n", phase->note ? phase->note : "",
+	       bad ? "  WRONG SOCKET" : "");
+	if (bad)
+		fprintf(stderr, "%s: %ld lookups found the wrong socket\n",
+			phase->name, bad);
+	free(lt);
+	return bad ? -1 : 0;
+}
+
+/*
+ * How many of the SYNs each member of a SO_REUSEPORT group got, by its
+ * slot in the group, summed over all groups: the lowest and highest
+ * share relative to an even split.
+ */
+static void reuseport_spread(const struct phase *phase)
+{
+	long *count = calloc(opts.reuseport, sizeof(*count));
+	long min = -1, max = 0;
+	unsigned int i;
+	int j;
+
+	for (i = 0; i < phase->nr_keys; i++) {
+		struct sock *sk = phase->lookup(&phase->keys[i]);
+		struct inet_reuseport_group *group;
+
+		if (!sk)
+			continue;
+		group = inet_csk(sk)->icsk_reuseport_group;
+		for (j = 0; group && j < (int)group->num_socks; j++) {
+			if (group->socks[j] == sk) {
+				count[j]++;
+				break;
+			}
+		}
+		sock_put(sk);
+	}
+	for (j = 0; j < opts.reuseport; j++) {
+		if (min < 0 || count[j] < min)
+			min = count[j];
+		if (count[j] > max)
+			max = count[j];
+	}
+	printf("reuseport: %d per group, SYNs per member %.3f..%.3f of an even share\n",
+	       opts.reuseport, (double)min * opts.reuseport / phase->nr_keys,
+	       (double)max * opts.reuseport / phase->nr_keys);
+	free(count);
+}
+
+#define CHURN_SETUP_SPINS	200
+
+static volatile int churn_done;
+static long churn_count;
+
+/*
+ * Close listener sk and give its memory straight to a new listener on the
+ * same address and port, as a SLAB_DESTROY_BY_RCU cache may: no grace
+ * period, and sk_alloc() clears it the protocol's way.
+ */
+static void churn_listener(struct sock *sk)
+{
+	__be32 addr = inet_sk(sk)->inet_rcv_saddr;
+	u16 port = inet_sk(sk)->inet_num;
+	int reuseport = sk->sk_reuseport;
+	int i;
+
+	inet_unhash(sk);
+	/* the last sock_put() of a lookup frees it */
+	while (atomic_cmpxchg(&sk->sk_refcnt, 1, 0) != 1)
+		cpu_relax();
+
+	if (bench_prot.clear_sk)
+		bench_prot.clear_sk(sk, bench_prot.obj_size);
+	else
+		sk_prot_clear_nulls(sk, bench_prot.obj_size);
+	bench_sk_init(sk, TCP_LISTEN, addr, port, 0, 0);
+	sk->sk_reuseport = reuseport;
+	/* a new socket takes a while to get to listen() */
+	for (i = 0; i < CHURN_SETUP_SPINS; i++)
+		cpu_relax();
+	inet_hash(sk);
+}
+
+static void *churn_fn(void *arg)
+{
+	while (!churn_done) {
+		churn_listener(listeners[rnd() % nr_listeners]);
+		churn_count++;
+	}
+	return NULL;
+}
+
+static int churn_run(const struct phase *syn)
+{
+	struct phase phase = *syn;
+	pthread_t churner;
+	int err;
+
+	phase.name = "syn+churn";
+	phase.check = check_syn_churn;
+	if (pthread_create(&churner, NULL, churn_fn, NULL)) {
+		perror("pthread_create");
+		exit(1);
+	}
+	err = run_phase(&phase);
+	churn_done = 1;
+	pthread_join(churner, NULL);
+	printf("%ld listeners closed and their memory reused during the lookups\n",
+	       churn_count);
+	return err;
+}
+
+static volatile long grow_hashed;	/* sockets 0..grow_hashed-1 are in */
+static volatile int grow_verify, grow_done;
+static long grow_lookups, grow_bad, grow_walks, grow_short_walks;
+
+/* looks up the sockets already hashed while more go in */
+static void *grow_verify_fn(void *arg)
+{
+	unsigned long long seed = 1;
+	struct lookup_key key;
+	long i = 0;
+
+	rcu_thread_online();
+	while (!grow_done) {
+		struct sock *sk;
+
+		if (!grow_verify || !grow_hashed) {
+			rcu_quiescent_state();
+			sched_yield();
+			continue;
+		}
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		estab_key((seed >> 33) % grow_hashed, &key);
+		sk = lookup_estab(&key);
+		if (!check_estab(&key, sk))
+			grow_bad++;
+		if (sk)
+			sock_put(sk);
+		grow_lookups++;
+		if (!(++i & 63))
+			rcu_quiescent_state();
+	}
+	rcu_thread_offline();
+	return NULL;
+}
+
+/* counts the sockets in ehash, bucket by bucket, while more go in */
+static void *grow_walk_fn(void *arg)
+{
+	rcu_thread_online();
+	while (!grow_done) {
+		long hashed = grow_hashed, found = 0;
+		unsigned int i;
+
+		if (!grow_verify || !hashed) {
+			rcu_quiescent_state();
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i <= inet_ehash_walk_mask(&hashinfo); i++) {
+			spinlock_t *lock = inet_ehash_lockp(&hashinfo, i);
+			struct inet_ehash_bucket *head;
+			struct hlist_nulls_node *node;
+			struct sock *sk;
+			unsigned int seq;
+
+			rcu_read_lock();
+			spin_lock_bh(lock);
+			head = inet_ehash_walk_bucket(&hashinfo, i, &seq);
+			if (head)
+				sk_nulls_for_each(sk, node, &head->chain)
+					found++;
+			spin_unlock_bh(lock);
+			rcu_read_unlock();
+			rcu_quiescent_state();
+		}
+		if (found < hashed)
+			grow_short_walks++;
+		grow_walks++;
+	}
+	rcu_thread_offline();
+	return NULL;
+}
+
+static long grow_next_step(long n)
+{
+	long decade = 1;
+
+	while (decade * 10 <= n)
+		decade *= 10;
+	return n < 2 * decade ? 2 * decade :
+	       n < 5 * decade ? 5 * decade : 10 * decade;
+}
+
+static int grow_run(void)
+{
+	unsigned int nr_keys = 1 << 20, i;
+	struct lookup_key *keys = xmalloc(nr_keys * sizeof(*keys));
+	struct phase phase = { NULL, keys, 0, lookup_estab, check_estab };
+	char name[24], note[64];
+	pthread_t verifier, walker;
+	long n = 0, step;
+	int err = 0;
+
+	if (pthread_create(&verifier, NULL, grow_verify_fn, NULL) ||
+	    pthread_create(&walker, NULL, grow_walk_fn, NULL)) {
+		perror("pthread_create");
+		exit(1);
+	}
+	printf("%-12s %10s %10s %10s %14s %10s %12s\n", "sockets", "lookups",
+	       "ns/lookup", "Mlookup/s", "misses/lookup", "buckets",
+	       "ms resizing");
+	for (step = 10000; n < opts.grow_max; step = grow_next_step(step)) {
+		double resize_secs = 0;
+
+		if (step > opts.grow_max)
+			step = opts.grow_max;
+		grow_verify = 1;
+		for (; n < step; n++) {
+			hash_estab(n);
+			grow_hashed = n + 1;
+			if (opts.grow && inet_ehash_overloaded(&hashinfo, n + 1)) {
+				double start = now();
+
+				if (inet_ehash_grow(&hashinfo)) {
+					fprintf(stderr, "cannot grow ehash\n");
+					exit(1);
+				}
+				resize_secs += now() - start;
+			}
+		}
+		grow_verify = 0;
+
+		phase.nr_keys = n < nr_keys ? n : nr_keys;
+		for (i = 0; i < phase.nr_keys; i++)
+			estab_key(rnd() % n, &keys[i]);
+		snprintf(name, sizeof(name), "%ld", n);
+		snprintf(note, sizeof(note), " %10u %12.1f",
+			 hashinfo.ehash_mask + 1, resize_secs * 1e3);
+		phase.name = name;
+		phase.note = note;
+		err |= run_phase(&phase);
+	}
+	grow_done = 1;
+	pthread_join(verifier, NULL);
+	pthread_join(walker, NULL);
+	printf("%ld lookups alongside the inserts and resizes, %ld missed\n",
+	       grow_lookups, grow_bad);
+	printf("%ld walks of ehash alongside them, %ld short of the sockets in\n",
+	       grow_walks, grow_short_walks);
+	free(keys);
+	return err || grow_bad || grow_short_walks ? -1 : 0;
+}
+
+static struct inet_timewait_death_row storm_death_row;
+
+static struct sock *storm_connect(int dest)
+{
+	struct sock *sk = bench_sk_alloc(TCP_SYN_SENT, htonl(UNBOUND_ADDR), 0,
+					 htonl(STORM_ADDR + dest),
+					 htons(STORM_PORT));
+
+	if (inet_hash_connect(&storm_death_row, sk)) {
+		sk_free(sk);
+		return NULL;
+	}
+	return sk;
+}
+
+static void storm_close(struct sock *sk)
+{
+	inet_unhash(sk);
+	inet_put_port(sk);
+	sock_put(sk);
+}
+
+static int storm_run(void)
+{
+	static const int levels[] = { 500, 900, 990, 999, 1000 };	/* per mille */
+	int ports = opts.storm_ports, dests = opts.storm_dests;
+	struct sock **open = xmalloc((long)dests * ports * sizeof(*open));
+	int *nr_open = xmalloc(dests * sizeof(*nr_open));
+	int level, d, err = 0;
+
+	storm_death_row.hashinfo = &hashinfo;
+	kshim_set_local_port_range(STORM_LOCAL_LOW, STORM_LOCAL_LOW + ports - 1);
+	memset(nr_open, 0, dests * sizeof(*nr_open));
+
+	printf("%-12s %10s %10s %12s %12s %10s %10s\n", "ports taken", "sockets",
+	       "connects", "ns/connect", "max us", "failed", "kzallocs");
+	for (level = 0; level < (int)(sizeof(levels) / sizeof(levels[0])); level++) {
+		int full = levels[level] == 1000;
+		int target = (long)ports * levels[level] / 1000;
+		int rounds = full ? STORM_ROUNDS / 100 : STORM_ROUNDS;
+		long kzallocs, sockets = 0;
+		double total = 0, worst = 0;
+		int r, failed = 0;
+		char name[24];
+
+		for (d = 0; d < dests; d++) {
+			struct sock **dopen = open + (long)d * ports;
+
+			while (nr_open[d] < target) {
+				dopen[nr_open[d]] = storm_connect(d);
+				if (!dopen[nr_open[d]]) {
+					fprintf(stderr, "connect failed with %d of %d ports taken\n",
+						nr_open[d], ports);
+					return -1;
+				}
+				nr_open[d]++;
+			}
+		}
+		kzallocs = kshim_kzallocs;
+		for (r = 0; r < rounds; r++) {
+			struct sock *sk;
+			double start;
+
+			d = rnd() % dests;
+			if (!full) {
+				int j = rnd() % nr_open[d];
+
+				storm_close(open[(long)d * ports + j]);
+				open[(long)d * ports + j] =
+					open[(long)d * ports + --nr_open[d]];
+			}
+			start = now();
+			sk = storm_connect(d);
+			start = now() - start;
+			total += start;
+			if (start > worst)
+				worst = start;
+			if (sk)
+				open[(long)d * ports + nr_open[d]++] = sk;
+			else
+				failed++;
+		}
+		/* with every port taken connect has to fail, otherwise never */
+		if (failed != (full ? rounds : 0))
+			err = -1;
+		for (d = 0; d < dests; d++)
+			sockets += nr_open[d];
+		snprintf(name, sizeof(name), "%.1f%%", levels[level] / 10.0);
+		printf("%-12s %10ld %10d %12.0f %12.1f %10d %10ld\n", name, sockets,
+		       rounds, total * 1e9 / rounds, worst * 1e6, failed,
+		       kshim_kzallocs - kzallocs);
+	}
+	for (d = 0; d < dests; d++)
+		while (nr_open[d])
+			storm_close(open[(long)d * ports + --nr_open[d]]);
+	free(nr_open);
+	free(open);
+	return err;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n established] [-l listeners] [-p ports] [-w 0|1] [-r group]\n"
+		"          [-e ehash_buckets] [-H lhash2_buckets] [-L lookups] [-t threads]\n"
+		"          [-o obj_size] [-g max_established] [-R 0|1] [-c ports] [-d dests] [-F]\n"
+		"  -n  established sockets (%d)\n"
+		"  -l  listeners bound to an address, spread over the ports (%d)\n"
+		"  -p  listening ports (%d)\n"
+		"  -w  add a wildcard listener on every port (%d)\n"
+		"  -r  SO_REUSEPORT sockets per listener (%d)\n"
+		"  -e  ehash buckets, rounded up to a power of two (%u)\n"
+		"  -H  (port, address) listener hash buckets, 0 for none (%u)\n"
+		"  -L  lookups per phase (%ld)\n"
+		"  -t  threads doing lookups (%d)\n"
+		"  -o  bytes per socket, at least sizeof(struct inet_connection_sock)=%zu (%u)\n"
+		"  -g  ehash growth run, up to this many established sockets\n"
+		"  -R  grow ehash during the growth run (%d)\n"
+		"  -c  connect storm, over a local port range of this size\n"
+		"  -d  destinations of the connect storm (%d)\n"
+		"  -F  syn lookups again while listeners are freed and reallocated\n",
+		prog, opts.nr_estab, opts.nr_listen, opts.nr_ports,
+		opts.wildcard, opts.reuseport, opts.ehash_size, opts.lhash2_size, opts.nr_lookups,
+		opts.nr_threads, sizeof(struct inet_connection_sock),
+		opts.obj_size, opts.grow, opts.storm_dests);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct phase phases[] = {
+		{ "established", NULL, 0, lookup_estab, check_estab },
+		{ "syn",	 NULL, 0, lookup_syn,	check_syn },
+	};
+	int c, err = 0;
+
+	while ((c = getopt(argc, argv, "n:l:p:w:r:e:H:L:t:o:g:R:c:d:Fh")) != -1) {
+		switch (c) {
+		case 'n':
+			opts.nr_estab = atoi(optarg);
+			break;
+		case 'l':
+			opts.nr_listen = atoi(optarg);
+			break;
+		case 'p':
+			opts.nr_ports = atoi(optarg);
+			break;
+		case 'w':
+			opts.wildcard = atoi(optarg) != 0;
+			break;
+		case 'r':
+			opts.reuseport = atoi(optarg);
+			break;
+		case 'e':
+			opts.ehash_size = roundup_pow_of_two(strtoul(optarg, NULL, 0));
+			break;
+		case 'H':
+			opts.lhash2_size = strtoul(optarg, NULL, 0);
+			if (opts.lhash2_size)
+				opts.lhash2_size = roundup_pow_of_two(opts.lhash2_size);
+			break;
+		case 'L':
+			opts.nr_lookups = atol(optarg);
+			break;
+		case 't':
+			opts.nr_threads = atoi(optarg);
+			break;
+		case 'o':
+			opts.obj_size = atoi(optarg);
+			break;
+		case 'g':
+			opts.grow_max = atol(optarg);
+			break;
+		case 'R':
+			opts.grow = atoi(optarg) != 0;
+			break;
+		case 'c':
+			opts.storm_ports = atoi(optarg);
+			break;
+		case 'd':
+			opts.storm_dests = atoi(optarg);
+			break;
+		case 'F':
+			opts.churn = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || opts.nr_estab < 1 || opts.nr_listen < 0 ||
+	    opts.nr_ports < 1 || opts.nr_ports > 65536 - LISTEN_PORT_BASE ||
+	    (!opts.nr_listen && !opts.wildcard) || opts.reuseport < 1 ||
+	    opts.ehash_size < 1 ||
+	    opts.nr_lookups < 1 || opts.nr_threads < 1 || opts.grow_max < 0 ||
+	    opts.storm_ports < 0 || opts.storm_ports > 65536 - STORM_LOCAL_LOW ||
+	    opts.storm_dests < 1 ||
+	    opts.obj_size < sizeof(struct inet_connection_sock))
+		usage(argv[0]);
+	opts.obj_size = (opts.obj_size + L1_CACHE_BYTES - 1) &
+			~(L1_CACHE_BYTES - 1);
+
+	kshim_init();
+	hashinfo_setup();
+	populate();
+	if (opts.grow_max) {
+		printf("growing to %ld established, %u ehash buckets at first%s, "
+		       "%u-byte socks\n", opts.grow_max, opts.ehash_size,
+		       opts.grow ? "" : " and at last", opts.obj_size);
+		return grow_run() ? 1 : 0;
+	}
+	if (opts.storm_ports) {
+		printf("connect storm to %d destination%s, %d local ports\n",
+		       opts.storm_dests, opts.storm_dests == 1 ? "" : "s",
+		       opts.storm_ports);
+		return storm_run() ? 1 : 0;
+	}
+	phases[0].keys = estab_keys(&phases[0].nr_keys);
+	phases[1].keys = syn_keys(&phases[1].nr_keys);
+
+	printf("%d established, %d listeners + %d wildcard on %d ports, x%d, "
+	       "%u ehash buckets, %u lhash2 buckets, %u-byte socks, %d thread%s\n",
+	       opts.nr_estab, opts.nr_listen, opts.wildcard ? opts.nr_ports : 0,
+	       opts.nr_ports, opts.reuseport, opts.ehash_size, opts.lhash2_size,
+	       opts.obj_size, opts.nr_threads,
+	       opts.nr_threads == 1 ? "" : "s");
+	printf("%-12s %10s %10s %10s %14s\n", "lookup", "lookups",
+	       "ns/lookup", "Mlookup/s", "misses/lookup");
+	for (c = 0; c < (int)(sizeof(phases) / sizeof(phases[0])); c++)
+		err |= run_phase(&phases[c]);
+	if (opts.reuseport > 1)
+		reuseport_spread(&phases[1]);
+	if (opts.churn)
+		err |= churn_run(&phases[1]);
+	return err ? 1 : 0;
+}
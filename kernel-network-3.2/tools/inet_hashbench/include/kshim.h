@@ -0,0 +1,443 @@
+/*
+ * Userspace stand-ins for the kernel facilities net/ipv4/inet_hashtables.c
+ * and the headers it pulls in need, so that file can be compiled as is
+ * into a benchmark.
+ *
+ * Every linux/ and asm/ header under this directory just includes this
+ * one. The shims behave like the kernel versions as far as the lookup
+ * code can tell: atomics and spinlocks are real, list primitives are
+ * the kernel's own; RCU readers are free, grace periods are real (see
+ * rcu_read_lock below).
+ */
+#ifndef _KSHIM_H
+#define _KSHIM_H
+
+/* everything from libc first: the kernel names below clash with some of it */
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/* glibc defines both; kernel headers test which one is defined */
+#undef __BIG_ENDIAN
+#ifndef __LITTLE_ENDIAN
+#define __LITTLE_ENDIAN 1234
+#endif
+
+#define CONFIG_NET_NS		1
+#define CONFIG_SMP		1
+#define BITS_PER_LONG		64
+#define L1_CACHE_SHIFT		6
+#define L1_CACHE_BYTES		(1 << L1_CACHE_SHIFT)
+#define PAGE_SIZE		4096UL
+
+/* types */
+typedef uint8_t			u8, __u8;
+typedef uint16_t		u16, __u16;
+typedef uint32_t		u32, __u32;
+typedef uint64_t		u64, __u64;
+typedef int8_t			s8, __s8;
+typedef int16_t			s16, __s16;
+typedef int32_t			s32, __s32;
+typedef int64_t			s64, __s64;
+typedef uint16_t		__be16, __le16, __sum16;
+typedef uint32_t		__be32, __le32, __wsum;
+typedef uint64_t		__be64;
+typedef unsigned int		gfp_t;
+typedef int64_t			ktime_t;
+
+/* compiler */
+#define __bitwise
+#define __force
+#define __user
+#define __rcu
+#define __iomem
+#define __read_mostly
+#define __init
+#define __inline__		inline
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+#define barrier()		__asm__ __volatile__("" : : : "memory")
+#define ACCESS_ONCE(x)		(*(volatile typeof(x) *)&(x))
+#define ____cacheline_aligned	__attribute__((aligned(L1_CACHE_BYTES)))
+#define ____cacheline_aligned_in_smp ____cacheline_aligned
+#define current_text_addr()	({ __label__ _l; _l: &&_l; })
+#define EXPORT_SYMBOL(sym)	extern int __kshim_export_##sym
+#define EXPORT_SYMBOL_GPL(sym)	extern int __kshim_export_##sym
+#define BUILD_BUG_ON(cond)	((void)sizeof(char[1 - 2 * !!(cond)]))
+
+#ifndef offsetof
+#define offsetof(type, member)	__builtin_offsetof(type, member)
+#endif
+#define container_of(ptr, type, member) ({			\
+	const typeof(((type *)0)->member) *__mptr = (ptr);	\
+	(type *)((char *)__mptr - offsetof(type, member)); })
+
+#define smp_mb()		__sync_synchronize()
+#define smp_rmb()		barrier()	/* x86: loads are not reordered */
+#define smp_wmb()		barrier()	/* x86: stores are not reordered */
+#define smp_read_barrier_depends() do { } while (0)
+#define cpu_relax()		__builtin_ia32_pause()
+
+#define rol32(word, shift)	(((word) << (shift)) | ((word) >> (32 - (shift))))
+
+/* bitmaps */
+#define BITS_TO_LONGS(nr)	(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+static inline void __set_bit(int nr, unsigned long *addr)
+{
+	addr[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void __clear_bit(int nr, unsigned long *addr)
+{
+	addr[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+static inline int test_bit(int nr, const unsigned long *addr)
+{
+	return (addr[BIT_WORD(nr)] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+/* first clear bit in [offset, size), size if none */
+static inline unsigned long find_next_zero_bit(const unsigned long *addr,
+					       unsigned long size,
+					       unsigned long offset)
+{
+	unsigned long word;
+
+	while (offset < size) {
+		word = ~addr[BIT_WORD(offset)] & (~0UL << (offset % BITS_PER_LONG));
+		if (word) {
+			offset = (offset & ~(BITS_PER_LONG - 1UL)) + __builtin_ctzl(word);
+			return offset < size ? offset : size;
+		}
+		offset = (offset | (BITS_PER_LONG - 1UL)) + 1;
+	}
+	return size;
+}
+
+/* diagnostics */
+#define pr_debug(fmt, ...)	do { } while (0)
+#define pr_err(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
+#define printk(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
+#define KERN_ERR
+#define BUG()			do { fprintf(stderr, "BUG at %s:%d\n", __FILE__, __LINE__); abort(); } while (0)
+#define BUG_ON(cond)		do { if (unlikely(cond)) BUG(); } while (0)
+#define WARN_ON(cond) ({						\
+	int __ret_warn_on = !!(cond);					\
+	if (unlikely(__ret_warn_on))					\
+		fprintf(stderr, "WARNING at %s:%d\n", __FILE__, __LINE__); \
+	__ret_warn_on; })
+
+/* atomics */
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+#define atomic_read(v)		ACCESS_ONCE((v)->counter)
+#define atomic_set(v, i)	(((v)->counter) = (i))
+#define atomic_inc(v)		((void)__sync_add_and_fetch(&(v)->counter, 1))
+#define atomic_dec(v)		((void)__sync_sub_and_fetch(&(v)->counter, 1))
+#define atomic_add(i, v)	((void)__sync_add_and_fetch(&(v)->counter, (i)))
+#define atomic_sub(i, v)	((void)__sync_sub_and_fetch(&(v)->counter, (i)))
+#define atomic_add_return(i, v)	__sync_add_and_fetch(&(v)->counter, (i))
+#define atomic_dec_and_test(v)	(__sync_sub_and_fetch(&(v)->counter, 1) == 0)
+#define atomic_cmpxchg(v, o, n)	__sync_val_compare_and_swap(&(v)->counter, (o), (n))
+
+static inline int atomic_add_unless(atomic_t *v, int a, int u)
+{
+	int c = atomic_read(v), old;
+
+	while (c != u) {
+		old = __sync_val_compare_and_swap(&v->counter, c, c + a);
+		if (old == c)
+			return 1;
+		c = old;
+	}
+	return 0;
+}
+#define atomic_inc_not_zero(v)	atomic_add_unless((v), 1, 0)
+
+/*
+ * Spinlocks: a test-and-test-and-set lock. Bottom halves do not exist
+ * here, so the _bh variants are the plain ones.
+ */
+typedef struct {
+	volatile int locked;
+} spinlock_t;
+
+#define __SPIN_LOCK_UNLOCKED(name) { 0 }
+#define DEFINE_SPINLOCK(x)	spinlock_t x = __SPIN_LOCK_UNLOCKED(x)
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+	lock->locked = 0;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	while (__sync_lock_test_and_set(&lock->locked, 1)) {
+		while (lock->locked)
+			cpu_relax();
+	}
+}
+
+static inline int spin_trylock(spinlock_t *lock)
+{
+	return !__sync_lock_test_and_set(&lock->locked, 1);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	__sync_lock_release(&lock->locked);
+}
+
+#define spin_lock_bh(l)		spin_lock(l)
+#define spin_unlock_bh(l)	spin_unlock(l)
+#define local_bh_disable()	do { } while (0)
+#define local_bh_enable()	do { } while (0)
+
+typedef struct {
+	pthread_rwlock_t rw;
+} rwlock_t;
+
+#define rwlock_init(l)		pthread_rwlock_init(&(l)->rw, NULL)
+#define read_lock(l)		pthread_rwlock_rdlock(&(l)->rw)
+#define read_unlock(l)		pthread_rwlock_unlock(&(l)->rw)
+#define write_lock(l)		pthread_rwlock_wrlock(&(l)->rw)
+#define write_unlock(l)		pthread_rwlock_unlock(&(l)->rw)
+#define write_lock_bh(l)	write_lock(l)
+#define write_unlock_bh(l)	write_unlock(l)
+
+/*
+ * Sequence counts. Writers are serialized by the caller.
+ */
+typedef struct {
+	unsigned int sequence;
+} seqcount_t;
+
+#define seqcount_init(s)	((s)->sequence = 0)
+
+static inline unsigned int read_seqcount_begin(const seqcount_t *s)
+{
+	unsigned int ret;
+
+	while ((ret = ACCESS_ONCE(s->sequence)) & 1)
+		cpu_relax();
+	smp_rmb();
+	return ret;
+}
+
+static inline int read_seqcount_retry(const seqcount_t *s, unsigned int start)
+{
+	smp_rmb();
+	return unlikely(ACCESS_ONCE(s->sequence) != start);
+}
+
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+	s->sequence++;
+	smp_wmb();
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+	smp_wmb();
+	s->sequence++;
+}
+
+/* mutexes, and sleeping */
+struct mutex {
+	pthread_mutex_t		m;
+};
+
+#define DEFINE_MUTEX(x)		struct mutex x = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_lock(l)		pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l)		pthread_mutex_unlock(&(l)->m)
+#define cond_resched()		do { } while (0)
+
+/*
+ * RCU, quiescent-state based as with a non-preemptible kernel: readers
+ * cost nothing, and a thread that looks things up while others may wait
+ * for a grace period registers with rcu_thread_online() and calls
+ * rcu_quiescent_state() outside its read-side sections, the way a CPU
+ * passes through the scheduler. synchronize_rcu() waits for every other
+ * online thread to do so; call_rcu() callbacks run at the end of the next
+ * synchronize_rcu().
+ */
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+struct kshim_rcu_reader {
+	volatile unsigned long		ctr;	/* last grace period seen, 0 offline */
+	struct kshim_rcu_reader		*next;
+} ____cacheline_aligned;
+
+extern __thread struct kshim_rcu_reader kshim_rcu_reader;
+extern volatile unsigned long kshim_rcu_gp;
+
+static inline void rcu_quiescent_state(void)
+{
+	smp_mb();
+	kshim_rcu_reader.ctr = kshim_rcu_gp;
+	smp_mb();
+}
+
+extern void rcu_thread_online(void);
+extern void rcu_thread_offline(void);
+extern void synchronize_rcu(void);
+extern void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+
+/* as in the kernel, a "function" below 4096 is the offset of the rcu_head */
+#define kfree_rcu(p, field)						\
+	call_rcu(&(p)->field,						\
+		 (void (*)(struct rcu_head *))offsetof(typeof(*(p)), field))
+
+#define rcu_read_lock()		barrier()
+#define rcu_read_unlock()	barrier()
+#define rcu_read_lock_bh()	barrier()
+#define rcu_read_unlock_bh()	barrier()
+#define rcu_dereference_raw(p)	({ typeof(p) _________p1 = ACCESS_ONCE(p); \
+				   smp_read_barrier_depends(); _________p1; })
+#define rcu_dereference(p)	rcu_dereference_raw(p)
+#define rcu_dereference_bh(p)	rcu_dereference_raw(p)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_assign_pointer(p, v) ({ smp_wmb(); (p) = (v); })
+#define RCU_INIT_POINTER(p, v)	((p) = (v))
+
+/* memory */
+#define GFP_ATOMIC		0x20u
+#define GFP_KERNEL		0xd0u
+#define __GFP_ZERO		0x8000u
+
+struct kmem_cache {
+	const char	*name;
+	size_t		size;
+};
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	return (flags & __GFP_ZERO) ? calloc(1, size) : malloc(size);
+}
+
+extern long kshim_kzallocs;
+#define kzalloc(size, flags)	\
+	(__sync_fetch_and_add(&kshim_kzallocs, 1), calloc(1, (size)))
+#define kfree(p)		free((void *)(p))
+#define vmalloc(size)		malloc(size)
+#define vfree(p)		free(p)
+#define is_vmalloc_addr(p)	1
+
+static inline void *kmem_cache_alloc(struct kmem_cache *cachep, gfp_t flags)
+{
+	return kmalloc(cachep->size, flags);
+}
+
+static inline void kmem_cache_free(struct kmem_cache *cachep, void *p)
+{
+	free(p);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+				     unsigned long flags, void (*ctor)(void *));
+
+/* cpus, time, randomness */
+extern void kshim_init(void);
+extern void kshim_set_local_port_range(int low, int high);
+extern int kshim_nr_cpus;
+#define num_possible_cpus()	kshim_nr_cpus
+extern volatile unsigned long jiffies;
+#define HZ			1000
+
+static inline u32 net_random(void)
+{
+	return (u32)random();
+}
+
+/* timers, only for the layout of the structures that embed one */
+struct timer_list {
+	struct timer_list	*next;
+	unsigned long		expires;
+	void			(*function)(unsigned long);
+	unsigned long		data;
+};
+
+/* wait queues */
+typedef struct {
+	spinlock_t		lock;
+} wait_queue_head_t;
+
+/* packets and devices, only what the static inlines in the headers touch */
+struct net_device {
+	char			name[16];
+	int			ifindex;
+};
+
+struct dst_entry {
+	struct net_device	*dev;
+};
+
+struct sk_buff {
+	struct sock		*sk;
+	struct dst_entry	*dst;
+	unsigned char		*data;
+	int			skb_iif;
+};
+
+struct iphdr {
+	__u8	ihl:4,
+		version:4;
+	__u8	tos;
+	__be16	tot_len;
+	__be16	id;
+	__be16	frag_off;
+	__u8	ttl;
+	__u8	protocol;
+	__sum16	check;
+	__be32	saddr;
+	__be32	daddr;
+};
+
+static inline struct dst_entry *skb_dst(const struct sk_buff *skb)
+{
+	return skb->dst;
+}
+
+static inline struct iphdr *ip_hdr(const struct sk_buff *skb)
+{
+	return (struct iphdr *)skb->data;
+}
+
+static inline int inet_iif(const struct sk_buff *skb)
+{
+	return skb->skb_iif;
+}
+
+/* kmemcheck annotations */
+#define kmemcheck_bitfield_begin(name)
+#define kmemcheck_bitfield_end(name)
+#define kmemcheck_annotate_bitfield(ptr, name) do { } while (0)
+
+/* mib counters are not kept */
+#define NET_INC_STATS_BH(net, field)	do { } while (0)
+#define NET_INC_STATS(net, field)	do { } while (0)
+enum {
+	LINUX_MIB_TIMEWAITRECYCLED,
+};
+
+#endif /* _KSHIM_H */
@@ -0,0 +1,33 @@
+/* struct flowi only for the size of inet_cork_full */
+#ifndef _NET_FLOW_H
+#define _NET_FLOW_H
+
+#include <kshim.h>
+
+#define FLOWI_FLAG_ANYSRC		0x01
+#define FLOWI_FLAG_PRECOW_METRICS	0x02
+#define FLOWI_FLAG_CAN_SLEEP		0x04
+
+struct flowi4 {
+	int			flowi4_oif;
+	int			flowi4_iif;
+	__u32			flowi4_mark;
+	__u8			flowi4_tos;
+	__u8			flowi4_scope;
+	__u8			flowi4_proto;
+	__u8			flowi4_flags;
+	__u32			flowi4_secid;
+	__be32			daddr;
+	__be32			saddr;
+	__be16			fl4_sport;
+	__be16			fl4_dport;
+};
+
+struct flowi {
+	union {
+		struct flowi4	ip4;
+		char		__pad[72];	/* flowi6, the largest member */
+	} u;
+};
+
+#endif	/* _NET_FLOW_H */
@@ -0,0 +1,17 @@
+/* The local port range helpers of include/net/ip.h */
+#ifndef _IP_H
+#define _IP_H
+
+#include <kshim.h>
+#include <net/inet_timewait_sock.h>
+
+extern void inet_get_local_port_range(int *low, int *high);
+
+extern unsigned long *sysctl_local_reserved_ports;
+static inline int inet_is_reserved_local_port(int port)
+{
+	return sysctl_local_reserved_ports[port / BITS_PER_LONG] &
+	       (1UL << (port % BITS_PER_LONG));
+}
+
+#endif	/* _IP_H */
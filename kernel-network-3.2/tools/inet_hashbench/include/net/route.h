@@ -0,0 +1,11 @@
+/*
+ * Nothing from include/net/route.h itself is used by the hash tables,
+ * but the kernel one is how inet_hashtables.h gets inet_timewait_sock.h.
+ */
+#ifndef _ROUTE_H
+#define _ROUTE_H
+
+#include <net/flow.h>
+#include <net/inet_timewait_sock.h>
+
+#endif	/* _ROUTE_H */
@@ -0,0 +1,8 @@
+#ifndef _NET_SECURE_SEQ
+#define _NET_SECURE_SEQ
+
+#include <kshim.h>
+
+extern u32 secure_ipv4_port_ephemeral(__be32 saddr, __be32 daddr, __be16 dport);
+
+#endif /* _NET_SECURE_SEQ */
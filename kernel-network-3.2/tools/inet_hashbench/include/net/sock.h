@@ -0,0 +1,292 @@
+/*
+ * A cut-down include/net/sock.h. struct sock_common is the tree's, field
+ * for field, so the hash chains walk the same cache lines as in the
+ * kernel; struct sock keeps only the members the hash table code and the
+ * inlines of the other net/ headers use. The hash helpers are the tree's.
+ */
+#ifndef _SOCK_H
+#define _SOCK_H
+
+#include <kshim.h>
+#include <linux/list.h>
+#include <linux/list_nulls.h>
+#include <linux/rculist_nulls.h>
+
+struct sock;
+struct proto;
+struct inet_hashinfo;
+
+/* a single network namespace */
+struct net {
+	atomic_t		count;
+};
+
+extern struct net init_net;
+
+static inline int net_eq(const struct net *net1, const struct net *net2)
+{
+	return net1 == net2;
+}
+
+static inline struct net *hold_net(struct net *net)
+{
+	return net;
+}
+
+static inline void release_net(struct net *net)
+{
+}
+
+static inline void write_pnet(struct net **pnet, struct net *net)
+{
+	*pnet = net;
+}
+
+static inline struct net *read_pnet(struct net * const *pnet)
+{
+	return *pnet;
+}
+
+static inline struct net *dev_net(const struct net_device *dev)
+{
+	return &init_net;
+}
+
+struct sock_common {
+	/* skc_daddr and skc_rcv_saddr must be grouped :
+	 * cf INET_MATCH() and INET_TW_MATCH()
+	 */
+	__be32			skc_daddr;
+	__be32			skc_rcv_saddr;
+
+	union  {
+		unsigned int	skc_hash;
+		__u16		skc_u16hashes[2];
+	};
+	unsigned short		skc_family;
+	volatile unsigned char	skc_state;
+	unsigned char		skc_reuse:4;
+	unsigned char		skc_reuseport:4;
+	int			skc_bound_dev_if;
+	union {
+		struct hlist_node	skc_bind_node;
+		struct hlist_nulls_node skc_portaddr_node;
+	};
+	struct proto		*skc_prot;
+#ifdef CONFIG_NET_NS
+	struct net	 	*skc_net;
+#endif
+	/*
+	 * fields between dontcopy_begin/dontcopy_end
+	 * are not copied in sock_copy()
+	 */
+	/* private: */
+	int			skc_dontcopy_begin[0];
+	/* public: */
+	union {
+		struct hlist_node	skc_node;
+		struct hlist_nulls_node skc_nulls_node;
+	};
+	int			skc_tx_queue_mapping;
+	atomic_t		skc_refcnt;
+	/* private: */
+	int                     skc_dontcopy_end[0];
+	/* public: */
+};
+
+struct sock {
+	struct sock_common	__sk_common;
+#define sk_node			__sk_common.skc_node
+#define sk_nulls_node		__sk_common.skc_nulls_node
+#define sk_refcnt		__sk_common.skc_refcnt
+#define sk_tx_queue_mapping	__sk_common.skc_tx_queue_mapping
+#define sk_hash			__sk_common.skc_hash
+#define sk_family		__sk_common.skc_family
+#define sk_state		__sk_common.skc_state
+#define sk_reuse		__sk_common.skc_reuse
+#define sk_reuseport		__sk_common.skc_reuseport
+#define sk_bound_dev_if		__sk_common.skc_bound_dev_if
+#define sk_bind_node		__sk_common.skc_bind_node
+#define sk_prot			__sk_common.skc_prot
+#define sk_net			__sk_common.skc_net
+	unsigned long		sk_flags;
+	unsigned int		sk_shutdown  : 2,
+				sk_no_check  : 2,
+				sk_userlocks : 4,
+				sk_protocol  : 8,
+				sk_type      : 16;
+	int			sk_err;
+	unsigned short		sk_ack_backlog;
+	unsigned short		sk_max_ack_backlog;
+	struct timer_list	sk_timer;
+	void			(*sk_destruct)(struct sock *sk);
+};
+
+struct proto {
+	char			name[32];
+	unsigned int		obj_size;
+	void			(*clear_sk)(struct sock *sk, int size);
+	union {
+		struct inet_hashinfo	*hashinfo;
+	} h;
+};
+
+#define SOCK_BINDADDR_LOCK	4
+#define SOCK_BINDPORT_LOCK	8
+
+/*
+ * What sk_alloc() does to the memory of a SLAB_DESTROY_BY_RCU socket
+ * without a clear_sk: zero it all but sk_node.next, which a lookup still
+ * walking the chain may follow.
+ */
+static inline void sk_prot_clear_nulls(struct sock *sk, int size)
+{
+	if (offsetof(struct sock, sk_node.next) != 0)
+		memset(sk, 0, offsetof(struct sock, sk_node.next));
+	memset(&sk->sk_node.pprev, 0,
+	       size - offsetof(struct sock, sk_node.pprev));
+}
+
+static inline struct net *sock_net(const struct sock *sk)
+{
+	return read_pnet(&sk->sk_net);
+}
+
+static inline void sock_net_set(struct sock *sk, struct net *net)
+{
+	write_pnet(&sk->sk_net, net);
+}
+
+/*
+ * Hashed lists helper routines
+ */
+static inline struct sock *sk_entry(const struct hlist_node *node)
+{
+	return hlist_entry(node, struct sock, sk_node);
+}
+
+static inline struct sock *__sk_head(const struct hlist_head *head)
+{
+	return hlist_entry(head->first, struct sock, sk_node);
+}
+
+static inline struct sock *sk_head(const struct hlist_head *head)
+{
+	return hlist_empty(head) ? NULL : __sk_head(head);
+}
+
+static inline int sk_unhashed(const struct sock *sk)
+{
+	return hlist_unhashed(&sk->sk_node);
+}
+
+static inline int sk_hashed(const struct sock *sk)
+{
+	return !sk_unhashed(sk);
+}
+
+static __inline__ void sk_nulls_node_init(struct hlist_nulls_node *node)
+{
+	node->pprev = NULL;
+}
+
+static inline void sock_hold(struct sock *sk)
+{
+	atomic_inc(&sk->sk_refcnt);
+}
+
+static inline void __sock_put(struct sock *sk)
+{
+	atomic_dec(&sk->sk_refcnt);
+}
+
+static __inline__ int __sk_nulls_del_node_init_rcu(struct sock *sk)
+{
+	if (sk_hashed(sk)) {
+		hlist_nulls_del_init_rcu(&sk->sk_nulls_node);
+		return 1;
+	}
+	return 0;
+}
+
+static __inline__ void __sk_nulls_add_node_rcu(struct sock *sk, struct hlist_nulls_head *list)
+{
+	hlist_nulls_add_head_rcu(&sk->sk_nulls_node, list);
+}
+
+static __inline__ void __sk_del_bind_node(struct sock *sk)
+{
+	__hlist_del(&sk->sk_bind_node);
+}
+
+static __inline__ void sk_add_bind_node(struct sock *sk,
+					struct hlist_head *list)
+{
+	hlist_add_head(&sk->sk_bind_node, list);
+}
+
+#define sk_nulls_for_each(__sk, node, list) \
+	hlist_nulls_for_each_entry(__sk, node, list, sk_nulls_node)
+#define sk_nulls_for_each_rcu(__sk, node, list) \
+	hlist_nulls_for_each_entry_rcu(__sk, node, list, sk_nulls_node)
+#define sk_for_each_bound(__sk, node, list) \
+	hlist_for_each_entry(__sk, node, list, sk_bind_node)
+
+static inline void sk_acceptq_removed(struct sock *sk)
+{
+	sk->sk_ack_backlog--;
+}
+
+static inline void sk_acceptq_added(struct sock *sk)
+{
+	sk->sk_ack_backlog++;
+}
+
+static inline int sk_acceptq_is_full(struct sock *sk)
+{
+	return sk->sk_ack_backlog > sk->sk_max_ack_backlog;
+}
+
+static inline void sock_prot_inuse_add(struct net *net, struct proto *prot,
+				       int inc)
+{
+}
+
+extern void sk_free(struct sock *sk);
+
+static inline void sock_put(struct sock *sk)
+{
+	if (atomic_dec_and_test(&sk->sk_refcnt))
+		sk_free(sk);
+}
+
+static inline struct sock *skb_steal_sock(struct sk_buff *skb)
+{
+	if (skb->sk) {
+		struct sock *sk = skb->sk;
+
+		skb->sk = NULL;
+		return sk;
+	}
+	return NULL;
+}
+
+static inline void sk_reset_timer(struct sock *sk, struct timer_list *timer,
+				  unsigned long expires)
+{
+	timer->expires = expires;
+}
+
+static inline void sk_stop_timer(struct sock *sk, struct timer_list *timer)
+{
+}
+
+#define ipv6_only_sock(sk)	0
+
+/* there are no struct sockets, so no owners: everything is root's */
+static inline int sock_i_uid(struct sock *sk)
+{
+	return 0;
+}
+
+#endif	/* _SOCK_H */
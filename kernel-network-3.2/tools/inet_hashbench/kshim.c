@@ -0,0 +1,176 @@
+/*
+ * Run-time side of the shims: the globals and out-of-line functions the
+ * hash table code links against, which in the kernel come from the rest
+ * of the network stack.
+ */
+#include <net/inet_hashtables.h>
+#include <net/secure_seq.h>
+#include <net/ip.h>
+
+struct net init_net;
+u32 inet_ehash_secret;
+int kshim_nr_cpus = 1;
+volatile unsigned long jiffies;
+long kshim_kzallocs;
+
+/* net.ipv4.ip_local_port_range and ip_local_reserved_ports */
+static int sysctl_local_port_range[2] = { 32768, 61000 };
+static unsigned long local_reserved_ports[65536 / BITS_PER_LONG];
+unsigned long *sysctl_local_reserved_ports = local_reserved_ports;
+
+/* RCU: the online threads, and the callbacks waiting for a grace period */
+__thread struct kshim_rcu_reader kshim_rcu_reader;
+volatile unsigned long kshim_rcu_gp = 1;
+static struct kshim_rcu_reader *rcu_readers;
+static struct rcu_head *rcu_callbacks;
+static pthread_mutex_t rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void rcu_thread_online(void)
+{
+	pthread_mutex_lock(&rcu_lock);
+	kshim_rcu_reader.ctr = kshim_rcu_gp;
+	kshim_rcu_reader.next = rcu_readers;
+	rcu_readers = &kshim_rcu_reader;
+	pthread_mutex_unlock(&rcu_lock);
+}
+
+void rcu_thread_offline(void)
+{
+	struct kshim_rcu_reader **pp;
+
+	/* quiescent from here on, for a synchronize_rcu() holding the lock */
+	smp_mb();
+	kshim_rcu_reader.ctr = 0;
+	pthread_mutex_lock(&rcu_lock);
+	for (pp = &rcu_readers; *pp; pp = &(*pp)->next) {
+		if (*pp == &kshim_rcu_reader) {
+			*pp = kshim_rcu_reader.next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&rcu_lock);
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	pthread_mutex_lock(&rcu_lock);
+	head->func = func;
+	head->next = rcu_callbacks;
+	rcu_callbacks = head;
+	pthread_mutex_unlock(&rcu_lock);
+}
+
+void synchronize_rcu(void)
+{
+	struct kshim_rcu_reader *r;
+	struct rcu_head *head, *next;
+	unsigned long gp;
+
+	pthread_mutex_lock(&rcu_lock);
+	head = rcu_callbacks;
+	rcu_callbacks = NULL;
+	smp_mb();
+	gp = kshim_rcu_gp + 2;
+	kshim_rcu_gp = gp;
+	smp_mb();
+	for (r = rcu_readers; r; r = r->next) {
+		if (r == &kshim_rcu_reader)
+			continue;
+		while (r->ctr && r->ctr != gp)
+			sched_yield();
+	}
+	smp_mb();
+	pthread_mutex_unlock(&rcu_lock);
+
+	for (; head; head = next) {
+		unsigned long offset = (unsigned long)head->func;
+
+		next = head->next;
+		if (offset < 4096)
+			free((char *)head - offset);
+		else
+			head->func(head);
+	}
+}
+
+void kshim_init(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_CONF);
+
+	kshim_nr_cpus = n > 0 ? n : 1;
+	atomic_set(&init_net.count, 1);
+	inet_ehash_secret = random() | 1;
+}
+
+void kshim_set_local_port_range(int low, int high)
+{
+	sysctl_local_port_range[0] = low;
+	sysctl_local_port_range[1] = high;
+}
+
+void inet_get_local_port_range(int *low, int *high)
+{
+	*low = sysctl_local_port_range[0];
+	*high = sysctl_local_port_range[1];
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+				     unsigned long flags, void (*ctor)(void *))
+{
+	struct kmem_cache *cachep = malloc(sizeof(*cachep));
+
+	if (cachep) {
+		cachep->name = name;
+		cachep->size = size;
+	}
+	return cachep;
+}
+
+/* the kernel uses keyed MD4 here; any keyed hash of the tuple will do */
+u32 secure_ipv4_port_ephemeral(__be32 saddr, __be32 daddr, __be16 dport)
+{
+	return jhash_3words(saddr, daddr, dport, inet_ehash_secret);
+}
+
+void sk_free(struct sock *sk)
+{
+	if (sk->sk_destruct)
+		sk->sk_destruct(sk);
+	free(sk);
+}
+
+int inet_twsk_unhash(struct inet_timewait_sock *tw)
+{
+	if (hlist_nulls_unhashed(&tw->tw_node))
+		return 0;
+
+	hlist_nulls_del_rcu(&tw->tw_node);
+	sk_nulls_node_init(&tw->tw_node);
+	return 1;
+}
+
+int inet_twsk_bind_unhash(struct inet_timewait_sock *tw,
+			  struct inet_hashinfo *hashinfo)
+{
+	struct inet_bind_bucket *tb = tw->tw_tb;
+
+	if (!tb)
+		return 0;
+
+	__hlist_del(&tw->tw_bind_node);
+	tw->tw_tb = NULL;
+	inet_bind_bucket_destroy(hashinfo->bind_bucket_cachep, tb);
+	return 1;
+}
+
+/* there are no timers: a TIME_WAIT'er lives until it is recycled */
+void inet_twsk_deschedule(struct inet_timewait_sock *tw,
+			  struct inet_timewait_death_row *twdr)
+{
+}
+
+void inet_twsk_put(struct inet_timewait_sock *tw)
+{
+	if (atomic_dec_and_test(&tw->tw_refcnt))
+		free(tw);
+}
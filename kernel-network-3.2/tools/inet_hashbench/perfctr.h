@@ -0,0 +1,15 @@
+/*
+ * Per-thread hardware counters through perf_event_open(2). Kept apart
+ * from the shims: the uapi perf header must not see include/linux/.
+ */
+#ifndef _PERFCTR_H
+#define _PERFCTR_H
+
+#include <stdint.h>
+
+/* LLC misses of the calling thread in user mode; -1 if not available */
+extern int perfctr_open(void);
+extern uint64_t perfctr_read(int fd);
+extern void perfctr_close(int fd);
+
+#endif /* _PERFCTR_H */
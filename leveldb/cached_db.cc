@@ -0,0 +1,190 @@
+#include "cached_db.h"
+
+#include <utility>
+#include <vector>
+
+namespace {
+
+// What a cache entry points to. NotFound is cached as found = false.
+struct CachedValue {
+    bool found;
+    std::string value;
+};
+
+// Rough per-entry bookkeeping of leveldb's LRU cache plus ours
+const size_t kEntryOverhead = 64 + sizeof(CachedValue);
+
+void DeleteCachedValue(const leveldb::Slice &, void *value)
+{
+    delete static_cast<CachedValue *>(value);
+}
+
+// Collects the keys a WriteBatch touches
+class KeyCollector : public leveldb::WriteBatch::Handler {
+public:
+    void Put(const leveldb::Slice &key, const leveldb::Slice &) override { keys.push_back(key.ToString()); }
+    void Delete(const leveldb::Slice &key) override { keys.push_back(key.ToString()); }
+    std::vector<std::string> keys;
+};
+
+}  // namespace
+
+CachedDB::ValueRef::ValueRef(ValueRef &&other) noexcept
+    : cache_(other.cache_), handle_(other.handle_), owned_(std::move(other.owned_))
+{
+    value_ = handle_ != nullptr ? other.value_ : leveldb::Slice(owned_);
+    other.cache_ = nullptr;
+    other.handle_ = nullptr;
+    other.value_.clear();
+}
+
+CachedDB::ValueRef &CachedDB::ValueRef::operator=(ValueRef &&other) noexcept
+{
+    if (this != &other) {
+        Reset();
+        cache_ = other.cache_;
+        handle_ = other.handle_;
+        owned_ = std::move(other.owned_);
+        value_ = handle_ != nullptr ? other.value_ : leveldb::Slice(owned_);
+        other.cache_ = nullptr;
+        other.handle_ = nullptr;
+        other.value_.clear();
+    }
+    return *this;
+}
+
+void CachedDB::ValueRef::Reset()
+{
+    if (handle_ != nullptr)
+        cache_->Release(handle_);
+    cache_ = nullptr;
+    handle_ = nullptr;
+    value_.clear();
+    owned_.clear();
+}
+
+CachedDB::CachedDB(leveldb::DB *db, size_t capacity_bytes)
+    : db_(db), cache_(leveldb::NewLRUCache(capacity_bytes)),
+      misses_(0), invalidations_(0), skipped_fills_(0)
+{
+    for (Stripe &s : stripes_)
+        s.epoch.store(0, std::memory_order_relaxed);
+}
+
+CachedDB::~CachedDB()
+{
+    delete cache_;
+}
+
+uint32_t CachedDB::Hash(const leveldb::Slice &key)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < key.size(); i++) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+leveldb::Status CachedDB::Get(const leveldb::ReadOptions &options, const leveldb::Slice &key,
+                              ValueRef *ref)
+{
+    leveldb::Cache::Handle *h;
+    leveldb::Status s;
+
+    ref->Reset();
+    if (options.snapshot != nullptr) {
+        s = db_->Get(options, key, &ref->owned_);
+        ref->value_ = ref->owned_;
+        return s;
+    }
+
+    h = cache_->Lookup(key);
+    if (h == nullptr) {
+        Stripe &stripe = stripes_[Hash(key) % kStripes];
+        uint64_t epoch = stripe.epoch.load(std::memory_order_acquire);
+        CachedValue *v = new CachedValue;
+
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        s = db_->Get(options, key, &v->value);
+        if (!s.ok() && !s.IsNotFound()) {
+            delete v;
+            return s;
+        }
+        v->found = s.ok();
+
+        std::lock_guard<std::mutex> l(stripe.mu);
+        if (stripe.epoch.load(std::memory_order_relaxed) != epoch) {
+            // a write to this stripe raced with the read: answer from what
+            // was read, but do not cache it
+            skipped_fills_.fetch_add(1, std::memory_order_relaxed);
+            ref->owned_ = std::move(v->value);
+            ref->value_ = ref->owned_;
+            delete v;
+            return s;
+        }
+        h = cache_->Insert(key, v, key.size() + v->value.size() + kEntryOverhead,
+                           DeleteCachedValue);
+    }
+
+    const CachedValue *v = static_cast<const CachedValue *>(cache_->Value(h));
+    if (!v->found) {
+        cache_->Release(h);
+        return leveldb::Status::NotFound(key);
+    }
+    ref->cache_ = cache_;
+    ref->handle_ = h;
+    ref->value_ = v->value;
+    return leveldb::Status::OK();
+}
+
+void CachedDB::Invalidate(const leveldb::Slice &key)
+{
+    Stripe &stripe = stripes_[Hash(key) % kStripes];
+
+    std::lock_guard<std::mutex> l(stripe.mu);
+    cache_->Erase(key);
+    stripe.epoch.fetch_add(1, std::memory_order_release);
+    invalidations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+leveldb::Status CachedDB::Put(const leveldb::WriteOptions &options, const leveldb::Slice &key,
+                              const leveldb::Slice &value)
+{
+    leveldb::Status s = db_->Put(options, key, value);
+
+    // invalidate even on failure: the write may have reached the log
+    Invalidate(key);
+    return s;
+}
+
+leveldb::Status CachedDB::Delete(const leveldb::WriteOptions &options, const leveldb::Slice &key)
+{
+    leveldb::Status s = db_->Delete(options, key);
+
+    Invalidate(key);
+    return s;
+}
+
+leveldb::Status CachedDB::Write(const leveldb::WriteOptions &options, leveldb::WriteBatch *updates)
+{
+    KeyCollector keys;
+
+    if (updates != nullptr)
+        updates->Iterate(&keys);
+    leveldb::Status s = db_->Write(options, updates);
+    for (const std::string &key : keys.keys)
+        Invalidate(key);
+    return s;
+}
+
+CachedDB::Stats CachedDB::GetStats() const
+{
+    Stats st;
+
+    st.misses = misses_.load(std::memory_order_relaxed);
+    st.invalidations = invalidations_.load(std::memory_order_relaxed);
+    st.skipped_fills = skipped_fills_.load(std::memory_order_relaxed);
+    return st;
+}
@@ -0,0 +1,103 @@
+// CachedDB: a read-through value cache in front of leveldb::DB::Get.
+//
+// db->Get(ReadOptions(), key, &value) copies the value into a std::string
+// on every call, and even a block-cache hit takes the DB mutex and walks
+// the memtables and a table index. For hot keys CachedDB keeps the value
+// itself in a leveldb::Cache (sharded, one mutex per shard, LRU, bounded
+// by the bytes charged) and hands out a ValueRef that pins the entry, so
+// a hit is a hash lookup and no copy.
+//
+// The cache only stays correct if every write goes through the wrapper:
+// Put, Delete and Write invalidate the keys they touch after the DB write.
+// Reads at a snapshot bypass the cache.
+
+#ifndef LEVELDB_BENCH_CACHED_DB_H_
+#define LEVELDB_BENCH_CACHED_DB_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "leveldb/cache.h"
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+
+class CachedDB {
+public:
+    // A value pinned in the cache (or, for reads that bypass it, owned).
+    // The bytes stay valid until the ValueRef is reset or destroyed, even
+    // if the entry is evicted or invalidated meanwhile.
+    class ValueRef {
+    public:
+        ValueRef() : cache_(nullptr), handle_(nullptr) {}
+        ~ValueRef() { Reset(); }
+        ValueRef(const ValueRef &) = delete;
+        ValueRef &operator=(const ValueRef &) = delete;
+        ValueRef(ValueRef &&other) noexcept;
+        ValueRef &operator=(ValueRef &&other) noexcept;
+
+        leveldb::Slice value() const { return value_; }
+        void Reset();
+
+    private:
+        friend class CachedDB;
+        leveldb::Cache *cache_;
+        leveldb::Cache::Handle *handle_;
+        leveldb::Slice value_;
+        std::string owned_;
+    };
+
+    // Only the slow paths are counted; a shared hit counter would be the
+    // one cache line every reader of a hot key writes to.
+    struct Stats {
+        uint64_t misses;
+        uint64_t invalidations;
+        uint64_t skipped_fills;     // fills dropped because of a racing write
+    };
+
+    // db stays owned by the caller. capacity_bytes bounds key + value +
+    // per-entry overhead of everything cached.
+    CachedDB(leveldb::DB *db, size_t capacity_bytes);
+    ~CachedDB();
+    CachedDB(const CachedDB &) = delete;
+    CachedDB &operator=(const CachedDB &) = delete;
+
+    // Like DB::Get, but the value is returned pinned. NotFound results are
+    // cached too, hot missing keys are as common as hot present ones.
+    leveldb::Status Get(const leveldb::ReadOptions &options, const leveldb::Slice &key,
+                        ValueRef *ref);
+
+    leveldb::Status Put(const leveldb::WriteOptions &options, const leveldb::Slice &key,
+                        const leveldb::Slice &value);
+    leveldb::Status Delete(const leveldb::WriteOptions &options, const leveldb::Slice &key);
+    leveldb::Status Write(const leveldb::WriteOptions &options, leveldb::WriteBatch *updates);
+
+    leveldb::DB *db() const { return db_; }
+    size_t TotalCharge() const { return cache_->TotalCharge(); }
+    Stats GetStats() const;
+
+private:
+    // A miss reads the DB without any cache lock held, so a write can slip
+    // in between the read and the fill. Every write erases its keys and
+    // bumps the epoch of their stripe; a fill only goes ahead if the epoch
+    // is still the one seen before the read. The stripe mutex makes
+    // "check epoch, insert" and "erase, bump epoch" atomic to each other;
+    // hits never take it.
+    static const int kStripes = 256;
+
+    struct alignas(64) Stripe {
+        std::mutex mu;
+        std::atomic<uint64_t> epoch;
+    };
+
+    static uint32_t Hash(const leveldb::Slice &key);
+    void Invalidate(const leveldb::Slice &key);
+
+    leveldb::DB *db_;
+    leveldb::Cache *cache_;
+    Stripe stripes_[kStripes];
+    std::atomic<uint64_t> misses_, invalidations_, skipped_fills_;
+};
+
+#endif  // LEVELDB_BENCH_CACHED_DB_H_
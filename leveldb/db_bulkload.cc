@@ -0,0 +1,283 @@
+// db_bulkload: how fast can we load N keys into a fresh database?
+//
+// For every combination of write mode and sync flag the benchmark destroys
+// the database, loads the keys and reports
+//   - ops/s and MB/s of the load itself,
+//   - write amplification: bytes leveldb wrote to files (log, tables,
+//     manifest, compactions up to the close) per byte of user data,
+//   - the size of the database directory once it is closed.
+//
+// Write modes:
+//   put        one DB::Put per key
+//   batch:N    WriteBatch of N keys per DB::Write
+//
+// Synchronous writes fsync the log on every Put/Write, so they run at the
+// speed of the disk's flush latency; they load --sync_num keys instead of
+// --num so that a run finishes.
+//
+// Usage: db_bulkload [--num=N] [--sync_num=N] [--value_size=N]
+//                    [--batch=1,10,100,1000,10000] [--sync=0|1|both]
+//                    [--order=seq|random] [--write_buffer_size=BYTES]
+//                    [--db=/tmp/db_bulkload]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "leveldb/write_batch.h"
+
+namespace {
+
+struct Flags {
+    long num = 1000000;
+    long sync_num = 10000;
+    int value_size = 100;
+    std::vector<int> batches = {1, 10, 100, 1000, 10000};
+    bool async = true;
+    bool sync = true;
+    bool random_order = false;
+    size_t write_buffer_size = 4 << 20;
+    std::string db = "/tmp/db_bulkload";
+};
+
+const int kKeySize = 16;
+
+double NowSeconds()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Bytes this process has passed to write(2) and friends, which is where
+// all of leveldb's file output goes.
+uint64_t WrittenBytes()
+{
+    FILE *f = fopen("/proc/self/io", "r");
+    char line[128];
+    unsigned long long v = 0;
+
+    if (f == nullptr)
+        return 0;
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        if (sscanf(line, "wchar: %llu", &v) == 1)
+            break;
+    }
+    fclose(f);
+    return v;
+}
+
+uint64_t DirectorySize(const std::string &dir)
+{
+    leveldb::Env *env = leveldb::Env::Default();
+    std::vector<std::string> children;
+    uint64_t total = 0, size;
+
+    env->GetChildren(dir, &children);
+    for (const std::string &name : children) {
+        if (env->GetFileSize(dir + "/" + name, &size).ok())
+            total += size;
+    }
+    return total;
+}
+
+// Values like db_bench's: random bytes that compress to about half, so
+// snappy has realistic work to do.
+class ValueGenerator {
+public:
+    ValueGenerator()
+    {
+        std::mt19937 rnd(301);
+        while (data_.size() < 1048576) {
+            std::string piece(100, ' ');
+            for (int i = 0; i < 50; i++)
+                piece[i] = ' ' + rnd() % 95;
+            for (int i = 50; i < 100; i++)
+                piece[i] = piece[i - 50];
+            data_ += piece;
+        }
+    }
+
+    leveldb::Slice Next(int len)
+    {
+        if (pos_ + len > data_.size())
+            pos_ = 0;
+        pos_ += len;
+        return leveldb::Slice(data_.data() + pos_ - len, len);
+    }
+
+private:
+    std::string data_;
+    size_t pos_ = 0;
+};
+
+struct Result {
+    std::string mode;
+    bool sync;
+    long keys;
+    double secs;
+    double write_amp;
+    uint64_t disk_bytes;
+};
+
+Result RunOne(const Flags &flags, int batch, bool sync, const std::vector<uint64_t> &order)
+{
+    leveldb::Options options;
+    leveldb::WriteOptions write_options;
+    leveldb::WriteBatch write_batch;
+    leveldb::DB *db;
+    ValueGenerator gen;
+    char key[kKeySize + 1];
+    Result r;
+
+    options.create_if_missing = true;
+    options.error_if_exists = true;
+    options.write_buffer_size = flags.write_buffer_size;
+    write_options.sync = sync;
+
+    leveldb::DestroyDB(flags.db, options);
+    leveldb::Status s = leveldb::DB::Open(options, flags.db, &db);
+    if (!s.ok()) {
+        std::cerr << "open " << flags.db << ": " << s.ToString() << std::endl;
+        exit(1);
+    }
+
+    r.mode = batch == 0 ? "put" : "batch:" + std::to_string(batch);
+    r.sync = sync;
+    r.keys = sync ? std::min(flags.sync_num, flags.num) : flags.num;
+
+    uint64_t written = WrittenBytes();
+    double start = NowSeconds();
+    for (long i = 0; i < r.keys && s.ok(); i++) {
+        snprintf(key, sizeof(key), "%016llu", (unsigned long long)order[i]);
+        if (batch == 0) {
+            s = db->Put(write_options, leveldb::Slice(key, kKeySize), gen.Next(flags.value_size));
+            continue;
+        }
+        write_batch.Put(leveldb::Slice(key, kKeySize), gen.Next(flags.value_size));
+        if ((i + 1) % batch == 0 || i + 1 == r.keys) {
+            s = db->Write(write_options, &write_batch);
+            write_batch.Clear();
+        }
+    }
+    r.secs = NowSeconds() - start;
+    if (!s.ok()) {
+        std::cerr << "write: " << s.ToString() << std::endl;
+        exit(1);
+    }
+
+    // closing waits for a running compaction, so its output is counted
+    delete db;
+    uint64_t user_bytes = (uint64_t)r.keys * (kKeySize + flags.value_size);
+    r.write_amp = (double)(WrittenBytes() - written) / user_bytes;
+    r.disk_bytes = DirectorySize(flags.db);
+    leveldb::DestroyDB(flags.db, options);
+    return r;
+}
+
+void PrintHeader()
+{
+    printf("%-12s %-5s %10s %12s %9s %9s %9s %8s\n",
+           "mode", "sync", "keys", "ops/s", "MB/s", "secs", "write-amp", "disk MB");
+}
+
+void PrintResult(const Result &r, const Flags &flags)
+{
+    double mb = (double)r.keys * (kKeySize + flags.value_size) / 1048576.0;
+
+    printf("%-12s %-5s %10ld %12.0f %9.1f %9.2f %9.2f %8.1f\n",
+           r.mode.c_str(), r.sync ? "yes" : "no", r.keys,
+           r.keys / r.secs, mb / r.secs, r.secs, r.write_amp,
+           r.disk_bytes / 1048576.0);
+    fflush(stdout);
+}
+
+bool ParseFlags(int argc, char *argv[], Flags *flags)
+{
+    long n;
+    char junk;
+    char buf[256];
+
+    for (int i = 1; i < argc; i++) {
+        if (sscanf(argv[i], "--num=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->num = n;
+        } else if (sscanf(argv[i], "--sync_num=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->sync_num = n;
+        } else if (sscanf(argv[i], "--value_size=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->value_size = (int)n;
+        } else if (sscanf(argv[i], "--write_buffer_size=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->write_buffer_size = n;
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            // 1 means plain Put, anything larger a WriteBatch of that many keys
+            std::stringstream ss(argv[i] + 8);
+            std::string item;
+            flags->batches.clear();
+            while (std::getline(ss, item, ',')) {
+                n = atol(item.c_str());
+                if (n < 1)
+                    return false;
+                flags->batches.push_back((int)n);
+            }
+        } else if (sscanf(argv[i], "--sync=%255s", buf) == 1) {
+            flags->async = strcmp(buf, "1") != 0;
+            flags->sync = strcmp(buf, "0") != 0;
+            if (strcmp(buf, "0") && strcmp(buf, "1") && strcmp(buf, "both"))
+                return false;
+        } else if (sscanf(argv[i], "--order=%255s", buf) == 1) {
+            if (strcmp(buf, "random") == 0)
+                flags->random_order = true;
+            else if (strcmp(buf, "seq") != 0)
+                return false;
+        } else if (strncmp(argv[i], "--db=", 5) == 0) {
+            flags->db = argv[i] + 5;
+        } else {
+            return false;
+        }
+    }
+    return !flags->batches.empty();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    Flags flags;
+
+    if (!ParseFlags(argc, argv, &flags)) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--num=N] [--sync_num=N] [--value_size=N] [--batch=1,10,100,...]"
+                  << " [--sync=0|1|both] [--order=seq|random] [--write_buffer_size=BYTES]"
+                  << " [--db=PATH]" << std::endl;
+        return 1;
+    }
+
+    // nightly imports are usually sorted; random order shows the cost of
+    // overlapping tables in level 0 and the compactions they cause
+    std::vector<uint64_t> order(flags.num);
+    for (long i = 0; i < flags.num; i++)
+        order[i] = i;
+    if (flags.random_order)
+        std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+
+    printf("keys %ld (sync runs %ld), %d byte keys, %d byte values, %s order, "
+           "write buffer %zu KB\n",
+           flags.num, std::min(flags.sync_num, flags.num), kKeySize, flags.value_size,
+           flags.random_order ? "random" : "sequential", flags.write_buffer_size >> 10);
+    PrintHeader();
+    for (int sync = 0; sync <= 1; sync++) {
+        if ((sync && !flags.sync) || (!sync && !flags.async))
+            continue;
+        for (int batch : flags.batches)
+            PrintResult(RunOne(flags, batch == 1 ? 0 : batch, sync, order), flags);
+    }
+    return 0;
+}
@@ -0,0 +1,312 @@
+// db_keycmp: what does the comparator cost on a seek-heavy workload?
+//
+// The same two-number keys (sorted by the first number, then the second,
+// like leveldb_example.cc) are stored in four ways:
+//   text       "a:b" in decimal, compared by a comparator that parses both
+//              numbers out of both keys on every call, and that cannot
+//              shorten index keys (what the example's TwoPartComparator
+//              would do once its Parsekey is filled in)
+//   fixed      EncodeTwoPartKey (key_codec.h), 8 bytes, TwoPartComparator
+//   bytewise   the same 8 bytes under leveldb's default BytewiseComparator
+//   varint     two PutOrderedVarint64 fields under BytewiseComparator
+//
+// For each it reports
+//   - ns per Compare call while sorting all keys,
+//   - the average length of the index-block keys FindShortestSeparator
+//     makes at the block boundaries of a table (one block per ~4 KB),
+//   - random Seeks per second on a loaded database, and its size on disk.
+//
+// Usage: db_keycmp [--num=N] [--seeks=N] [--value_size=N]
+//                  [--encodings=text,fixed,bytewise,varint] [--db=/tmp/db_keycmp]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+
+#include "leveldb/comparator.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "leveldb/write_batch.h"
+
+#include "key_codec.h"
+
+namespace {
+
+struct Flags {
+    long num = 1000000;
+    long seeks = 1000000;
+    int value_size = 100;
+    std::vector<std::string> encodings = {"text", "fixed", "bytewise", "varint"};
+    std::string db = "/tmp/db_keycmp";
+};
+
+// Second numbers per first number: think rows per user
+const int kPerGroup = 16;
+const int kBlockSize = 4096;
+
+double NowSeconds()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t DirectorySize(const std::string &dir)
+{
+    leveldb::Env *env = leveldb::Env::Default();
+    std::vector<std::string> children;
+    uint64_t total = 0, size;
+
+    env->GetChildren(dir, &children);
+    for (const std::string &name : children) {
+        if (env->GetFileSize(dir + "/" + name, &size).ok())
+            total += size;
+    }
+    return total;
+}
+
+// The parse-on-compare baseline: keys are "a:b" in decimal
+class ParsedTwoPartComparator : public leveldb::Comparator {
+public:
+    int Compare(const leveldb::Slice &a, const leveldb::Slice &b) const override
+    {
+        int a1, a2, b1, b2;
+        Parsekey(a, &a1, &a2);
+        Parsekey(b, &b1, &b2);
+        if (a1 < b1) return -1;
+        if (a1 > b1) return +1;
+        if (a2 < b2) return -1;
+        if (a2 > b2) return +1;
+        return 0;
+    }
+
+    const char *Name() const override { return "TwoPartComparator.text"; }
+    void FindShortestSeparator(std::string *, const leveldb::Slice &) const override {}
+    void FindShortSuccessor(std::string *) const override {}
+
+private:
+    static void Parsekey(const leveldb::Slice &s, int *a, int *b)
+    {
+        size_t i = 0;
+        int *out = a;
+        bool neg = false;
+
+        *a = *b = 0;
+        for (; i < s.size(); i++) {
+            char c = s[i];
+            if (c == ':' && out == a) {
+                if (neg)
+                    *a = -*a;
+                out = b;
+                neg = false;
+            } else if (c == '-') {
+                neg = true;
+            } else {
+                *out = *out * 10 + (c - '0');
+            }
+        }
+        if (neg)
+            *out = -*out;
+    }
+};
+
+struct Encoding {
+    const char *name;
+    const leveldb::Comparator *cmp;
+    std::string (*encode)(int32_t a, int32_t b);
+};
+
+std::string EncodeText(int32_t a, int32_t b)
+{
+    char buf[32];
+    return std::string(buf, snprintf(buf, sizeof(buf), "%d:%d", a, b));
+}
+
+std::string EncodeVarint(int32_t a, int32_t b)
+{
+    std::string key;
+    PutOrderedVarint64(&key, (uint32_t)a);
+    PutOrderedVarint64(&key, (uint32_t)b);
+    return key;
+}
+
+ParsedTwoPartComparator parsed_cmp;
+TwoPartComparator fixed_cmp;
+
+const Encoding kEncodings[] = {
+    {"text", &parsed_cmp, EncodeText},
+    {"fixed", &fixed_cmp, EncodeTwoPartKey},
+    {"bytewise", nullptr, EncodeTwoPartKey},    // BytewiseComparator()
+    {"varint", nullptr, EncodeVarint},
+};
+
+struct Result {
+    double key_bytes;
+    double ns_per_compare;
+    double index_key_bytes;
+    double seeks_per_sec;
+    uint64_t disk_bytes;
+};
+
+Result RunOne(const Flags &flags, const Encoding &enc, const std::vector<uint32_t> &order)
+{
+    const leveldb::Comparator *cmp = enc.cmp ? enc.cmp : leveldb::BytewiseComparator();
+    std::vector<std::string> keys;
+    Result r = {0, 0, 0, 0, 0};
+
+    keys.reserve(flags.num);
+    for (long i = 0; i < flags.num; i++) {
+        keys.push_back(enc.encode(order[i] / kPerGroup, (order[i] % kPerGroup) * 4099));
+        r.key_bytes += keys.back().size();
+    }
+    r.key_bytes /= flags.num;
+
+    // sorting a shuffled copy is comparisons and little else
+    std::vector<leveldb::Slice> sorted(keys.begin(), keys.end());
+    uint64_t compares = 0;
+    double start = NowSeconds();
+    std::sort(sorted.begin(), sorted.end(),
+              [cmp, &compares](const leveldb::Slice &a, const leveldb::Slice &b) {
+                  compares++;
+                  return cmp->Compare(a, b) < 0;
+              });
+    r.ns_per_compare = (NowSeconds() - start) * 1e9 / compares;
+
+    // a table writes one index entry per data block: a key between the
+    // last key of the block and the first key of the next one
+    int per_block = std::max(1, kBlockSize / (int)(r.key_bytes + flags.value_size + 3));
+    long blocks = 0;
+    for (long i = per_block; i < flags.num; i += per_block) {
+        std::string sep = sorted[i - 1].ToString();
+        cmp->FindShortestSeparator(&sep, sorted[i]);
+        r.index_key_bytes += sep.size();
+        blocks++;
+    }
+    if (blocks > 0)
+        r.index_key_bytes /= blocks;
+
+    if (flags.seeks == 0)
+        return r;
+
+    leveldb::Options options;
+    leveldb::WriteBatch batch;
+    leveldb::DB *db;
+    std::string value(flags.value_size, 'v');
+
+    options.create_if_missing = true;
+    options.comparator = cmp;
+    leveldb::DestroyDB(flags.db, options);
+    leveldb::Status s = leveldb::DB::Open(options, flags.db, &db);
+    if (!s.ok()) {
+        std::cerr << "open " << flags.db << ": " << s.ToString() << std::endl;
+        exit(1);
+    }
+    for (long i = 0; i < flags.num && s.ok(); i++) {
+        batch.Put(keys[i], value);
+        if ((i + 1) % 1000 == 0 || i + 1 == flags.num) {
+            s = db->Write(leveldb::WriteOptions(), &batch);
+            batch.Clear();
+        }
+    }
+    // seek the tables, not the memtable
+    db->CompactRange(nullptr, nullptr);
+    if (!s.ok()) {
+        std::cerr << "write: " << s.ToString() << std::endl;
+        exit(1);
+    }
+
+    std::mt19937_64 rnd(7);
+    leveldb::Iterator *it = db->NewIterator(leveldb::ReadOptions());
+    long found = 0;
+    start = NowSeconds();
+    for (long i = 0; i < flags.seeks; i++) {
+        const std::string &target = keys[rnd() % flags.num];
+        it->Seek(target);
+        if (it->Valid() && it->key() == target)
+            found++;
+    }
+    r.seeks_per_sec = flags.seeks / (NowSeconds() - start);
+    if (found != flags.seeks)
+        std::cerr << enc.name << ": " << flags.seeks - found << " seeks missed their key" << std::endl;
+    delete it;
+    delete db;
+    r.disk_bytes = DirectorySize(flags.db);
+    leveldb::DestroyDB(flags.db, options);
+    return r;
+}
+
+bool ParseFlags(int argc, char *argv[], Flags *flags)
+{
+    long n;
+    char junk;
+
+    for (int i = 1; i < argc; i++) {
+        if (sscanf(argv[i], "--num=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->num = n;
+        } else if (sscanf(argv[i], "--seeks=%ld%c", &n, &junk) == 1 && n >= 0) {
+            flags->seeks = n;
+        } else if (sscanf(argv[i], "--value_size=%ld%c", &n, &junk) == 1 && n >= 0) {
+            flags->value_size = (int)n;
+        } else if (strncmp(argv[i], "--encodings=", 12) == 0) {
+            std::stringstream ss(argv[i] + 12);
+            std::string item;
+            flags->encodings.clear();
+            while (std::getline(ss, item, ',')) {
+                bool known = false;
+                for (const Encoding &enc : kEncodings)
+                    known = known || item == enc.name;
+                if (!known)
+                    return false;
+                flags->encodings.push_back(item);
+            }
+        } else if (strncmp(argv[i], "--db=", 5) == 0) {
+            flags->db = argv[i] + 5;
+        } else {
+            return false;
+        }
+    }
+    return !flags->encodings.empty();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    Flags flags;
+
+    if (!ParseFlags(argc, argv, &flags)) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--num=N] [--seeks=N] [--value_size=N]"
+                  << " [--encodings=text,fixed,bytewise,varint] [--db=PATH]" << std::endl;
+        return 1;
+    }
+
+    // the same keys for every encoding, in the same random order
+    std::vector<uint32_t> order(flags.num);
+    for (long i = 0; i < flags.num; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+
+    printf("keys %ld, %d byte values, %ld random seeks\n", flags.num, flags.value_size, flags.seeks);
+    printf("%-10s %8s %12s %12s %12s %8s\n",
+           "encoding", "key B", "ns/compare", "index key B", "seeks/s", "disk MB");
+    for (const std::string &name : flags.encodings) {
+        for (const Encoding &enc : kEncodings) {
+            if (name != enc.name)
+                continue;
+            Result r = RunOne(flags, enc, order);
+            printf("%-10s %8.1f %12.1f %12.1f %12.0f %8.1f\n",
+                   enc.name, r.key_bytes, r.ns_per_compare, r.index_key_bytes,
+                   r.seeks_per_sec, r.disk_bytes / 1048576.0);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,337 @@
+// db_scan: full scans with one iterator vs ParallelScan (parallel_scan.h).
+//
+// The baseline is the loop of leveldb_example.cc: one iterator,
+// SeekToFirst() and Next() to the end. Every parallel run must see the
+// same number of keys, bytes and the same checksum over all key/value
+// pairs, which the benchmark checks; each thread keeps its totals per
+// range and they are added up at the end.
+//
+// With --export=FILE every range is also written to its own part file
+// as "key\tvalue\n" lines, and the parts are concatenated in range order,
+// which gives the same file as a single-iterator export.
+//
+// Usage: db_scan [--num=N] [--value_size=N] [--threads=1,2,4,8] [--ranges=N]
+//                [--use_existing=0|1] [--export=FILE] [--db=/tmp/db_scan]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+
+#include "parallel_scan.h"
+
+namespace {
+
+struct Flags {
+    long num = 1000000;
+    int value_size = 100;
+    std::vector<int> threads = {1, 2, 4, 8};
+    int ranges = 0;
+    bool use_existing = false;
+    std::string export_file;
+    std::string db = "/tmp/db_scan";
+};
+
+double NowSeconds()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t FnvHash64(const leveldb::Slice &s, uint64_t h)
+{
+    for (size_t i = 0; i < s.size(); i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// What a scan adds up. The checksum is a sum of per-pair hashes, so it
+// does not depend on the order ranges finish in.
+struct Totals {
+    uint64_t keys = 0;
+    uint64_t bytes = 0;
+    uint64_t checksum = 0;
+
+    void Add(const leveldb::Slice &key, const leveldb::Slice &value)
+    {
+        keys++;
+        bytes += key.size() + value.size();
+        checksum += FnvHash64(value, FnvHash64(key, 14695981039346656037ull));
+    }
+
+    void Merge(const Totals &other)
+    {
+        keys += other.keys;
+        bytes += other.bytes;
+        checksum += other.checksum;
+    }
+
+    bool operator==(const Totals &other) const
+    {
+        return keys == other.keys && bytes == other.bytes && checksum == other.checksum;
+    }
+};
+
+// Padded so that threads counting neighbouring ranges do not share a line
+struct alignas(64) RangeTotals {
+    Totals totals;
+    FILE *part = nullptr;
+};
+
+void Load(leveldb::DB *db, const Flags &flags)
+{
+    std::mt19937_64 rnd(301);
+    leveldb::WriteBatch batch;
+    std::string value(flags.value_size, ' ');
+    char key[32];
+    leveldb::Status s;
+
+    for (long i = 0; i < flags.num && s.ok(); i++) {
+        for (char &c : value)
+            c = 'a' + rnd() % 26;
+        snprintf(key, sizeof(key), "%016llu", (unsigned long long)(rnd() % (flags.num * 10)));
+        batch.Put(key, value);
+        if ((i + 1) % 1000 == 0 || i + 1 == flags.num) {
+            s = db->Write(leveldb::WriteOptions(), &batch);
+            batch.Clear();
+        }
+    }
+    if (!s.ok()) {
+        std::cerr << "load: " << s.ToString() << std::endl;
+        exit(1);
+    }
+    // the partitioning works from table sizes, so get everything into tables
+    db->CompactRange(nullptr, nullptr);
+}
+
+void WriteRecord(FILE *f, const leveldb::Slice &key, const leveldb::Slice &value)
+{
+    fwrite(key.data(), 1, key.size(), f);
+    fputc('\t', f);
+    fwrite(value.data(), 1, value.size(), f);
+    fputc('\n', f);
+}
+
+// Appends the part files to out in order and removes them
+bool Concatenate(const std::string &out, const std::vector<std::string> &parts)
+{
+    FILE *dst = fopen(out.c_str(), "w");
+    std::vector<char> buf(1 << 20);
+    bool ok = dst != nullptr;
+
+    for (const std::string &part : parts) {
+        FILE *src = ok ? fopen(part.c_str(), "r") : nullptr;
+        size_t n;
+        if (src == nullptr) {
+            ok = false;
+        } else {
+            while ((n = fread(buf.data(), 1, buf.size(), src)) > 0)
+                ok = ok && fwrite(buf.data(), 1, n, dst) == n;
+            fclose(src);
+        }
+        remove(part.c_str());
+    }
+    if (dst != nullptr && fclose(dst) != 0)
+        ok = false;
+    return ok;
+}
+
+Totals ScanOne(leveldb::DB *db, const Flags &flags, const leveldb::Snapshot *snapshot, double *secs)
+{
+    leveldb::ReadOptions read_options;
+    FILE *out = nullptr;
+    Totals totals;
+
+    read_options.snapshot = snapshot;
+    read_options.fill_cache = false;
+    if (!flags.export_file.empty())
+        out = fopen(flags.export_file.c_str(), "w");
+
+    double start = NowSeconds();
+    leveldb::Iterator *it = db->NewIterator(read_options);
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        totals.Add(it->key(), it->value());
+        if (out != nullptr)
+            WriteRecord(out, it->key(), it->value());
+    }
+    if (!it->status().ok()) {
+        std::cerr << "scan: " << it->status().ToString() << std::endl;
+        exit(1);
+    }
+    delete it;
+    if (out != nullptr)
+        fclose(out);
+    *secs = NowSeconds() - start;
+    return totals;
+}
+
+Totals ScanParallel(leveldb::DB *db, const Flags &flags, const leveldb::Snapshot *snapshot,
+                    int threads, double *secs, size_t *nranges, uint64_t *max_range_keys)
+{
+    ParallelScanOptions options;
+    std::vector<ScanRange> ranges;
+    std::vector<RangeTotals> per_range;
+    std::vector<std::string> parts;
+    Totals totals;
+
+    options.threads = threads;
+    options.ranges = flags.ranges;
+    options.snapshot = snapshot;
+
+    // the number of ranges is only known once they are made, so size the
+    // per-range state for the most that can come back
+    int max_ranges = flags.ranges > 0 ? flags.ranges : 4 * threads;
+    per_range.resize(max_ranges);
+    if (!flags.export_file.empty()) {
+        for (int r = 0; r < max_ranges; r++) {
+            parts.push_back(flags.export_file + ".part" + std::to_string(r));
+            per_range[r].part = fopen(parts.back().c_str(), "w");
+            if (per_range[r].part == nullptr) {
+                perror(parts.back().c_str());
+                exit(1);
+            }
+        }
+    }
+
+    double start = NowSeconds();
+    leveldb::Status s = ParallelScan(db, options,
+        [&per_range](int r, const leveldb::Slice &key, const leveldb::Slice &value) {
+            per_range[r].totals.Add(key, value);
+            if (per_range[r].part != nullptr)
+                WriteRecord(per_range[r].part, key, value);
+            return true;
+        }, &ranges);
+    if (!s.ok()) {
+        std::cerr << "parallel scan: " << s.ToString() << std::endl;
+        exit(1);
+    }
+    *max_range_keys = 0;
+    for (RangeTotals &rt : per_range) {
+        totals.Merge(rt.totals);
+        *max_range_keys = std::max(*max_range_keys, rt.totals.keys);
+        if (rt.part != nullptr)
+            fclose(rt.part);
+    }
+    if (!parts.empty() && !Concatenate(flags.export_file, parts)) {
+        std::cerr << "export to " << flags.export_file << " failed" << std::endl;
+        exit(1);
+    }
+    *secs = NowSeconds() - start;
+    *nranges = ranges.size();
+    return totals;
+}
+
+bool ParseList(const char *arg, std::vector<int> *out)
+{
+    std::stringstream ss(arg);
+    std::string item;
+
+    out->clear();
+    while (std::getline(ss, item, ',')) {
+        int n = atoi(item.c_str());
+        if (n < 1)
+            return false;
+        out->push_back(n);
+    }
+    return !out->empty();
+}
+
+bool ParseFlags(int argc, char *argv[], Flags *flags)
+{
+    long n;
+    char junk;
+
+    for (int i = 1; i < argc; i++) {
+        if (sscanf(argv[i], "--num=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->num = n;
+        } else if (sscanf(argv[i], "--value_size=%ld%c", &n, &junk) == 1 && n >= 0) {
+            flags->value_size = (int)n;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            if (!ParseList(argv[i] + 10, &flags->threads))
+                return false;
+        } else if (sscanf(argv[i], "--ranges=%ld%c", &n, &junk) == 1 && n >= 0) {
+            flags->ranges = (int)n;
+        } else if (sscanf(argv[i], "--use_existing=%ld%c", &n, &junk) == 1) {
+            flags->use_existing = n != 0;
+        } else if (strncmp(argv[i], "--export=", 9) == 0) {
+            flags->export_file = argv[i] + 9;
+        } else if (strncmp(argv[i], "--db=", 5) == 0) {
+            flags->db = argv[i] + 5;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    Flags flags;
+    leveldb::Options options;
+    leveldb::DB *db;
+
+    if (!ParseFlags(argc, argv, &flags)) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--num=N] [--value_size=N] [--threads=1,2,4,8] [--ranges=N]"
+                  << " [--use_existing=0|1] [--export=FILE] [--db=PATH]" << std::endl;
+        return 1;
+    }
+
+    options.create_if_missing = true;
+    if (!flags.use_existing)
+        leveldb::DestroyDB(flags.db, options);
+    leveldb::Status s = leveldb::DB::Open(options, flags.db, &db);
+    if (!s.ok()) {
+        std::cerr << "open " << flags.db << ": " << s.ToString() << std::endl;
+        return 1;
+    }
+    if (!flags.use_existing)
+        Load(db, flags);
+
+    // every scan reads at the same snapshot, so they must all agree
+    const leveldb::Snapshot *snapshot = db->GetSnapshot();
+    double secs;
+    Totals base = ScanOne(db, flags, snapshot, &secs);
+    double base_rate = base.bytes / secs / 1048576.0;
+
+    printf("%llu keys, %.1f MB\n", (unsigned long long)base.keys, base.bytes / 1048576.0);
+    printf("%-10s %7s %10s %9s %8s %8s %10s\n",
+           "scan", "ranges", "keys", "MB/s", "secs", "speedup", "max range");
+    printf("%-10s %7d %10llu %9.1f %8.2f %8.2f %10llu\n", "iterator", 1,
+           (unsigned long long)base.keys, base_rate, secs, 1.0, (unsigned long long)base.keys);
+
+    int status = 0;
+    for (int threads : flags.threads) {
+        size_t nranges;
+        uint64_t max_range_keys;
+        Totals t = ScanParallel(db, flags, snapshot, threads, &secs, &nranges, &max_range_keys);
+        double rate = t.bytes / secs / 1048576.0;
+        char name[32];
+
+        snprintf(name, sizeof(name), "%d thr", threads);
+        printf("%-10s %7zu %10llu %9.1f %8.2f %8.2f %10llu%s\n", name, nranges,
+               (unsigned long long)t.keys, rate, secs, rate / base_rate,
+               (unsigned long long)max_range_keys, t == base ? "" : "  MISMATCH");
+        fflush(stdout);
+        if (!(t == base))
+            status = 1;
+    }
+
+    db->ReleaseSnapshot(snapshot);
+    delete db;
+    return status;
+}
@@ -0,0 +1,334 @@
+// db_snapshot: online backup of a leveldb database into a snapshot file
+// (snapshot_file.h) and the matching import.
+//
+// Export reads the DB at one snapshot, like the snapshot section of
+// leveldb_example.cc, so writers keep going and the file is still a
+// consistent point-in-time copy. (leveldb lets one process open a DB, so
+// a live DB is exported by its own process calling Export().) The
+// iterator does not fill the block cache, and blocks are compressed on
+// --threads threads so that one core is left for reading.
+//
+// Import loads a file into a new DB with large WriteBatches. The records
+// come sorted, so every memtable flushes to a table that overlaps no
+// other and compactions have little to do.
+//
+// Modes:
+//   export   --db to --file
+//   import   --file to --import_db, which must not exist yet
+//   verify   read --file and check every checksum and the record count
+//   bench    load --num keys into --db, export while --writers threads
+//            keep writing, import, and check the imported DB holds
+//            exactly what the export saw
+//
+// Usage: db_snapshot [--mode=bench|export|import|verify] [--db=/tmp/db_snapshot]
+//                    [--file=/tmp/db_snapshot.snap] [--import_db=/tmp/db_snapshot_import]
+//                    [--threads=2] [--level=1] [--block_size=BYTES] [--batch_bytes=BYTES]
+//                    [--write_buffer_size=BYTES] [--num=N] [--value_size=N] [--writers=N]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <chrono>
+
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+
+#include "snapshot_file.h"
+
+namespace {
+
+struct Flags {
+    std::string mode = "bench";
+    std::string db = "/tmp/db_snapshot";
+    std::string file = "/tmp/db_snapshot.snap";
+    std::string import_db = "/tmp/db_snapshot_import";
+    SnapshotFileOptions file_options;
+    size_t batch_bytes = 4 << 20;
+    size_t write_buffer_size = 64 << 20;
+    long num = 1000000;
+    int value_size = 100;
+    int writers = 1;
+};
+
+double NowSeconds()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t FnvHash64(const leveldb::Slice &s, uint64_t h)
+{
+    for (size_t i = 0; i < s.size(); i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+uint64_t PairHash(const leveldb::Slice &key, const leveldb::Slice &value)
+{
+    return FnvHash64(value, FnvHash64(key, 14695981039346656037ull));
+}
+
+void Die(const char *what, const leveldb::Status &s)
+{
+    std::cerr << what << ": " << s.ToString() << std::endl;
+    exit(1);
+}
+
+// Exports db at a new snapshot; *checksum gets the sum of the pair hashes
+void Export(leveldb::DB *db, const Flags &flags, uint64_t *checksum)
+{
+    leveldb::ReadOptions read_options;
+    SnapshotWriter writer(flags.file_options);
+    leveldb::Status s;
+
+    read_options.snapshot = db->GetSnapshot();
+    read_options.fill_cache = false;
+    *checksum = 0;
+
+    double start = NowSeconds();
+    s = writer.Open(flags.file);
+    leveldb::Iterator *it = db->NewIterator(read_options);
+    for (it->SeekToFirst(); s.ok() && it->Valid(); it->Next()) {
+        s = writer.Add(it->key(), it->value());
+        *checksum += PairHash(it->key(), it->value());
+    }
+    if (s.ok())
+        s = it->status();
+    delete it;
+    db->ReleaseSnapshot(read_options.snapshot);
+    if (s.ok())
+        s = writer.Finish();
+    if (!s.ok())
+        Die("export", s);
+    double secs = NowSeconds() - start;
+
+    printf("export: %llu records, %.1f MB raw, %.1f MB file (%.2fx), %.2f secs, %.1f MB/s raw\n",
+           (unsigned long long)writer.records(), writer.raw_bytes() / 1048576.0,
+           writer.file_bytes() / 1048576.0, (double)writer.raw_bytes() / writer.file_bytes(),
+           secs, writer.raw_bytes() / 1048576.0 / secs);
+}
+
+// Imports into a new DB; if out is not nullptr the DB is left open there
+void Import(const Flags &flags, leveldb::DB **out)
+{
+    leveldb::Options options;
+    leveldb::WriteOptions write_options;
+    leveldb::WriteBatch batch;
+    SnapshotReader reader;
+    leveldb::Slice key, value;
+    leveldb::DB *db;
+    size_t batch_bytes = 0;
+    uint64_t bytes = 0;
+
+    options.create_if_missing = true;
+    options.error_if_exists = true;
+    options.write_buffer_size = flags.write_buffer_size;
+
+    double start = NowSeconds();
+    leveldb::Status s = reader.Open(flags.file);
+    if (!s.ok())
+        Die("import", s);
+    s = leveldb::DB::Open(options, flags.import_db, &db);
+    if (!s.ok())
+        Die("open", s);
+    while (s.ok() && reader.Next(&key, &value)) {
+        batch.Put(key, value);
+        batch_bytes += key.size() + value.size();
+        bytes += key.size() + value.size();
+        if (batch_bytes >= flags.batch_bytes) {
+            s = db->Write(write_options, &batch);
+            batch.Clear();
+            batch_bytes = 0;
+        }
+    }
+    // a broken file leaves the DB partly imported; it is a new DB, so the
+    // caller can just remove it
+    if (s.ok())
+        s = reader.status();
+    if (s.ok() && batch_bytes > 0)
+        s = db->Write(write_options, &batch);
+    if (!s.ok())
+        Die("import", s);
+    double secs = NowSeconds() - start;
+    if (out != nullptr)
+        *out = db;
+    else
+        delete db;
+
+    printf("import: %llu records, %.1f MB, %.2f secs, %.1f MB/s\n",
+           (unsigned long long)reader.records(), bytes / 1048576.0, secs, bytes / 1048576.0 / secs);
+}
+
+void Verify(const Flags &flags)
+{
+    SnapshotReader reader;
+    leveldb::Slice key, value;
+    uint64_t checksum = 0;
+
+    leveldb::Status s = reader.Open(flags.file);
+    while (s.ok() && reader.Next(&key, &value))
+        checksum += PairHash(key, value);
+    if (s.ok())
+        s = reader.status();
+    if (!s.ok())
+        Die("verify", s);
+    printf("verify: %llu records, checksum %016llx\n",
+           (unsigned long long)reader.records(), (unsigned long long)checksum);
+}
+
+void Load(leveldb::DB *db, const Flags &flags)
+{
+    std::mt19937_64 rnd(301);
+    leveldb::WriteBatch batch;
+    std::string value(flags.value_size, ' ');
+    char key[32];
+    leveldb::Status s;
+
+    for (long i = 0; i < flags.num && s.ok(); i++) {
+        // half random letters, half repeats: about 2:1 for a compressor
+        for (int j = 0; j < flags.value_size; j++)
+            value[j] = j < flags.value_size / 2 ? 'a' + rnd() % 26 : value[j - flags.value_size / 2];
+        snprintf(key, sizeof(key), "user%016llu", (unsigned long long)(rnd() % (flags.num * 10)));
+        batch.Put(key, value);
+        if ((i + 1) % 1000 == 0 || i + 1 == flags.num) {
+            s = db->Write(leveldb::WriteOptions(), &batch);
+            batch.Clear();
+        }
+    }
+    if (!s.ok())
+        Die("load", s);
+}
+
+void Bench(const Flags &flags)
+{
+    leveldb::Options options;
+    leveldb::DB *db;
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> writes(0);
+    std::vector<std::thread> writers;
+    uint64_t exported;
+
+    options.create_if_missing = true;
+    leveldb::DestroyDB(flags.db, options);
+    leveldb::DestroyDB(flags.import_db, options);
+    leveldb::Status s = leveldb::DB::Open(options, flags.db, &db);
+    if (!s.ok())
+        Die("open", s);
+    Load(db, flags);
+
+    // overwrites and new keys, neither of which may show up in the export
+    for (int t = 0; t < flags.writers; t++) {
+        writers.emplace_back([&, t]() {
+            std::mt19937_64 rnd(t + 1);
+            std::string value(flags.value_size, 'w');
+            char key[32];
+            while (!stop.load(std::memory_order_relaxed)) {
+                snprintf(key, sizeof(key), "user%016llu", (unsigned long long)(rnd() % (flags.num * 20)));
+                if (!db->Put(leveldb::WriteOptions(), key, value).ok())
+                    break;
+                writes++;
+            }
+        });
+    }
+    Export(db, flags, &exported);
+    stop = true;
+    for (std::thread &t : writers)
+        t.join();
+    printf("        %llu writes by %d writer%s during the export\n",
+           (unsigned long long)writes.load(), flags.writers, flags.writers == 1 ? "" : "s");
+    delete db;
+
+    Import(flags, &db);
+
+    uint64_t imported = 0;
+    leveldb::Iterator *it = db->NewIterator(leveldb::ReadOptions());
+    for (it->SeekToFirst(); it->Valid(); it->Next())
+        imported += PairHash(it->key(), it->value());
+    delete it;
+    delete db;
+    printf("check:  imported DB %s the snapshot\n", imported == exported ? "matches" : "DOES NOT MATCH");
+    if (imported != exported)
+        exit(1);
+}
+
+bool ParseFlags(int argc, char *argv[], Flags *flags)
+{
+    long n;
+    char junk;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--mode=", 7) == 0) {
+            flags->mode = argv[i] + 7;
+        } else if (strncmp(argv[i], "--db=", 5) == 0) {
+            flags->db = argv[i] + 5;
+        } else if (strncmp(argv[i], "--file=", 7) == 0) {
+            flags->file = argv[i] + 7;
+        } else if (strncmp(argv[i], "--import_db=", 12) == 0) {
+            flags->import_db = argv[i] + 12;
+        } else if (sscanf(argv[i], "--threads=%ld%c", &n, &junk) == 1 && n >= 0) {
+            flags->file_options.threads = (int)n;
+        } else if (sscanf(argv[i], "--level=%ld%c", &n, &junk) == 1 && n >= 0 && n <= 9) {
+            flags->file_options.level = (int)n;
+        } else if (sscanf(argv[i], "--block_size=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->file_options.block_size = n;
+        } else if (sscanf(argv[i], "--batch_bytes=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->batch_bytes = n;
+        } else if (sscanf(argv[i], "--write_buffer_size=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->write_buffer_size = n;
+        } else if (sscanf(argv[i], "--num=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->num = n;
+        } else if (sscanf(argv[i], "--value_size=%ld%c", &n, &junk) == 1 && n >= 0) {
+            flags->value_size = (int)n;
+        } else if (sscanf(argv[i], "--writers=%ld%c", &n, &junk) == 1 && n >= 0) {
+            flags->writers = (int)n;
+        } else {
+            return false;
+        }
+    }
+    return flags->mode == "bench" || flags->mode == "export" || flags->mode == "import" ||
+           flags->mode == "verify";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    Flags flags;
+
+    if (!ParseFlags(argc, argv, &flags)) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--mode=bench|export|import|verify] [--db=PATH] [--file=PATH]"
+                  << " [--import_db=PATH] [--threads=N] [--level=0-9] [--block_size=BYTES]"
+                  << " [--batch_bytes=BYTES] [--write_buffer_size=BYTES] [--num=N]"
+                  << " [--value_size=N] [--writers=N]" << std::endl;
+        return 1;
+    }
+
+    if (flags.mode == "bench") {
+        Bench(flags);
+    } else if (flags.mode == "export") {
+        leveldb::Options options;
+        leveldb::DB *db;
+        uint64_t checksum;
+        leveldb::Status s = leveldb::DB::Open(options, flags.db, &db);
+        if (!s.ok())
+            Die("open", s);
+        Export(db, flags, &checksum);
+        printf("        checksum %016llx\n", (unsigned long long)checksum);
+        delete db;
+    } else if (flags.mode == "import") {
+        Import(flags, nullptr);
+    } else {
+        Verify(flags);
+    }
+    return 0;
+}
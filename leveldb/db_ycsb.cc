@@ -0,0 +1,473 @@
+// db_ycsb: YCSB core workloads against one leveldb::DB shared by T threads.
+//
+// As the example's Concurrency section says, a single DB object may be
+// used from many threads without extra locking; every Get, Put, iterator
+// and snapshot still goes through the DB-wide mutex for a moment. This
+// driver runs the standard YCSB mixes with a growing number of threads so
+// that the point where that mutex starts to cost shows up as flattening
+// ops/s and growing tail latency.
+//
+//   a  50% read, 50% update                  zipfian
+//   b  95% read,  5% update                  zipfian
+//   c  100% read                             zipfian
+//   d  95% read,  5% insert                  latest
+//   e  95% scan,  5% insert                  zipfian, scans of 1..scan_max
+//   f  50% read, 50% read-modify-write       zipfian
+//
+// --snapshot_reads=P turns P percent of the reads into snapshot reads
+// (GetSnapshot, Get at the snapshot, ReleaseSnapshot). Every operation
+// type gets its own latency histogram; they are printed per run.
+//
+// --value_cache=MB routes reads and writes through CachedDB (cached_db.h),
+// which serves hot keys from pinned cache entries instead of DB::Get;
+// scans and snapshot reads still go to the DB.
+//
+// Usage: db_ycsb [--workloads=a,b,c,d,e,f] [--threads=1,2,4,8]
+//                [--records=N] [--ops=N] [--value_size=N] [--zipf=0.99]
+//                [--scan_max=N] [--snapshot_reads=P] [--cache_size=MB]
+//                [--value_cache=MB] [--use_existing=0|1] [--db=/tmp/db_ycsb]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <chrono>
+
+#include "leveldb/db.h"
+#include "leveldb/cache.h"
+#include "leveldb/write_batch.h"
+
+#include "cached_db.h"
+#include "histogram.h"
+
+namespace {
+
+enum OpType { kRead, kSnapshotRead, kUpdate, kInsert, kScan, kReadModifyWrite, kNumOpTypes };
+
+const char *kOpNames[kNumOpTypes] = {
+    "read", "snap-read", "update", "insert", "scan", "rmw",
+};
+
+struct Workload {
+    char name;
+    double read, update, insert, scan, rmw;
+    bool latest;    // key choice favours recent inserts
+};
+
+const Workload kWorkloads[] = {
+    {'a', 0.50, 0.50, 0.00, 0.00, 0.00, false},
+    {'b', 0.95, 0.05, 0.00, 0.00, 0.00, false},
+    {'c', 1.00, 0.00, 0.00, 0.00, 0.00, false},
+    {'d', 0.95, 0.00, 0.05, 0.00, 0.00, true},
+    {'e', 0.00, 0.00, 0.05, 0.95, 0.00, false},
+    {'f', 0.50, 0.00, 0.00, 0.00, 0.50, false},
+};
+
+struct Flags {
+    std::string workloads = "a,b,c,d,e,f";
+    std::vector<int> threads = {1, 2, 4, 8};
+    long records = 1000000;
+    long ops = 1000000;
+    int value_size = 1000;
+    double zipf = 0.99;
+    int scan_max = 100;
+    int snapshot_reads = 0;
+    long cache_size_mb = 8;
+    long value_cache_mb = 0;
+    bool use_existing = false;
+    std::string db = "/tmp/db_ycsb";
+};
+
+uint64_t NowNanos()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// YCSB hashes the record number into the key so that inserts, which come
+// in record order, land all over the keyspace.
+uint64_t FnvHash64(uint64_t v)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    for (int i = 0; i < 8; i++) {
+        h ^= v & 0xff;
+        h *= 0x100000001b3ull;
+        v >>= 8;
+    }
+    return h;
+}
+
+void RecordKey(uint64_t record, std::string *key)
+{
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), "user%020llu", (unsigned long long)FnvHash64(record));
+    key->assign(buf);
+}
+
+// Gray et al.'s zipfian generator, as in YCSB: item 0 is the most popular.
+// zeta(n) is computed once, so items beyond n (inserted later) are
+// reached by scrambling, as YCSB's ScrambledZipfianGenerator does.
+class Zipfian {
+public:
+    Zipfian(uint64_t n, double theta) : n_(n), theta_(theta)
+    {
+        zetan_ = Zeta(n, theta);
+        double zeta2 = Zeta(2, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan_);
+    }
+
+    uint64_t Next(std::mt19937_64 &rnd) const
+    {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rnd);
+        double uz = u * zetan_;
+
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + std::pow(0.5, theta_))
+            return 1;
+        uint64_t v = (uint64_t)(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+        return v < n_ ? v : n_ - 1;
+    }
+
+private:
+    static double Zeta(uint64_t n, double theta)
+    {
+        double sum = 0;
+
+        for (uint64_t i = 1; i <= n; i++)
+            sum += 1.0 / std::pow((double)i, theta);
+        return sum;
+    }
+
+    uint64_t n_;
+    double theta_, zetan_, alpha_, eta_;
+};
+
+struct Shared {
+    leveldb::DB *db;
+    const Flags *flags;
+    const Workload *workload;
+    const Zipfian *zipf;
+    CachedDB *cache;                    // nullptr: plain DB::Get/Put
+    std::atomic<long> ops_left;
+    std::atomic<uint64_t> records;      // inserted so far, the next insert's number
+};
+
+struct ThreadState {
+    Histogram hist[kNumOpTypes];
+    std::string value;
+};
+
+// Next record to operate on; insert numbers are handed out separately
+uint64_t ChooseRecord(Shared *sh, std::mt19937_64 &rnd)
+{
+    uint64_t n = sh->records.load(std::memory_order_relaxed);
+    uint64_t z = sh->zipf->Next(rnd);
+
+    if (sh->workload->latest)
+        return z < n ? n - 1 - z : 0;
+    return FnvHash64(z) % n;
+}
+
+void FillValue(std::string *v, int size, std::mt19937_64 &rnd)
+{
+    v->resize(size);
+    for (int i = 0; i < size; i += 8) {
+        uint64_t r = rnd();
+        memcpy(&(*v)[i], &r, size - i < 8 ? size - i : 8);
+    }
+}
+
+void Worker(Shared *sh, ThreadState *ts, int id)
+{
+    const Workload *w = sh->workload;
+    const Flags *flags = sh->flags;
+    leveldb::DB *db = sh->db;
+    leveldb::WriteOptions write_options;
+    std::mt19937_64 rnd(1000 + id);
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    std::string key, value;
+    CachedDB::ValueRef ref;
+    leveldb::Status s;
+    const long kChunk = 100;
+
+    FillValue(&ts->value, flags->value_size, rnd);
+    while (true) {
+        // claim operations in chunks to keep the counter off the fast path
+        long claimed = sh->ops_left.fetch_sub(kChunk, std::memory_order_relaxed);
+        if (claimed <= 0)
+            break;
+        for (long i = 0; i < std::min(claimed, kChunk); i++) {
+            double r = uni(rnd);
+            OpType op;
+            uint64_t start, record;
+
+            if (r < w->read)
+                op = (int)(uni(rnd) * 100) < flags->snapshot_reads ? kSnapshotRead : kRead;
+            else if (r < w->read + w->update)
+                op = kUpdate;
+            else if (r < w->read + w->update + w->insert)
+                op = kInsert;
+            else if (r < w->read + w->update + w->insert + w->scan)
+                op = kScan;
+            else
+                op = kReadModifyWrite;
+
+            if (op == kInsert)
+                record = sh->records.fetch_add(1, std::memory_order_relaxed);
+            else
+                record = ChooseRecord(sh, rnd);
+            RecordKey(record, &key);
+
+            start = NowNanos();
+            switch (op) {
+            case kRead:
+                if (sh->cache != nullptr) {
+                    s = sh->cache->Get(leveldb::ReadOptions(), key, &ref);
+                    ref.Reset();
+                } else {
+                    s = db->Get(leveldb::ReadOptions(), key, &value);
+                }
+                break;
+            case kSnapshotRead: {
+                leveldb::ReadOptions read_options;
+                read_options.snapshot = db->GetSnapshot();
+                s = db->Get(read_options, key, &value);
+                db->ReleaseSnapshot(read_options.snapshot);
+                break;
+            }
+            case kUpdate:
+            case kInsert:
+                // vary a few bytes so that values are not all identical
+                memcpy(&ts->value[0], &start, std::min<size_t>(8, ts->value.size()));
+                if (sh->cache != nullptr)
+                    s = sh->cache->Put(write_options, key, ts->value);
+                else
+                    s = db->Put(write_options, key, ts->value);
+                break;
+            case kScan: {
+                int len = 1 + rnd() % flags->scan_max;
+                leveldb::Iterator *it = db->NewIterator(leveldb::ReadOptions());
+                for (it->Seek(key); it->Valid() && len > 0; it->Next(), len--)
+                    value.assign(it->value().data(), it->value().size());
+                s = it->status();
+                delete it;
+                break;
+            }
+            case kReadModifyWrite:
+                if (sh->cache != nullptr) {
+                    s = sh->cache->Get(leveldb::ReadOptions(), key, &ref);
+                    ref.Reset();
+                } else {
+                    s = db->Get(leveldb::ReadOptions(), key, &value);
+                }
+                if (s.ok() || s.IsNotFound()) {
+                    memcpy(&ts->value[0], &start, std::min<size_t>(8, ts->value.size()));
+                    if (sh->cache != nullptr)
+                        s = sh->cache->Put(write_options, key, ts->value);
+                    else
+                        s = db->Put(write_options, key, ts->value);
+                }
+                break;
+            default:
+                break;
+            }
+            ts->hist[op].Add(NowNanos() - start);
+            if (!s.ok() && !s.IsNotFound()) {
+                std::cerr << kOpNames[op] << ": " << s.ToString() << std::endl;
+                exit(1);
+            }
+        }
+    }
+}
+
+void Load(leveldb::DB *db, const Flags &flags)
+{
+    leveldb::WriteBatch batch;
+    std::mt19937_64 rnd(1);
+    std::string key, value;
+    uint64_t start = NowNanos();
+
+    FillValue(&value, flags.value_size, rnd);
+    for (long i = 0; i < flags.records; i++) {
+        RecordKey(i, &key);
+        batch.Put(key, value);
+        if ((i + 1) % 1000 == 0 || i + 1 == flags.records) {
+            leveldb::Status s = db->Write(leveldb::WriteOptions(), &batch);
+            if (!s.ok()) {
+                std::cerr << "load: " << s.ToString() << std::endl;
+                exit(1);
+            }
+            batch.Clear();
+        }
+    }
+    printf("loaded %ld records in %.1f s\n", flags.records, (NowNanos() - start) / 1e9);
+}
+
+bool ParseFlags(int argc, char *argv[], Flags *flags)
+{
+    long n;
+    double d;
+    char junk;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--workloads=", 12) == 0) {
+            flags->workloads = argv[i] + 12;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            std::stringstream ss(argv[i] + 10);
+            std::string item;
+            flags->threads.clear();
+            while (std::getline(ss, item, ',')) {
+                if (atoi(item.c_str()) < 1)
+                    return false;
+                flags->threads.push_back(atoi(item.c_str()));
+            }
+        } else if (sscanf(argv[i], "--records=%ld%c", &n, &junk) == 1 && n > 1) {
+            flags->records = n;
+        } else if (sscanf(argv[i], "--ops=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->ops = n;
+        } else if (sscanf(argv[i], "--value_size=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->value_size = (int)n;
+        } else if (sscanf(argv[i], "--zipf=%lf%c", &d, &junk) == 1 && d > 0 && d < 1) {
+            flags->zipf = d;
+        } else if (sscanf(argv[i], "--scan_max=%ld%c", &n, &junk) == 1 && n > 0) {
+            flags->scan_max = (int)n;
+        } else if (sscanf(argv[i], "--snapshot_reads=%ld%c", &n, &junk) == 1 && n >= 0 && n <= 100) {
+            flags->snapshot_reads = (int)n;
+        } else if (sscanf(argv[i], "--cache_size=%ld%c", &n, &junk) == 1 && n >= 0) {
+            flags->cache_size_mb = n;
+        } else if (sscanf(argv[i], "--value_cache=%ld%c", &n, &junk) == 1 && n >= 0) {
+            flags->value_cache_mb = n;
+        } else if (sscanf(argv[i], "--use_existing=%ld%c", &n, &junk) == 1) {
+            flags->use_existing = n != 0;
+        } else if (strncmp(argv[i], "--db=", 5) == 0) {
+            flags->db = argv[i] + 5;
+        } else {
+            return false;
+        }
+    }
+    return !flags->threads.empty();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    Flags flags;
+    leveldb::Options options;
+    leveldb::DB *db;
+
+    if (!ParseFlags(argc, argv, &flags)) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--workloads=a,b,c,d,e,f] [--threads=1,2,4,8] [--records=N] [--ops=N]"
+                  << " [--value_size=N] [--zipf=0.99] [--scan_max=N] [--snapshot_reads=P]"
+                  << " [--cache_size=MB] [--value_cache=MB] [--use_existing=0|1] [--db=PATH]"
+                  << std::endl;
+        return 1;
+    }
+
+    options.create_if_missing = true;
+    options.block_cache = leveldb::NewLRUCache(flags.cache_size_mb << 20);
+    if (!flags.use_existing)
+        leveldb::DestroyDB(flags.db, options);
+    leveldb::Status s = leveldb::DB::Open(options, flags.db, &db);
+    if (!s.ok()) {
+        std::cerr << "open " << flags.db << ": " << s.ToString() << std::endl;
+        return 1;
+    }
+    if (!flags.use_existing)
+        Load(db, flags);
+
+    printf("%ld records, %d byte values, zipf %.2f, %ld ops per run, %d%% snapshot reads\n",
+           flags.records, flags.value_size, flags.zipf, flags.ops, flags.snapshot_reads);
+
+    Zipfian zipf(flags.records, flags.zipf);
+    CachedDB *cache = nullptr;
+    if (flags.value_cache_mb > 0)
+        cache = new CachedDB(db, flags.value_cache_mb << 20);
+    uint64_t records = flags.records;
+    std::map<char, double> single_thread;
+
+    for (char name : flags.workloads) {
+        const Workload *w = nullptr;
+        for (const Workload &cand : kWorkloads)
+            if (cand.name == name)
+                w = &cand;
+        if (w == nullptr)
+            continue;
+
+        for (int nthreads : flags.threads) {
+            Shared sh;
+            std::vector<ThreadState> states(nthreads);
+            std::vector<std::thread> threads;
+            Histogram total[kNumOpTypes];
+
+            sh.db = db;
+            sh.flags = &flags;
+            sh.workload = w;
+            sh.zipf = &zipf;
+            sh.cache = cache;
+            sh.ops_left = flags.ops;
+            sh.records = records;
+            CachedDB::Stats before = {0, 0, 0};
+            if (cache != nullptr)
+                before = cache->GetStats();
+
+            uint64_t start = NowNanos();
+            for (int t = 0; t < nthreads; t++)
+                threads.emplace_back(Worker, &sh, &states[t], t);
+            for (std::thread &t : threads)
+                t.join();
+            double secs = (NowNanos() - start) / 1e9;
+            records = sh.records;
+
+            double rate = flags.ops / secs;
+            if (nthreads == 1)
+                single_thread[name] = rate;
+            printf("\nworkload %c, %d thread%s: %.0f ops/s", name, nthreads,
+                   nthreads > 1 ? "s" : "", rate);
+            if (single_thread.count(name) && nthreads > 1)
+                printf(" (%.2fx one thread, %.0f%% per-thread efficiency)",
+                       rate / single_thread[name], 100.0 * rate / single_thread[name] / nthreads);
+            printf("\n");
+            for (int op = 0; op < kNumOpTypes; op++) {
+                for (ThreadState &ts : states)
+                    total[op].Merge(ts.hist[op]);
+                if (total[op].Count() > 0)
+                    printf("  %-10s %s\n", kOpNames[op], total[op].Summary(1000.0, "us").c_str());
+            }
+            if (cache != nullptr) {
+                // hits are not counted (see cached_db.h), so derive them
+                // from the reads that went through the cache
+                CachedDB::Stats after = cache->GetStats();
+                uint64_t reads = total[kRead].Count() + total[kReadModifyWrite].Count();
+                uint64_t misses = after.misses - before.misses;
+                printf("  value cache: %.1f%% hits, %llu misses, %llu invalidations, "
+                       "%llu skipped fills, %.1f MB\n",
+                       reads ? 100.0 * (reads - std::min(reads, misses)) / reads : 0.0,
+                       (unsigned long long)misses,
+                       (unsigned long long)(after.invalidations - before.invalidations),
+                       (unsigned long long)(after.skipped_fills - before.skipped_fills),
+                       cache->TotalCharge() / 1048576.0);
+            }
+            fflush(stdout);
+        }
+    }
+
+    delete cache;
+    delete db;
+    delete options.block_cache;
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Log-linear latency histogram for db_ycsb, one per operation type.
+//
+// Values below 2^kSubBits are recorded exactly; above that every
+// power-of-two range is split into 2^kSubBits linear sub-buckets, so a
+// percentile is off by less than 1% for kSubBits = 7. Recording is one
+// increment, so every thread keeps its own and they are merged at the end.
+
+#ifndef LEVELDB_BENCH_HISTOGRAM_H_
+#define LEVELDB_BENCH_HISTOGRAM_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+class Histogram {
+public:
+    static const int kSubBits = 7;
+    static const int kSubCount = 1 << kSubBits;
+    static const int kBuckets = (64 - kSubBits + 1) * kSubCount;
+
+    Histogram() { Clear(); }
+
+    void Clear()
+    {
+        memset(counts_, 0, sizeof(counts_));
+        count_ = 0;
+        sum_ = 0;
+        min_ = UINT64_MAX;
+        max_ = 0;
+    }
+
+    void Add(uint64_t v)
+    {
+        counts_[Index(v)]++;
+        count_++;
+        sum_ += (double)v;
+        if (v < min_)
+            min_ = v;
+        if (v > max_)
+            max_ = v;
+    }
+
+    void Merge(const Histogram &other)
+    {
+        for (int i = 0; i < kBuckets; i++)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        if (other.min_ < min_)
+            min_ = other.min_;
+        if (other.max_ > max_)
+            max_ = other.max_;
+    }
+
+    uint64_t Count() const { return count_; }
+    uint64_t Max() const { return max_; }
+    double Average() const { return count_ ? sum_ / count_ : 0.0; }
+
+    // Smallest recorded value v such that p percent of the values are <= v
+    uint64_t Percentile(double p) const
+    {
+        uint64_t want, seen = 0;
+
+        if (count_ == 0)
+            return 0;
+        want = (uint64_t)(p / 100.0 * count_ + 0.5);
+        if (want < 1)
+            want = 1;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += counts_[i];
+            if (seen >= want)
+                return Value(i) < max_ ? Value(i) : max_;
+        }
+        return max_;
+    }
+
+    // One line: count, average and percentiles, values divided by scale
+    std::string Summary(double scale, const char *unit) const
+    {
+        char buf[256];
+
+        snprintf(buf, sizeof(buf),
+                 "%10llu  avg %9.1f  p50 %9.1f  p90 %9.1f  p99 %9.1f  p99.9 %9.1f  max %10.1f %s",
+                 (unsigned long long)count_, Average() / scale,
+                 Percentile(50) / scale, Percentile(90) / scale, Percentile(99) / scale,
+                 Percentile(99.9) / scale, max_ / scale, unit);
+        return buf;
+    }
+
+private:
+    static int Index(uint64_t v)
+    {
+        if (v < (uint64_t)kSubCount)
+            return (int)v;
+        // v >> shift always falls in [kSubCount, 2 * kSubCount)
+        int shift = 63 - __builtin_clzll(v) - kSubBits;
+        return shift * kSubCount + (int)(v >> shift);
+    }
+
+    // Highest value that maps to bucket idx
+    static uint64_t Value(int idx)
+    {
+        if (idx < kSubCount)
+            return idx;
+        int shift = idx / kSubCount - 1;
+        uint64_t sub = idx - shift * kSubCount;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    uint64_t counts_[kBuckets];
+    uint64_t count_;
+    double sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+#endif  // LEVELDB_BENCH_HISTOGRAM_H_
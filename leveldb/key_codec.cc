@@ -0,0 +1,251 @@
+#include "key_codec.h"
+
+#include <cstring>
+
+namespace {
+
+uint64_t LoadBigEndian64(const char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+void PutBigEndian(std::string *dst, uint64_t value, int bytes)
+{
+    char buf[8];
+
+    for (int i = bytes - 1; i >= 0; i--) {
+        buf[i] = (char)(value & 0xff);
+        value >>= 8;
+    }
+    dst->append(buf, bytes);
+}
+
+bool GetBigEndian(leveldb::Slice *input, int bytes, uint64_t *value)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(input->data());
+    uint64_t v = 0;
+
+    if (input->size() < (size_t)bytes)
+        return false;
+    for (int i = 0; i < bytes; i++)
+        v = (v << 8) | u[i];
+    input->remove_prefix(bytes);
+    *value = v;
+    return true;
+}
+
+}  // namespace
+
+void PutBigEndian32(std::string *dst, uint32_t value)
+{
+    PutBigEndian(dst, value, 4);
+}
+
+void PutBigEndian64(std::string *dst, uint64_t value)
+{
+    PutBigEndian(dst, value, 8);
+}
+
+void PutOrderedInt32(std::string *dst, int32_t value)
+{
+    PutBigEndian(dst, (uint32_t)value ^ 0x80000000u, 4);
+}
+
+void PutOrderedInt64(std::string *dst, int64_t value)
+{
+    PutBigEndian(dst, (uint64_t)value ^ 0x8000000000000000ull, 8);
+}
+
+// The first byte picks the form (the same scheme as SQLite4's varint):
+//   0..240     the value itself
+//   241..248   two bytes, value 240..2287
+//   249        three bytes, value 2288..67823
+//   250..255   followed by 3..8 big-endian bytes
+// Within a form larger values have larger bytes, and every value of a
+// form is larger than every value of the forms with smaller first bytes.
+int OrderedVarintLength(uint64_t value)
+{
+    int n = 3;
+
+    if (value <= 240)
+        return 1;
+    if (value <= 2287)
+        return 2;
+    if (value <= 67823)
+        return 3;
+    while (n < 8 && (value >> (8 * n)) != 0)
+        n++;
+    return n + 1;
+}
+
+void PutOrderedVarint64(std::string *dst, uint64_t value)
+{
+    int len = OrderedVarintLength(value);
+
+    if (len == 1) {
+        dst->push_back((char)value);
+    } else if (len == 2) {
+        value -= 240;
+        dst->push_back((char)(241 + (value >> 8)));
+        dst->push_back((char)(value & 0xff));
+    } else if (value <= 67823) {
+        value -= 2288;
+        dst->push_back((char)249);
+        dst->push_back((char)(value >> 8));
+        dst->push_back((char)(value & 0xff));
+    } else {
+        dst->push_back((char)(247 + len - 1));
+        PutBigEndian(dst, value, len - 1);
+    }
+}
+
+void PutOrderedString(std::string *dst, const leveldb::Slice &value)
+{
+    for (size_t i = 0; i < value.size(); i++) {
+        dst->push_back(value[i]);
+        if (value[i] == '\0')
+            dst->push_back((char)0xff);
+    }
+    dst->push_back('\0');
+    dst->push_back('\1');
+}
+
+bool GetBigEndian32(leveldb::Slice *input, uint32_t *value)
+{
+    uint64_t v;
+
+    if (!GetBigEndian(input, 4, &v))
+        return false;
+    *value = (uint32_t)v;
+    return true;
+}
+
+bool GetBigEndian64(leveldb::Slice *input, uint64_t *value)
+{
+    return GetBigEndian(input, 8, value);
+}
+
+bool GetOrderedInt32(leveldb::Slice *input, int32_t *value)
+{
+    uint64_t v;
+
+    if (!GetBigEndian(input, 4, &v))
+        return false;
+    *value = (int32_t)((uint32_t)v ^ 0x80000000u);
+    return true;
+}
+
+bool GetOrderedInt64(leveldb::Slice *input, int64_t *value)
+{
+    uint64_t v;
+
+    if (!GetBigEndian(input, 8, &v))
+        return false;
+    *value = (int64_t)(v ^ 0x8000000000000000ull);
+    return true;
+}
+
+bool GetOrderedVarint64(leveldb::Slice *input, uint64_t *value)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(input->data());
+    uint64_t v;
+
+    if (input->empty())
+        return false;
+    if (u[0] <= 240) {
+        *value = u[0];
+        input->remove_prefix(1);
+        return true;
+    }
+    if (u[0] <= 248) {
+        if (input->size() < 2)
+            return false;
+        *value = 240 + ((uint64_t)(u[0] - 241) << 8) + u[1];
+        input->remove_prefix(2);
+        return true;
+    }
+    if (u[0] == 249) {
+        if (input->size() < 3)
+            return false;
+        *value = 2288 + ((uint64_t)u[1] << 8) + u[2];
+        input->remove_prefix(3);
+        return true;
+    }
+    int n = u[0] - 247;
+    input->remove_prefix(1);
+    if (!GetBigEndian(input, n, &v))
+        return false;
+    // reject non-canonical encodings, they would break the order
+    if (OrderedVarintLength(v) != n + 1)
+        return false;
+    *value = v;
+    return true;
+}
+
+bool GetOrderedString(leveldb::Slice *input, std::string *value)
+{
+    const char *p = input->data();
+    size_t n = input->size();
+
+    value->clear();
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != '\0') {
+            value->push_back(p[i]);
+            continue;
+        }
+        if (i + 1 == n)
+            return false;
+        if (p[i + 1] == '\1') {
+            input->remove_prefix(i + 2);
+            return true;
+        }
+        if (p[i + 1] != (char)0xff)
+            return false;
+        value->push_back('\0');
+        i++;
+    }
+    return false;
+}
+
+std::string EncodeTwoPartKey(int32_t a, int32_t b)
+{
+    std::string key;
+
+    key.reserve(8);
+    PutOrderedInt32(&key, a);
+    PutOrderedInt32(&key, b);
+    return key;
+}
+
+bool DecodeTwoPartKey(const leveldb::Slice &key, int32_t *a, int32_t *b)
+{
+    leveldb::Slice in = key;
+
+    return GetOrderedInt32(&in, a) && GetOrderedInt32(&in, b) && in.empty();
+}
+
+int TwoPartComparator::Compare(const leveldb::Slice &a, const leveldb::Slice &b) const
+{
+    if (a.size() == 8 && b.size() == 8) {
+        uint64_t x = LoadBigEndian64(a.data());
+        uint64_t y = LoadBigEndian64(b.data());
+        return x < y ? -1 : x > y;
+    }
+    return a.compare(b);
+}
+
+void TwoPartComparator::FindShortestSeparator(std::string *start, const leveldb::Slice &limit) const
+{
+    leveldb::BytewiseComparator()->FindShortestSeparator(start, limit);
+}
+
+void TwoPartComparator::FindShortSuccessor(std::string *key) const
+{
+    leveldb::BytewiseComparator()->FindShortSuccessor(key);
+}
@@ -0,0 +1,69 @@
+// Order-preserving ("memcmp-able") encodings for composite keys.
+//
+// Every Put* below appends a field such that comparing two encoded keys
+// with memcmp gives the same order as comparing the fields one by one.
+// Keys built this way sort correctly under leveldb's default
+// BytewiseComparator, which compares without parsing anything and whose
+// FindShortestSeparator/FindShortSuccessor shorten the keys stored in
+// index blocks. A custom comparator that parses its keys gets neither.
+//
+// Field encodings:
+//   PutBigEndian32/64    unsigned, fixed width, most significant byte first
+//   PutOrderedInt32/64   signed, fixed width: big-endian with the sign bit
+//                        flipped, so negative numbers sort first
+//   PutOrderedVarint64   unsigned, 1 to 9 bytes; the first byte tells the
+//                        length and shorter encodings are smaller values
+//   PutOrderedString     arbitrary bytes, 0x00 escaped as 00 ff and ended
+//                        by 00 01, so a string sorts before its extensions
+//
+// Fixed-width and varint fields are self-delimiting, so any sequence of
+// them is still prefix-free and the concatenation keeps the order.
+// Get* consume one field from the front of *input and return false if it
+// is truncated or malformed.
+
+#ifndef LEVELDB_BENCH_KEY_CODEC_H_
+#define LEVELDB_BENCH_KEY_CODEC_H_
+
+#include <cstdint>
+#include <string>
+
+#include "leveldb/comparator.h"
+#include "leveldb/slice.h"
+
+void PutBigEndian32(std::string *dst, uint32_t value);
+void PutBigEndian64(std::string *dst, uint64_t value);
+void PutOrderedInt32(std::string *dst, int32_t value);
+void PutOrderedInt64(std::string *dst, int64_t value);
+void PutOrderedVarint64(std::string *dst, uint64_t value);
+void PutOrderedString(std::string *dst, const leveldb::Slice &value);
+
+bool GetBigEndian32(leveldb::Slice *input, uint32_t *value);
+bool GetBigEndian64(leveldb::Slice *input, uint64_t *value);
+bool GetOrderedInt32(leveldb::Slice *input, int32_t *value);
+bool GetOrderedInt64(leveldb::Slice *input, int64_t *value);
+bool GetOrderedVarint64(leveldb::Slice *input, uint64_t *value);
+bool GetOrderedString(leveldb::Slice *input, std::string *value);
+
+// Bytes PutOrderedVarint64 writes for value
+int OrderedVarintLength(uint64_t value);
+
+// The two-number key of leveldb_example.cc, sorted by the first number and
+// then the second: two PutOrderedInt32 fields, 8 bytes.
+std::string EncodeTwoPartKey(int32_t a, int32_t b);
+bool DecodeTwoPartKey(const leveldb::Slice &key, int32_t *a, int32_t *b);
+
+// Comparator for EncodeTwoPartKey keys. Two 8-byte keys are compared as
+// two big-endian 64-bit loads instead of parsing both numbers out of each
+// key. Because the encoding is memcmp-able, this is the bytewise order,
+// so anything else (the shortened keys leveldb puts into index blocks)
+// falls back to a plain byte comparison and the separator functions are
+// the bytewise ones.
+class TwoPartComparator : public leveldb::Comparator {
+public:
+    int Compare(const leveldb::Slice &a, const leveldb::Slice &b) const override;
+    const char *Name() const override { return "TwoPartComparator.fixed"; }
+    void FindShortestSeparator(std::string *start, const leveldb::Slice &limit) const override;
+    void FindShortSuccessor(std::string *key) const override;
+};
+
+#endif  // LEVELDB_BENCH_KEY_CODEC_H_
@@ -3,6 +3,7 @@
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 #include "leveldb/comparator.h"
+#include "key_codec.h"
 
 int main(int argc, char *argv[])
 {
@@ -142,6 +143,9 @@ int main(int argc, char *argv[])
     }
     assert(it->status().ok());   // Check for any errors found during the scan
     delete it;
+    // A single iterator scans on one core. To scan a large database with several threads,
+    // see ParallelScan() in parallel_scan.h: it splits the keyspace into ranges of about
+    // equal size and scans them with one iterator each, all at the same snapshot.
     
     // The following variation shows how to process just the keys in the range [start, limit):
     // for ( it->Seek(start); 
@@ -177,32 +181,28 @@ int main(int argc, char *argv[])
     // The preceding examples used the default ordering function for key, which orders bytes lexicographically.
     // You can also supply a custom comparator when opening a database. For example, suppose each database key consists of 
     // two numbers and we should sort by the first number, breaking ties by the second number.
-    // First, define a proper subclass of leveldb::Comparator that expresses thes rules:
-    class TwoPartComparator : public leveldb::Comparator {
-		void Parsekey(const leveldb::Slice &s, int *a, int *b) const{
-					
-		}
-    public:
-        // Threa-way comparison function:
-        // if a > b : negative result
-        // if a < b : positive result
-        // else : zero result 
-        int Compare(const leveldb::Slice &a, const leveldb::Slice &b) const {
-            int a1, a2, b1, b2;
-            Parsekey(a, &a1, &a2);
-            Parsekey(b, &b1, &b2);
-            if (a1 < b1) return -1;
-            if (a1 > b1) return +1;
-            if (a2 < b2) return -1;
-            if (a2 > b2) return +1;
-            return 0;
-        };
-
-        // Ignore the following methods for now:
-        const char* Name() const {return "TwoPartComparator";};
-        void FindShortestSeparator(std::string*, const leveldb::Slice&) const { }
-        void FindShortSuccessor(std::string*) const { }
-    };
+    // First, define a proper subclass of leveldb::Comparator that expresses thes rules.
+    // A comparator that parses both numbers out of both keys on every Compare call is slow,
+    // and leveldb cannot shorten the keys it stores in index blocks without knowing the format.
+    // Instead, key_codec.h encodes the two numbers as fixed-width big-endian fields with the
+    // sign bit flipped, so that the byte order of the keys is the numeric order:
+    //
+    //     class TwoPartComparator : public leveldb::Comparator {
+    //     public:
+    //         // Three-way comparison function:
+    //         // if a < b : negative result
+    //         // if a > b : positive result
+    //         // else : zero result
+    //         int Compare(const leveldb::Slice &a, const leveldb::Slice &b) const;
+    //         const char* Name() const { return "TwoPartComparator.fixed"; }
+    //         void FindShortestSeparator(std::string*, const leveldb::Slice&) const;
+    //         void FindShortSuccessor(std::string*) const;
+    //     };
+    //
+    // Compare() is two 64-bit loads, and since the order is the bytewise order the
+    // FindShortestSeparator/FindShortSuccessor methods are the ones of BytewiseComparator.
+    // Keys are built with EncodeTwoPartKey(a, b) and read back with DecodeTwoPartKey().
+    // (With such an encoding the default comparator would sort them correctly as well.)
     
     // Now, create a database using this custom comparator:
     TwoPartComparator cmp;
@@ -210,9 +210,21 @@ int main(int argc, char *argv[])
     leveldb::Options options2;
     options2.create_if_missing = true;
     options2.comparator = &cmp; 
-    leveldb::Status status2  = leveldb::DB::Open(options2, "/temp/testdb2", &db2);
+    leveldb::Status status2  = leveldb::DB::Open(options2, "/tmp/testdb2", &db2);
     assert(status2.ok());
 
+    status2 = db2->Put(leveldb::WriteOptions(), EncodeTwoPartKey(2, -1), "second");
+    if (status2.ok()) status2 = db2->Put(leveldb::WriteOptions(), EncodeTwoPartKey(1, 7), "first");
+    assert(status2.ok());
+    leveldb::Iterator *it2 = db2->NewIterator(leveldb::ReadOptions());
+    for (it2->SeekToFirst(); it2->Valid(); it2->Next()) {
+        int32_t a, b;
+        if (DecodeTwoPartKey(it2->key(), &a, &b))
+            std::cout << "(" << a << ", " << b << "): " << it2->value().ToString() << std::endl;
+    }
+    delete it2;
+    delete db2;
+
 
     // # CLosing A Database
     // ===========================
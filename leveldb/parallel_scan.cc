@@ -0,0 +1,188 @@
+#include "parallel_scan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Rounds of the bisection for each split point. The sizes leveldb reports
+// only change at block granularity, 32 rounds are far below that.
+const int kBisectRounds = 32;
+
+// The 8 bytes of key after the first prefix_len ones, as a big-endian
+// number (zero padded), and back
+uint64_t KeyToNumber(const std::string &key, size_t prefix_len)
+{
+    uint64_t v = 0;
+
+    for (size_t i = prefix_len; i < prefix_len + 8; i++)
+        v = (v << 8) | (i < key.size() ? (unsigned char)key[i] : 0);
+    return v;
+}
+
+std::string NumberToKey(const std::string &prefix, uint64_t v)
+{
+    std::string key = prefix;
+
+    for (int shift = 56; shift >= 0; shift -= 8)
+        key.push_back((char)(v >> shift));
+    return key;
+}
+
+}  // namespace
+
+std::vector<ScanRange> PartitionKeyspace(leveldb::DB *db, int n, const leveldb::Snapshot *snapshot)
+{
+    leveldb::ReadOptions read_options;
+    std::vector<ScanRange> ranges;
+    std::string first, last;
+
+    read_options.snapshot = snapshot;
+    read_options.fill_cache = false;
+    leveldb::Iterator *it = db->NewIterator(read_options);
+    it->SeekToFirst();
+    if (it->Valid()) {
+        first = it->key().ToString();
+        it->SeekToLast();
+        last = it->key().ToString();
+    }
+    bool empty = !it->Valid();
+    delete it;
+    if (empty)
+        return ranges;
+
+    size_t prefix_len = 0;
+    while (prefix_len < first.size() && prefix_len < last.size() && first[prefix_len] == last[prefix_len])
+        prefix_len++;
+    std::string prefix = first.substr(0, prefix_len);
+    uint64_t lo = KeyToNumber(first, prefix_len);
+    uint64_t hi = KeyToNumber(last, prefix_len);
+    if (n <= 1 || hi <= lo) {
+        ranges.push_back(ScanRange());
+        return ranges;
+    }
+
+    // Split point i goes where the size of [first, split) is i/n of the
+    // total. leveldb only counts data that is in tables, if there is none
+    // (a small DB still in the memtable) the keyspace is split evenly.
+    std::vector<uint64_t> split(n - 1);
+    leveldb::Range all(first, last);
+    uint64_t total = 0;
+    db->GetApproximateSizes(&all, 1, &total);
+    for (int i = 0; i < n - 1; i++)
+        split[i] = lo + (uint64_t)((unsigned __int128)(hi - lo) * (i + 1) / n);
+
+    if (total > 0) {
+        std::vector<uint64_t> below(n - 1, lo), above(n - 1, hi);
+        std::vector<std::string> probe_keys(n - 1);
+        std::vector<leveldb::Range> probes(n - 1);
+        std::vector<uint64_t> sizes(n - 1);
+
+        for (int round = 0; round < kBisectRounds; round++) {
+            for (int i = 0; i < n - 1; i++) {
+                split[i] = below[i] + (above[i] - below[i]) / 2;
+                probe_keys[i] = NumberToKey(prefix, split[i]);
+                probes[i] = leveldb::Range(first, probe_keys[i]);
+            }
+            db->GetApproximateSizes(probes.data(), n - 1, sizes.data());
+            for (int i = 0; i < n - 1; i++) {
+                if (sizes[i] < total * (i + 1) / n)
+                    below[i] = split[i];
+                else
+                    above[i] = split[i];
+            }
+        }
+        split = above;
+    }
+
+    // Splits that collapsed onto each other (or onto the first key) would
+    // only make empty ranges
+    std::string start;
+    leveldb::Slice previous(first);
+    std::vector<std::string> keys;
+    keys.reserve(n - 1);
+    for (int i = 0; i < n - 1; i++) {
+        keys.push_back(NumberToKey(prefix, split[i]));
+        if (leveldb::Slice(keys.back()).compare(previous) <= 0) {
+            keys.pop_back();
+            continue;
+        }
+        previous = keys.back();
+    }
+    for (const std::string &key : keys) {
+        ranges.push_back(ScanRange{start, key});
+        start = key;
+    }
+    ranges.push_back(ScanRange{start, std::string()});
+    return ranges;
+}
+
+leveldb::Status ParallelScan(leveldb::DB *db, const ParallelScanOptions &options,
+                             const ScanVisitor &visitor, std::vector<ScanRange> *ranges_out)
+{
+    const leveldb::Snapshot *snapshot = options.snapshot;
+    int threads = std::max(1, options.threads);
+    int nranges = options.ranges > 0 ? options.ranges : 4 * threads;
+
+    if (snapshot == nullptr)
+        snapshot = db->GetSnapshot();
+    std::vector<ScanRange> ranges = PartitionKeyspace(db, nranges, snapshot);
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> stop(false);
+    std::mutex mu;
+    leveldb::Status status;
+
+    auto worker = [&]() {
+        leveldb::ReadOptions read_options;
+        read_options.snapshot = snapshot;
+        read_options.fill_cache = options.fill_cache;
+        leveldb::Iterator *it = db->NewIterator(read_options);
+        size_t r;
+
+        while (!stop.load(std::memory_order_relaxed) && (r = next++) < ranges.size()) {
+            const ScanRange &range = ranges[r];
+            leveldb::Slice limit(range.limit);
+
+            if (range.start.empty())
+                it->SeekToFirst();
+            else
+                it->Seek(range.start);
+            for (; it->Valid(); it->Next()) {
+                if (!limit.empty() && it->key().compare(limit) >= 0)
+                    break;
+                if (!visitor((int)r, it->key(), it->value()) || stop.load(std::memory_order_relaxed)) {
+                    stop = true;
+                    break;
+                }
+            }
+            if (!it->status().ok()) {
+                std::lock_guard<std::mutex> l(mu);
+                if (status.ok())
+                    status = it->status();
+                stop = true;
+            }
+        }
+        delete it;
+    };
+
+    threads = std::min<int>(threads, std::max<size_t>(1, ranges.size()));
+    if (threads == 1) {
+        worker();
+    } else {
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; t++)
+            pool.emplace_back(worker);
+        for (std::thread &t : pool)
+            t.join();
+    }
+
+    if (options.snapshot == nullptr)
+        db->ReleaseSnapshot(snapshot);
+    if (ranges_out != nullptr)
+        ranges_out->swap(ranges);
+    return status;
+}
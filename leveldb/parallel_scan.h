@@ -0,0 +1,64 @@
+// ParallelScan: a full scan of a leveldb::DB on several cores.
+//
+// One iterator walking SeekToFirst()..Next() is bound to one core: it
+// reads, checksums and decompresses every block by itself. ParallelScan
+// cuts the keyspace into ranges of about equal size on disk (found with
+// DB::GetApproximateSizes), and a pool of threads scans them, one
+// iterator per range. All iterators read at the same snapshot, so the
+// union of the ranges is exactly the single-iterator scan at that
+// snapshot, regardless of concurrent writes.
+//
+// Ranges are numbered in key order and each is visited in key order by a
+// single thread, so results that are kept per range and concatenated in
+// range order come out sorted; results that are aggregated per range are
+// simply merged at the end.
+//
+// Split points are made up by interpolating between the first and the
+// last key as byte strings, so the ranges are only right for a DB using
+// the bytewise order (which includes the key_codec.h encodings).
+
+#ifndef LEVELDB_BENCH_PARALLEL_SCAN_H_
+#define LEVELDB_BENCH_PARALLEL_SCAN_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "leveldb/db.h"
+
+struct ScanRange {
+    std::string start;      // inclusive, empty: the first key
+    std::string limit;      // exclusive, empty: past the last key
+};
+
+struct ParallelScanOptions {
+    int threads = 4;
+
+    // More ranges than threads evens out ranges whose size was guessed
+    // badly; 0 means four per thread.
+    int ranges = 0;
+
+    // Snapshot to read at; nullptr takes (and releases) one for the scan.
+    const leveldb::Snapshot *snapshot = nullptr;
+
+    // A full scan would otherwise push the whole DB through the block
+    // cache and evict what the point reads need.
+    bool fill_cache = false;
+};
+
+// Called for every key of range, in key order, on the thread scanning
+// that range. Returning false stops the scan of all ranges.
+typedef std::function<bool(int range, const leveldb::Slice &key, const leveldb::Slice &value)>
+    ScanVisitor;
+
+// Up to n ranges that together cover the whole keyspace, in key order.
+// Fewer come back if the DB is empty or has too few distinct keys.
+std::vector<ScanRange> PartitionKeyspace(leveldb::DB *db, int n, const leveldb::Snapshot *snapshot);
+
+// Scans db with options.threads threads. *ranges, if not nullptr, gets
+// the ranges that were used, visitor's range argument indexes it.
+// Returns the first error an iterator reported.
+leveldb::Status ParallelScan(leveldb::DB *db, const ParallelScanOptions &options,
+                             const ScanVisitor &visitor, std::vector<ScanRange> *ranges);
+
+#endif  // LEVELDB_BENCH_PARALLEL_SCAN_H_
@@ -0,0 +1,366 @@
+#include "snapshot_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+
+const char kMagic[8] = {'L', 'D', 'B', 'S', 'N', 'A', 'P', '1'};
+const size_t kBlockHeaderSize = 13;
+
+// Anything longer is a corrupt length, not a block we wrote
+const uint32_t kMaxBlockSize = 1u << 30;
+
+enum BlockType : char {
+    kNoCompression = 0,
+    kZlibCompression = 1,
+    kEndBlock = (char)0xff,
+};
+
+void EncodeFixed32(char *buf, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        buf[i] = (char)(v >> (8 * i));
+}
+
+void EncodeFixed64(char *buf, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        buf[i] = (char)(v >> (8 * i));
+}
+
+uint32_t DecodeFixed32(const char *p)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+uint64_t DecodeFixed64(const char *p)
+{
+    return DecodeFixed32(p) | ((uint64_t)DecodeFixed32(p + 4) << 32);
+}
+
+void PutVarint32(std::string *dst, uint32_t v)
+{
+    while (v >= 0x80) {
+        dst->push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    dst->push_back((char)v);
+}
+
+bool GetVarint32(leveldb::Slice *input, uint32_t *value)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(input->data());
+    uint32_t v = 0;
+
+    for (size_t i = 0; i < input->size() && i < 5; i++) {
+        v |= (uint32_t)(p[i] & 0x7f) << (7 * i);
+        if ((p[i] & 0x80) == 0) {
+            input->remove_prefix(i + 1);
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t BlockCrc(const char *header, const leveldb::Slice &stored)
+{
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef *>(header), 9);
+    return (uint32_t)crc32(crc, reinterpret_cast<const Bytef *>(stored.data()), stored.size());
+}
+
+leveldb::Status FileError(const std::string &path)
+{
+    return leveldb::Status::IOError(path + ": " + strerror(errno));
+}
+
+}  // namespace
+
+SnapshotWriter::SnapshotWriter(const SnapshotFileOptions &options)
+    : options_(options), file_(nullptr), current_(new Block),
+      records_(0), raw_bytes_(0), file_bytes_(0), shutdown_(false)
+{
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    {
+        std::lock_guard<std::mutex> l(mu_);
+        shutdown_ = true;
+    }
+    work_cv_.notify_all();
+    for (std::thread &t : pool_)
+        t.join();
+    // an unfinished file has no end block, readers will say so
+    if (file_ != nullptr)
+        fclose(file_);
+}
+
+leveldb::Status SnapshotWriter::Open(const std::string &path)
+{
+    path_ = path;
+    file_ = fopen(path.c_str(), "wb");
+    if (file_ == nullptr)
+        return FileError(path);
+    if (fwrite(kMagic, 1, sizeof(kMagic), file_) != sizeof(kMagic))
+        return FileError(path);
+    file_bytes_ = sizeof(kMagic);
+    if (options_.level > 0) {
+        for (int i = 0; i < options_.threads; i++)
+            pool_.emplace_back(&SnapshotWriter::CompressLoop, this);
+    }
+    return leveldb::Status::OK();
+}
+
+leveldb::Status SnapshotWriter::Add(const leveldb::Slice &key, const leveldb::Slice &value)
+{
+    std::string &raw = current_->raw;
+    size_t shared = 0;
+
+    if (records_ > 0 && key.compare(last_key_) <= 0)
+        return leveldb::Status::InvalidArgument("keys out of order", key);
+    if (!raw.empty()) {
+        size_t n = std::min(last_key_.size(), key.size());
+        while (shared < n && last_key_[shared] == key[shared])
+            shared++;
+    }
+    PutVarint32(&raw, shared);
+    PutVarint32(&raw, key.size() - shared);
+    PutVarint32(&raw, value.size());
+    raw.append(key.data() + shared, key.size() - shared);
+    raw.append(value.data(), value.size());
+    last_key_.assign(key.data(), key.size());
+    records_++;
+    raw_bytes_ += key.size() + value.size();
+
+    if (raw.size() < options_.block_size)
+        return leveldb::Status::OK();
+    Submit();
+    return WriteDone(false);
+}
+
+void SnapshotWriter::Submit()
+{
+    if (current_->raw.empty())
+        return;
+    Block *b = current_.get();
+
+    if (pool_.empty()) {
+        Compress(b);
+        b->done = true;
+    }
+    std::unique_lock<std::mutex> l(mu_);
+    inflight_.push_back(std::move(current_));
+    if (!b->done) {
+        todo_.push_back(b);
+        work_cv_.notify_one();
+    }
+    l.unlock();
+    current_.reset(new Block);
+}
+
+void SnapshotWriter::Compress(Block *b) const
+{
+    uLongf len = compressBound(b->raw.size());
+
+    if (options_.level > 0) {
+        b->stored.resize(len);
+        if (compress2(reinterpret_cast<Bytef *>(&b->stored[0]), &len,
+                      reinterpret_cast<const Bytef *>(b->raw.data()), b->raw.size(),
+                      options_.level) == Z_OK && len < b->raw.size()) {
+            b->type = kZlibCompression;
+            b->stored.resize(len);
+            return;
+        }
+    }
+    // incompressible: storing it is smaller and faster to read
+    b->type = kNoCompression;
+    b->stored.swap(b->raw);
+}
+
+void SnapshotWriter::CompressLoop()
+{
+    std::unique_lock<std::mutex> l(mu_);
+
+    for (;;) {
+        while (todo_.empty() && !shutdown_)
+            work_cv_.wait(l);
+        if (todo_.empty())
+            return;
+        Block *b = todo_.front();
+        todo_.pop_front();
+        l.unlock();
+        Compress(b);
+        l.lock();
+        b->done = true;
+        done_cv_.notify_all();
+    }
+}
+
+// Writes the compressed blocks at the head of the queue. Unless wait_all,
+// it only waits when too many blocks are queued, which bounds the memory
+// held and throttles the caller to the speed of the compressors.
+leveldb::Status SnapshotWriter::WriteDone(bool wait_all)
+{
+    size_t max_inflight = 2 * pool_.size() + 1;
+    std::unique_lock<std::mutex> l(mu_);
+
+    while (!inflight_.empty()) {
+        if (!inflight_.front()->done) {
+            if (!wait_all && inflight_.size() <= max_inflight)
+                break;
+            done_cv_.wait(l);
+            continue;
+        }
+        std::unique_ptr<Block> b = std::move(inflight_.front());
+        inflight_.pop_front();
+        l.unlock();
+        uint32_t raw_len = b->type == kNoCompression ? b->stored.size() : b->raw.size();
+        leveldb::Status s = WriteBlock(b->type, b->stored, raw_len);
+        if (!s.ok())
+            return s;
+        l.lock();
+    }
+    return leveldb::Status::OK();
+}
+
+leveldb::Status SnapshotWriter::WriteBlock(char type, const leveldb::Slice &stored, uint32_t raw_len)
+{
+    char header[kBlockHeaderSize];
+
+    EncodeFixed32(header, stored.size());
+    EncodeFixed32(header + 4, raw_len);
+    header[8] = type;
+    EncodeFixed32(header + 9, BlockCrc(header, stored));
+    if (fwrite(header, 1, sizeof(header), file_) != sizeof(header) ||
+        fwrite(stored.data(), 1, stored.size(), file_) != stored.size())
+        return FileError(path_);
+    file_bytes_ += sizeof(header) + stored.size();
+    return leveldb::Status::OK();
+}
+
+leveldb::Status SnapshotWriter::Finish()
+{
+    char end[16];
+
+    Submit();
+    leveldb::Status s = WriteDone(true);
+    if (!s.ok())
+        return s;
+    EncodeFixed64(end, records_);
+    EncodeFixed64(end + 8, raw_bytes_);
+    s = WriteBlock(kEndBlock, leveldb::Slice(end, sizeof(end)), sizeof(end));
+    if (!s.ok())
+        return s;
+    if (fflush(file_) != 0 || (options_.sync && fsync(fileno(file_)) != 0))
+        return FileError(path_);
+    int rc = fclose(file_);
+    file_ = nullptr;
+    return rc == 0 ? leveldb::Status::OK() : FileError(path_);
+}
+
+SnapshotReader::SnapshotReader() : file_(nullptr), records_(0), end_(false)
+{
+}
+
+SnapshotReader::~SnapshotReader()
+{
+    if (file_ != nullptr)
+        fclose(file_);
+}
+
+leveldb::Status SnapshotReader::Open(const std::string &path)
+{
+    char magic[sizeof(kMagic)];
+
+    path_ = path;
+    file_ = fopen(path.c_str(), "rb");
+    if (file_ == nullptr)
+        return status_ = FileError(path);
+    if (fread(magic, 1, sizeof(magic), file_) != sizeof(magic) ||
+        memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+        return status_ = leveldb::Status::Corruption(path + ": not a snapshot file");
+    return status_;
+}
+
+bool SnapshotReader::ReadBlock()
+{
+    char header[kBlockHeaderSize];
+
+    if (fread(header, 1, sizeof(header), file_) != sizeof(header)) {
+        status_ = ferror(file_) ? FileError(path_)
+                                : leveldb::Status::Corruption(path_ + ": truncated, no end block");
+        return false;
+    }
+    uint32_t stored_len = DecodeFixed32(header);
+    uint32_t raw_len = DecodeFixed32(header + 4);
+    char type = header[8];
+    if (stored_len > kMaxBlockSize || raw_len > kMaxBlockSize) {
+        status_ = leveldb::Status::Corruption(path_ + ": bad block length");
+        return false;
+    }
+    stored_.resize(stored_len);
+    if (fread(&stored_[0], 1, stored_len, file_) != stored_len) {
+        status_ = leveldb::Status::Corruption(path_ + ": truncated block");
+        return false;
+    }
+    if (BlockCrc(header, stored_) != DecodeFixed32(header + 9)) {
+        status_ = leveldb::Status::Corruption(path_ + ": block checksum mismatch");
+        return false;
+    }
+
+    if (type == kEndBlock) {
+        end_ = true;
+        if (stored_len != 16 || DecodeFixed64(stored_.data()) != records_)
+            status_ = leveldb::Status::Corruption(path_ + ": record count mismatch");
+        return false;
+    }
+    if (type == kNoCompression) {
+        raw_.swap(stored_);
+    } else if (type == kZlibCompression) {
+        uLongf len = raw_len;
+        raw_.resize(raw_len);
+        if (uncompress(reinterpret_cast<Bytef *>(&raw_[0]), &len,
+                       reinterpret_cast<const Bytef *>(stored_.data()), stored_.size()) != Z_OK ||
+            len != raw_len) {
+            status_ = leveldb::Status::Corruption(path_ + ": bad compressed block");
+            return false;
+        }
+    } else {
+        status_ = leveldb::Status::Corruption(path_ + ": unknown block type");
+        return false;
+    }
+    rest_ = raw_;
+    key_.clear();
+    return true;
+}
+
+bool SnapshotReader::Next(leveldb::Slice *key, leveldb::Slice *value)
+{
+    uint32_t shared, non_shared, value_len;
+
+    if (end_ || !status_.ok())
+        return false;
+    while (rest_.empty()) {
+        if (!ReadBlock())
+            return false;
+    }
+    if (!GetVarint32(&rest_, &shared) || !GetVarint32(&rest_, &non_shared) ||
+        !GetVarint32(&rest_, &value_len) || shared > key_.size() ||
+        (uint64_t)non_shared + value_len > rest_.size()) {
+        status_ = leveldb::Status::Corruption(path_ + ": bad record");
+        return false;
+    }
+    key_.resize(shared);
+    key_.append(rest_.data(), non_shared);
+    *key = key_;
+    *value = leveldb::Slice(rest_.data() + non_shared, value_len);
+    rest_.remove_prefix(non_shared + value_len);
+    records_++;
+    return true;
+}
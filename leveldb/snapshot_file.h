@@ -0,0 +1,131 @@
+// Snapshot files: a compact, checksummed stream of sorted key/value pairs.
+//
+// Layout:
+//   header   "LDBSNAP1"
+//   blocks   stored_len fixed32 | raw_len fixed32 | type u8 | crc fixed32 | stored_len bytes
+//   end      a block of type kEndBlock: record count fixed64 | raw bytes fixed64
+//
+// Fixed-width integers are little endian, like leveldb's own files. The
+// crc (zlib's crc32) covers the first 9 header bytes and the stored
+// bytes, so a flipped length is caught as well as a flipped payload. A
+// file without the end block was cut short.
+//
+// A block holds records in the format of a leveldb table block without
+// restart points:
+//   shared varint32 | non_shared varint32 | value_len varint32 | key delta | value
+// where shared is the length of the prefix the key has in common with the
+// previous key of the same block. Every block starts over at shared = 0,
+// so blocks can be checked and decompressed independently; the writer
+// compresses them on a pool of threads and writes them in order.
+
+#ifndef LEVELDB_BENCH_SNAPSHOT_FILE_H_
+#define LEVELDB_BENCH_SNAPSHOT_FILE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+struct SnapshotFileOptions {
+    // Raw bytes per block. Large blocks compress better; a block is also
+    // the unit a reader has to hold in memory.
+    size_t block_size = 256 << 10;
+
+    // zlib level, 0 stores the blocks uncompressed
+    int level = 1;
+
+    // Threads compressing blocks while the caller keeps adding records;
+    // 0 compresses in the caller
+    int threads = 2;
+
+    // fsync the file before Finish returns
+    bool sync = true;
+};
+
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const SnapshotFileOptions &options);
+    ~SnapshotWriter();
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    leveldb::Status Open(const std::string &path);
+
+    // Keys must come in increasing order, as an iterator returns them
+    leveldb::Status Add(const leveldb::Slice &key, const leveldb::Slice &value);
+
+    // Writes the end block and closes the file; nothing can be added after
+    leveldb::Status Finish();
+
+    uint64_t records() const { return records_; }
+    uint64_t raw_bytes() const { return raw_bytes_; }
+    uint64_t file_bytes() const { return file_bytes_; }
+
+private:
+    struct Block {
+        std::string raw;
+        std::string stored;
+        char type;
+        bool done = false;
+    };
+
+    void Submit();
+    void Compress(Block *b) const;
+    void CompressLoop();
+    leveldb::Status WriteDone(bool wait_all);
+    leveldb::Status WriteBlock(char type, const leveldb::Slice &stored, uint32_t raw_len);
+
+    SnapshotFileOptions options_;
+    FILE *file_;
+    std::string path_;
+    std::unique_ptr<Block> current_;
+    std::string last_key_;
+    uint64_t records_, raw_bytes_, file_bytes_;
+
+    // Blocks in file order; the ones not compressed yet are also in todo_
+    std::mutex mu_;
+    std::condition_variable work_cv_, done_cv_;
+    std::deque<std::unique_ptr<Block>> inflight_;
+    std::deque<Block *> todo_;
+    bool shutdown_;
+    std::vector<std::thread> pool_;
+};
+
+class SnapshotReader {
+public:
+    SnapshotReader();
+    ~SnapshotReader();
+    SnapshotReader(const SnapshotReader &) = delete;
+    SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+    leveldb::Status Open(const std::string &path);
+
+    // The next record, or false at the end of the file or on an error;
+    // status() tells which. key and value stay valid until the next call.
+    bool Next(leveldb::Slice *key, leveldb::Slice *value);
+    leveldb::Status status() const { return status_; }
+
+    uint64_t records() const { return records_; }
+
+private:
+    bool ReadBlock();
+
+    FILE *file_;
+    std::string path_;
+    std::string stored_, raw_;
+    leveldb::Slice rest_;           // the unread part of raw_
+    std::string key_;
+    uint64_t records_;
+    bool end_;
+    leveldb::Status status_;
+};
+
+#endif  // LEVELDB_BENCH_SNAPSHOT_FILE_H_
@@ -1,18 +1,134 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 
-int main(int argc, const char *argv[])
+/* Pipe bandwidth, with and without copies.
+ *
+ *   writer -w write    : write() the buffer, data is copied into the pipe
+ *          -w vmsplice : vmsplice() the buffer, the pipe references the
+ *                        user pages instead of copying them
+ *   reader -r read     : read() out of the pipe, a second copy
+ *          -r null     : splice() the pipe into /dev/null, no copy
+ *          -r socket   : splice() the pipe into a unix stream socket
+ *
+ * The buffer is page aligned, because vmsplice can only map whole pages
+ * into the pipe, and the pipe itself can be grown with -p (F_SETPIPE_SZ)
+ * so that one vmsplice/splice moves more than the default 64 KiB. */
+
+#define DEFAULT_BUFSIZE (4*1024*1024)
+#define DEFAULT_COUNT (10000)
+
+enum { WR_WRITE, WR_VMSPLICE };
+enum { RD_READ, RD_NULL, RD_SOCKET };
+
+static int full_write(int fd, const char *buff, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buff, len);
+        if (n < 0)
+            return -1;
+        buff += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int full_vmsplice(int fd, char *buff, size_t len)
+{
+    struct iovec iov;
+    ssize_t n;
+
+    while (len > 0) {
+        iov.iov_base = buff;
+        iov.iov_len = len;
+        n = vmsplice(fd, &iov, 1, 0);
+        if (n < 0)
+            return -1;
+        buff += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Reads and throws away whatever arrives on the other end of the socket */
+static void drain(int fd, char *buff, size_t size)
+{
+    while (read(fd, buff, size) > 0)
+        ;
+    exit(EXIT_SUCCESS);
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-w write|vmsplice] [-r read|null|socket] [-b bufsize] [-n count] [-p pipesize]\n", prog);
+}
+
+int main(int argc, char *argv[])
 {
-    
-    char buff[4*1024*1024];
+    char *buff;
     pid_t pid;
     int pipefds[2];
+    int opt;
+    int wmode = WR_WRITE, rmode = RD_READ;
+    size_t bufsize = DEFAULT_BUFSIZE;
+    long count = DEFAULT_COUNT;
+    int pipesize = 0;
+
+    while ((opt = getopt(argc, argv, "w:r:b:n:p:h")) != -1) {
+        switch (opt) {
+        case 'w':
+            if (strcmp(optarg, "vmsplice") == 0)
+                wmode = WR_VMSPLICE;
+            else if (strcmp(optarg, "write") != 0)
+                goto bad_usage;
+            break;
+        case 'r':
+            if (strcmp(optarg, "null") == 0)
+                rmode = RD_NULL;
+            else if (strcmp(optarg, "socket") == 0)
+                rmode = RD_SOCKET;
+            else if (strcmp(optarg, "read") != 0)
+                goto bad_usage;
+            break;
+        case 'b':
+            bufsize = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = atol(optarg);
+            break;
+        case 'p':
+            pipesize = atoi(optarg);
+            break;
+        default:
+            goto bad_usage;
+        }
+    }
+
+    if (posix_memalign((void **)&buff, sysconf(_SC_PAGESIZE), bufsize) != 0) {
+        perror("posix_memalign ");
+        exit(EXIT_FAILURE);
+    }
+    memset(buff, 'x', bufsize);    /* fault the pages in before timing */
+
     if (pipe(pipefds) < 0) {
         perror("pipe ");
         exit(EXIT_FAILURE);
     }
+    if (pipesize > 0 && fcntl(pipefds[1], F_SETPIPE_SZ, pipesize) < 0) {
+        perror("F_SETPIPE_SZ ");
+        exit(EXIT_FAILURE);
+    }
+    printf("pipe size %d bytes, buffer %zu bytes x %ld\n",
+           fcntl(pipefds[1], F_GETPIPE_SZ), bufsize, count);
 
     pid = fork();
     if (pid<0) {
@@ -20,31 +136,79 @@ int main(int argc, const char *argv[])
         exit(EXIT_FAILURE);
     } else if (pid>0) { // parent
         close(pipefds[0]);          /* Close unused read end */
-        printf("Begin writing data...\n");
-        int i = 10000;
-        while(i--)
-            write(pipefds[1], buff, sizeof(buff));
+        printf("Begin writing data (%s)...\n", wmode == WR_VMSPLICE ? "vmsplice" : "write");
+        long i = count;
+        int ret = 0;
+        while(i-- && ret == 0) {
+            if (wmode == WR_VMSPLICE)
+                ret = full_vmsplice(pipefds[1], buff, bufsize);
+            else
+                ret = full_write(pipefds[1], buff, bufsize);
+        }
+        if (ret < 0)
+            perror("write ");
         printf("write data finish\n");
         close(pipefds[1]);          /* Reader will see EOF */
+        wait(NULL);
     } else { // child
-        close(pipefds[1]);          /* Close unused write end */        
+        close(pipefds[1]);          /* Close unused write end */
         long read_in_bytes = 0;
-        int ret = 0;
-        struct timeval tv_before,tv_after;  
-        
+        ssize_t ret = 0;
+        int outfd = -1;
+        int sv[2];
+        struct timeval tv_before,tv_after;
+
+        if (rmode == RD_NULL) {
+            outfd = open("/dev/null", O_WRONLY);
+            if (outfd < 0) {
+                perror("open /dev/null ");
+                exit(EXIT_FAILURE);
+            }
+        } else if (rmode == RD_SOCKET) {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+                perror("socketpair ");
+                exit(EXIT_FAILURE);
+            }
+            if (fork() == 0) {
+                close(sv[0]);
+                close(pipefds[0]);
+                drain(sv[1], buff, bufsize);
+            }
+            close(sv[1]);
+            outfd = sv[0];
+        }
+
         gettimeofday(&tv_before, NULL);
-        while ((ret = read(pipefds[0], buff, sizeof(buff))) > 0) {
-            read_in_bytes += ret;
+        if (rmode == RD_READ) {
+            while ((ret = read(pipefds[0], buff, bufsize)) > 0) {
+                read_in_bytes += ret;
+            }
+        } else {
+            while ((ret = splice(pipefds[0], NULL, outfd, NULL, bufsize,
+                                 SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) {
+                read_in_bytes += ret;
+            }
         }
+        if (ret < 0)
+            perror("read ");
         gettimeofday(&tv_after, NULL);
-         
-        float total_time_in_second = (tv_after.tv_sec+tv_after.tv_usec/1000000) -
-                                     (tv_before.tv_sec+tv_before.tv_usec/1000000);
-        printf ("Read %ld bytes finish in %0.2f seconds\n", read_in_bytes ,total_time_in_second);
-        float rate = read_in_bytes/(1024*1024*total_time_in_second);
-        printf("Pipe rate in linux is %0.2f Mbps\n", rate);
+
+        double total_time_in_second = (tv_after.tv_sec - tv_before.tv_sec) +
+                                      (tv_after.tv_usec - tv_before.tv_usec) / 1000000.0;
+        printf ("Read %ld bytes finish in %0.2f seconds (%s)\n", read_in_bytes ,total_time_in_second,
+                rmode == RD_READ ? "read" : rmode == RD_NULL ? "splice to /dev/null" : "splice to socket");
+        double rate = read_in_bytes/(1024*1024*total_time_in_second);
+        printf("Pipe rate in linux is %0.2f MiB/s\n", rate);
         close(pipefds[0]);
+        if (outfd >= 0)
+            close(outfd);
+        if (rmode == RD_SOCKET)
+            wait(NULL);
     }
 
     return 0;
+
+bad_usage:
+    usage(argv[0]);
+    return EXIT_FAILURE;
 }
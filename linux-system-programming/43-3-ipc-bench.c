@@ -0,0 +1,681 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <mqueue.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+
+/* One benchmark for the IPC mechanisms of chapter 43:
+ *
+ *   pipe, fifo, sysv (System V message queue), mq (POSIX message queue),
+ *   unix-stream, unix-dgram, socketpair, eventfd, shm (POSIX shared
+ *   memory + process-shared semaphores)
+ *
+ * For every mechanism and message size two tests run between a parent
+ * and a forked child, each pinned to its own CPU:
+ *   - bulk: the parent streams messages one way, reports MiB/s and msg/s
+ *   - ping-pong: the child echoes every message, reports round-trip
+ *     latency percentiles
+ *
+ * It replaces the System V message queue test of 43-2 (-m sysv); 43-1
+ * stays as the pipe benchmark with its vmsplice/splice variants.
+ *
+ * Build: gcc -O2 -Wall 43-3-ipc-bench.c -o ipc-bench -lrt -lpthread
+ */
+
+#define MAX_SIZES (32)
+#define BULK_BYTES (256L*1024*1024)
+#define BULK_MAX_MSGS (200000)
+#define PINGPONG_BYTES (64L*1024*1024)
+#define PINGPONG_MAX_ITERS (20000)
+#define PINGPONG_WARMUP (100)
+
+/* One direction of a channel. Every mechanism is set up as two of these,
+ * parent->child and child->parent, before the fork. */
+struct endpoint {
+    int rfd;
+    int wfd;
+    int msqid;
+    mqd_t mq;
+    struct shm_slot *shm;
+    char *msgbuf;       /* sysv: mtype header + payload */
+};
+
+struct shm_slot {
+    sem_t full;
+    sem_t empty;
+    size_t len;
+    char data[];
+};
+
+struct mechanism {
+    const char *name;
+    int fixed_size;     /* only carries this many bytes, 0 = any size */
+    int (*setup)(struct endpoint *e, size_t size, int idx);
+    int (*send)(struct endpoint *e, const char *buf, size_t len);
+    int (*recv)(struct endpoint *e, char *buf, size_t len);
+    void (*teardown)(struct endpoint *e, size_t size);
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* the CPUs we were allowed to run on at startup */
+static cpu_set_t orig_affinity;
+
+static void restore_affinity(void)
+{
+    sched_setaffinity(0, sizeof(orig_affinity), &orig_affinity);
+}
+
+static int pin_cpu(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0)
+        return 0;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static long read_proc_long(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    long v = -1;
+
+    if (fp) {
+        if (fscanf(fp, "%ld", &v) != 1)
+            v = -1;
+        fclose(fp);
+    }
+    return v;
+}
+
+/* ---- byte streams: pipe, fifo, unix-stream, socketpair ---- */
+
+static int stream_send(struct endpoint *e, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(e->wfd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int stream_recv(struct endpoint *e, char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(e->rfd, buf, len);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void fd_teardown(struct endpoint *e, size_t size)
+{
+    close(e->rfd);
+    if (e->wfd != e->rfd)
+        close(e->wfd);
+}
+
+static int pipe_setup(struct endpoint *e, size_t size, int idx)
+{
+    int fds[2];
+
+    if (pipe(fds) < 0)
+        return -1;
+    e->rfd = fds[0];
+    e->wfd = fds[1];
+    /* a bigger pipe lets large messages go through in fewer wakeups */
+    fcntl(e->wfd, F_SETPIPE_SZ, 1024 * 1024);
+    return 0;
+}
+
+static int fifo_setup(struct endpoint *e, size_t size, int idx)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/tmp/ipc-bench-%d-%d.fifo", getpid(), idx);
+    unlink(path);
+    if (mkfifo(path, S_IRUSR | S_IWUSR) < 0)
+        return -1;
+
+    /* open the read end non-blocking first so the write open does not
+     * wait for a reader, then switch it back to blocking */
+    e->rfd = open(path, O_RDONLY | O_NONBLOCK);
+    e->wfd = open(path, O_WRONLY);
+    unlink(path);
+    if (e->rfd < 0 || e->wfd < 0)
+        return -1;
+    fcntl(e->rfd, F_SETFL, 0);
+    fcntl(e->wfd, F_SETPIPE_SZ, 1024 * 1024);
+    return 0;
+}
+
+static int socketpair_setup(struct endpoint *e, size_t size, int idx)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        return -1;
+    e->wfd = sv[0];
+    e->rfd = sv[1];
+    return 0;
+}
+
+/* A named (abstract namespace) listener, connect and accept: the way two
+ * unrelated processes would normally find each other. */
+static int unix_connect_pair(struct endpoint *e, int type, int idx)
+{
+    struct sockaddr_un addr;
+    socklen_t alen;
+    int lfd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "ipc-bench-%d-%d", getpid(), idx);
+    alen = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1);
+
+    lfd = socket(AF_UNIX, type, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, alen) < 0)
+        return -1;
+
+    if (type == SOCK_DGRAM) {
+        e->rfd = lfd;
+        e->wfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (e->wfd < 0 || connect(e->wfd, (struct sockaddr *)&addr, alen) < 0)
+            return -1;
+        return 0;
+    }
+
+    if (listen(lfd, 1) < 0)
+        return -1;
+    e->wfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (e->wfd < 0 || connect(e->wfd, (struct sockaddr *)&addr, alen) < 0)
+        return -1;
+    e->rfd = accept(lfd, NULL, NULL);
+    close(lfd);
+    return e->rfd < 0 ? -1 : 0;
+}
+
+static int unix_stream_setup(struct endpoint *e, size_t size, int idx)
+{
+    return unix_connect_pair(e, SOCK_STREAM, idx);
+}
+
+/* ---- datagrams: unix-dgram ---- */
+
+static int unix_dgram_setup(struct endpoint *e, size_t size, int idx)
+{
+    int sndbuf = (int)(size * 2 + 4096);
+    socklen_t len = sizeof(sndbuf);
+
+    if (unix_connect_pair(e, SOCK_DGRAM, idx) < 0)
+        return -1;
+
+    /* a datagram must fit into the sender's socket buffer in one piece */
+    setsockopt(e->wfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    getsockopt(e->wfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+    if ((size_t)sndbuf < size + 512) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return 0;
+}
+
+static int dgram_send(struct endpoint *e, const char *buf, size_t len)
+{
+    return send(e->wfd, buf, len, 0) == (ssize_t)len ? 0 : -1;
+}
+
+static int dgram_recv(struct endpoint *e, char *buf, size_t len)
+{
+    return recv(e->rfd, buf, len, 0) == (ssize_t)len ? 0 : -1;
+}
+
+/* ---- System V message queue ---- */
+
+static int sysv_setup(struct endpoint *e, size_t size, int idx)
+{
+    long msgmax = read_proc_long("/proc/sys/kernel/msgmax");
+    long msgmnb = read_proc_long("/proc/sys/kernel/msgmnb");
+
+    if ((msgmax > 0 && (long)size > msgmax) || (msgmnb > 0 && (long)size > msgmnb)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    e->msqid = msgget(IPC_PRIVATE, S_IRUSR | S_IWUSR);
+    if (e->msqid < 0)
+        return -1;
+    e->msgbuf = malloc(sizeof(long) + size);
+    if (e->msgbuf == NULL)
+        return -1;
+    *(long *)e->msgbuf = 1;
+    return 0;
+}
+
+static int sysv_send(struct endpoint *e, const char *buf, size_t len)
+{
+    memcpy(e->msgbuf + sizeof(long), buf, len);
+    while (msgsnd(e->msqid, e->msgbuf, len, 0) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+static int sysv_recv(struct endpoint *e, char *buf, size_t len)
+{
+    ssize_t n;
+
+    while ((n = msgrcv(e->msqid, e->msgbuf, len, 0, 0)) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    memcpy(buf, e->msgbuf + sizeof(long), n);
+    return (size_t)n == len ? 0 : -1;
+}
+
+static void sysv_teardown(struct endpoint *e, size_t size)
+{
+    msgctl(e->msqid, IPC_RMID, NULL);
+    free(e->msgbuf);
+}
+
+/* ---- POSIX message queue ---- */
+
+static int mq_setup(struct endpoint *e, size_t size, int idx)
+{
+    struct mq_attr attr;
+    char name[64];
+
+    memset(&attr, 0, sizeof(attr));
+    attr.mq_maxmsg = 10;
+    attr.mq_msgsize = size;
+
+    snprintf(name, sizeof(name), "/ipc-bench-%d-%d", getpid(), idx);
+    e->mq = mq_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, &attr);
+    if (e->mq == (mqd_t)-1)
+        return -1;
+    mq_unlink(name);    /* the descriptor survives the fork, the name is not needed */
+    return 0;
+}
+
+static int mq_send_msg(struct endpoint *e, const char *buf, size_t len)
+{
+    while (mq_send(e->mq, buf, len, 0) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+static int mq_recv_msg(struct endpoint *e, char *buf, size_t len)
+{
+    ssize_t n;
+
+    while ((n = mq_receive(e->mq, buf, len, NULL)) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return (size_t)n == len ? 0 : -1;
+}
+
+static void mq_teardown(struct endpoint *e, size_t size)
+{
+    mq_close(e->mq);
+}
+
+/* ---- eventfd: a notification only, 8 bytes of counter ---- */
+
+static int eventfd_setup(struct endpoint *e, size_t size, int idx)
+{
+    /* semaphore mode, so back-to-back posts are not merged into one read */
+    e->rfd = e->wfd = eventfd(0, EFD_SEMAPHORE);
+    return e->rfd < 0 ? -1 : 0;
+}
+
+static int eventfd_send(struct endpoint *e, const char *buf, size_t len)
+{
+    uint64_t v = 1;
+
+    return write(e->wfd, &v, sizeof(v)) == sizeof(v) ? 0 : -1;
+}
+
+static int eventfd_recv(struct endpoint *e, char *buf, size_t len)
+{
+    uint64_t v;
+
+    return read(e->rfd, &v, sizeof(v)) == sizeof(v) ? 0 : -1;
+}
+
+/* ---- POSIX shared memory, one slot guarded by two semaphores ---- */
+
+static int shm_setup(struct endpoint *e, size_t size, int idx)
+{
+    char name[64];
+    size_t total = sizeof(struct shm_slot) + size;
+    int fd;
+
+    snprintf(name, sizeof(name), "/ipc-bench-%d-%d", getpid(), idx);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        return -1;
+    shm_unlink(name);
+    if (ftruncate(fd, total) < 0) {
+        close(fd);
+        return -1;
+    }
+    e->shm = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (e->shm == MAP_FAILED)
+        return -1;
+
+    sem_init(&e->shm->full, 1, 0);
+    sem_init(&e->shm->empty, 1, 1);
+    return 0;
+}
+
+static int shm_send(struct endpoint *e, const char *buf, size_t len)
+{
+    while (sem_wait(&e->shm->empty) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    memcpy(e->shm->data, buf, len);
+    e->shm->len = len;
+    return sem_post(&e->shm->full);
+}
+
+static int shm_recv(struct endpoint *e, char *buf, size_t len)
+{
+    while (sem_wait(&e->shm->full) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    memcpy(buf, e->shm->data, len);
+    return sem_post(&e->shm->empty);
+}
+
+static void shm_teardown(struct endpoint *e, size_t size)
+{
+    sem_destroy(&e->shm->full);
+    sem_destroy(&e->shm->empty);
+    munmap(e->shm, sizeof(struct shm_slot) + size);
+}
+
+static const struct mechanism mechanisms[] = {
+    { "pipe",        0, pipe_setup,        stream_send,   stream_recv,   fd_teardown },
+    { "fifo",        0, fifo_setup,        stream_send,   stream_recv,   fd_teardown },
+    { "sysv",        0, sysv_setup,        sysv_send,     sysv_recv,     sysv_teardown },
+    { "mq",          0, mq_setup,          mq_send_msg,   mq_recv_msg,   mq_teardown },
+    { "unix-stream", 0, unix_stream_setup, stream_send,   stream_recv,   fd_teardown },
+    { "unix-dgram",  0, unix_dgram_setup,  dgram_send,    dgram_recv,    fd_teardown },
+    { "socketpair",  0, socketpair_setup,  stream_send,   stream_recv,   fd_teardown },
+    { "eventfd",     8, eventfd_setup,     eventfd_send,  eventfd_recv,  fd_teardown },
+    { "shm",         0, shm_setup,         shm_send,      shm_recv,      shm_teardown },
+};
+
+#define NR_MECHANISMS (sizeof(mechanisms) / sizeof(mechanisms[0]))
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(uint64_t *v, long n, double p)
+{
+    long i = (long)(p / 100.0 * n);
+
+    if (i >= n)
+        i = n - 1;
+    return v[i] / 1000.0;
+}
+
+/* Runs both tests for one mechanism and size; returns -1 if the
+ * mechanism cannot carry messages of this size. */
+static int bench_one(const struct mechanism *m, size_t size, int cpu_parent,
+                     int cpu_child, long bulk_msgs_max, long pp_iters_max)
+{
+    struct endpoint fwd, back;
+    long bulk_msgs, pp_iters, i;
+    uint64_t t0, t1, *rtt;
+    char *buf;
+    pid_t pid;
+    int status;
+
+    memset(&fwd, 0, sizeof(fwd));
+    memset(&back, 0, sizeof(back));
+    if (m->setup(&fwd, size, 0) < 0) {
+        printf("%-12s %9zu  n/a (%s)\n", m->name, size, strerror(errno));
+        return -1;
+    }
+    if (m->setup(&back, size, 1) < 0) {
+        printf("%-12s %9zu  n/a (%s)\n", m->name, size, strerror(errno));
+        m->teardown(&fwd, size);
+        return -1;
+    }
+
+    bulk_msgs = BULK_BYTES / size;
+    if (bulk_msgs > bulk_msgs_max)
+        bulk_msgs = bulk_msgs_max;
+    if (bulk_msgs < 16)
+        bulk_msgs = 16;
+    pp_iters = PINGPONG_BYTES / size;
+    if (pp_iters > pp_iters_max)
+        pp_iters = pp_iters_max;
+    if (pp_iters < 16)
+        pp_iters = 16;
+
+    buf = malloc(size);
+    rtt = malloc(pp_iters * sizeof(*rtt));
+    if (buf == NULL || rtt == NULL) {
+        perror("malloc ");
+        exit(EXIT_FAILURE);
+    }
+    memset(buf, 'x', size);
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork ");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) { // child: sink, then echo
+        pin_cpu(cpu_child);
+        for (i = 0; i < bulk_msgs; i++)
+            if (m->recv(&fwd, buf, size) < 0)
+                _exit(EXIT_FAILURE);
+        if (m->send(&back, buf, size) < 0)
+            _exit(EXIT_FAILURE);
+        for (i = 0; i < pp_iters + PINGPONG_WARMUP; i++) {
+            if (m->recv(&fwd, buf, size) < 0 || m->send(&back, buf, size) < 0)
+                _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    pin_cpu(cpu_parent);
+
+    /* bulk: the final ack makes sure everything has been received */
+    t0 = now_ns();
+    for (i = 0; i < bulk_msgs; i++)
+        if (m->send(&fwd, buf, size) < 0)
+            goto failed;
+    if (m->recv(&back, buf, size) < 0)
+        goto failed;
+    t1 = now_ns();
+
+    for (i = 0; i < pp_iters + PINGPONG_WARMUP; i++) {
+        uint64_t s = now_ns();
+        if (m->send(&fwd, buf, size) < 0 || m->recv(&back, buf, size) < 0)
+            goto failed;
+        if (i >= PINGPONG_WARMUP)
+            rtt[i - PINGPONG_WARMUP] = now_ns() - s;
+    }
+
+    waitpid(pid, &status, 0);
+    qsort(rtt, pp_iters, sizeof(*rtt), cmp_u64);
+
+    printf("%-12s %9zu %10.1f %11.0f %9.2f %9.2f %9.2f %9.2f\n",
+           m->name, size,
+           (double)bulk_msgs * size / (1024.0 * 1024.0) / ((t1 - t0) / 1e9),
+           bulk_msgs / ((t1 - t0) / 1e9),
+           percentile_us(rtt, pp_iters, 50),
+           percentile_us(rtt, pp_iters, 90),
+           percentile_us(rtt, pp_iters, 99),
+           percentile_us(rtt, pp_iters, 99.9));
+    fflush(stdout);
+
+    restore_affinity();
+    m->teardown(&fwd, size);
+    m->teardown(&back, size);
+    free(buf);
+    free(rtt);
+    return 0;
+
+failed:
+    printf("%-12s %9zu  failed (%s)\n", m->name, size, strerror(errno));
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    restore_affinity();
+    m->teardown(&fwd, size);
+    m->teardown(&back, size);
+    free(buf);
+    free(rtt);
+    return -1;
+}
+
+/* Is name one of the comma separated entries in list? */
+static int in_list(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = list;
+
+    while ((p = strstr(p, name)) != NULL) {
+        if ((p == list || p[-1] == ',') && (p[len] == '\0' || p[len] == ','))
+            return 1;
+        p += len;
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    unsigned int i;
+
+    printf("usage: %s [-m mech[,mech...]] [-s size[,size...]] [-c parentcpu,childcpu] [-n bulkmsgs] [-l iters]\n", prog);
+    printf("  mechanisms:");
+    for (i = 0; i < NR_MECHANISMS; i++)
+        printf(" %s", mechanisms[i].name);
+    printf("\n  default sizes: 8 64 512 4K 32K 256K 4M bytes; cpus 0,1\n");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t sizes[MAX_SIZES] = { 8, 64, 512, 4096, 32768, 262144, 4194304 };
+    int nsizes = 7;
+    const char *only = NULL;
+    int cpu_parent = 0, cpu_child = 1;
+    long bulk_msgs_max = BULK_MAX_MSGS, pp_iters_max = PINGPONG_MAX_ITERS;
+    long ncpu;
+    unsigned int i;
+    char *tok, *save;
+    int opt, j;
+
+    while ((opt = getopt(argc, argv, "m:s:c:n:l:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            only = optarg;
+            break;
+        case 's':
+            nsizes = 0;
+            for (tok = strtok_r(optarg, ",", &save); tok && nsizes < MAX_SIZES;
+                 tok = strtok_r(NULL, ",", &save))
+                sizes[nsizes++] = strtoul(tok, NULL, 0);
+            break;
+        case 'c':
+            if (sscanf(optarg, "%d,%d", &cpu_parent, &cpu_child) != 2) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            bulk_msgs_max = atol(optarg);
+            break;
+        case 'l':
+            pp_iters_max = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (sched_getaffinity(0, sizeof(orig_affinity), &orig_affinity) < 0) {
+        perror("sched_getaffinity ");
+        return EXIT_FAILURE;
+    }
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_parent >= ncpu)
+        cpu_parent = -1;
+    if (cpu_child >= ncpu)
+        cpu_child = -1;
+    printf("# parent cpu %d, child cpu %d (-1 = not pinned)\n", cpu_parent, cpu_child);
+    printf("%-12s %9s %10s %11s %9s %9s %9s %9s\n",
+           "mechanism", "size", "MiB/s", "msg/s", "p50(us)", "p90(us)", "p99(us)", "p99.9(us)");
+
+    for (i = 0; i < NR_MECHANISMS; i++) {
+        const struct mechanism *m = &mechanisms[i];
+
+        if (only && !in_list(only, m->name))
+            continue;
+        if (m->fixed_size) {
+            bench_one(m, m->fixed_size, cpu_parent, cpu_child, bulk_msgs_max, pp_iters_max);
+            continue;
+        }
+        for (j = 0; j < nsizes; j++)
+            bench_one(m, sizes[j], cpu_parent, cpu_child, bulk_msgs_max, pp_iters_max);
+    }
+
+    return 0;
+}
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "./shm_ring.h"
+
+/* Cross-process message passing through the shared-memory ring in
+ * shm_ring.c, compared with the pipe path of 43-1.c.
+ *
+ *   -t spsc : one producer, one consumer, SPSC ring
+ *   -t mpmc : -P producers, -C consumers, MPMC ring
+ *   -t pipe : the same messages through a pipe with write()/read()
+ *
+ * Reports bulk throughput and the ping-pong round-trip latency between
+ * two processes pinned to different CPUs.
+ *
+ * Build: gcc -O2 -Wall 43-4-shm-ring.c shm_ring.c -o shm-ring -lrt
+ */
+
+#define RING_SLOTS (1024)
+#define PINGPONG_WARMUP (1000)
+
+enum { T_SPSC, T_MPMC, T_PIPE };
+
+/* A channel is a ring or a pipe; both carry fixed-size messages here */
+struct chan {
+    int type;
+    struct shm_ring ring;
+    int fds[2];
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void pin_cpu(int cpu)
+{
+    cpu_set_t set;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % ncpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+static int chan_create(struct chan *c, int type, int idx, uint32_t msg_max)
+{
+    char name[64];
+
+    c->type = type;
+    if (type == T_PIPE)
+        return pipe(c->fds);
+
+    /* the mapping is inherited across fork, the name can go right away */
+    snprintf(name, sizeof(name), "/shm-ring-bench-%d-%d", getpid(), idx);
+    if (shm_ring_create(&c->ring, name, type == T_SPSC ? SHM_RING_SPSC : SHM_RING_MPMC,
+                        RING_SLOTS, msg_max) < 0)
+        return -1;
+    shm_ring_unlink(name);
+    return 0;
+}
+
+static int chan_send(struct chan *c, const char *buf, uint32_t len)
+{
+    ssize_t n;
+
+    if (c->type != T_PIPE)
+        return shm_ring_send(&c->ring, buf, len);
+
+    while (len > 0) {
+        n = write(c->fds[1], buf, len);
+        if (n < 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int chan_recv(struct chan *c, char *buf, uint32_t len)
+{
+    ssize_t n;
+    uint32_t got = 0;
+
+    if (c->type != T_PIPE)
+        return shm_ring_recv(&c->ring, buf, len);
+
+    while (got < len) {
+        n = read(c->fds[0], buf + got, len - got);
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+    return (int)got;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Producers each send their share, then the parent sends one empty
+ * message per consumer as an end marker (pipes have no message
+ * boundaries, so there the consumer simply counts). */
+static void bench_throughput(int type, uint32_t size, long nmsgs, int nprod, int ncons)
+{
+    struct chan c;
+    char *buf;
+    uint64_t t0, t1;
+    long i, share;
+    int p, status;
+
+    if (chan_create(&c, type, 0, size) < 0) {
+        perror("create channel ");
+        exit(EXIT_FAILURE);
+    }
+    buf = calloc(1, size);
+
+    t0 = now_ns();
+    for (p = 0; p < ncons; p++) {
+        if (fork() == 0) {
+            pin_cpu(1 + nprod + p);
+            share = nmsgs / ncons;
+            if (type == T_PIPE) {
+                for (i = 0; i < share; i++)
+                    if (chan_recv(&c, buf, size) < 0)
+                        _exit(EXIT_FAILURE);
+            } else {
+                while (shm_ring_recv(&c.ring, buf, size) > 0)
+                    ;
+            }
+            _exit(EXIT_SUCCESS);
+        }
+    }
+    for (p = 0; p < nprod; p++) {
+        if (fork() == 0) {
+            pin_cpu(1 + p);
+            share = nmsgs / nprod;
+            for (i = 0; i < share; i++)
+                if (chan_send(&c, buf, size) < 0)
+                    _exit(EXIT_FAILURE);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    for (p = 0; p < nprod; p++)
+        wait(&status);
+    if (type != T_PIPE)
+        for (p = 0; p < ncons; p++)
+            shm_ring_send(&c.ring, buf, 0);
+    for (p = 0; p < ncons; p++)
+        wait(&status);
+    t1 = now_ns();
+
+    printf("throughput  %-5s %dP/%dC size %6u: %10.0f msg/s %9.1f MiB/s\n",
+           type == T_SPSC ? "spsc" : type == T_MPMC ? "mpmc" : "pipe",
+           nprod, ncons, size,
+           nmsgs / ((t1 - t0) / 1e9),
+           (double)nmsgs * size / (1024.0 * 1024.0) / ((t1 - t0) / 1e9));
+    free(buf);
+}
+
+static void bench_latency(int type, uint32_t size, long iters)
+{
+    struct chan fwd, back;
+    uint64_t *rtt, s;
+    char *buf;
+    long i;
+    pid_t pid;
+
+    if (type == T_MPMC)
+        type = T_SPSC;  /* one pair of processes: the SPSC ring is the right tool */
+    if (chan_create(&fwd, type, 1, size) < 0 || chan_create(&back, type, 2, size) < 0) {
+        perror("create channel ");
+        exit(EXIT_FAILURE);
+    }
+    buf = calloc(1, size);
+    rtt = malloc(iters * sizeof(*rtt));
+
+    pid = fork();
+    if (pid == 0) {
+        pin_cpu(1);
+        for (i = 0; i < iters + PINGPONG_WARMUP; i++) {
+            if (chan_recv(&fwd, buf, size) < 0 || chan_send(&back, buf, size) < 0)
+                _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    pin_cpu(0);
+    for (i = 0; i < iters + PINGPONG_WARMUP; i++) {
+        s = now_ns();
+        if (chan_send(&fwd, buf, size) < 0 || chan_recv(&back, buf, size) < 0) {
+            perror("ping-pong ");
+            exit(EXIT_FAILURE);
+        }
+        if (i >= PINGPONG_WARMUP)
+            rtt[i - PINGPONG_WARMUP] = now_ns() - s;
+    }
+    waitpid(pid, NULL, 0);
+
+    qsort(rtt, iters, sizeof(*rtt), cmp_u64);
+    printf("round trip  %-5s size %6u: p50 %7.0f ns  p90 %7.0f ns  p99 %7.0f ns  p99.9 %7.0f ns\n",
+           type == T_PIPE ? "pipe" : "spsc", size,
+           (double)rtt[iters / 2], (double)rtt[iters * 90 / 100],
+           (double)rtt[iters * 99 / 100], (double)rtt[iters * 999 / 1000]);
+    free(rtt);
+    free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, type = T_SPSC, nprod = 1, ncons = 1;
+    uint32_t size = 64;
+    long nmsgs = 10000000, iters = 100000;
+
+    while ((opt = getopt(argc, argv, "t:s:n:l:P:C:h")) != -1) {
+        switch (opt) {
+        case 't':
+            if (strcmp(optarg, "mpmc") == 0)
+                type = T_MPMC;
+            else if (strcmp(optarg, "pipe") == 0)
+                type = T_PIPE;
+            else if (strcmp(optarg, "spsc") == 0)
+                type = T_SPSC;
+            else
+                goto bad_usage;
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            nmsgs = atol(optarg);
+            break;
+        case 'l':
+            iters = atol(optarg);
+            break;
+        case 'P':
+            nprod = atoi(optarg);
+            break;
+        case 'C':
+            ncons = atoi(optarg);
+            break;
+        default:
+            goto bad_usage;
+        }
+    }
+
+    if (size == 0 || nprod < 1 || ncons < 1 || iters < 1)
+        goto bad_usage;
+    if (type != T_MPMC && (nprod != 1 || ncons != 1)) {
+        printf("several producers or consumers need -t mpmc\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_throughput(type, size, nmsgs, nprod, ncons);
+    bench_latency(type, size, iters);
+    return 0;
+
+bad_usage:
+    printf("usage: %s [-t spsc|mpmc|pipe] [-s size] [-n messages] [-l pingpongs] [-P producers] [-C consumers]\n", argv[0]);
+    return EXIT_FAILURE;
+}
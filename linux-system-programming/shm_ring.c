@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "./shm_ring.h"
+
+#define CACHELINE (64)
+#define SHM_RING_MAGIC (0x52494e47)     /* "RING" */
+#define SPIN_LIMIT (2000)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+/* Everything a producer writes sits on different cache lines from what a
+ * consumer writes, so the two sides never false-share. */
+struct shm_ring_hdr {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t nslots;
+    uint32_t slot_size;
+    uint32_t msg_max;
+
+    uint64_t head __attribute__((aligned(CACHELINE)));
+    uint64_t tail __attribute__((aligned(CACHELINE)));
+
+    /* futex words: bumped by the side that makes progress, waited on by
+     * the side that cannot */
+    uint32_t data_seq __attribute__((aligned(CACHELINE)));
+    uint32_t data_waiters;
+    uint32_t space_seq __attribute__((aligned(CACHELINE)));
+    uint32_t space_waiters;
+} __attribute__((aligned(CACHELINE)));
+
+struct shm_ring_slot {
+    uint64_t seq;       /* mpmc only */
+    uint32_t len;
+    uint32_t pad;
+    char data[];
+};
+
+static int futex_wait(uint32_t *addr, uint32_t val)
+{
+    return (int)syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static int futex_wake(uint32_t *addr, int n)
+{
+    return (int)syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0);
+}
+
+static inline struct shm_ring_slot *slot_at(struct shm_ring *r, uint64_t pos)
+{
+    return (struct shm_ring_slot *)(r->slots + (size_t)(pos & r->mask) * r->slot_size);
+}
+
+/* Called after publishing progress. The seq_cst fence pairs with the one
+ * in wait_until(): either we see the waiter, or it sees our progress. */
+static inline void wake_waiter(uint32_t *seq, uint32_t *waiters)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(seq, 1);
+    }
+}
+
+static void wait_until(struct shm_ring *r, int (*ready)(struct shm_ring *),
+                       uint32_t *seq, uint32_t *waiters)
+{
+    uint32_t val;
+    int i;
+
+    for (i = 0; i < r->spin; i++) {
+        if (ready(r))
+            return;
+        cpu_relax();
+    }
+
+    while (1) {
+        __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+        val = __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+        if (ready(r)) {
+            __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+            return;
+        }
+        futex_wait(seq, val);
+        __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+        if (ready(r))
+            return;
+    }
+}
+
+static int spsc_has_data(struct shm_ring *r)
+{
+    return __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&r->hdr->tail, __ATOMIC_RELAXED);
+}
+
+static int spsc_has_space(struct shm_ring *r)
+{
+    return __atomic_load_n(&r->hdr->head, __ATOMIC_RELAXED) -
+           __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE) < r->hdr->nslots;
+}
+
+static int mpmc_has_data(struct shm_ring *r)
+{
+    uint64_t pos = __atomic_load_n(&r->hdr->tail, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&slot_at(r, pos)->seq, __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+static int mpmc_has_space(struct shm_ring *r)
+{
+    uint64_t pos = __atomic_load_n(&r->hdr->head, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&slot_at(r, pos)->seq, __ATOMIC_ACQUIRE) == pos;
+}
+
+static int spsc_try_send(struct shm_ring *r, const void *buf, uint32_t len)
+{
+    struct shm_ring_hdr *h = r->hdr;
+    struct shm_ring_slot *s;
+    uint64_t head = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+
+    if (head - r->cached_tail >= h->nslots) {
+        r->cached_tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+        if (head - r->cached_tail >= h->nslots) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    s = slot_at(r, head);
+    memcpy(s->data, buf, len);
+    s->len = len;
+    __atomic_store_n(&h->head, head + 1, __ATOMIC_RELEASE);
+
+    wake_waiter(&h->data_seq, &h->data_waiters);
+    return 0;
+}
+
+static int spsc_try_recv(struct shm_ring *r, void *buf, uint32_t size)
+{
+    struct shm_ring_hdr *h = r->hdr;
+    struct shm_ring_slot *s;
+    uint64_t tail = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+    uint32_t len;
+
+    if (tail == r->cached_head) {
+        r->cached_head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+        if (tail == r->cached_head) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    s = slot_at(r, tail);
+    len = s->len;
+    if (len <= size)
+        memcpy(buf, s->data, len);
+    __atomic_store_n(&h->tail, tail + 1, __ATOMIC_RELEASE);
+
+    wake_waiter(&h->space_seq, &h->space_waiters);
+    if (len > size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return (int)len;
+}
+
+static int mpmc_try_send(struct shm_ring *r, const void *buf, uint32_t len)
+{
+    struct shm_ring_hdr *h = r->hdr;
+    struct shm_ring_slot *s;
+    uint64_t pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+    int64_t dif;
+
+    while (1) {
+        s = slot_at(r, pos);
+        dif = (int64_t)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&h->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            errno = EAGAIN;
+            return -1;
+        } else {
+            pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(s->data, buf, len);
+    s->len = len;
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+
+    wake_waiter(&h->data_seq, &h->data_waiters);
+    return 0;
+}
+
+static int mpmc_try_recv(struct shm_ring *r, void *buf, uint32_t size)
+{
+    struct shm_ring_hdr *h = r->hdr;
+    struct shm_ring_slot *s;
+    uint64_t pos = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+    uint32_t len;
+    int64_t dif;
+
+    while (1) {
+        s = slot_at(r, pos);
+        dif = (int64_t)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&h->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            errno = EAGAIN;
+            return -1;
+        } else {
+            pos = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    len = s->len;
+    if (len <= size)
+        memcpy(buf, s->data, len);
+    __atomic_store_n(&s->seq, pos + h->nslots, __ATOMIC_RELEASE);
+
+    wake_waiter(&h->space_seq, &h->space_waiters);
+    if (len > size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return (int)len;
+}
+
+int shm_ring_try_send(struct shm_ring *r, const void *buf, uint32_t len)
+{
+    if (len > r->msg_max) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (r->hdr->type == SHM_RING_SPSC)
+        return spsc_try_send(r, buf, len);
+    return mpmc_try_send(r, buf, len);
+}
+
+int shm_ring_try_recv(struct shm_ring *r, void *buf, uint32_t size)
+{
+    if (r->hdr->type == SHM_RING_SPSC)
+        return spsc_try_recv(r, buf, size);
+    return mpmc_try_recv(r, buf, size);
+}
+
+int shm_ring_send(struct shm_ring *r, const void *buf, uint32_t len)
+{
+    struct shm_ring_hdr *h = r->hdr;
+    int ret;
+
+    while ((ret = shm_ring_try_send(r, buf, len)) < 0 && errno == EAGAIN)
+        wait_until(r, h->type == SHM_RING_SPSC ? spsc_has_space : mpmc_has_space,
+                   &h->space_seq, &h->space_waiters);
+    return ret;
+}
+
+int shm_ring_recv(struct shm_ring *r, void *buf, uint32_t size)
+{
+    struct shm_ring_hdr *h = r->hdr;
+    int ret;
+
+    while ((ret = shm_ring_try_recv(r, buf, size)) < 0 && errno == EAGAIN)
+        wait_until(r, h->type == SHM_RING_SPSC ? spsc_has_data : mpmc_has_data,
+                   &h->data_seq, &h->data_waiters);
+    return ret;
+}
+
+static int shm_ring_map(struct shm_ring *r, int fd, size_t size)
+{
+    void *p;
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (p == MAP_FAILED)
+        return -1;
+
+    r->hdr = p;
+    r->slots = (char *)p + sizeof(struct shm_ring_hdr);
+    r->map_size = size;
+    return 0;
+}
+
+/* The geometry comes from h, which need not be the mapped header: an
+ * opener passes the copy it has validated, so a peer rewriting the shared
+ * header later cannot make us index past the mapping. */
+static void shm_ring_attach(struct shm_ring *r, const struct shm_ring_hdr *h)
+{
+    r->mask = h->nslots - 1;
+    r->slot_size = h->slot_size;
+    r->msg_max = h->msg_max;
+    r->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+    r->cached_head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+    r->cached_tail = __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE);
+}
+
+int shm_ring_create(struct shm_ring *r, const char *name, int type,
+                    uint32_t nslots, uint32_t msg_max)
+{
+    struct shm_ring_hdr *h;
+    uint32_t slot_size, n = 1, i;
+    size_t size;
+    int fd;
+
+    if ((type != SHM_RING_SPSC && type != SHM_RING_MPMC) || nslots == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    while (n < nslots)
+        n <<= 1;
+    slot_size = (sizeof(struct shm_ring_slot) + msg_max + CACHELINE - 1) & ~(CACHELINE - 1);
+    size = sizeof(struct shm_ring_hdr) + (size_t)n * slot_size;
+
+    memset(r, 0, sizeof(*r));
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, size) < 0 || shm_ring_map(r, fd, size) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    close(fd);
+
+    h = r->hdr;
+    h->type = type;
+    h->nslots = n;
+    h->slot_size = slot_size;
+    h->msg_max = msg_max;
+    r->mask = n - 1;
+    r->slot_size = slot_size;
+    for (i = 0; i < n; i++)
+        slot_at(r, i)->seq = i;
+
+    /* the magic is written last: a ring is only valid once it is there */
+    __atomic_store_n(&h->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    shm_ring_attach(r, h);
+    return 0;
+}
+
+/* Does h describe a ring shm_ring_create() made, fitting in size bytes?
+ * A stale or foreign segment of the same name must not get us to index
+ * slots past the end of the mapping. */
+static int shm_ring_hdr_valid(const struct shm_ring_hdr *h, size_t size)
+{
+    return h->magic == SHM_RING_MAGIC &&
+           (h->type == SHM_RING_SPSC || h->type == SHM_RING_MPMC) &&
+           h->nslots != 0 && (h->nslots & (h->nslots - 1)) == 0 &&
+           h->slot_size >= sizeof(struct shm_ring_slot) &&
+           h->slot_size % CACHELINE == 0 &&
+           h->msg_max <= h->slot_size - sizeof(struct shm_ring_slot) &&
+           size >= sizeof(*h) &&
+           h->nslots <= (size - sizeof(*h)) / h->slot_size;
+}
+
+int shm_ring_open(struct shm_ring *r, const char *name)
+{
+    struct shm_ring_hdr hdr;
+    struct stat st;
+    int fd;
+
+    memset(r, 0, sizeof(*r));
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        !shm_ring_hdr_valid(&hdr, st.st_size)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    if (shm_ring_map(r, fd, sizeof(hdr) + (size_t)hdr.nslots * hdr.slot_size) < 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if (__atomic_load_n(&r->hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC) {
+        shm_ring_close(r);
+        errno = EINVAL;
+        return -1;
+    }
+    shm_ring_attach(r, &hdr);
+    return 0;
+}
+
+void shm_ring_close(struct shm_ring *r)
+{
+    if (r->hdr)
+        munmap(r->hdr, r->map_size);
+    memset(r, 0, sizeof(*r));
+}
+
+int shm_ring_unlink(const char *name)
+{
+    return shm_unlink(name);
+}
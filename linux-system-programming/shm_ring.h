@@ -0,0 +1,62 @@
+#ifndef __SHM_RING_H__
+#define __SHM_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A message ring in POSIX shared memory (shm_open + mmap), usable between
+ * unrelated processes.
+ *
+ * SHM_RING_SPSC: one producer, one consumer. head and tail live on their
+ *   own cache lines and each side keeps a private copy of the other's
+ *   index, so the fast path is a few plain loads and one release store.
+ * SHM_RING_MPMC: any number of producers and consumers. Every slot carries
+ *   a sequence number (Vyukov's bounded queue), head and tail are claimed
+ *   with compare-and-swap.
+ *
+ * Neither variant makes a system call while the ring is neither empty nor
+ * full. A consumer finding it empty (or a producer finding it full) spins
+ * briefly (only on multi-cpu machines, where the other side can make
+ * progress meanwhile) and then sleeps on a futex in the shared header;
+ * the other side only issues FUTEX_WAKE when it sees somebody registered
+ * as waiting. */
+
+#define SHM_RING_SPSC (1)
+#define SHM_RING_MPMC (2)
+
+struct shm_ring_hdr;
+
+struct shm_ring {
+    struct shm_ring_hdr *hdr;
+    char *slots;
+    size_t map_size;
+    uint32_t mask;
+    uint32_t slot_size;
+    uint32_t msg_max;
+    int spin;               /* busy-wait rounds before sleeping, 0 on one cpu */
+    uint64_t cached_head;   /* spsc consumer: last head seen */
+    uint64_t cached_tail;   /* spsc producer: last tail seen */
+};
+
+/* Create (O_EXCL) and map a ring of nslots slots, nslots rounded up to a
+ * power of two, each holding a message of up to msg_max bytes.
+ * Returns 0 or -1 with errno set. */
+int shm_ring_create(struct shm_ring *r, const char *name, int type,
+                    uint32_t nslots, uint32_t msg_max);
+
+/* Map a ring somebody else created */
+int shm_ring_open(struct shm_ring *r, const char *name);
+
+void shm_ring_close(struct shm_ring *r);
+int shm_ring_unlink(const char *name);
+
+/* Blocking send/receive. recv returns the message length, or -1 if the
+ * message does not fit into size bytes (it is dropped). */
+int shm_ring_send(struct shm_ring *r, const void *buf, uint32_t len);
+int shm_ring_recv(struct shm_ring *r, void *buf, uint32_t size);
+
+/* Non-blocking variants, return -1 with errno EAGAIN when full/empty */
+int shm_ring_try_send(struct shm_ring *r, const void *buf, uint32_t len);
+int shm_ring_try_recv(struct shm_ring *r, void *buf, uint32_t size);
+
+#endif
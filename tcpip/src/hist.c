@@ -0,0 +1,99 @@
+#include <string.h>
+
+#include "./hist.h"
+
+static int hist_index(uint64_t v)
+{
+    int shift;
+
+    if (v < HIST_SUB_COUNT)
+        return (int)v;
+
+    /* v >> shift always falls in [HIST_SUB_COUNT, 2 * HIST_SUB_COUNT) */
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return shift * HIST_SUB_COUNT + (int)(v >> shift);
+}
+
+/* Highest value that maps to bucket idx */
+static uint64_t hist_value(int idx)
+{
+    int shift;
+    uint64_t sub;
+
+    if (idx < HIST_SUB_COUNT)
+        return idx;
+
+    shift = idx / HIST_SUB_COUNT - 1;
+    sub = idx - shift * HIST_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+void hist_init(struct hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hist_record(struct hist *h, uint64_t value)
+{
+    h->counts[hist_index(value)]++;
+    h->count++;
+    h->sum += (double)value;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t hist_percentile(const struct hist *h, double p)
+{
+    uint64_t target, seen = 0;
+    uint64_t v;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+
+    target = (uint64_t)(p / 100.0 * h->count + 0.5);
+    if (target < 1)
+        target = 1;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            v = hist_value(i);
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+void hist_print_json(FILE *fp, const char *name, const struct hist *h)
+{
+    fprintf(fp, "\"%s\": {\"count\": %llu, \"min\": %llu, \"mean\": %.1f, "
+            "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p99.9\": %llu, "
+            "\"p99.99\": %llu, \"max\": %llu}",
+            name, (unsigned long long)h->count,
+            (unsigned long long)(h->count ? h->min : 0),
+            h->count ? h->sum / h->count : 0.0,
+            (unsigned long long)hist_percentile(h, 50.0),
+            (unsigned long long)hist_percentile(h, 90.0),
+            (unsigned long long)hist_percentile(h, 99.0),
+            (unsigned long long)hist_percentile(h, 99.9),
+            (unsigned long long)hist_percentile(h, 99.99),
+            (unsigned long long)h->max);
+}
@@ -0,0 +1,31 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Log-linear latency histogram in the spirit of HdrHistogram.
+ * Values below 2^HIST_SUB_BITS are recorded exactly; above that every
+ * power-of-two range is split into 2^HIST_SUB_BITS linear sub-buckets,
+ * which keeps the relative error under 1% for HIST_SUB_BITS = 7. */
+#define HIST_SUB_BITS (7)
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+struct hist {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    uint64_t counts[HIST_BUCKETS];
+};
+
+void hist_init(struct hist *h);
+void hist_record(struct hist *h, uint64_t value);
+void hist_merge(struct hist *dst, const struct hist *src);
+uint64_t hist_percentile(const struct hist *h, double p);
+
+/* Print the summary as a JSON object: "name": {count, min, mean, p50, ...} */
+void hist_print_json(FILE *fp, const char *name, const struct hist *h);
+
+#endif
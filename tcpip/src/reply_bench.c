@@ -0,0 +1,120 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "./reply_cache.h"
+
+#define MAXBUFSIZE (200)
+
+/* Measures the CPU spent producing one time reply, the old way
+ * (time + ctime + snprintf per connection) against a copy out of the
+ * shared reply cache, with several threads reading concurrently as the
+ * timeserv workers do. */
+
+struct bench_arg {
+    int use_cache;
+    long iters;
+    uint64_t cpu_ns;
+    unsigned long sink;
+};
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *bench_thread(void *arg)
+{
+    struct bench_arg *a = arg;
+    char buff[MAXBUFSIZE];
+    char tbuf[32];
+    time_t ticks;
+    uint64_t t0;
+    long i;
+    int len;
+
+    t0 = thread_cpu_ns();
+    for (i = 0; i < a->iters; i++) {
+        if (a->use_cache) {
+            len = reply_cache_read(&reply_cache, buff, sizeof(buff), NULL);
+        } else {
+            ticks = time(NULL);
+            len = snprintf(buff, sizeof(buff), "%.24s\n", ctime_r(&ticks, tbuf));
+        }
+        a->sink += len + buff[len - 2];
+    }
+    a->cpu_ns = thread_cpu_ns() - t0;
+    return NULL;
+}
+
+static double run(int use_cache, int nthreads, long iters)
+{
+    struct bench_arg *args;
+    pthread_t *tids;
+    uint64_t cpu_ns = 0;
+    int i;
+
+    args = calloc(nthreads, sizeof(*args));
+    tids = calloc(nthreads, sizeof(*tids));
+    if (args == NULL || tids == NULL) {
+        perror("calloc: ");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        args[i].use_cache = use_cache;
+        args[i].iters = iters;
+        pthread_create(&tids[i], NULL, bench_thread, &args[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        cpu_ns += args[i].cpu_ns;
+    }
+
+    free(args);
+    free(tids);
+    return (double)cpu_ns / ((double)iters * nthreads);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, nthreads = 4;
+    long iters = 2000000;
+    double fmt_ns, cache_ns;
+
+    while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+        switch (opt) {
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'n':
+            iters = atol(optarg);
+            break;
+        default:
+            printf("usage: %s [-t threads] [-n iterations per thread]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if (reply_cache_start(&reply_cache) < 0)
+        return -1;
+
+    fmt_ns = run(0, nthreads, iters);
+    cache_ns = run(1, nthreads, iters);
+
+    printf("threads %d, %ld replies per thread\n", nthreads, iters);
+    printf("%-28s %8.1f ns cpu/reply\n", "time+ctime+snprintf:", fmt_ns);
+    printf("%-28s %8.1f ns cpu/reply\n", "reply cache (seqlock):", cache_ns);
+    printf("at 100k conn/s formatting costs %.2f%% of a core, the cache %.2f%%\n",
+           fmt_ns * 100000 / 1e9 * 100, cache_ns * 100000 / 1e9 * 100);
+    printf("at 1M conn/s formatting costs %.2f%% of a core, the cache %.2f%%\n",
+           fmt_ns * 1000000 / 1e9 * 100, cache_ns * 1000000 / 1e9 * 100);
+    return 0;
+}
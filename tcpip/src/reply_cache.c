@@ -0,0 +1,100 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "./reply_cache.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+struct reply_cache reply_cache;
+
+void reply_cache_refresh(struct reply_cache *rc)
+{
+    time_t now = time(NULL);
+    char tbuf[32];
+    int len;
+
+    if (now == rc->ticks && rc->len)
+        return;
+
+    __atomic_store_n(&rc->seq, rc->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    len = snprintf(rc->buff, sizeof(rc->buff), "%.24s\n", ctime_r(&now, tbuf));
+    rc->len = len;
+    rc->ticks = now;
+
+    __atomic_store_n(&rc->seq, rc->seq + 1, __ATOMIC_RELEASE);
+}
+
+unsigned int reply_cache_read(const struct reply_cache *rc, char *buff,
+                              size_t size, unsigned int *seq)
+{
+    unsigned int s1, s2, len;
+
+    do {
+        s1 = __atomic_load_n(&rc->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) {
+            cpu_relax();
+            continue;
+        }
+        len = rc->len;
+        if (len > size)
+            len = size;
+        memcpy(buff, rc->buff, len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&rc->seq, __ATOMIC_RELAXED);
+    } while ((s1 & 1) || s1 != s2);
+
+    if (seq)
+        *seq = s1;
+    return len;
+}
+
+unsigned int reply_cache_seq(const struct reply_cache *rc)
+{
+    unsigned int s;
+
+    while ((s = __atomic_load_n(&rc->seq, __ATOMIC_ACQUIRE)) & 1)
+        cpu_relax();
+    return s;
+}
+
+static void *reply_cache_thread(void *arg)
+{
+    struct reply_cache *rc = arg;
+    struct timespec ts;
+
+    while (1) {
+        reply_cache_refresh(rc);
+
+        /* sleep until just past the next wall-clock second */
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        ts.tv_nsec = 1000000;
+        while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) != 0)
+            ;
+    }
+    return NULL;
+}
+
+int reply_cache_start(struct reply_cache *rc)
+{
+    pthread_t tid;
+    int ret;
+
+    reply_cache_refresh(rc);
+
+    ret = pthread_create(&tid, NULL, reply_cache_thread, rc);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create reply cache: %s\n", strerror(ret));
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
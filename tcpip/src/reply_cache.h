@@ -0,0 +1,37 @@
+#ifndef __REPLY_CACHE_H__
+#define __REPLY_CACHE_H__
+
+#include <stddef.h>
+#include <time.h>
+
+#define REPLY_MAXLEN (64)
+
+/* The time reply, formatted once per second by a single refresher and
+ * read by any number of serving threads under a seqlock: seq is odd while
+ * an update is in progress, and a reader retries if seq moved while it
+ * was copying. Readers never format, allocate or take a lock. */
+struct reply_cache {
+    unsigned int seq;
+    unsigned int len;
+    time_t ticks;
+    char buff[REPLY_MAXLEN];
+} __attribute__((aligned(64)));
+
+extern struct reply_cache reply_cache;
+
+/* Reformat the reply if the second has changed. Single writer only. */
+void reply_cache_refresh(struct reply_cache *rc);
+
+/* Copy the current reply into buff, returns its length.
+ * If seq is non-NULL the sequence number of the copy is stored there,
+ * so callers can cheaply tell whether the reply changed since. */
+unsigned int reply_cache_read(const struct reply_cache *rc, char *buff,
+                              size_t size, unsigned int *seq);
+
+/* Sequence number of the reply currently published (always even) */
+unsigned int reply_cache_seq(const struct reply_cache *rc);
+
+/* Start a detached thread that refreshes rc at every second boundary */
+int reply_cache_start(struct reply_cache *rc);
+
+#endif
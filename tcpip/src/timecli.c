@@ -1,49 +1,418 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <time.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "./hist.h"
+
 #define MAXBUFFSIZE  (200)
 #define SERVERPORT  (1033)
+#define MAXEVENTS (256)
+#define DEFAULT_TIMEOUT (5.0)
+/* how often in-flight requests are checked against the timeout */
+#define EXPIRE_INTERVAL_NS (10000000ull)
 
-int main(int argc, char *argv[])
+/* One in-flight request. t_sched is the time the request was *meant* to
+ * start: in open-loop mode a request that had to wait for a free slot is
+ * still measured from its scheduled arrival, so queueing delay inside the
+ * generator shows up in the latency instead of being silently omitted. */
+struct req {
+    int fd;
+    int connected;
+    int got_first;
+    uint64_t t_sched;
+    uint64_t t_connect;
+    uint64_t t_first;
+    struct req *next_free;
+};
+
+struct loadgen {
+    struct sockaddr_in servaddr;
+    int epfd;
+    int concurrency;
+    long total;             /* stop after this many requests, 0 = unlimited */
+    double duration;        /* stop after this many seconds, 0 = unlimited */
+    double rate;            /* open-loop arrivals per second, 0 = closed loop */
+    double timeout;         /* give up on a request after this many seconds */
+
+    struct req *reqs;
+    struct req *free_list;
+    int inflight;
+    long started;
+    long completed;
+    long connect_errors;
+    long read_errors;
+    long timeouts;
+
+    struct hist connect_lat;
+    struct hist first_byte_lat;
+    struct hist full_lat;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Exponentially distributed inter-arrival gap, giving Poisson arrivals */
+static uint64_t poisson_gap_ns(double rate)
+{
+    double u;
+
+    do {
+        u = drand48();
+    } while (u == 0.0);
+    return (uint64_t)(-log(u) / rate * 1e9);
+}
+
+static void req_finish(struct loadgen *lg, struct req *r)
+{
+    close(r->fd);
+    r->fd = -1;
+    r->next_free = lg->free_list;
+    lg->free_list = r;
+    lg->inflight--;
+}
+
+static int req_start(struct loadgen *lg, uint64_t t_sched)
+{
+    struct epoll_event ev;
+    struct req *r;
+    int ret;
+
+    r = lg->free_list;
+    lg->free_list = r->next_free;
+    lg->inflight++;
+    lg->started++;
+
+    r->connected = 0;
+    r->got_first = 0;
+    r->t_sched = t_sched;
+
+    r->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (r->fd < 0) {
+        lg->connect_errors++;
+        r->next_free = lg->free_list;
+        lg->free_list = r;
+        lg->inflight--;
+        return -1;
+    }
+
+    ret = connect(r->fd, (struct sockaddr *)&lg->servaddr, sizeof(lg->servaddr));
+    if (ret < 0 && errno != EINPROGRESS) {
+        lg->connect_errors++;
+        req_finish(lg, r);
+        return -1;
+    }
+    if (ret == 0) {
+        r->connected = 1;
+        r->t_connect = now_ns();
+        hist_record(&lg->connect_lat, r->t_connect - r->t_sched);
+    }
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = r;
+    if (epoll_ctl(lg->epfd, EPOLL_CTL_ADD, r->fd, &ev) < 0) {
+        lg->connect_errors++;
+        req_finish(lg, r);
+        return -1;
+    }
+    return 0;
+}
+
+static void req_event(struct loadgen *lg, struct req *r)
+{
+    char buff[MAXBUFFSIZE];
+    socklen_t len;
+    uint64_t t;
+    int err = 0;
+    ssize_t n;
+
+    if (!r->connected) {
+        len = sizeof(err);
+        if (getsockopt(r->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            if (err == EINPROGRESS)
+                return;
+            lg->connect_errors++;
+            req_finish(lg, r);
+            return;
+        }
+        r->connected = 1;
+        r->t_connect = now_ns();
+        hist_record(&lg->connect_lat, r->t_connect - r->t_sched);
+    }
+
+    while (1) {
+        n = read(r->fd, buff, sizeof(buff));
+        if (n > 0) {
+            if (!r->got_first) {
+                r->got_first = 1;
+                r->t_first = now_ns();
+                hist_record(&lg->first_byte_lat, r->t_first - r->t_sched);
+            }
+            continue;
+        }
+        if (n == 0) {
+            t = now_ns();
+            if (r->got_first) {
+                hist_record(&lg->full_lat, t - r->t_sched);
+                lg->completed++;
+            } else {
+                lg->read_errors++;
+            }
+            req_finish(lg, r);
+            return;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN) {
+            lg->read_errors++;
+            req_finish(lg, r);
+        }
+        return;
+    }
+}
+
+/* A server that accepts and then never answers must not hold a slot
+ * forever, nor keep the final drain from finishing: such requests are
+ * dropped once they are older than the timeout and counted as errors. */
+static void req_expire(struct loadgen *lg, uint64_t now)
+{
+    uint64_t limit = (uint64_t)(lg->timeout * 1e9);
+    int i;
+
+    for (i = 0; i < lg->concurrency; i++) {
+        if (lg->reqs[i].fd >= 0 && now - lg->reqs[i].t_sched > limit) {
+            lg->timeouts++;
+            req_finish(lg, &lg->reqs[i]);
+        }
+    }
+}
+
+static int loadgen_run(struct loadgen *lg)
+{
+    struct epoll_event events[MAXEVENTS];
+    uint64_t t_begin, t_end, t_stop, now, next_arrival, next_expire;
+    int nfds, i, ret, timeout, stopping = 0;
+
+    lg->reqs = calloc(lg->concurrency, sizeof(*lg->reqs));
+    if (lg->reqs == NULL) {
+        perror("calloc: ");
+        return -1;
+    }
+    for (i = 0; i < lg->concurrency; i++) {
+        lg->reqs[i].fd = -1;
+        lg->reqs[i].next_free = lg->free_list;
+        lg->free_list = &lg->reqs[i];
+    }
+
+    lg->epfd = epoll_create1(0);
+    if (lg->epfd < 0) {
+        perror("epoll_create1: ");
+        return -1;
+    }
+
+    hist_init(&lg->connect_lat);
+    hist_init(&lg->first_byte_lat);
+    hist_init(&lg->full_lat);
+
+    t_begin = now_ns();
+    t_stop = lg->duration > 0 ? t_begin + (uint64_t)(lg->duration * 1e9) : UINT64_MAX;
+    next_arrival = t_begin;
+    next_expire = t_begin + EXPIRE_INTERVAL_NS;
+
+    while (!stopping || lg->inflight > 0) {
+        now = now_ns();
+        if (!stopping && (now >= t_stop || (lg->total && lg->started >= lg->total)))
+            stopping = 1;
+        if (now >= next_expire) {
+            req_expire(lg, now);
+            next_expire = now + EXPIRE_INTERVAL_NS;
+        }
+
+        if (!stopping) {
+            if (lg->rate > 0) {
+                while (lg->free_list && next_arrival <= now &&
+                       next_arrival < t_stop &&
+                       (!lg->total || lg->started < lg->total)) {
+                    ret = req_start(lg, next_arrival);
+                    next_arrival += poisson_gap_ns(lg->rate);
+                    if (ret < 0)
+                        break;
+                }
+            } else {
+                /* a failed start gives its slot back at once; retry next round */
+                while (lg->free_list && (!lg->total || lg->started < lg->total))
+                    if (req_start(lg, now_ns()) < 0)
+                        break;
+            }
+        }
+
+        /* sleep until the next arrival; with sub-millisecond gaps this
+         * degenerates into polling, which is what a load generator wants */
+        if (stopping || lg->rate <= 0)
+            timeout = 100;
+        else if (!lg->free_list || next_arrival <= now)
+            timeout = lg->free_list ? 0 : 100;
+        else
+            timeout = (int)((next_arrival - now) / 1000000);
+
+        nfds = epoll_wait(lg->epfd, events, MAXEVENTS, timeout);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait: ");
+            return -1;
+        }
+        for (i = 0; i < nfds; i++)
+            req_event(lg, events[i].data.ptr);
+    }
+    t_end = now_ns();
+
+    printf("{\"mode\": \"%s\", \"server\": \"%s\", \"port\": %d, "
+           "\"concurrency\": %d, \"target_rate\": %.1f, "
+           "\"elapsed_s\": %.3f, \"started\": %ld, \"completed\": %ld, "
+           "\"connect_errors\": %ld, \"read_errors\": %ld, \"timeouts\": %ld, "
+           "\"achieved_rate\": %.1f, \"latency_ns\": {",
+           lg->rate > 0 ? "open" : "closed",
+           inet_ntoa(lg->servaddr.sin_addr), ntohs(lg->servaddr.sin_port),
+           lg->concurrency, lg->rate,
+           (t_end - t_begin) / 1e9, lg->started, lg->completed,
+           lg->connect_errors, lg->read_errors, lg->timeouts,
+           lg->completed / ((t_end - t_begin) / 1e9));
+    hist_print_json(stdout, "connect", &lg->connect_lat);
+    printf(", ");
+    hist_print_json(stdout, "first_byte", &lg->first_byte_lat);
+    printf(", ");
+    hist_print_json(stdout, "full", &lg->full_lat);
+    printf("}}\n");
+
+    close(lg->epfd);
+    free(lg->reqs);
+    return 0;
+}
+
+/* The original behaviour: one connection, print whatever the server sends */
+static int fetch_once(struct sockaddr_in *servaddr)
 {
     int sockfd, n;
     char recvline[MAXBUFFSIZE];
-    struct sockaddr_in servaddr;
     int ret;
-    
+
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
         perror("Open a socket: ");
         return -1;
     }
 
-    bzero(&servaddr, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_port = htons(SERVERPORT);
-    
-    if (1!=inet_pton(AF_INET, argv[1], &servaddr.sin_addr)) {
-        printf ("server address error.\n"); 
-        return -1;
-    }
-
-    
-    ret = connect(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr));
+    ret = connect(sockfd, (struct sockaddr *)servaddr, sizeof(*servaddr));
     if (ret < 0) {
         perror("connect ");
         return -1;
     }
 
     while ((n=read(sockfd, recvline, MAXBUFFSIZE)) > 0) {
-        if (fputs(recvline, stdout) == EOF)  {
-            printf("fputs error.\n");
-        } 
+        if (fwrite(recvline, 1, n, stdout) != (size_t)n)  {
+            printf("fwrite error.\n");
+        }
     }
-    
+
+    close(sockfd);
     return 0;
 }
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-p port] [-c conns] [-n requests] [-d seconds] [-r rate] [-t seconds] server\n", prog);
+    printf("  without -c/-n/-d/-r: fetch the time once and print it\n");
+    printf("  -c conns    : concurrent connections (closed loop) or in-flight cap (open loop)\n");
+    printf("  -n requests : stop after this many requests\n");
+    printf("  -d seconds  : stop after this many seconds\n");
+    printf("  -r rate     : open loop, Poisson arrivals at this many connections/s\n");
+    printf("  -t seconds  : count a request as timed out after this long (%.0f)\n",
+           DEFAULT_TIMEOUT);
+    printf("  results are printed as a single JSON object, latencies in ns\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct loadgen lg;
+    struct rlimit rl;
+    int opt, port = SERVERPORT;
+    int load = 0;
+
+    memset(&lg, 0, sizeof(lg));
+    lg.concurrency = 1;
+    lg.timeout = DEFAULT_TIMEOUT;
+
+    while ((opt = getopt(argc, argv, "p:c:n:d:r:t:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            lg.concurrency = atoi(optarg);
+            load = 1;
+            break;
+        case 'n':
+            lg.total = atol(optarg);
+            load = 1;
+            break;
+        case 'd':
+            lg.duration = atof(optarg);
+            load = 1;
+            break;
+        case 'r':
+            lg.rate = atof(optarg);
+            load = 1;
+            break;
+        case 't':
+            lg.timeout = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind != argc - 1 || lg.concurrency < 1 || lg.timeout <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    lg.servaddr.sin_family = AF_INET;
+    lg.servaddr.sin_port = htons(port);
+    if (1!=inet_pton(AF_INET, argv[optind], &lg.servaddr.sin_addr)) {
+        printf ("server address error.\n");
+        return -1;
+    }
+
+    if (!load)
+        return fetch_once(&lg.servaddr);
+
+    if (!lg.total && lg.duration <= 0)
+        lg.duration = 10;
+
+    /* every in-flight request holds a socket */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)lg.concurrency + 16) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    srand48(now_ns());
+    return loadgen_run(&lg);
+}
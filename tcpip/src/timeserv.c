@@ -1,49 +1,383 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sched.h>
 #include <time.h>
 #include <netinet/in.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "./uring.h"
+#include "./reply_cache.h"
+
 #define MAXBUFSIZE (200)
 #define LISTENQUE (10)
 #define LISTENPORT (1033)
 
-int main(int argc, char *argv[])
-{
-    int listenfd, connfd;
-    struct sockaddr_in servaddr;
+/* epoll mode: the listen queue must be deep enough to absorb bursts,
+ * and each wakeup accepts at most ACCEPT_BATCH connections before the
+ * other ready events get serviced, so a connect storm cannot starve
+ * connections that are still waiting to write their reply. */
+#define EPOLL_LISTENQUE (4096)
+#define MAXEVENTS (256)
+#define ACCEPT_BATCH (64)
+/* out of descriptors or memory: wait this long before accepting again,
+ * unless another event comes in first and maybe freed something */
+#define ACCEPT_BACKOFF_MS (10)
+
+/* io_uring mode: one multishot accept sqe stays armed on the listener and
+ * every accepted fd gets a write-from-registered-buffer sqe linked to a
+ * close sqe. Successful writes and closes post no cqe at all, so a single
+ * io_uring_enter() submits and reaps work for many connections. */
+#define URING_ENTRIES (4096)
+#define UD_ACCEPT (1ull << 32)
+#define UD_WRITE (2ull << 32)
+#define UD_CLOSE (3ull << 32)
+#define UD_TAG(ud) ((ud) & ~0xffffffffull)
+#define UD_FD(ud) ((int)((ud) & 0xffffffffull))
+
+/* A connection whose reply did not fit into the socket buffer in one go.
+ * Only allocated on that slow path: normally the reply is written right
+ * after accept and the connection is closed without keeping any state. */
+struct conn {
+    int fd;
+    size_t len;
+    size_t off;
     char buff[MAXBUFSIZE];
-    time_t ticks;
+};
+
+/* Write as much of the pending reply as possible.
+ * Returns 1 when done, 0 when the send buffer is full (wait for EPOLLOUT),
+ * -1 on error. */
+static int conn_flush(struct conn *c)
+{
+    ssize_t n;
+
+    while (c->off < c->len) {
+        n = send(c->fd, c->buff + c->off, c->len - c->off, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->off += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/* Try to write the reply straight from the stack; only allocate a conn
+ * and register for EPOLLOUT if the write would block. */
+static void handle_new_conn(int epfd, int connfd)
+{
+    struct conn tmp, *c;
+    struct epoll_event ev;
     int ret;
-    
-    listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    if (listenfd < 0) {
-        perror("Open a socket: ");
+
+    tmp.fd = connfd;
+    tmp.off = 0;
+    tmp.len = reply_cache_read(&reply_cache, tmp.buff, sizeof(tmp.buff), NULL);
+
+    ret = conn_flush(&tmp);
+    if (ret != 0) {
+        close(connfd);
+        return;
+    }
+
+    c = malloc(sizeof(*c));
+    if (c == NULL) {
+        close(connfd);
+        return;
+    }
+    memcpy(c, &tmp, sizeof(*c));
+
+    ev.events = EPOLLOUT | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+        perror("epoll_ctl add conn: ");
+        close(connfd);
+        free(c);
+    }
+}
+
+/* Accept at most ACCEPT_BATCH connections.
+ * Returns 1 if the accept queue may still hold connections, 0 once it has
+ * been drained (EAGAIN), -1 when out of resources (back off, then retry). */
+static int accept_batch(int epfd, int listenfd)
+{
+    int i, connfd;
+
+    for (i = 0; i < ACCEPT_BATCH; i++) {
+        connfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd >= 0) {
+            handle_new_conn(epfd, connfd);
+            continue;
+        }
+        switch (errno) {
+        case EINTR:
+        case ECONNABORTED:
+            continue;
+        case EAGAIN:
+            return 0;
+        case EMFILE:
+        case ENFILE:
+        case ENOBUFS:
+        case ENOMEM:
+            /* out of resources for now, retry once some connections close */
+            return -1;
+        default:
+            perror("Accept: ");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Edge-triggered epoll reactor.
+ * With EPOLLET the listener is only reported again after it has been
+ * drained, so when a batch runs out we remember accept_pending and poll
+ * with a zero timeout, servicing other events before accepting more.
+ * When accept runs out of descriptors the queue is not drained either,
+ * but polling it would spin: wait up to ACCEPT_BACKOFF_MS instead. */
+static int serve_epoll(int listenfd)
+{
+    struct epoll_event ev, events[MAXEVENTS];
+    struct conn *c;
+    int epfd, nfds, i, ret;
+    int accept_pending = 1, accept_backoff = 0;
+    int timeout;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1: ");
         return -1;
     }
-    bzero(&servaddr, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    servaddr.sin_port = htons(LISTENPORT);
-    
-    ret = bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)); 
-    if (ret < 0) {
-        perror("Bind a socket: ");
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;     /* NULL marks the listening socket */
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+        perror("epoll_ctl add listenfd: ");
+        close(epfd);
         return -1;
     }
-     
-    ret = listen(listenfd, LISTENQUE);
-    if (ret < 0) {
-        perror("listen a socket: ");
+
+    while (1) {
+        timeout = accept_pending ? 0 : accept_backoff ? ACCEPT_BACKOFF_MS : -1;
+        nfds = epoll_wait(epfd, events, MAXEVENTS, timeout);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait: ");
+            break;
+        }
+
+        for (i = 0; i < nfds; i++) {
+            c = events[i].data.ptr;
+            if (c == NULL) {
+                accept_pending = 1;
+                continue;
+            }
+            ret = conn_flush(c);
+            if (ret != 0 || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                close(c->fd);
+                free(c);
+            }
+        }
+
+        if (accept_backoff) {
+            accept_backoff = 0;
+            accept_pending = 1;
+        }
+        if (accept_pending) {
+            ret = accept_batch(epfd, listenfd);
+            accept_pending = ret > 0;
+            accept_backoff = ret < 0;
+        }
+    }
+
+    close(epfd);
+    return -1;
+}
+
+/* The reply lives in two registered buffers. Whenever the shared reply
+ * cache publishes a new second, the buffer not in use is refilled from it
+ * and becomes current; writes still queued against the previous buffer
+ * finish long before it is reused a second later. */
+struct uring_reply {
+    char buff[2][MAXBUFSIZE];
+    unsigned int len[2];
+    int cur;
+    unsigned int seq;
+};
+
+static void uring_reply_refresh(struct uring_reply *r)
+{
+    int next;
+
+    if (reply_cache_seq(&reply_cache) == r->seq)
+        return;
+    next = r->cur ^ 1;
+    r->len[next] = reply_cache_read(&reply_cache, r->buff[next], MAXBUFSIZE, &r->seq);
+    r->cur = next;
+}
+
+static int uring_arm_accept(struct uring *ring, int listenfd)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(ring);
+    if (sqe == NULL)
         return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = UD_ACCEPT;
+    return 0;
+}
+
+/* Returns 0 once the reply is queued, -1 if the submission queue had no
+ * room for it; the connection is closed then. */
+static int uring_queue_reply(struct uring *ring, struct uring_reply *r, int connfd)
+{
+    struct io_uring_sqe *sqe, *close_sqe;
+
+    /* the linked pair must go into the queue together; the kernel may
+     * refuse more sqes for now (EBUSY while completions are pending), in
+     * which case the connection is dropped rather than stalling the loop
+     * that reaps those completions */
+    if (uring_sq_space(ring) < 2 && uring_submit_and_wait(ring, 0) < 0 &&
+        errno != EBUSY && errno != EAGAIN)
+        perror("io_uring_enter: ");
+
+    sqe = uring_get_sqe(ring);
+    close_sqe = uring_get_sqe(ring);
+    if (sqe == NULL || close_sqe == NULL) {
+        /* an sqe already handed out is submitted anyway: make it a no-op */
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_NOP;
+            sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        }
+        close(connfd);
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = connfd;
+    sqe->addr = (unsigned long)r->buff[r->cur];
+    sqe->len = r->len[r->cur];
+    sqe->buf_index = r->cur;
+    sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = UD_WRITE | connfd;
+
+    close_sqe->opcode = IORING_OP_CLOSE;
+    close_sqe->fd = connfd;
+    close_sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    close_sqe->user_data = UD_CLOSE | connfd;
+    return 0;
+}
+
+static int serve_uring(int listenfd)
+{
+    struct uring ring;
+    struct uring_reply *reply;
+    struct io_uring_cqe *cqe;
+    struct iovec iovs[2];
+    int ret, res;
+    int accept_armed = 0;
+    unsigned int flags;
+    unsigned long long ud;
+
+    /* deferring task work to our own io_uring_enter() calls saves IPIs;
+     * fall back to a plain ring on kernels that do not know the flags */
+    if (uring_init(&ring, URING_ENTRIES,
+                   IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER) < 0 &&
+        uring_init(&ring, URING_ENTRIES, 0) < 0) {
+        perror("io_uring_setup: ");
+        return -1;
+    }
+
+    reply = calloc(1, sizeof(*reply));
+    if (reply == NULL) {
+        perror("calloc reply: ");
+        uring_exit(&ring);
+        return -1;
+    }
+    uring_reply_refresh(reply);
+
+    iovs[0].iov_base = reply->buff[0];
+    iovs[0].iov_len = MAXBUFSIZE;
+    iovs[1].iov_base = reply->buff[1];
+    iovs[1].iov_len = MAXBUFSIZE;
+    if (uring_register_buffers(&ring, iovs, 2) < 0) {
+        perror("io_uring_register buffers: ");
+        goto out;
+    }
+
+    while (1) {
+        /* (re)arming needs a free sqe; while the queue is full, do not
+         * block for completions so the next pass can try again */
+        if (!accept_armed)
+            accept_armed = uring_arm_accept(&ring, listenfd) == 0;
+        ret = uring_submit_and_wait(&ring, accept_armed ? 1 : 0);
+        if (ret < 0 && errno != EBUSY && errno != EAGAIN) {
+            perror("io_uring_enter: ");
+            break;
+        }
+
+        uring_reply_refresh(reply);
+
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            ud = cqe->user_data;
+            res = cqe->res;
+            flags = cqe->flags;
+            uring_cqe_seen(&ring);
+
+            switch (UD_TAG(ud)) {
+            case UD_ACCEPT:
+                if (res >= 0) {
+                    uring_queue_reply(&ring, reply, res);
+                } else if (res == -EINVAL) {
+                    fprintf(stderr, "multishot accept is not supported by this kernel\n");
+                    goto out;
+                }
+                if (!(flags & IORING_CQE_F_MORE))
+                    accept_armed = 0;
+                break;
+            case UD_CLOSE:
+                /* a failed or short write cancels the linked close */
+                if (res == -ECANCELED)
+                    close(UD_FD(ud));
+                break;
+            default:
+                break;
+            }
+        }
     }
-    
-    printf("\n\nTime server is running on port %d.\n", LISTENPORT);
-    
+
+out:
+    uring_exit(&ring);
+    free(reply);
+    return -1;
+}
+
+static int serve_block(int listenfd)
+{
+    int connfd;
+#if 0
+    char buff[MAXBUFSIZE];
+#endif
+
     while(1) {
         connfd = accept(listenfd, NULL, NULL);
 #if 0
@@ -52,8 +386,7 @@ int main(int argc, char *argv[])
             continue;
         }
         printf("Time server get a request from client\n");
-        ticks = time(NULL);
-        snprintf (buff, sizeof(buff), "%.24s\n", ctime(&ticks));
+        reply_cache_read(&reply_cache, buff, sizeof(buff), NULL);
         write(connfd, buff, strlen(buff));
         close(connfd);
 #endif
@@ -63,3 +396,196 @@ int main(int argc, char *argv[])
 
     return 0;
 }
+
+typedef int (*serve_fn)(int listenfd);
+
+/* One SO_REUSEPORT listener plus its own event loop per worker.
+ * The kernel hashes each incoming SYN onto one of the listeners in the
+ * reuseport group, so every worker has a private accept queue and the
+ * accept path scales with the number of cores instead of one. */
+struct worker {
+    pthread_t tid;
+    int id;
+    int cpu;
+    int listenfd;
+    serve_fn serve;
+};
+
+static int open_listener(int backlog, int reuseport, int nonblock)
+{
+    struct sockaddr_in servaddr;
+    int listenfd, ret, on = 1;
+
+    listenfd = socket(PF_INET, SOCK_STREAM | (nonblock ? SOCK_NONBLOCK : 0), 0);
+    if (listenfd < 0) {
+        perror("Open a socket: ");
+        return -1;
+    }
+
+    /* restarting the server must not fail on connections it left in TIME_WAIT */
+    ret = setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (ret < 0) {
+        perror("setsockopt SO_REUSEADDR: ");
+        close(listenfd);
+        return -1;
+    }
+
+    if (reuseport) {
+        ret = setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        if (ret < 0) {
+            perror("setsockopt SO_REUSEPORT: ");
+            close(listenfd);
+            return -1;
+        }
+    }
+
+    bzero(&servaddr, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servaddr.sin_port = htons(LISTENPORT);
+
+    ret = bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr));
+    if (ret < 0) {
+        perror("Bind a socket: ");
+        close(listenfd);
+        return -1;
+    }
+
+    ret = listen(listenfd, backlog);
+    if (ret < 0) {
+        perror("listen a socket: ");
+        close(listenfd);
+        return -1;
+    }
+
+    return listenfd;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    cpu_set_t cpuset;
+    int ret;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(w->cpu, &cpuset);
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (ret != 0)
+        fprintf(stderr, "worker %d: pin to cpu %d: %s\n", w->id, w->cpu, strerror(ret));
+
+    w->serve(w->listenfd);
+    return NULL;
+}
+
+/* Listeners are all created up front in the main thread so that a bind
+ * failure is reported before any worker starts serving. */
+static int serve_workers(int nworkers, serve_fn serve)
+{
+    struct worker *workers;
+    long ncpu;
+    int i, ret;
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1)
+        ncpu = 1;
+
+    workers = calloc(nworkers, sizeof(*workers));
+    if (workers == NULL) {
+        perror("calloc workers: ");
+        return -1;
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        workers[i].id = i;
+        workers[i].cpu = i % ncpu;
+        workers[i].serve = serve;
+        workers[i].listenfd = open_listener(EPOLL_LISTENQUE, 1, serve == serve_epoll);
+        if (workers[i].listenfd < 0)
+            return -1;
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        ret = pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]);
+        if (ret != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+            return -1;
+        }
+    }
+
+    for (i = 0; i < nworkers; i++)
+        pthread_join(workers[i].tid, NULL);
+
+    free(workers);
+    return -1;
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-m block|epoll|uring] [-w workers]\n", prog);
+    printf("  -m block : accept and serve one client at a time (default)\n");
+    printf("  -m epoll : edge-triggered epoll reactor with non-blocking accept4()\n");
+    printf("  -m uring : io_uring multishot accept with linked write+close\n");
+    printf("  -w N     : N pinned epoll (or uring) workers, each with its own SO_REUSEPORT listener\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int listenfd;
+    int opt;
+    const char *mode = "block";
+    serve_fn serve = serve_block;
+    int nworkers = 0;
+
+    while ((opt = getopt(argc, argv, "m:w:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            mode = optarg;
+            if (strcmp(optarg, "epoll") == 0) {
+                serve = serve_epoll;
+            } else if (strcmp(optarg, "uring") == 0) {
+                serve = serve_uring;
+            } else if (strcmp(optarg, "block") == 0) {
+                serve = serve_block;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            if (nworkers < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    /* a client resetting the connection must not kill the server on write */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (reply_cache_start(&reply_cache) < 0)
+        return -1;
+
+    if (nworkers > 0) {
+        if (serve == serve_block) {
+            serve = serve_epoll;
+            mode = "epoll";
+        }
+        printf("\n\nTime server is running on port %d (%d reuseport %s workers).\n",
+               LISTENPORT, nworkers, mode);
+        return serve_workers(nworkers, serve);
+    }
+
+    listenfd = open_listener(serve == serve_block ? LISTENQUE : EPOLL_LISTENQUE, 0,
+                             serve == serve_epoll);
+    if (listenfd < 0)
+        return -1;
+
+    printf("\n\nTime server is running on port %d (%s mode).\n", LISTENPORT, mode);
+
+    return serve(listenfd);
+}
@@ -0,0 +1,167 @@
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./uring.h"
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+int uring_init(struct uring *ring, unsigned int entries, unsigned int flags)
+{
+    struct io_uring_params p;
+    void *ptr;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0)
+        return -1;
+    ring->features = p.features;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ptr = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED)
+        goto err;
+    ring->sq_ring = ptr;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ptr = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED)
+            goto err;
+        ring->cq_ring = ptr;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ptr = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED)
+        goto err;
+    ring->sqes = ptr;
+
+    ring->sq_head = (unsigned int *)((char *)ring->sq_ring + p.sq_off.head);
+    ring->sq_tail = (unsigned int *)((char *)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)((char *)ring->sq_ring + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->sq_submitted = *ring->sq_tail;
+
+    ring->cq_head = (unsigned int *)((char *)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (unsigned int *)((char *)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+
+    return 0;
+
+err:
+    uring_exit(ring);
+    return -1;
+}
+
+void uring_exit(struct uring *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+unsigned int uring_sq_space(struct uring *ring)
+{
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    return ring->sq_entries - (ring->sq_local_tail - head);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    if (uring_sq_space(ring) == 0)
+        return NULL;
+
+    sqe = &ring->sqes[ring->sq_local_tail & *ring->sq_mask];
+    ring->sq_array[ring->sq_local_tail & *ring->sq_mask] =
+        ring->sq_local_tail & *ring->sq_mask;
+    ring->sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(struct uring *ring, unsigned int wait_nr)
+{
+    unsigned int to_submit;
+    int ret;
+
+    if (ring->sq_local_tail != ring->sq_submitted) {
+        /* sqe contents must be visible before the kernel sees the new tail */
+        __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+        ring->sq_submitted = ring->sq_local_tail;
+    }
+
+    /* count everything the kernel has not consumed yet, including sqes a
+     * previous short submit left behind */
+    to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (!to_submit && !wait_nr)
+        return 0;
+
+    do {
+        ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr,
+                                 wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring)
+{
+    unsigned int head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_register_buffers(struct uring *ring, const struct iovec *iovs, unsigned int nr)
+{
+    return (int)syscall(__NR_io_uring_register, ring->fd,
+                        IORING_REGISTER_BUFFERS, iovs, nr);
+}
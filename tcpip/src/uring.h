@@ -0,0 +1,56 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <linux/io_uring.h>
+
+/* Just enough of an io_uring wrapper for timeserv, talking to the raw
+ * io_uring_setup/io_uring_enter/io_uring_register syscalls so the server
+ * does not need liburing to build. */
+struct uring {
+    int fd;
+    unsigned int features;
+
+    /* submission queue */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail;     /* sqes handed out, not yet published */
+    unsigned int sq_submitted;      /* sqes published to the kernel */
+
+    /* completion queue */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+int uring_init(struct uring *ring, unsigned int entries, unsigned int flags);
+void uring_exit(struct uring *ring);
+
+/* Returns a zeroed sqe, or NULL when the submission queue is full */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/* Number of sqes that can still be handed out before the queue is full */
+unsigned int uring_sq_space(struct uring *ring);
+
+/* Publish pending sqes and optionally wait for wait_nr completions,
+ * all in one io_uring_enter(). Returns the number of sqes submitted. */
+int uring_submit_and_wait(struct uring *ring, unsigned int wait_nr);
+
+/* Peek at the next completion, NULL if none. Call uring_cqe_seen() once
+ * the cqe has been consumed. */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+void uring_cqe_seen(struct uring *ring);
+
+int uring_register_buffers(struct uring *ring, const struct iovec *iovs, unsigned int nr);
+
+#endif
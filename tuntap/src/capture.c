@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "./capture.h"
+
+#define PCAP_MAGIC (0xa1b2c3d4)
+#define WRITER_IDLE_NS (1000000)   /* sleep 1ms when every ring is empty */
+
+struct pcap_file_hdr {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_rec_hdr {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+/* A slot is the record header, filled in by the producer, followed by
+ * the captured bytes, so the writer copies it to the file in one go. */
+struct slot {
+    struct pcap_rec_hdr rec;
+    char data[];
+};
+
+int capture_init(struct capture *c, const char *path, int linktype,
+                 uint32_t snaplen, size_t file_size, int nfiles)
+{
+    memset(c, 0, sizeof(*c));
+    if (nfiles < 1 || file_size < sizeof(struct pcap_file_hdr) +
+        sizeof(struct pcap_rec_hdr) + snaplen) {
+        errno = EINVAL;
+        return -1;
+    }
+    c->path = path;
+    c->linktype = linktype;
+    c->snaplen = snaplen;
+    c->file_size = file_size;
+    c->nfiles = nfiles;
+    c->file_idx = -1;
+    c->fd = -1;
+    return 0;
+}
+
+struct capture_ring *capture_ring_new(struct capture *c)
+{
+    struct capture_ring *r;
+
+    if (c->nrings == CAPTURE_MAX_RINGS) {
+        errno = ENOSPC;
+        return NULL;
+    }
+    r = aligned_alloc(64, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    r->snaplen = c->snaplen;
+    r->slot_size = (sizeof(struct slot) + c->snaplen + 63) & ~63u;
+    r->slots = malloc((size_t)CAPTURE_RING_SLOTS * r->slot_size);
+    if (r->slots == NULL) {
+        free(r);
+        return NULL;
+    }
+    c->rings[c->nrings++] = r;
+    return r;
+}
+
+void capture_packet(struct capture_ring *r, const void *pkt, size_t len)
+{
+    uint64_t head = r->head;
+    struct slot *s;
+    struct timespec ts;
+
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == CAPTURE_RING_SLOTS) {
+        __atomic_store_n(&r->drops, r->drops + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    s = (struct slot *)(r->slots + (head & (CAPTURE_RING_SLOTS - 1)) * r->slot_size);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    s->rec.ts_sec = ts.tv_sec;
+    s->rec.ts_usec = ts.tv_nsec / 1000;
+    s->rec.len = len;
+    s->rec.caplen = len < r->snaplen ? len : r->snaplen;
+    memcpy(s->data, pkt, s->rec.caplen);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+unsigned long capture_drops(struct capture *c)
+{
+    unsigned long drops = 0;
+    int i;
+
+    for (i = 0; i < c->nrings; i++)
+        drops += __atomic_load_n(&c->rings[i]->drops, __ATOMIC_RELAXED);
+    return drops;
+}
+
+void capture_exit(struct capture *c)
+{
+    __atomic_store_n(&c->stop, 1, __ATOMIC_RELEASE);
+}
+
+/* Unmap the current file and cut it to the bytes actually written */
+static void close_file(struct capture *c)
+{
+    if (c->fd < 0)
+        return;
+    munmap(c->map, c->file_size);
+    if (ftruncate(c->fd, c->used) < 0)
+        perror("capture: ftruncate");
+    close(c->fd);
+    c->fd = -1;
+}
+
+/* Move on to the next file of the rotation, preallocated and mapped */
+static int open_next_file(struct capture *c)
+{
+    struct pcap_file_hdr hdr;
+    char name[4096];
+
+    close_file(c);
+    c->file_idx = (c->file_idx + 1) % c->nfiles;
+    if (c->nfiles > 1)
+        snprintf(name, sizeof(name), "%s.%d", c->path, c->file_idx);
+    else
+        snprintf(name, sizeof(name), "%s", c->path);
+
+    c->fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (c->fd < 0)
+        return -1;
+    /* reserve the blocks now rather than on the first touch of each page */
+    if (posix_fallocate(c->fd, 0, c->file_size) != 0 &&
+        ftruncate(c->fd, c->file_size) < 0)
+        goto fail;
+    c->map = mmap(NULL, c->file_size, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+    if (c->map == MAP_FAILED)
+        goto fail;
+
+    hdr.magic = PCAP_MAGIC;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = c->snaplen;
+    hdr.linktype = c->linktype;
+    memcpy(c->map, &hdr, sizeof(hdr));
+    c->used = sizeof(hdr);
+    return 0;
+
+fail:
+    close(c->fd);
+    c->fd = -1;
+    return -1;
+}
+
+/* Copy everything queued in r to the file. Returns the number of records. */
+static int drain_ring(struct capture *c, struct capture_ring *r)
+{
+    uint64_t tail = r->tail, head;
+    struct slot *s;
+    size_t n;
+    int cnt = 0;
+
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    for (; tail != head; tail++, cnt++) {
+        s = (struct slot *)(r->slots + (tail & (CAPTURE_RING_SLOTS - 1)) * r->slot_size);
+        n = sizeof(s->rec) + s->rec.caplen;
+        if (c->used + n > c->file_size && open_next_file(c) < 0) {
+            perror("capture: opening next file");
+            exit(1);
+        }
+        memcpy(c->map + c->used, s, n);
+        c->used += n;
+        /* hand the slot back as soon as it is copied */
+        __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    c->packets += cnt;
+    return cnt;
+}
+
+static void *writer_main(void *arg)
+{
+    struct capture *c = arg;
+    struct timespec idle = { 0, WRITER_IDLE_NS };
+    int i, got;
+
+    while (1) {
+        got = 0;
+        for (i = 0; i < c->nrings; i++)
+            got += drain_ring(c, c->rings[i]);
+        if (__atomic_load_n(&c->stop, __ATOMIC_ACQUIRE)) {
+            for (i = 0; i < c->nrings; i++)
+                drain_ring(c, c->rings[i]);
+            close_file(c);
+            exit(0);
+        }
+        if (got == 0)
+            nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+int capture_start(struct capture *c)
+{
+    int ret;
+
+    if (open_next_file(c) < 0)
+        return -1;
+    ret = pthread_create(&c->writer, NULL, writer_main, c);
+    if (ret != 0) {
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
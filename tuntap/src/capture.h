@@ -0,0 +1,77 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Always-on packet capture into pcap files.
+ *
+ * Every thread that sees packets owns one capture_ring, a single-producer
+ * single-consumer ring of preallocated slots. capture_packet() copies the
+ * packet (up to snaplen bytes) and its timestamp into the next free slot
+ * with one release store, or counts a drop when the ring is full; it
+ * never waits and never makes a system call besides clock_gettime().
+ *
+ * One writer thread drains all rings into a pcap file that is sized up
+ * front and mmap'd, so writing a record is a memcpy. When a file is full
+ * the writer moves on to the next of nfiles files, overwriting the oldest,
+ * which bounds the disk space the capture can take. */
+
+#define CAPTURE_MAX_RINGS (65)
+#define CAPTURE_RING_SLOTS (4096)
+
+/* pcap link types */
+#define CAPTURE_LINK_ETHERNET (1)
+#define CAPTURE_LINK_RAW (101)  /* raw ipv4/ipv6, what a tun device carries */
+
+struct capture_ring {
+    /* written by the producer */
+    uint64_t head __attribute__((aligned(64)));
+    unsigned long drops;
+    /* written by the writer thread */
+    uint64_t tail __attribute__((aligned(64)));
+    char *slots __attribute__((aligned(64)));
+    uint32_t slot_size;
+    uint32_t snaplen;
+};
+
+struct capture {
+    struct capture_ring *rings[CAPTURE_MAX_RINGS];
+    int nrings;
+    pthread_t writer;
+    int stop;
+    const char *path;
+    int nfiles;
+    int linktype;
+    uint32_t snaplen;
+    size_t file_size;
+    int file_idx;
+    int fd;
+    char *map;
+    size_t used;
+    unsigned long packets;      /* written, for the statistics */
+};
+
+/* Prepare a capture to path (path.0 ... path.N-1 when nfiles > 1), files
+ * of file_size bytes each. Returns 0, or -1 with errno set. */
+int capture_init(struct capture *c, const char *path, int linktype,
+                 uint32_t snaplen, size_t file_size, int nfiles);
+
+/* Add a ring for one producer thread; call before capture_start(). */
+struct capture_ring *capture_ring_new(struct capture *c);
+
+/* Start the writer thread */
+int capture_start(struct capture *c);
+
+/* Queue a packet; drops it if the ring is full. Producer side only. */
+void capture_packet(struct capture_ring *r, const void *pkt, size_t len);
+
+/* Sum of the drops of all rings */
+unsigned long capture_drops(struct capture *c);
+
+/* Async-signal-safe: ask the writer thread to write out what is queued,
+ * trim the current file to its real length and exit the process. */
+void capture_exit(struct capture *c);
+
+#endif
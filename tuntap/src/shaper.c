@@ -0,0 +1,679 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "./shaper.h"
+
+#define QUANTUM (1600)              /* DRR quantum, about one packet */
+#define MIN_BURST (16 * 1600)       /* added to the default 1ms burst */
+#define MAX_DEBT_PS (1000000000000ll)  /* tokens never go below -1s, like mbuffer */
+#define PS_PER_NS (1000)
+
+enum { C_IDLE, C_ACTIVE, C_WAITING };
+
+struct shaper_class {
+    uint32_t id;
+    struct shaper_class *parent;
+    struct shaper_class *next;      /* definition order */
+    int children;
+
+    /* token buckets, in picoseconds of sending time */
+    uint64_t ps_per_byte;           /* at rate */
+    uint64_t cps_per_byte;          /* at ceil */
+    int64_t buffer, cbuffer;
+    int64_t tokens, ctokens;
+    uint64_t t_c;                   /* ns, last update */
+
+    /* leaf queue */
+    struct shaper_pkt *qhead, *qtail;
+    int qlen, limit;
+    int32_t deficit;
+    int state;
+    struct shaper_class *anext;     /* active list or wheel slot */
+    uint64_t expire_tick;
+};
+
+/* IPv4 5-tuple, network byte order; also used as the mask */
+struct flow_key {
+    uint32_t src;
+    uint32_t dst;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t pad[3];
+};
+
+struct filter_entry {
+    struct flow_key key;
+    int prio;                       /* file order, 0 = empty slot */
+    uint32_t class_id;
+};
+
+/* Tuple space search: every filter mask gets an exact-match hash table,
+ * so a lookup costs one probe per distinct mask, not one per filter. */
+struct shaper_filter_table {
+    struct flow_key mask;
+    struct filter_entry *slots;
+    uint32_t size;                  /* power of two */
+    uint32_t used;
+    int min_prio;
+};
+
+static uint32_t key_hash(const struct flow_key *k)
+{
+    uint64_t a, b;
+
+    memcpy(&a, k, 8);
+    memcpy(&b, (const char *)k + 8, 8);
+    a ^= b * 0x9e3779b97f4a7c15ull;
+    a ^= a >> 29;
+    a *= 0xbf58476d1ce4e5b9ull;
+    return (uint32_t)(a ^ (a >> 32));
+}
+
+static void key_apply_mask(struct flow_key *dst, const struct flow_key *k,
+                           const struct flow_key *m)
+{
+    dst->src = k->src & m->src;
+    dst->dst = k->dst & m->dst;
+    dst->sport = k->sport & m->sport;
+    dst->dport = k->dport & m->dport;
+    dst->proto = k->proto & m->proto;
+    memset(dst->pad, 0, sizeof(dst->pad));
+}
+
+static int table_insert(struct shaper_filter_table *t, const struct filter_entry *e)
+{
+    struct filter_entry *old = t->slots;
+    uint32_t i, n = t->size;
+
+    if ((t->used + 1) * 2 > t->size) {
+        t->size = t->size ? t->size * 2 : 16;
+        t->slots = calloc(t->size, sizeof(*t->slots));
+        if (t->slots == NULL)
+            return -1;
+        t->used = 0;
+        for (i = 0; i < n; i++)
+            if (old[i].prio)
+                table_insert(t, &old[i]);
+        free(old);
+    }
+    for (i = key_hash(&e->key) & (t->size - 1); t->slots[i].prio;
+         i = (i + 1) & (t->size - 1)) {
+        /* an earlier filter with the same key shadows this one */
+        if (memcmp(&t->slots[i].key, &e->key, sizeof(e->key)) == 0)
+            return 0;
+    }
+    t->slots[i] = *e;
+    t->used++;
+    if (t->min_prio == 0 || e->prio < t->min_prio)
+        t->min_prio = e->prio;
+    return 0;
+}
+
+static const struct filter_entry *table_lookup(const struct shaper_filter_table *t,
+                                               const struct flow_key *k)
+{
+    struct flow_key m;
+    uint32_t i;
+
+    key_apply_mask(&m, k, &t->mask);
+    for (i = key_hash(&m) & (t->size - 1); t->slots[i].prio; i = (i + 1) & (t->size - 1))
+        if (memcmp(&t->slots[i].key, &m, sizeof(m)) == 0)
+            return &t->slots[i];
+    return NULL;
+}
+
+/* Non-first fragments and protocols without ports match with ports 0 */
+static int flow_key_parse(struct flow_key *k, const uint8_t *pkt, uint32_t len)
+{
+    uint32_t ihl;
+
+    memset(k, 0, sizeof(*k));
+    if (len < 20 || (pkt[0] >> 4) != 4)
+        return -1;
+    ihl = (pkt[0] & 0xf) * 4;
+    if (ihl < 20 || ihl > len)
+        return -1;
+    k->proto = pkt[9];
+    memcpy(&k->src, pkt + 12, 4);
+    memcpy(&k->dst, pkt + 16, 4);
+    if ((k->proto == IPPROTO_TCP || k->proto == IPPROTO_UDP) &&
+        (((pkt[6] & 0x1f) << 8) | pkt[7]) == 0 && len >= ihl + 4) {
+        memcpy(&k->sport, pkt + ihl, 2);
+        memcpy(&k->dport, pkt + ihl + 2, 2);
+    }
+    return 0;
+}
+
+static uint32_t classify(struct shaper *s, const struct shaper_pkt *p)
+{
+    const struct filter_entry *e, *best = NULL;
+    struct flow_key k;
+    int i;
+
+    if (flow_key_parse(&k, (const uint8_t *)p->data, p->len) == 0) {
+        /* tables are sorted by their best priority, so stop early */
+        for (i = 0; i < s->ntables; i++) {
+            if (best != NULL && s->tables[i].min_prio > best->prio)
+                break;
+            e = table_lookup(&s->tables[i], &k);
+            if (e != NULL && (best == NULL || e->prio < best->prio))
+                best = e;
+        }
+    }
+    return best != NULL ? best->class_id : (uint32_t)s->default_id;
+}
+
+/* Bring a class's buckets up to now */
+static void class_update(struct shaper_class *c, uint64_t now)
+{
+    int64_t d;
+
+    if (c->t_c == 0)
+        c->t_c = now;
+    if (now <= c->t_c)
+        return;
+    d = (int64_t)(now - c->t_c) * PS_PER_NS;
+    c->tokens = c->tokens + d > c->buffer ? c->buffer : c->tokens + d;
+    c->ctokens = c->ctokens + d > c->cbuffer ? c->cbuffer : c->ctokens + d;
+    c->t_c = now;
+}
+
+/* As in sch_htb, a class may send while its tokens are not negative, and
+ * otherwise borrow from the nearest ancestor that may, as long as its
+ * own ceil allows. Returns 0 and the lender, or the ns to wait. */
+static int64_t find_lender(struct shaper_class *c, uint64_t now, struct shaper_class **lender)
+{
+    int64_t d_own, d_ceil, d_parent;
+
+    class_update(c, now);
+    if (c->tokens >= 0) {
+        *lender = c;
+        return 0;
+    }
+    d_own = -c->tokens / PS_PER_NS + 1;
+    if (c->parent == NULL)
+        return d_own;
+    if (c->ctokens < 0) {
+        d_ceil = -c->ctokens / PS_PER_NS + 1;
+        return d_ceil < d_own ? d_ceil : d_own;
+    }
+    d_parent = find_lender(c->parent, now, lender);
+    if (d_parent == 0)
+        return 0;
+    return d_parent < d_own ? d_parent : d_own;
+}
+
+/* Tokens are taken from the lender and its ancestors, ctokens from the
+ * whole path: the classes below the lender borrowed. */
+static void charge(struct shaper_class *c, struct shaper_class *lender, uint32_t len,
+                   uint64_t now)
+{
+    int below = 1;
+
+    for (; c != NULL; c = c->parent) {
+        class_update(c, now);
+        if (c == lender)
+            below = 0;
+        if (!below) {
+            c->tokens -= (int64_t)(len * c->ps_per_byte);
+            if (c->tokens < -MAX_DEBT_PS)
+                c->tokens = -MAX_DEBT_PS;
+        }
+        c->ctokens -= (int64_t)(len * c->cps_per_byte);
+        if (c->ctokens < -MAX_DEBT_PS)
+            c->ctokens = -MAX_DEBT_PS;
+    }
+}
+
+static void active_push(struct shaper *s, struct shaper_class *c)
+{
+    c->state = C_ACTIVE;
+    c->anext = NULL;
+    if (s->active_tail != NULL)
+        s->active_tail->anext = c;
+    else
+        s->active_head = c;
+    s->active_tail = c;
+}
+
+static struct shaper_class *active_pop(struct shaper *s)
+{
+    struct shaper_class *c = s->active_head;
+
+    s->active_head = c->anext;
+    if (s->active_head == NULL)
+        s->active_tail = NULL;
+    c->anext = NULL;
+    return c;
+}
+
+static void wheel_add(struct shaper *s, struct shaper_class *c, uint64_t expire_ns)
+{
+    uint64_t tick = (expire_ns + SHAPER_TICK_NS - 1) / SHAPER_TICK_NS;
+    uint32_t slot;
+
+    if (tick <= s->wheel_tick)
+        tick = s->wheel_tick + 1;
+    slot = tick % SHAPER_WHEEL_SLOTS;
+    c->state = C_WAITING;
+    c->expire_tick = tick;
+    c->anext = s->wheel[slot];
+    s->wheel[slot] = c;
+    s->waiting++;
+}
+
+/* Move every class whose wait is over back to the active list. Each
+ * slot is visited at most once per call however long it has been. */
+static void wheel_advance(struct shaper *s, uint64_t now)
+{
+    uint64_t cur = now / SHAPER_TICK_NS, t, last;
+    struct shaper_class **pp, *c;
+
+    if (s->waiting == 0 || cur <= s->wheel_tick) {
+        if (cur > s->wheel_tick)
+            s->wheel_tick = cur;
+        return;
+    }
+    last = cur - s->wheel_tick > SHAPER_WHEEL_SLOTS ? s->wheel_tick + SHAPER_WHEEL_SLOTS : cur;
+    for (t = s->wheel_tick + 1; t <= last; t++) {
+        pp = &s->wheel[t % SHAPER_WHEEL_SLOTS];
+        while ((c = *pp) != NULL) {
+            if (c->expire_tick <= cur) {
+                *pp = c->anext;
+                s->waiting--;
+                active_push(s, c);
+            } else {
+                pp = &c->anext;
+            }
+        }
+    }
+    s->wheel_tick = cur;
+}
+
+int64_t shaper_next_event(struct shaper *s, uint64_t now)
+{
+    uint64_t t, best = 0;
+    struct shaper_class *c;
+    int64_t d;
+
+    if (s->active_head != NULL)
+        return 0;
+    if (s->waiting == 0)
+        return -1;
+    for (t = s->wheel_tick + 1; t <= s->wheel_tick + SHAPER_WHEEL_SLOTS; t++) {
+        for (c = s->wheel[t % SHAPER_WHEEL_SLOTS]; c != NULL; c = c->anext) {
+            if (best == 0 || c->expire_tick < best)
+                best = c->expire_tick;
+        }
+        /* the first slot due this round holds the earliest expiry */
+        if (best != 0 && best <= t)
+            break;
+    }
+    d = (int64_t)(best * SHAPER_TICK_NS) - (int64_t)now;
+    return d > 0 ? d : 0;
+}
+
+struct shaper_pkt *shaper_pkt_get(struct shaper *s)
+{
+    struct shaper_pkt *p = s->free_pkts;
+
+    if (p != NULL)
+        s->free_pkts = p->next;
+    return p;
+}
+
+void shaper_pkt_put(struct shaper *s, struct shaper_pkt *p)
+{
+    p->next = s->free_pkts;
+    s->free_pkts = p;
+}
+
+int shaper_enqueue(struct shaper *s, struct shaper_pkt *p, uint64_t now)
+{
+    struct shaper_class *c;
+    uint32_t id;
+
+    id = classify(s, p);
+    if (id == 0) {
+        s->stats.unclassified++;
+        return 0;
+    }
+    c = s->classes[id];
+    if (c->qlen >= c->limit) {
+        s->stats.dropped++;
+        return -1;
+    }
+    p->next = NULL;
+    if (c->qtail != NULL)
+        c->qtail->next = p;
+    else
+        c->qhead = p;
+    c->qtail = p;
+    c->qlen++;
+    s->stats.enqueued++;
+    s->stats.queued++;
+
+    if (c->state == C_IDLE) {
+        wheel_advance(s, now);
+        active_push(s, c);
+    }
+    return 1;
+}
+
+int shaper_dequeue(struct shaper *s, struct shaper_pkt **out, int max, uint64_t now)
+{
+    struct shaper_class *c, *lender;
+    struct shaper_pkt *p;
+    int64_t wait;
+    int n = 0;
+
+    wheel_advance(s, now);
+    while (n < max && s->active_head != NULL) {
+        c = s->active_head;
+        if (c->deficit <= 0) {
+            c->deficit += QUANTUM;
+            active_push(s, active_pop(s));
+            continue;
+        }
+        wait = find_lender(c, now, &lender);
+        if (wait > 0) {
+            active_pop(s);
+            wheel_add(s, c, now + wait);
+            continue;
+        }
+
+        p = c->qhead;
+        c->qhead = p->next;
+        if (c->qhead == NULL)
+            c->qtail = NULL;
+        c->qlen--;
+        charge(c, lender, p->len, now);
+        c->deficit -= p->len;
+        out[n++] = p;
+        s->stats.sent++;
+        s->stats.sent_bytes += p->len;
+        s->stats.queued--;
+
+        if (c->qlen == 0) {
+            active_pop(s);
+            c->state = C_IDLE;
+            c->deficit = 0;
+        }
+    }
+    return n;
+}
+
+/* "10mbit" etc. to picoseconds per byte; 0 on error */
+static uint64_t parse_rate(const char *str)
+{
+    char *end;
+    double bps = strtod(str, &end);
+
+    if (end == str || bps <= 0)
+        return 0;
+    if (strcasecmp(end, "kbit") == 0)
+        bps *= 1e3;
+    else if (strcasecmp(end, "mbit") == 0)
+        bps *= 1e6;
+    else if (strcasecmp(end, "gbit") == 0)
+        bps *= 1e9;
+    else if (*end != '\0' && strcasecmp(end, "bit") != 0)
+        return 0;
+    if (bps > 8e12)
+        return 0;
+    return (uint64_t)(8e12 / bps + 0.5);
+}
+
+static int parse_id(const char *str)
+{
+    char *end;
+    long id = str ? strtol(str, &end, 0) : 0;
+
+    if (str == NULL || *end != '\0' || id < 1 || id >= SHAPER_MAX_CLASSES)
+        return 0;
+    return (int)id;
+}
+
+static int parse_prefix(const char *str, uint32_t *addr, uint32_t *mask)
+{
+    char buf[64], *slash;
+    long len = 32;
+
+    if (str == NULL || strlen(str) >= sizeof(buf))
+        return -1;
+    strcpy(buf, str);
+    slash = strchr(buf, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        len = strtol(slash + 1, NULL, 10);
+        if (len < 0 || len > 32)
+            return -1;
+    }
+    if (inet_pton(AF_INET, buf, addr) != 1)
+        return -1;
+    *mask = len ? htonl(0xffffffffu << (32 - len)) : 0;
+    *addr &= *mask;
+    return 0;
+}
+
+static int parse_class(struct shaper *s, char **save)
+{
+    struct shaper_class *c;
+    char *tok, *arg;
+    uint64_t burst = 0, cburst = 0;
+    int id;
+
+    id = parse_id(strtok_r(NULL, " \t", save));
+    if (id == 0 || s->classes[id] != NULL)
+        return -1;
+    c = calloc(1, sizeof(*c));
+    if (c == NULL)
+        return -1;
+    c->id = id;
+    c->limit = SHAPER_DEFAULT_LIMIT;
+
+    while ((tok = strtok_r(NULL, " \t", save)) != NULL) {
+        arg = strtok_r(NULL, " \t", save);
+        if (arg == NULL)
+            goto bad;
+        if (strcmp(tok, "parent") == 0) {
+            id = parse_id(arg);
+            if (id == 0 || s->classes[id] == NULL)
+                goto bad;
+            c->parent = s->classes[id];
+        } else if (strcmp(tok, "rate") == 0) {
+            c->ps_per_byte = parse_rate(arg);
+        } else if (strcmp(tok, "ceil") == 0) {
+            c->cps_per_byte = parse_rate(arg);
+        } else if (strcmp(tok, "burst") == 0) {
+            burst = strtoull(arg, NULL, 0);
+        } else if (strcmp(tok, "cburst") == 0) {
+            cburst = strtoull(arg, NULL, 0);
+        } else if (strcmp(tok, "limit") == 0) {
+            c->limit = atoi(arg);
+        } else {
+            goto bad;
+        }
+    }
+    if (c->ps_per_byte == 0 || c->limit < 1)
+        goto bad;
+    if (c->cps_per_byte == 0 || c->cps_per_byte > c->ps_per_byte)
+        c->cps_per_byte = c->ps_per_byte;
+    /* like tc, the default burst is what the rate sends in a jiffy,
+     * here a millisecond */
+    if (burst == 0)
+        burst = 1000000000ull / c->ps_per_byte + MIN_BURST;
+    if (cburst == 0)
+        cburst = 1000000000ull / c->cps_per_byte + MIN_BURST;
+    c->buffer = c->tokens = (int64_t)(burst * c->ps_per_byte);
+    c->cbuffer = c->ctokens = (int64_t)(cburst * c->cps_per_byte);
+
+    if (c->parent != NULL)
+        c->parent->children++;
+    s->classes[c->id] = c;
+    c->next = s->list;
+    s->list = c;
+    s->nclasses++;
+    return 0;
+
+bad:
+    free(c);
+    return -1;
+}
+
+static int parse_filter(struct shaper *s, char **save)
+{
+    struct filter_entry e;
+    struct flow_key mask;
+    struct shaper_filter_table *t;
+    char *tok, *arg;
+    int i;
+
+    memset(&e, 0, sizeof(e));
+    memset(&mask, 0, sizeof(mask));
+    while ((tok = strtok_r(NULL, " \t", save)) != NULL) {
+        arg = strtok_r(NULL, " \t", save);
+        if (arg == NULL)
+            return -1;
+        if (strcmp(tok, "proto") == 0) {
+            if (strcmp(arg, "tcp") == 0)
+                e.key.proto = IPPROTO_TCP;
+            else if (strcmp(arg, "udp") == 0)
+                e.key.proto = IPPROTO_UDP;
+            else if (strcmp(arg, "icmp") == 0)
+                e.key.proto = IPPROTO_ICMP;
+            else
+                e.key.proto = atoi(arg);
+            mask.proto = 0xff;
+        } else if (strcmp(tok, "src") == 0) {
+            if (parse_prefix(arg, &e.key.src, &mask.src) < 0)
+                return -1;
+        } else if (strcmp(tok, "dst") == 0) {
+            if (parse_prefix(arg, &e.key.dst, &mask.dst) < 0)
+                return -1;
+        } else if (strcmp(tok, "sport") == 0) {
+            e.key.sport = htons(atoi(arg));
+            mask.sport = 0xffff;
+        } else if (strcmp(tok, "dport") == 0) {
+            e.key.dport = htons(atoi(arg));
+            mask.dport = 0xffff;
+        } else if (strcmp(tok, "class") == 0) {
+            e.class_id = parse_id(arg);
+            if (e.class_id == 0 || s->classes[e.class_id] == NULL)
+                return -1;
+        } else {
+            return -1;
+        }
+    }
+    if (e.class_id == 0)
+        return -1;
+    e.prio = ++s->nfilters;
+
+    for (i = 0; i < s->ntables; i++)
+        if (memcmp(&s->tables[i].mask, &mask, sizeof(mask)) == 0)
+            break;
+    if (i == s->ntables) {
+        t = realloc(s->tables, (s->ntables + 1) * sizeof(*t));
+        if (t == NULL)
+            return -1;
+        s->tables = t;
+        memset(&t[i], 0, sizeof(t[i]));
+        t[i].mask = mask;
+        s->ntables++;
+    }
+    return table_insert(&s->tables[i], &e);
+}
+
+/* Packets are only queued on leaves; a class may have been given
+ * children after a filter pointed at it. */
+static int check_leaves(struct shaper *s)
+{
+    uint32_t i, j;
+
+    if (s->default_id != 0 && s->classes[s->default_id]->children != 0) {
+        fprintf(stderr, "shaper: default class %d is not a leaf\n", s->default_id);
+        return -1;
+    }
+    for (i = 0; i < (uint32_t)s->ntables; i++) {
+        for (j = 0; j < s->tables[i].size; j++) {
+            const struct filter_entry *e = &s->tables[i].slots[j];
+
+            if (e->prio && s->classes[e->class_id]->children != 0) {
+                fprintf(stderr, "shaper: filter %d: class %u is not a leaf\n",
+                        e->prio, e->class_id);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int shaper_load(struct shaper *s, const char *path, int npkts, size_t pkt_size)
+{
+    FILE *f;
+    char line[512], *tok, *save, *hash;
+    int lineno = 0, ret = 0, i;
+    size_t stride;
+
+    memset(s, 0, sizeof(*s));
+    s->classes = calloc(SHAPER_MAX_CLASSES, sizeof(*s->classes));
+    if (s->classes == NULL)
+        return -1;
+    f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    while (ret == 0 && fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        hash = strchr(line, '#');
+        if (hash != NULL)
+            *hash = '\0';
+        line[strcspn(line, "\r\n")] = '\0';
+        tok = strtok_r(line, " \t", &save);
+        if (tok == NULL)
+            continue;
+        if (strcmp(tok, "class") == 0) {
+            ret = parse_class(s, &save);
+        } else if (strcmp(tok, "filter") == 0) {
+            ret = parse_filter(s, &save);
+        } else if (strcmp(tok, "default") == 0) {
+            s->default_id = parse_id(strtok_r(NULL, " \t", &save));
+            ret = (s->default_id == 0 || s->classes[s->default_id] == NULL) ? -1 : 0;
+        } else {
+            ret = -1;
+        }
+        if (ret < 0)
+            fprintf(stderr, "shaper: %s:%d: cannot parse this line\n", path, lineno);
+    }
+    fclose(f);
+
+    if (ret < 0 || check_leaves(s) < 0)
+        return -1;
+
+    /* most specific work first: order the tables by their best filter */
+    for (i = 1; i < s->ntables; i++) {
+        struct shaper_filter_table t = s->tables[i];
+        int j = i - 1;
+
+        while (j >= 0 && s->tables[j].min_prio > t.min_prio) {
+            s->tables[j + 1] = s->tables[j];
+            j--;
+        }
+        s->tables[j + 1] = t;
+    }
+
+    stride = (sizeof(struct shaper_pkt) + pkt_size + 63) & ~(size_t)63;
+    s->pkt_size = pkt_size;
+    s->pool = malloc(stride * npkts);
+    if (s->pool == NULL)
+        return -1;
+    for (i = npkts - 1; i >= 0; i--)
+        shaper_pkt_put(s, (struct shaper_pkt *)(s->pool + i * stride));
+    return 0;
+}
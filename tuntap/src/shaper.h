@@ -0,0 +1,102 @@
+#ifndef __SHAPER_H__
+#define __SHAPER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A userspace HTB (hierarchical token bucket) for the tunnel's egress.
+ *
+ * Classes form a tree. Each has a rate, guaranteed, and a ceil it may
+ * reach by borrowing unused rate from its ancestors; both are token
+ * buckets kept in picoseconds of sending time, as sch_htb keeps them in
+ * nanoseconds. Packets are classified by their IPv4 5-tuple and queued on
+ * a leaf class. A leaf whose head packet may not be sent yet is parked on
+ * a hashed timer wheel until the time it may; leaves that can send are
+ * served deficit round robin. Classification, enqueue and dequeue are
+ * O(1) in the number of classes.
+ *
+ * The configuration file has one statement per line, '#' starts a
+ * comment:
+ *
+ *   class <id> [parent <id>] rate <rate> [ceil <rate>] [burst <bytes>]
+ *         [cburst <bytes>] [limit <packets>]
+ *   filter [proto tcp|udp|icmp|<n>] [src <ip>[/<len>]] [sport <port>]
+ *          [dst <ip>[/<len>]] [dport <port>] class <id>
+ *   default <id>
+ *
+ * Rates take a kbit, mbit or gbit suffix (bits per second otherwise).
+ * Filters are tried in file order, the first match wins; packets no filter
+ * matches go to the default class, or pass unshaped if there is none. */
+
+#define SHAPER_MAX_CLASSES (65536)   /* class ids are 1..65535 */
+#define SHAPER_DEFAULT_LIMIT (128)
+#define SHAPER_TICK_NS (100000)      /* timer wheel resolution */
+#define SHAPER_WHEEL_SLOTS (1024)
+
+struct shaper_pkt {
+    struct shaper_pkt *next;
+    uint32_t len;
+    char data[];
+};
+
+struct shaper_class;
+struct shaper_filter_table;
+
+struct shaper_stats {
+    unsigned long enqueued;
+    unsigned long sent;
+    unsigned long sent_bytes;
+    unsigned long dropped;       /* leaf queue full or no buffer */
+    unsigned long unclassified;  /* passed through without a class */
+    unsigned long queued;        /* packets waiting right now */
+};
+
+struct shaper {
+    struct shaper_class **classes;   /* by id */
+    struct shaper_class *list;       /* all classes, in definition order */
+    int nclasses;
+    int default_id;
+
+    struct shaper_filter_table *tables;  /* one per distinct filter mask */
+    int ntables;
+    int nfilters;
+
+    /* leaves that have packets and may send, deficit round robin */
+    struct shaper_class *active_head, *active_tail;
+
+    /* leaves waiting for tokens; slot = expiry tick % SHAPER_WHEEL_SLOTS */
+    struct shaper_class *wheel[SHAPER_WHEEL_SLOTS];
+    uint64_t wheel_tick;    /* last tick processed */
+    int waiting;
+
+    /* packet buffers, preallocated */
+    char *pool;
+    struct shaper_pkt *free_pkts;
+    size_t pkt_size;
+
+    struct shaper_stats stats;
+};
+
+/* Read the configuration and allocate npkts buffers of up to pkt_size
+ * bytes. Returns 0, or -1 after printing what is wrong. */
+int shaper_load(struct shaper *s, const char *path, int npkts, size_t pkt_size);
+
+/* A free buffer to read a packet into, or NULL if none is left */
+struct shaper_pkt *shaper_pkt_get(struct shaper *s);
+void shaper_pkt_put(struct shaper *s, struct shaper_pkt *p);
+
+/* Classify p (an ip packet of p->len bytes) and queue it. Returns 1 if it
+ * was queued, 0 if it matched no class and the caller should send it
+ * right away, or -1 if it was dropped; in the last two cases the buffer
+ * still belongs to the caller. */
+int shaper_enqueue(struct shaper *s, struct shaper_pkt *p, uint64_t now_ns);
+
+/* Release up to max packets that may be sent at now_ns. The caller sends
+ * them and gives the buffers back with shaper_pkt_put(). */
+int shaper_dequeue(struct shaper *s, struct shaper_pkt **out, int max, uint64_t now_ns);
+
+/* Nanoseconds until shaper_dequeue() may have something to release:
+ * 0 if it has now, -1 if nothing is queued. */
+int64_t shaper_next_event(struct shaper *s, uint64_t now_ns);
+
+#endif
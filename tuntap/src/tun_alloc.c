@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <linux/virtio_net.h>
 #include <sys/ioctl.h>
 
 #include "./tun_alloc.h"
@@ -56,3 +57,40 @@ int tun_alloc(char *dev, int flags) {
    * with the virtual interface */
   return fd;
 }
+
+/* Attach "queues" file descriptors to one multiqueue interface.
+ *
+ * Every open of the clone device with IFF_MULTI_QUEUE and the same name
+ * adds one more queue to the interface; the kernel spreads flows over
+ * the queues by their rx hash, so each fd can be served by its own
+ * thread. On success fds[0..queues-1] are filled in, dev holds the
+ * interface name and 0 is returned; on failure every fd opened so far
+ * is closed and a negative value is returned. */
+int tun_alloc_mq(char *dev, int flags, int *fds, int queues)
+{
+  int i, fd;
+
+  for (i = 0; i < queues; i++) {
+    fd = tun_alloc(dev, flags | IFF_MULTI_QUEUE);
+    if (fd < 0) {
+      while (--i >= 0)
+        close(fds[i]);
+      return fd;
+    }
+    fds[i] = fd;
+  }
+  return 0;
+}
+
+/* Enable checksum/segmentation offloads (TUN_F_* flags) on an fd opened
+ * with IFF_VNET_HDR. From then on reads may return 64 KiB GSO packets
+ * and packets without a valid L4 checksum, described by the
+ * virtio_net_hdr in front of them. */
+int tun_set_offload(int fd, unsigned int offloads)
+{
+  int sz = sizeof(struct virtio_net_hdr);
+
+  if (ioctl(fd, TUNSETVNETHDRSZ, &sz) < 0)
+    return -1;
+  return ioctl(fd, TUNSETOFFLOAD, offloads);
+}
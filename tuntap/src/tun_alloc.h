@@ -1,5 +1,8 @@
 #ifndef __TUN_ALLOC_H__
 #define __TUN_ALLOC_H__
 
+int tun_alloc(char *dev, int flags);
+int tun_alloc_mq(char *dev, int flags, int *fds, int queues);
+int tun_set_offload(int fd, unsigned int offloads);
 
 #endif
@@ -1,49 +1,513 @@
   /* tunclient.c */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
 
 #include "./tun_alloc.h"
+#include "./vnet_hdr.h"
+#include "./udptun.h"
+#include "./capture.h"
+
+/* Batch mode: every wakeup drains up to BATCH packets into preallocated
+ * buffers before going back to epoll, and only counters are kept, printed
+ * once per second, instead of a printf per packet.
+ *
+ * With -q N the interface is opened with IFF_MULTI_QUEUE and every queue
+ * gets its own reader thread pinned to its own cpu.
+ *
+ * With -o the interface is opened with IFF_VNET_HDR and checksum/TSO
+ * offloads, packets grow up to 64 KiB and each one is counted both as
+ * read and as the number of MTU-sized segments it stands for. In tunnel
+ * mode (-u) the tunnel then exchanges such super-packets with the device,
+ * see udptun.h.
+ *
+ * With -u port the client becomes one end of a point-to-point tunnel:
+ * packets from the device go to the peer (-r host:port, or whoever sends
+ * first) over UDP and the peer's datagrams are written back, see
+ * udptun.c. -S config shapes what goes to the peer with a hierarchical
+ * token bucket, see shaper.h for the configuration.
+ *
+ * With -w file every packet is also copied into a per-thread capture ring
+ * and written to rotating pcap files by a separate thread, see capture.c;
+ * a full ring drops captured copies, never the forwarded packet. */
+#define BATCH (64)
+#define PKTBUFSIZE (4096)
+#define MAXQUEUES (64)
+
 static char buffer[4096];
 
+struct counters {
+    unsigned long packets;
+    unsigned long bytes;
+    unsigned long wakeups;
+    unsigned long segs;         /* -o: wire packets after segmentation */
+    unsigned long gso_packets;  /* -o: reads that were GSO super-packets */
+    unsigned long bad_hdrs;     /* -o: malformed virtio_net_hdr */
+};
+
+static int offload;
+static int capturing;
+static struct capture cap;
+
+#define DEFAULT_SNAPLEN (1600)
+#define DEFAULT_CAPFILE_MB (64)
+#define DEFAULT_CAPFILES (4)
+#define SHAPER_PKTS (8192)      /* packets the shaper can hold in total */
+
+/* One reader thread per queue. Counters are only written by the reader
+ * and read by the main thread for the once-a-second report. */
+struct reader {
+    pthread_t tid;
+    int queue;
+    int cpu;
+    int tun_fd;
+    struct counters cnt;
+    char *pktbufs;
+    size_t bufsize;
+    struct capture_ring *cap;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void counters_read(struct counters *dst, const struct counters *src)
+{
+    dst->packets = __atomic_load_n(&src->packets, __ATOMIC_RELAXED);
+    dst->bytes = __atomic_load_n(&src->bytes, __ATOMIC_RELAXED);
+    dst->wakeups = __atomic_load_n(&src->wakeups, __ATOMIC_RELAXED);
+    dst->segs = __atomic_load_n(&src->segs, __ATOMIC_RELAXED);
+    dst->gso_packets = __atomic_load_n(&src->gso_packets, __ATOMIC_RELAXED);
+    dst->bad_hdrs = __atomic_load_n(&src->bad_hdrs, __ATOMIC_RELAXED);
+}
+
+static void print_rate(const char *name, struct counters *now, struct counters *last, double secs)
+{
+    unsigned long pkts = now->packets - last->packets;
+    unsigned long wakeups = now->wakeups - last->wakeups;
+
+    printf("%s: %.0f pkts/s %.1f Mbit/s %.1f pkts/wakeup", name,
+           pkts / secs, (now->bytes - last->bytes) * 8 / secs / 1e6,
+           wakeups ? (double)pkts / wakeups : 0.0);
+    if (offload)
+        printf(" %.0f segs/s %.0f gso/s %lu bad hdrs",
+               (now->segs - last->segs) / secs,
+               (now->gso_packets - last->gso_packets) / secs, now->bad_hdrs);
+    printf("\n");
+    *last = *now;
+}
+
+/* Drain the fd until it would block or BATCH packets have been read.
+ * A tun fd hands out exactly one packet per read(), so a batch is a run
+ * of reads into the preallocated buffers with no wait in between.
+ * Returns the number of packets read, or -1 on error. */
+static int read_batch(struct reader *r, struct iovec *pkts, int max)
+{
+    ssize_t n;
+    int i;
+
+    i = 0;
+    while (i < max) {
+        n = read(r->tun_fd, r->pktbufs + i * r->bufsize, r->bufsize);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+        pkts[i].iov_base = r->pktbufs + i * r->bufsize;
+        pkts[i].iov_len = n;
+        i++;
+    }
+    return i;
+}
+
+static void *reader_main(void *arg)
+{
+    struct reader *r = arg;
+    struct epoll_event ev;
+    struct iovec pkts[BATCH];
+    cpu_set_t cpuset;
+    struct vnet_info vi;
+    unsigned long bytes, segs, gso, bad;
+    int epfd, nfds, n, i;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(r->cpu, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+        fprintf(stderr, "queue %d: cannot pin to cpu %d\n", r->queue, r->cpu);
+
+    if (fcntl(r->tun_fd, F_SETFL, fcntl(r->tun_fd, F_GETFL) | O_NONBLOCK) < 0) {
+        perror("fcntl O_NONBLOCK");
+        exit(1);
+    }
+
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = r->tun_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, r->tun_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+
+    while (1) {
+        nfds = epoll_wait(epfd, &ev, 1, -1);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            exit(1);
+        }
+
+        __atomic_store_n(&r->cnt.wakeups, r->cnt.wakeups + 1, __ATOMIC_RELAXED);
+        /* keep reading full batches while the queue has packets */
+        do {
+            n = read_batch(r, pkts, BATCH);
+            if (n < 0) {
+                perror("Reading from interface");
+                close(r->tun_fd);
+                exit(1);
+            }
+            bytes = segs = gso = bad = 0;
+            for (i = 0; i < n; i++) {
+                /* Do whatever with the data */
+                bytes += pkts[i].iov_len;
+                if (r->cap != NULL) {
+                    if (offload && pkts[i].iov_len >= VNET_HDR_LEN)
+                        capture_packet(r->cap, (char *)pkts[i].iov_base + VNET_HDR_LEN,
+                                       pkts[i].iov_len - VNET_HDR_LEN);
+                    else if (!offload)
+                        capture_packet(r->cap, pkts[i].iov_base, pkts[i].iov_len);
+                }
+                if (!offload)
+                    continue;
+                if (vnet_hdr_parse(pkts[i].iov_base, pkts[i].iov_len, &vi) < 0) {
+                    bad++;
+                    continue;
+                }
+                segs += vi.segs;
+                if (vi.gso != VIRTIO_NET_HDR_GSO_NONE)
+                    gso++;
+            }
+            __atomic_store_n(&r->cnt.bytes, r->cnt.bytes + bytes, __ATOMIC_RELAXED);
+            if (offload) {
+                __atomic_store_n(&r->cnt.segs, r->cnt.segs + segs, __ATOMIC_RELAXED);
+                __atomic_store_n(&r->cnt.gso_packets, r->cnt.gso_packets + gso, __ATOMIC_RELAXED);
+                __atomic_store_n(&r->cnt.bad_hdrs, r->cnt.bad_hdrs + bad, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&r->cnt.packets, r->cnt.packets + n, __ATOMIC_RELAXED);
+        } while (n == BATCH);
+    }
+    return NULL;
+}
+
+static void stop_capture(int sig)
+{
+    (void)sig;
+    capture_exit(&cap);
+}
+
+/* Start the writer once all rings exist; Ctrl-C then lets it trim the
+ * preallocated pcap file to what was written before the process ends. */
+static void start_capture(void)
+{
+    struct sigaction sa;
+
+    if (capture_start(&cap) < 0) {
+        perror("Starting capture");
+        exit(1);
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_capture;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+static void run_batch(int *tun_fds, int queues, const char *tun_name)
+{
+    struct reader *readers;
+    struct counters total, last_total, *last;
+    char name[IFNAMSIZ + 16];
+    double t_last, t;
+    long ncpu;
+    int i, ret;
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1)
+        ncpu = 1;
+
+    readers = calloc(queues, sizeof(*readers));
+    last = calloc(queues, sizeof(*last));
+    if (readers == NULL || last == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (i = 0; i < queues; i++) {
+        readers[i].queue = i;
+        readers[i].cpu = i % ncpu;
+        readers[i].tun_fd = tun_fds[i];
+        readers[i].bufsize = offload ? VNET_MAX_PKT : PKTBUFSIZE;
+        readers[i].pktbufs = malloc(BATCH * readers[i].bufsize);
+        if (readers[i].pktbufs == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        if (capturing && (readers[i].cap = capture_ring_new(&cap)) == NULL) {
+            perror("capture ring");
+            exit(1);
+        }
+        ret = pthread_create(&readers[i].tid, NULL, reader_main, &readers[i]);
+        if (ret != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+            exit(1);
+        }
+    }
+
+    if (capturing)
+        start_capture();
+
+    memset(&last_total, 0, sizeof(last_total));
+    t_last = now_sec();
+
+    while (1) {
+        sleep(1);
+        t = now_sec();
+        memset(&total, 0, sizeof(total));
+        for (i = 0; i < queues; i++) {
+            struct counters c;
+
+            counters_read(&c, &readers[i].cnt);
+            total.packets += c.packets;
+            total.bytes += c.bytes;
+            total.wakeups += c.wakeups;
+            total.segs += c.segs;
+            total.gso_packets += c.gso_packets;
+            total.bad_hdrs += c.bad_hdrs;
+            if (queues > 1) {
+                snprintf(name, sizeof(name), "%s queue %d", tun_name, i);
+                print_rate(name, &c, &last[i], t - t_last);
+            }
+        }
+        print_rate(tun_name, &total, &last_total, t - t_last);
+        if (capturing)
+            printf("%s: capture %lu packets written, %lu dropped\n", tun_name,
+                   __atomic_load_n(&cap.packets, __ATOMIC_RELAXED), capture_drops(&cap));
+        fflush(stdout);
+        t_last = t;
+    }
+}
+
+/* TSO only makes sense on a tun device (ip packets); on tap the kernel
+ * still gives us checksum offload. */
+static void enable_offload(int fd)
+{
+    if (tun_set_offload(fd, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN) < 0 &&
+        tun_set_offload(fd, TUN_F_CSUM) < 0) {
+        perror("TUNSETOFFLOAD");
+        exit(1);
+    }
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-b] [-q queues] [-o] [-u port [-r host:port] [-S shaper.conf]]\n"
+           "       [-w file [-s snaplen] [-C MB] [-W files]] intefacename(etc:tun0) mode(tun/tap)\n", prog);
+    printf("  -b : batch mode, drain the device in batches and only print counters\n");
+    printf("  -q : open the interface with N queues (IFF_MULTI_QUEUE), one pinned\n");
+    printf("       reader thread per queue; implies -b\n");
+    printf("  -o : IFF_VNET_HDR with checksum and TSO offload, up to 64 KiB per\n");
+    printf("       packet; implies -b\n");
+    printf("  -u : tunnel the device over UDP, bound to this local port\n");
+    printf("  -r : the tunnel peer, host:port; without it the first sender is\n");
+    printf("       the peer\n");
+    printf("  -S : shape the tunnel's outgoing traffic (HTB) as this file says\n");
+    printf("  -w : capture all packets to this pcap file\n");
+    printf("  -s : capture snaplen, default %d bytes\n", DEFAULT_SNAPLEN);
+    printf("  -C : capture file size in MB, default %d\n", DEFAULT_CAPFILE_MB);
+    printf("  -W : rotate over this many capture files (file.0, file.1, ...),\n");
+    printf("       default %d\n", DEFAULT_CAPFILES);
+}
+
 int main(int argc, char *argv[])
 {
 	char tun_name[IFNAMSIZ];
     int tun_fd=-1;
-    int nread = 0;	
-    
-    if (argc!=3) {
-        printf("usage: %s intefacename(etc:tun0) mode(tun/tap)\n", argv[0]);
+    int nread = 0;
+    int batch = 0;
+    int queues = 1;
+    int tun_fds[MAXQUEUES];
+    int opt;
+    int lport = 0;
+    const char *peer = NULL;
+    const char *capfile = NULL;
+    const char *shaper_conf = NULL;
+    int snaplen = DEFAULT_SNAPLEN;
+    long capfile_mb = DEFAULT_CAPFILE_MB;
+    int capfiles = DEFAULT_CAPFILES;
+    struct capture_ring *simple_ring = NULL;
+
+    while ((opt = getopt(argc, argv, "bq:ou:r:S:w:s:C:W:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            batch = 1;
+            break;
+        case 'q':
+            queues = atoi(optarg);
+            if (queues < 1 || queues > MAXQUEUES) {
+                usage(argv[0]);
+                exit(1);
+            }
+            batch = 1;
+            break;
+        case 'o':
+            offload = 1;
+            batch = 1;
+            break;
+        case 'u':
+            lport = atoi(optarg);
+            break;
+        case 'r':
+            peer = optarg;
+            break;
+        case 'S':
+            shaper_conf = optarg;
+            break;
+        case 'w':
+            capfile = optarg;
+            break;
+        case 's':
+            snaplen = atoi(optarg);
+            break;
+        case 'C':
+            capfile_mb = atol(optarg);
+            break;
+        case 'W':
+            capfiles = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (argc - optind != 2 || ((peer != NULL || shaper_conf != NULL) && lport == 0) ||
+        (lport != 0 && queues > 1) || (offload && shaper_conf != NULL)) {
+        usage(argv[0]);
         exit(1);
     }
-    
+
     int flag = 0;
-    if (strncmp("tun",argv[2],3) == 0) {
+    if (strncmp("tun", argv[optind + 1], 3) == 0) {
         flag = IFF_TUN | IFF_NO_PI;
-    } else if (strncmp("tap", argv[2], 3)!=0) {
+    } else if (strncmp("tap", argv[optind + 1], 3) == 0) {
         flag = IFF_TAP | IFF_NO_PI;
     } else {
-        printf("usage: %s intefacename(etc:tun0) mode(tun/tap)\n", argv[0]);
+        usage(argv[0]);
         exit(1);
     }
-    
+
+	if (offload)
+	  flag |= IFF_VNET_HDR;
+
+	if (capfile != NULL) {
+	  if (snaplen < 1 || snaplen > 65535 ||
+	      capture_init(&cap, capfile, (flag & IFF_TUN) ? CAPTURE_LINK_RAW : CAPTURE_LINK_ETHERNET,
+	                   snaplen, (size_t)capfile_mb << 20, capfiles) < 0) {
+	    usage(argv[0]);
+	    exit(1);
+	  }
+	  capturing = 1;
+	}
+
 	/* Connect to the device */
-	strncpy(tun_name, argv[1], IFNAMSIZ);
+	strncpy(tun_name, argv[optind], IFNAMSIZ - 1);
+	tun_name[IFNAMSIZ - 1] = '\0';
+	if (queues > 1) {
+	  if (tun_alloc_mq(tun_name, flag, tun_fds, queues) < 0) {
+	    perror("Allocating multiqueue interface");
+	    exit(1);
+	  }
+	  for (int q = 0; offload && q < queues; q++)
+	    enable_offload(tun_fds[q]);
+	  run_batch(tun_fds, queues, tun_name);
+	}
+
 	tun_fd = tun_alloc(tun_name, flag);  /* tun interface */
-	
+
 	if(tun_fd < 0){
 	  perror("Allocating interface");
 	  exit(1);
 	}
-	
+
+	if (offload)
+	  enable_offload(tun_fd);
+
+	if (lport != 0) {
+	  struct udptun t;
+	  static struct shaper shaper;
+
+	  if (udptun_open(&t, tun_fd, lport, peer, offload) < 0) {
+	    perror("Opening UDP tunnel");
+	    exit(1);
+	  }
+	  if (shaper_conf != NULL) {
+	    if (shaper_load(&shaper, shaper_conf, SHAPER_PKTS, UDPTUN_MTU_MAX) < 0) {
+	      fprintf(stderr, "Loading %s failed\n", shaper_conf);
+	      exit(1);
+	    }
+	    t.shaper = &shaper;
+	  }
+	  if (capturing) {
+	    if ((t.cap = capture_ring_new(&cap)) == NULL) {
+	      perror("capture ring");
+	      exit(1);
+	    }
+	    start_capture();
+	  }
+	  udptun_run(&t, tun_name);
+	  perror("UDP tunnel");
+	  exit(1);
+	}
+
+	if (batch)
+	  run_batch(&tun_fd, 1, tun_name);
+
+	if (capturing) {
+	  simple_ring = capture_ring_new(&cap);
+	  if (simple_ring == NULL) {
+	    perror("capture ring");
+	    exit(1);
+	  }
+	  start_capture();
+	}
+
 	/* Now read data coming from the kernel */
 	while(1) {
 	  /* Note that "buffer" should be at least the MTU size of the interface, eg 1500 bytes */
@@ -53,8 +517,11 @@ int main(int argc, char *argv[])
 	    close(tun_fd);
 	    exit(1);
 	  }
-	
+
 	  /* Do whatever with the data */
-	  printf("Read %d bytes from device %s\n", nread, tun_name);
+	  if (simple_ring != NULL)
+	    capture_packet(simple_ring, buffer, nread);
+	  else
+	    printf("Read %d bytes from device %s\n", nread, tun_name);
 	}
 }
@@ -0,0 +1,720 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "./udptun.h"
+#include "./vnet_hdr.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP (17)
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT (103)
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO (104)
+#endif
+
+#define TUN_MTU_MAX (UDPTUN_MTU_MAX)
+#define GSO_MAX_SEGS (64)           /* UDP_MAX_SEGMENTS of older kernels */
+#define GSO_MAX_BYTES (65000)       /* stay below the 64 KiB ip datagram */
+#define GRO_BUFSIZE (65536)
+#define SOCK_BUFSIZE (4 << 20)
+
+/* One outgoing datagram, or with GSO a run of equal-sized packets that
+ * sit back to back in txbuf; only the last one may be shorter. */
+struct tx_run {
+    char *base;
+    size_t len;
+    uint16_t seg;
+    int segs;
+    int closed;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int resolve(const char *hostport, struct sockaddr_storage *ss, socklen_t *len)
+{
+    struct addrinfo hints, *res;
+    char host[256];
+    const char *colon;
+    int err;
+
+    colon = strrchr(hostport, ':');
+    if (colon == NULL || colon == hostport || (size_t)(colon - hostport) >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(host, hostport, colon - hostport);
+    host[colon - hostport] = '\0';
+    /* allow [v6addr]:port */
+    if (host[0] == '[' && host[colon - hostport - 1] == ']') {
+        memmove(host, host + 1, colon - hostport - 2);
+        host[colon - hostport - 2] = '\0';
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    err = getaddrinfo(host, colon + 1, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", hostport, gai_strerror(err));
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(ss, res->ai_addr, res->ai_addrlen);
+    *len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+int udptun_open(struct udptun *t, int tun_fd, int lport, const char *peer, int vnet)
+{
+    struct sockaddr_storage peer_addr, local;
+    socklen_t peer_len = 0;
+    int family = AF_INET6, one = 1, zero = 0, bufsize = SOCK_BUFSIZE;
+    int probe = 1200;
+
+    memset(t, 0, sizeof(*t));
+    t->tun_fd = tun_fd;
+    t->vnet = vnet;
+
+    if (peer != NULL) {
+        if (resolve(peer, &peer_addr, &peer_len) < 0)
+            return -1;
+        family = peer_addr.ss_family;
+    }
+
+    t->udp_fd = socket(family, SOCK_DGRAM, 0);
+    if (t->udp_fd < 0)
+        return -1;
+    setsockopt(t->udp_fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    setsockopt(t->udp_fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+    memset(&local, 0, sizeof(local));
+    if (family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&local;
+
+        /* without a peer accept both v4 and v6 */
+        setsockopt(t->udp_fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(lport);
+        sin6->sin6_addr = in6addr_any;
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&local;
+
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(lport);
+        sin->sin_addr.s_addr = htonl(INADDR_ANY);
+    }
+    if (bind(t->udp_fd, (struct sockaddr *)&local, sizeof(local)) < 0)
+        goto fail;
+
+    if (peer != NULL) {
+        if (connect(t->udp_fd, (struct sockaddr *)&peer_addr, peer_len) < 0)
+            goto fail;
+        t->has_peer = 1;
+    }
+
+    /* UDP_SEGMENT (Linux 4.18) and UDP_GRO (5.0) are only used when the
+     * kernel accepts them; otherwise every packet is its own datagram. */
+    t->gso = setsockopt(t->udp_fd, SOL_UDP, UDP_SEGMENT, &probe, sizeof(probe)) == 0;
+    if (t->gso) {
+        probe = 0;
+        setsockopt(t->udp_fd, SOL_UDP, UDP_SEGMENT, &probe, sizeof(probe));
+    }
+    t->gro = setsockopt(t->udp_fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+
+    t->rx_bufsize = t->gro ? GRO_BUFSIZE : TUN_MTU_MAX;
+    t->txbuf = malloc(UDPTUN_BATCH * TUN_MTU_MAX);
+    t->rxbuf = malloc(UDPTUN_BATCH * t->rx_bufsize);
+    if (vnet)
+        t->rdbuf = malloc(VNET_MAX_PKT);
+    if (t->txbuf == NULL || t->rxbuf == NULL || (vnet && t->rdbuf == NULL))
+        goto fail;
+
+    if (fcntl(tun_fd, F_SETFL, fcntl(tun_fd, F_GETFL) | O_NONBLOCK) < 0)
+        goto fail;
+    return 0;
+
+fail:
+    close(t->udp_fd);
+    free(t->txbuf);
+    free(t->rxbuf);
+    free(t->rdbuf);
+    return -1;
+}
+
+/* Send the packets of one GSO run as separate datagrams, for when the
+ * kernel turned UDP_SEGMENT down. */
+static int send_run_split(struct udptun *t, const struct tx_run *r)
+{
+    struct mmsghdr msgs[GSO_MAX_SEGS];
+    struct iovec iov[GSO_MAX_SEGS];
+    size_t off;
+    int n, done, ret;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (off = 0, n = 0; off < r->len; off += iov[n++].iov_len) {
+        iov[n].iov_base = r->base + off;
+        iov[n].iov_len = r->len - off < r->seg ? r->len - off : r->seg;
+        msgs[n].msg_hdr.msg_iov = &iov[n];
+        msgs[n].msg_hdr.msg_iovlen = 1;
+    }
+
+    done = 0;
+    while (done < n) {
+        ret = sendmmsg(t->udp_fd, msgs + done, n - done, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == ECONNREFUSED) {
+                t->cnt.drops++;
+                done++;
+                continue;
+            }
+            return -1;
+        }
+        t->cnt.send_calls++;
+        t->cnt.send_msgs += ret;
+        done += ret;
+    }
+    return 0;
+}
+
+/* Send runs[0..n) with as few sendmmsg() calls as the socket allows.
+ * The socket is blocking, so a full send buffer slows the tun reader
+ * down instead of dropping. */
+static int send_runs(struct udptun *t, struct tx_run *runs, int n)
+{
+    struct mmsghdr msgs[UDPTUN_BATCH];
+    struct iovec iov[UDPTUN_BATCH];
+    char ctrl[UDPTUN_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr *cm;
+    int i, done, ret;
+
+    memset(msgs, 0, n * sizeof(msgs[0]));
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = runs[i].base;
+        iov[i].iov_len = runs[i].len;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (runs[i].segs > 1) {
+            msgs[i].msg_hdr.msg_control = ctrl[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+            cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            memcpy(CMSG_DATA(cm), &runs[i].seg, sizeof(uint16_t));
+        }
+    }
+
+    done = 0;
+    while (done < n) {
+        ret = sendmmsg(t->udp_fd, msgs + done, n - done, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            /* the peer is not listening (yet): not our problem */
+            if (errno == ECONNREFUSED) {
+                t->cnt.drops += runs[done].segs;
+                done++;
+                continue;
+            }
+            /* the route's device cannot do GSO: fall back for good.
+             * The runs still to go in this batch, the rejected one
+             * included, lose UDP_SEGMENT and go out packet by packet */
+            if (errno == EIO && runs[done].segs > 1 && t->gso) {
+                fprintf(stderr, "UDP GSO rejected, sending packets one by one\n");
+                t->gso = 0;
+                for (i = done; i < n; i++)
+                    if (send_run_split(t, &runs[i]) < 0)
+                        return -1;
+                break;
+            }
+            return -1;
+        }
+        t->cnt.send_calls++;
+        t->cnt.send_msgs += ret;
+        done += ret;
+    }
+    return 0;
+}
+
+/* Append a packet that sits at the end of txbuf to the runs: it joins
+ * the current GSO run if it is no longer than the run's packets. */
+static void add_to_runs(struct udptun *t, struct tx_run *runs, int *nruns,
+                        struct tx_run **curp, char *base, size_t n)
+{
+    struct tx_run *cur = *curp;
+
+    if (t->gso && cur != NULL && !cur->closed && n <= cur->seg &&
+        cur->segs < GSO_MAX_SEGS && cur->len + n <= GSO_MAX_BYTES) {
+        cur->len += n;
+        cur->segs++;
+        if (n < cur->seg)
+            cur->closed = 1;
+    } else {
+        cur = &runs[(*nruns)++];
+        cur->base = base;
+        cur->len = n;
+        cur->seg = n;
+        cur->segs = 1;
+        cur->closed = 0;
+        *curp = cur;
+    }
+}
+
+/* Read up to UDPTUN_BATCH packets from the tun fd back to back into
+ * txbuf, grouping them into GSO runs as they come, and send them.
+ * Returns the number of packets read, or -1 on error. */
+static int tun_to_udp(struct udptun *t)
+{
+    struct tx_run runs[UDPTUN_BATCH], *cur = NULL;
+    size_t off = 0;
+    ssize_t n;
+    int npkts = 0, nruns = 0;
+
+    while (npkts < UDPTUN_BATCH) {
+        n = read(t->tun_fd, t->txbuf + off, TUN_MTU_MAX);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+        if (n == 0)
+            continue;
+        if (t->cap != NULL)
+            capture_packet(t->cap, t->txbuf + off, n);
+        npkts++;
+        t->cnt.tun_packets++;
+        t->cnt.tun_bytes += n;
+        add_to_runs(t, runs, &nruns, &cur, t->txbuf + off, n);
+        off += n;
+    }
+
+    if (npkts == 0)
+        return 0;
+    if (!t->has_peer) {
+        t->cnt.drops += npkts;
+        return npkts;
+    }
+    if (send_runs(t, runs, nruns) < 0)
+        return -1;
+    return npkts;
+}
+
+/* The vnet variant of tun_to_udp(): a packet read may be a TCP
+ * super-packet, which is cut into segments back to back in txbuf, where
+ * they make up a GSO run. txbuf is sent whenever it or the runs fill up,
+ * so one read can turn into more than a batch of packets. */
+static int tun_to_udp_vnet(struct udptun *t)
+{
+    struct tx_run runs[UDPTUN_BATCH], *cur = NULL;
+    struct vnet_info vi;
+    size_t off = 0, len;
+    ssize_t n;
+    unsigned int i;
+    int nreads = 0, npkts = 0, nruns = 0;
+
+    while (nreads < UDPTUN_BATCH) {
+        n = read(t->tun_fd, t->rdbuf, VNET_MAX_PKT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+        nreads++;
+        /* every segment must fit into the peer's receive buffers */
+        if (vnet_hdr_parse(t->rdbuf, n, &vi) < 0 || vnet_seg_len(&vi, 0) > TUN_MTU_MAX) {
+            t->cnt.drops++;
+            continue;
+        }
+        if (vi.gso != VIRTIO_NET_HDR_GSO_NONE)
+            t->cnt.tun_gso++;
+
+        for (i = 0; i < vi.segs; i++) {
+            if (off + TUN_MTU_MAX > UDPTUN_BATCH * TUN_MTU_MAX || nruns == UDPTUN_BATCH) {
+                if (!t->has_peer)
+                    t->cnt.drops += npkts;
+                else if (send_runs(t, runs, nruns) < 0)
+                    return -1;
+                off = npkts = nruns = 0;
+                cur = NULL;
+            }
+            len = vnet_segment(&vi, i, t->txbuf + off);
+            if (t->cap != NULL)
+                capture_packet(t->cap, t->txbuf + off, len);
+            npkts++;
+            t->cnt.tun_packets++;
+            t->cnt.tun_bytes += len;
+            add_to_runs(t, runs, &nruns, &cur, t->txbuf + off, len);
+            off += len;
+        }
+    }
+
+    if (npkts == 0)
+        return nreads;
+    if (!t->has_peer) {
+        t->cnt.drops += npkts;
+        return nreads;
+    }
+    if (send_runs(t, runs, nruns) < 0)
+        return -1;
+    return nreads;
+}
+
+/* Send packets the shaper let go: copied back to back into txbuf they
+ * form GSO runs like freshly read ones. The buffers go back to the pool. */
+static int send_shaped(struct udptun *t, struct shaper_pkt **pkts, int n)
+{
+    struct tx_run runs[UDPTUN_BATCH], *cur = NULL;
+    size_t off = 0;
+    int i, nruns = 0;
+
+    for (i = 0; i < n; i++) {
+        memcpy(t->txbuf + off, pkts[i]->data, pkts[i]->len);
+        add_to_runs(t, runs, &nruns, &cur, t->txbuf + off, pkts[i]->len);
+        off += pkts[i]->len;
+        shaper_pkt_put(t->shaper, pkts[i]);
+    }
+    if (!t->has_peer) {
+        t->cnt.drops += n;
+        return 0;
+    }
+    return send_runs(t, runs, nruns);
+}
+
+/* The shaped variant of tun_to_udp(): packets are read straight into
+ * shaper buffers and queued on their class; only packets no class
+ * matches are sent at once. */
+static int tun_to_shaper(struct udptun *t)
+{
+    struct shaper_pkt *pass[UDPTUN_BATCH], *p;
+    uint64_t now = now_ns();
+    ssize_t n;
+    int npkts = 0, npass = 0, ret;
+
+    while (npkts < UDPTUN_BATCH) {
+        /* with the pool used up, read into txbuf just to drop */
+        p = shaper_pkt_get(t->shaper);
+        n = read(t->tun_fd, p != NULL ? p->data : t->txbuf, TUN_MTU_MAX);
+        if (n <= 0) {
+            if (p != NULL)
+                shaper_pkt_put(t->shaper, p);
+            if (n == 0 || errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+        if (t->cap != NULL)
+            capture_packet(t->cap, p != NULL ? p->data : t->txbuf, n);
+        npkts++;
+        t->cnt.tun_packets++;
+        t->cnt.tun_bytes += n;
+        if (p == NULL) {
+            t->shaper->stats.dropped++;
+            continue;
+        }
+
+        p->len = n;
+        ret = shaper_enqueue(t->shaper, p, now);
+        if (ret == 0)
+            pass[npass++] = p;
+        else if (ret < 0)
+            shaper_pkt_put(t->shaper, p);
+    }
+    if (npass > 0 && send_shaped(t, pass, npass) < 0)
+        return -1;
+    return npkts;
+}
+
+/* Send whatever the shaper releases by now */
+static int shaper_release(struct udptun *t)
+{
+    struct shaper_pkt *pkts[UDPTUN_BATCH];
+    int n;
+
+    do {
+        n = shaper_dequeue(t->shaper, pkts, UDPTUN_BATCH, now_ns());
+        if (n > 0 && send_shaped(t, pkts, n) < 0)
+            return -1;
+    } while (n == UDPTUN_BATCH);
+    return 0;
+}
+
+static int learn_peer(struct udptun *t, const struct sockaddr_storage *from, socklen_t len)
+{
+    if (connect(t->udp_fd, (const struct sockaddr *)from, len) < 0)
+        return -1;
+    t->has_peer = 1;
+    return 0;
+}
+
+/* Write one datagram's worth of packets to the tun fd. With GRO the
+ * datagram may be several of the peer's packets glued together, each
+ * gso_size bytes except maybe the last. */
+static void write_to_tun(struct udptun *t, const char *buf, size_t len, size_t seg)
+{
+    size_t off, n;
+
+    if (seg == 0)
+        seg = len;
+    for (off = 0; off < len; off += n) {
+        n = len - off < seg ? len - off : seg;
+        if (write(t->tun_fd, buf + off, n) < 0) {
+            t->cnt.drops++;
+            continue;
+        }
+        if (t->cap != NULL)
+            capture_packet(t->cap, buf + off, n);
+        t->cnt.udp_packets++;
+        t->cnt.udp_bytes += n;
+    }
+}
+
+static void tun_write_counted(struct udptun *t, const struct iovec *iov, int niov,
+                              int npkts, size_t bytes)
+{
+    if (writev(t->tun_fd, iov, niov) < 0) {
+        t->cnt.drops += npkts;
+        return;
+    }
+    t->cnt.udp_packets += npkts;
+    t->cnt.udp_bytes += bytes;
+}
+
+/* The vnet variant of write_to_tun(): consecutive segments of one TCP
+ * flow in the datagram are written as one TSO packet, behind a
+ * virtio_net_hdr asking the kernel to segment and checksum it; anything
+ * else goes one by one behind a header asking for nothing. */
+static void write_to_tun_vnet(struct udptun *t, const char *buf, size_t len, size_t seg)
+{
+    static const struct virtio_net_hdr none = { .gso_type = VIRTIO_NET_HDR_GSO_NONE };
+    struct iovec iov[2 + GSO_MAX_SEGS];
+    struct virtio_net_hdr h;
+    char hdrbuf[256];
+    struct vnet_tso s;
+    size_t off, n, bytes;
+    int niov;
+
+    if (seg == 0)
+        seg = len;
+    for (off = 0; off < len; off += n) {
+        n = len - off < seg ? len - off : seg;
+        if (t->cap != NULL)
+            capture_packet(t->cap, buf + off, n);
+        if (vnet_tso_start(&s, buf + off, n) < 0 || s.hdr_len > sizeof(hdrbuf)) {
+            iov[0].iov_base = (void *)&none;
+            iov[0].iov_len = sizeof(none);
+            iov[1].iov_base = (void *)(buf + off);
+            iov[1].iov_len = n;
+            tun_write_counted(t, iov, 2, 1, n);
+            continue;
+        }
+
+        iov[1].iov_base = hdrbuf;
+        iov[1].iov_len = s.hdr_len;
+        iov[2].iov_base = (void *)(buf + off + s.hdr_len);
+        iov[2].iov_len = n - s.hdr_len;
+        niov = 3;
+        bytes = n;
+        while (off + n < len && niov < 2 + GSO_MAX_SEGS) {
+            const char *next = buf + off + n;
+            size_t next_len = len - off - n < seg ? len - off - n : seg;
+
+            if (vnet_tso_add(&s, next, next_len) < 0)
+                break;
+            if (t->cap != NULL)
+                capture_packet(t->cap, next, next_len);
+            iov[niov].iov_base = (void *)(next + s.hdr_len);
+            iov[niov].iov_len = next_len - s.hdr_len;
+            niov++;
+            bytes += next_len;
+            n += next_len;
+        }
+
+        if (s.npkts == 1) {
+            memcpy(hdrbuf, buf + off, s.hdr_len);
+            iov[0].iov_base = (void *)&none;
+        } else {
+            vnet_hdr_build(&s, &h, hdrbuf);
+            iov[0].iov_base = &h;
+            t->cnt.tun_tso++;
+        }
+        iov[0].iov_len = VNET_HDR_LEN;
+        tun_write_counted(t, iov, niov, s.npkts, bytes);
+    }
+}
+
+/* Receive up to UDPTUN_BATCH datagrams in one recvmmsg() and write their
+ * packets to the tun fd. Returns the number of datagrams, or -1. */
+static int udp_to_tun(struct udptun *t)
+{
+    struct mmsghdr msgs[UDPTUN_BATCH];
+    struct iovec iov[UDPTUN_BATCH];
+    struct sockaddr_storage from[UDPTUN_BATCH];
+    char ctrl[UDPTUN_BATCH][CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cm;
+    int i, n, seg;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < UDPTUN_BATCH; i++) {
+        iov[i].iov_base = t->rxbuf + i * t->rx_bufsize;
+        iov[i].iov_len = t->rx_bufsize;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = ctrl[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+        if (!t->has_peer) {
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        }
+    }
+
+    n = recvmmsg(t->udp_fd, msgs, UDPTUN_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EINTR || errno == ECONNREFUSED)
+            return 0;
+        return -1;
+    }
+    t->cnt.recv_calls++;
+
+    if (!t->has_peer && n > 0) {
+        if (learn_peer(t, &from[0], msgs[0].msg_hdr.msg_namelen) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        seg = 0;
+        for (cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm != NULL;
+             cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+            if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+                memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+        }
+        if (t->vnet)
+            write_to_tun_vnet(t, iov[i].iov_base, msgs[i].msg_len, seg);
+        else
+            write_to_tun(t, iov[i].iov_base, msgs[i].msg_len, seg);
+    }
+    return n;
+}
+
+static void print_rates(struct udptun *t, const char *name, struct udptun_counters *now,
+                        struct udptun_counters *last, double secs)
+{
+    unsigned long calls;
+
+    calls = now->send_calls - last->send_calls;
+    printf("%s: tun->udp %.0f pkts/s %.1f Mbit/s %.1f pkts/sendmmsg %.1f pkts/datagram",
+           name, (now->tun_packets - last->tun_packets) / secs,
+           (now->tun_bytes - last->tun_bytes) * 8 / secs / 1e6,
+           calls ? (double)(now->tun_packets - last->tun_packets) / calls : 0.0,
+           now->send_msgs > last->send_msgs ?
+               (double)(now->tun_packets - last->tun_packets) /
+               (now->send_msgs - last->send_msgs) : 0.0);
+    calls = now->recv_calls - last->recv_calls;
+    printf(" | udp->tun %.0f pkts/s %.1f Mbit/s %.1f pkts/recvmmsg | %lu drops",
+           (now->udp_packets - last->udp_packets) / secs,
+           (now->udp_bytes - last->udp_bytes) * 8 / secs / 1e6,
+           calls ? (double)(now->udp_packets - last->udp_packets) / calls : 0.0,
+           now->drops);
+    if (t->vnet)
+        printf(" | %.0f gso reads/s %.0f tso writes/s",
+               (now->tun_gso - last->tun_gso) / secs, (now->tun_tso - last->tun_tso) / secs);
+    if (t->shaper != NULL)
+        printf(" | shaper %lu queued %lu dropped %lu unclassified", t->shaper->stats.queued,
+               t->shaper->stats.dropped, t->shaper->stats.unclassified);
+    if (t->cap != NULL)
+        printf(" | %lu capture drops", __atomic_load_n(&t->cap->drops, __ATOMIC_RELAXED));
+    printf("\n");
+    fflush(stdout);
+    *last = *now;
+}
+
+int udptun_run(struct udptun *t, const char *name)
+{
+    struct epoll_event ev[2];
+    struct udptun_counters last;
+    double t_last, now;
+    int64_t wait;
+    int epfd, nfds, i, n, timeout;
+
+    epfd = epoll_create1(0);
+    if (epfd < 0)
+        return -1;
+    ev[0].events = EPOLLIN;
+    ev[0].data.fd = t->tun_fd;
+    ev[1].events = EPOLLIN;
+    ev[1].data.fd = t->udp_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->tun_fd, &ev[0]) < 0 ||
+        epoll_ctl(epfd, EPOLL_CTL_ADD, t->udp_fd, &ev[1]) < 0)
+        return -1;
+
+    printf("%s: udp gso %s, gro %s, tun tso %s\n", name, t->gso ? "on" : "off",
+           t->gro ? "on" : "off", t->vnet ? "on" : "off");
+    memset(&last, 0, sizeof(last));
+    t_last = now_sec();
+
+    while (1) {
+        now = now_sec();
+        if (now - t_last >= 1.0) {
+            print_rates(t, name, &t->cnt, &last, now - t_last);
+            t_last = now;
+        }
+        timeout = (int)((t_last + 1.0 - now) * 1000) + 1;
+        /* wake up when the next shaped packet is due */
+        if (t->shaper != NULL && (wait = shaper_next_event(t->shaper, now_ns())) >= 0 &&
+            (wait + 999999) / 1000000 < timeout)
+            timeout = (int)((wait + 999999) / 1000000);
+
+        nfds = epoll_wait(epfd, ev, 2, timeout);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        /* level triggered: drain one full batch per fd and per wakeup so
+         * neither direction can starve the other */
+        for (i = 0; i < nfds; i++) {
+            if (ev[i].data.fd == t->tun_fd)
+                n = t->shaper != NULL ? tun_to_shaper(t) :
+                    t->vnet ? tun_to_udp_vnet(t) : tun_to_udp(t);
+            else
+                n = udp_to_tun(t);
+            if (n < 0)
+                return -1;
+        }
+        if (t->shaper != NULL && shaper_release(t) < 0)
+            return -1;
+    }
+}
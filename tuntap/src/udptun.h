@@ -0,0 +1,71 @@
+#ifndef __UDPTUN_H__
+#define __UDPTUN_H__
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "./capture.h"
+#include "./shaper.h"
+
+/* A point-to-point tunnel: every packet read from the tun fd is sent as
+ * one UDP datagram to the peer, every datagram received from the peer is
+ * written back to the tun fd.
+ *
+ * Both directions are batched: up to UDPTUN_BATCH packets per sendmmsg()
+ * and per recvmmsg(). Where the kernel supports it, runs of equal-sized
+ * packets are handed to the socket as one UDP GSO send (UDP_SEGMENT) and
+ * incoming datagrams are coalesced by UDP GRO, so the per-packet cost of
+ * the socket layer is paid once per run instead of once per packet.
+ *
+ * With a tun fd opened with IFF_VNET_HDR and TSO (tunclient -o), 64 KiB
+ * TCP super-packets are read from the device and cut into MTU-sized
+ * segments straight into one UDP GSO run; on the way back the segments
+ * a GRO-coalesced datagram holds are written to the device as one TSO
+ * packet again. What goes over the wire is plain ip packets either way,
+ * so only one end needs to do this. */
+
+#define UDPTUN_BATCH (64)
+#define UDPTUN_MTU_MAX (4096)   /* largest packet read from the tun fd */
+
+struct udptun_counters {
+    unsigned long tun_packets;  /* tun -> udp */
+    unsigned long tun_bytes;
+    unsigned long send_calls;   /* sendmmsg() calls */
+    unsigned long send_msgs;    /* datagrams (or GSO runs) passed to them */
+    unsigned long udp_packets;  /* udp -> tun, after GRO splitting */
+    unsigned long udp_bytes;
+    unsigned long tun_gso;      /* vnet: super-packets read and cut up */
+    unsigned long tun_tso;      /* vnet: TSO packets written */
+    unsigned long recv_calls;   /* recvmmsg() calls that returned data */
+    unsigned long drops;        /* no peer yet, or failed write */
+};
+
+struct udptun {
+    int tun_fd;
+    int udp_fd;
+    int gso;                    /* UDP_SEGMENT usable */
+    int gro;                    /* UDP_GRO enabled */
+    int has_peer;               /* udp_fd is connected to the peer */
+    int vnet;                   /* tun_fd has IFF_VNET_HDR and TSO */
+    struct udptun_counters cnt;
+    char *txbuf;                /* UDPTUN_BATCH packets, back to back */
+    char *rxbuf;                /* UDPTUN_BATCH receive buffers */
+    char *rdbuf;                /* vnet: one packet as read from tun_fd */
+    size_t rx_bufsize;
+    struct capture_ring *cap;   /* copy both directions here, if set */
+    struct shaper *shaper;      /* shape tun -> udp, if set; its buffers
+                                 * must hold UDPTUN_MTU_MAX bytes; not
+                                 * with vnet */
+};
+
+/* Bind a UDP socket to lport and, if peer ("host:port") is not NULL,
+ * connect it. Without a peer the first datagram received decides who
+ * the peer is. vnet says tun_fd has IFF_VNET_HDR and TSO enabled.
+ * Returns 0, or -1 with errno set. */
+int udptun_open(struct udptun *t, int tun_fd, int lport, const char *peer, int vnet);
+
+/* Forward in both directions until an error, printing counters once per
+ * second. Only returns on error. */
+int udptun_run(struct udptun *t, const char *name);
+
+#endif
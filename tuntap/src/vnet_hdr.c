@@ -0,0 +1,303 @@
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+#include "./vnet_hdr.h"
+
+#define TCP_FLAGS_OFF (13)
+#define TCP_FLAG_FIN (0x01)
+#define TCP_FLAG_PSH (0x08)
+#define TCP_FLAG_ACK (0x10)
+#define TCP_FLAG_CWR (0x80)
+
+/* Internet checksum over native-order words; fold and complement to use */
+static uint64_t csum_add(uint64_t sum, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint32_t w;
+    uint16_t h = 0;
+
+    while (len >= 4) {
+        memcpy(&w, p, 4);
+        sum += w;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        memcpy(&h, p, 2);
+        sum += h;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        h = 0;
+        memcpy(&h, p, 1);
+        sum += h;
+    }
+    return sum;
+}
+
+static uint16_t csum_fold(uint64_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+/* The tcp pseudo header: addresses, protocol and l4 length */
+static uint64_t pseudo_sum(const uint8_t *l3, int v6, size_t l4_len)
+{
+    uint64_t sum;
+
+    if (v6)
+        sum = csum_add(0, l3 + offsetof(struct ip6_hdr, ip6_src), 32);
+    else
+        sum = csum_add(0, l3 + offsetof(struct iphdr, saddr), 8);
+    return sum + htons(IPPROTO_TCP) + htons((uint16_t)l4_len);
+}
+
+/* A TCP segment in an ip packet of exactly len bytes: no ip fragments,
+ * no ipv6 extension headers. */
+struct tcp_seg {
+    int v6;
+    size_t l4_off;
+    size_t hdr_len;
+    size_t payload;
+    uint32_t seq;
+    uint8_t flags;
+};
+
+static int tcp_seg_parse(const uint8_t *p, size_t len, struct tcp_seg *ts)
+{
+    const struct tcphdr *th;
+
+    if (len < 1)
+        return -1;
+    if ((p[0] >> 4) == 4) {
+        const struct iphdr *iph = (const struct iphdr *)p;
+
+        if (len < sizeof(*iph) || iph->ihl < 5 || iph->protocol != IPPROTO_TCP ||
+            ntohs(iph->tot_len) != len || (iph->frag_off & htons(IP_MF | IP_OFFMASK)))
+            return -1;
+        ts->v6 = 0;
+        ts->l4_off = iph->ihl * 4;
+    } else if ((p[0] >> 4) == 6) {
+        const struct ip6_hdr *ip6 = (const struct ip6_hdr *)p;
+
+        if (len < sizeof(*ip6) || ip6->ip6_nxt != IPPROTO_TCP ||
+            ntohs(ip6->ip6_plen) + sizeof(*ip6) != len)
+            return -1;
+        ts->v6 = 1;
+        ts->l4_off = sizeof(*ip6);
+    } else {
+        return -1;
+    }
+
+    if (len < ts->l4_off + sizeof(*th))
+        return -1;
+    th = (const struct tcphdr *)(p + ts->l4_off);
+    if (th->doff < 5 || len < ts->l4_off + th->doff * 4)
+        return -1;
+    ts->hdr_len = ts->l4_off + th->doff * 4;
+    ts->payload = len - ts->hdr_len;
+    ts->seq = ntohl(th->seq);
+    ts->flags = p[ts->l4_off + TCP_FLAGS_OFF];
+    return 0;
+}
+
+int vnet_hdr_parse(const void *pkt, size_t len, struct vnet_info *info)
+{
+    const struct virtio_net_hdr *h = pkt;
+    struct tcp_seg ts;
+
+    if (len < VNET_HDR_LEN)
+        return -1;
+
+    memset(info, 0, sizeof(*info));
+    info->l3 = (const uint8_t *)pkt + VNET_HDR_LEN;
+    info->l3_len = len - VNET_HDR_LEN;
+    info->gso = h->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+    info->gso_size = h->gso_size;
+    info->needs_csum = !!(h->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM);
+    info->csum_start = h->csum_start;
+    info->csum_offset = h->csum_offset;
+    info->segs = 1;
+
+    if (info->needs_csum &&
+        (size_t)info->csum_start + info->csum_offset + 2 > info->l3_len)
+        return -1;
+
+    if (info->gso == VIRTIO_NET_HDR_GSO_NONE)
+        return 0;
+    /* hdr_len from the kernel may cover payload as well: measure it */
+    if ((info->gso != VIRTIO_NET_HDR_GSO_TCPV4 && info->gso != VIRTIO_NET_HDR_GSO_TCPV6) ||
+        info->gso_size == 0 || tcp_seg_parse(info->l3, info->l3_len, &ts) < 0 ||
+        ts.v6 != (info->gso == VIRTIO_NET_HDR_GSO_TCPV6))
+        return -1;
+    info->hdr_len = ts.hdr_len;
+    info->l4_off = ts.l4_off;
+    info->segs = (ts.payload + info->gso_size - 1) / info->gso_size;
+    if (info->segs == 0)
+        info->segs = 1;
+    return 0;
+}
+
+size_t vnet_seg_len(const struct vnet_info *info, unsigned int i)
+{
+    size_t payload, off;
+
+    if (info->gso == VIRTIO_NET_HDR_GSO_NONE)
+        return info->l3_len;
+    payload = info->l3_len - info->hdr_len;
+    off = (size_t)i * info->gso_size;
+    return info->hdr_len + (payload - off < info->gso_size ? payload - off : info->gso_size);
+}
+
+size_t vnet_segment(const struct vnet_info *info, unsigned int i, void *out)
+{
+    uint8_t *p = out;
+    size_t len = vnet_seg_len(info, i), l4_len;
+    uint32_t seq;
+    uint16_t v, csum;
+    int v6;
+
+    if (info->gso == VIRTIO_NET_HDR_GSO_NONE) {
+        memcpy(p, info->l3, len);
+        if (info->needs_csum) {
+            /* the field holds the pseudo header sum already */
+            csum = ~csum_fold(csum_add(0, p + info->csum_start, len - info->csum_start));
+            if (csum == 0 && info->csum_offset == offsetof(struct udphdr, check))
+                csum = 0xffff;
+            memcpy(p + info->csum_start + info->csum_offset, &csum, 2);
+        }
+        return len;
+    }
+
+    memcpy(p, info->l3, info->hdr_len);
+    memcpy(p + info->hdr_len, info->l3 + info->hdr_len + (size_t)i * info->gso_size,
+           len - info->hdr_len);
+
+    v6 = info->gso == VIRTIO_NET_HDR_GSO_TCPV6;
+    if (v6) {
+        struct ip6_hdr *ip6 = (struct ip6_hdr *)p;
+
+        ip6->ip6_plen = htons(len - sizeof(*ip6));
+    } else {
+        struct iphdr *iph = (struct iphdr *)p;
+
+        iph->tot_len = htons(len);
+        iph->id = htons(ntohs(iph->id) + i);
+        iph->check = 0;
+        iph->check = ~csum_fold(csum_add(0, iph, info->l4_off));
+    }
+
+    /* the sequence number moves on; FIN and PSH only on the last
+     * segment, CWR only on the first */
+    memcpy(&seq, p + info->l4_off + offsetof(struct tcphdr, seq), 4);
+    seq = htonl(ntohl(seq) + i * info->gso_size);
+    memcpy(p + info->l4_off + offsetof(struct tcphdr, seq), &seq, 4);
+    if (i != info->segs - 1)
+        p[info->l4_off + TCP_FLAGS_OFF] &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+    if (i != 0)
+        p[info->l4_off + TCP_FLAGS_OFF] &= ~TCP_FLAG_CWR;
+
+    l4_len = len - info->l4_off;
+    v = 0;
+    memcpy(p + info->l4_off + offsetof(struct tcphdr, check), &v, 2);
+    csum = ~csum_fold(csum_add(pseudo_sum(p, v6, l4_len), p + info->l4_off, l4_len));
+    memcpy(p + info->l4_off + offsetof(struct tcphdr, check), &csum, 2);
+    return len;
+}
+
+int vnet_tso_start(struct vnet_tso *s, const void *pkt, size_t len)
+{
+    struct tcp_seg ts;
+
+    if (tcp_seg_parse(pkt, len, &ts) < 0 || ts.payload == 0 || ts.payload > 0xffff)
+        return -1;
+    s->first = pkt;
+    s->hdr_len = ts.hdr_len;
+    s->l4_off = ts.l4_off;
+    s->payload = ts.payload;
+    s->mss = ts.payload;
+    s->next_seq = ts.seq + ts.payload;
+    s->v6 = ts.v6;
+    s->npkts = 1;
+    s->open = ts.flags == TCP_FLAG_ACK;
+    s->push = 0;
+    return 0;
+}
+
+int vnet_tso_add(struct vnet_tso *s, const void *pkt, size_t len)
+{
+    const uint8_t *p = pkt, *f = s->first;
+    size_t l4 = s->l4_off;
+    struct tcp_seg ts;
+
+    if (!s->open || tcp_seg_parse(p, len, &ts) < 0 || ts.v6 != s->v6 ||
+        ts.hdr_len != s->hdr_len || ts.l4_off != l4 || ts.seq != s->next_seq ||
+        ts.payload == 0 || ts.payload > s->mss ||
+        (ts.flags != TCP_FLAG_ACK && ts.flags != (TCP_FLAG_ACK | TCP_FLAG_PSH)) ||
+        s->hdr_len - (s->v6 ? sizeof(struct ip6_hdr) : 0) + s->payload + ts.payload > 0xffff)
+        return -1;
+
+    /* same flow, same everything but the fields segmentation changes:
+     * ip length, id and checksum, tcp sequence number, flags, checksum */
+    if (s->v6) {
+        if (memcmp(p, f, 4) || memcmp(p + 6, f + 6, l4 - 6))
+            return -1;
+    } else {
+        if (memcmp(p, f, 2) || memcmp(p + 6, f + 6, 4) || memcmp(p + 12, f + 12, l4 - 12))
+            return -1;
+    }
+    if (memcmp(p + l4, f + l4, 4) ||                            /* ports */
+        memcmp(p + l4 + 8, f + l4 + 8, 5) ||                    /* ack, doff */
+        memcmp(p + l4 + 14, f + l4 + 14, 2) ||                  /* window */
+        memcmp(p + l4 + 18, f + l4 + 18, s->hdr_len - l4 - 18)) /* urg, options */
+        return -1;
+
+    s->payload += ts.payload;
+    s->next_seq += ts.payload;
+    s->npkts++;
+    s->open = ts.payload == s->mss && ts.flags == TCP_FLAG_ACK;
+    s->push = !!(ts.flags & TCP_FLAG_PSH);
+    return 0;
+}
+
+void vnet_hdr_build(const struct vnet_tso *s, struct virtio_net_hdr *h, void *hdrbuf)
+{
+    uint8_t *p = hdrbuf;
+    size_t l4_len = s->hdr_len - s->l4_off + s->payload;
+    uint16_t csum;
+
+    memcpy(p, s->first, s->hdr_len);
+    if (s->v6) {
+        struct ip6_hdr *ip6 = (struct ip6_hdr *)p;
+
+        ip6->ip6_plen = htons(s->hdr_len - sizeof(*ip6) + s->payload);
+    } else {
+        struct iphdr *iph = (struct iphdr *)p;
+
+        iph->tot_len = htons(s->hdr_len + s->payload);
+        iph->check = 0;
+        iph->check = ~csum_fold(csum_add(0, iph, s->l4_off));
+    }
+    if (s->push)
+        p[s->l4_off + TCP_FLAGS_OFF] |= TCP_FLAG_PSH;
+
+    /* NEEDS_CSUM: the kernel sums from csum_start on, starting from the
+     * pseudo header sum we leave in the checksum field */
+    csum = csum_fold(pseudo_sum(p, s->v6, l4_len));
+    memcpy(p + s->l4_off + offsetof(struct tcphdr, check), &csum, 2);
+
+    memset(h, 0, sizeof(*h));
+    h->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    h->gso_type = s->v6 ? VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4;
+    h->gso_size = s->mss;
+    h->hdr_len = s->hdr_len;
+    h->csum_start = s->l4_off;
+    h->csum_offset = offsetof(struct tcphdr, check);
+}
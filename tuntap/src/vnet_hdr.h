@@ -0,0 +1,76 @@
+#ifndef __VNET_HDR_H__
+#define __VNET_HDR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/virtio_net.h>
+
+/* With IFF_VNET_HDR every packet read from or written to the tun fd is
+ * preceded by a struct virtio_net_hdr (in host byte order). Once the
+ * offloads are enabled with TUNSETOFFLOAD the kernel may hand us TCP
+ * super-packets of up to 64 KiB (gso_type != GSO_NONE, to be cut into
+ * gso_size segments) and packets whose L4 checksum is still to be filled
+ * in (NEEDS_CSUM at csum_start + csum_offset), and accepts the same from
+ * us. One read then moves what would otherwise be dozens of MTU-sized
+ * packets. */
+
+#define VNET_HDR_LEN (sizeof(struct virtio_net_hdr))
+#define VNET_MAX_PKT (65535 + VNET_HDR_LEN)
+
+struct vnet_info {
+    const uint8_t *l3;      /* the ip packet following the header */
+    size_t l3_len;
+    int gso;                /* VIRTIO_NET_HDR_GSO_* without the ECN bit */
+    uint16_t gso_size;
+    uint16_t hdr_len;       /* gso: l3 + l4 headers repeated in every segment */
+    uint16_t l4_off;        /* gso: where the tcp header starts */
+    int needs_csum;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    unsigned int segs;      /* packets this turns into on the wire */
+};
+
+/* Parse the header in front of pkt. Only TCP segmentation is accepted, and
+ * its ip and tcp headers are checked and measured here rather than taken
+ * from hdr_len. Returns 0, or -1 if it is malformed. */
+int vnet_hdr_parse(const void *pkt, size_t len, struct vnet_info *info);
+
+/* Length of wire packet i (0 <= i < info->segs) */
+size_t vnet_seg_len(const struct vnet_info *info, unsigned int i);
+
+/* Copy wire packet i to out: segment i of a GSO packet with its own ip
+ * and tcp headers and checksums, or the packet itself with a checksum
+ * left to us filled in. Returns its length. */
+size_t vnet_segment(const struct vnet_info *info, unsigned int i, void *out);
+
+/* The other direction: a run of full-sized segments of one TCP flow with
+ * consecutive sequence numbers, as a GRO-coalesced datagram from the
+ * peer carries them, goes to the device as one TSO packet. */
+struct vnet_tso {
+    const uint8_t *first;   /* its ip and tcp headers head the TSO packet */
+    size_t hdr_len;
+    size_t l4_off;
+    size_t payload;         /* bytes of payload so far */
+    uint16_t mss;           /* payload of the first segment */
+    uint32_t next_seq;
+    int v6;
+    int npkts;
+    int open;               /* the last segment was full and only ACK */
+    int push;               /* the last segment had PSH */
+};
+
+/* Start a TSO packet with pkt. Returns 0, or -1 if pkt is not a TCP
+ * segment carrying data. */
+int vnet_tso_start(struct vnet_tso *s, const void *pkt, size_t len);
+
+/* Append pkt, whose payload is then pkt + s->hdr_len. Returns 0, or -1 if
+ * it cannot follow the segments so far. */
+int vnet_tso_add(struct vnet_tso *s, const void *pkt, size_t len);
+
+/* Fill in the virtio_net_hdr asking for TSO and checksum offload, and in
+ * hdrbuf (s->hdr_len bytes) the first segment's ip and tcp headers fixed
+ * up for the whole packet. Only for runs of more than one segment. */
+void vnet_hdr_build(const struct vnet_tso *s, struct virtio_net_hdr *h, void *hdrbuf);
+
+#endif